@@ -0,0 +1,138 @@
+#include "BulkExporter.h"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+const std::string TCP_PREFIX = "tcp:";
+
+int connectTo(const std::string& address) {
+    const size_t colon = address.rfind(':');
+    if (colon == std::string::npos) {
+        throw std::runtime_error("Expected tcp:<host>:<port>, not tcp:" + address);
+    }
+    const std::string host = address.substr(0, colon);
+    const std::string port = address.substr(colon + 1);
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* found = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0) {
+        throw std::runtime_error("Cannot resolve " + address);
+    }
+    int fd = -1;
+    for (addrinfo* candidate = found; candidate != nullptr && fd < 0; candidate = candidate->ai_next) {
+        fd = ::socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+        if (fd >= 0 && ::connect(fd, candidate->ai_addr, candidate->ai_addrlen) != 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot connect to " + address + ": " + strerror(errno));
+    }
+    return fd;
+}
+
+void appendInt(std::string& out, int value) {
+    char digits[16];
+    auto written = std::to_chars(digits, digits + sizeof(digits), value);
+    out.append(digits, written.ptr);
+}
+
+} // namespace
+
+BulkExporter::BulkExporter(const std::string& destination, BulkLoader::Format format,
+                           size_t bufferBytes)
+    : destination(destination), format(format), fd(-1), connected(false),
+      bufferBytes(std::max<size_t>(bufferBytes, 4096)) {
+    if (destination.compare(0, TCP_PREFIX.size(), TCP_PREFIX) == 0) {
+        fd = connectTo(destination.substr(TCP_PREFIX.size()));
+        connected = true;
+    } else {
+        fd = ::open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot write " + destination + ": " + strerror(errno));
+        }
+    }
+    buffer.reserve(this->bufferBytes);
+}
+
+BulkExporter::~BulkExporter() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+void BulkExporter::add(const std::string& key, const std::vector<int>& keyValues) {
+    if (format == BulkLoader::Csv) {
+        if (key.find_first_of(",\n\r") != std::string::npos || (!key.empty() && key[0] == '#')) {
+            throw std::runtime_error("Key " + key + " cannot be exported as CSV, use binary");
+        }
+        if (keyValues.empty()) return;
+        buffer += key;
+        for (int value : keyValues) {
+            buffer.push_back(',');
+            appendInt(buffer, value);
+        }
+        buffer.push_back('\n');
+    } else {
+        const uint32_t keySize = static_cast<uint32_t>(key.size());
+        const uint32_t count = static_cast<uint32_t>(keyValues.size());
+        buffer.append(reinterpret_cast<const char*>(&keySize), sizeof(keySize));
+        buffer += key;
+        buffer.append(reinterpret_cast<const char*>(&count), sizeof(count));
+        buffer.append(reinterpret_cast<const char*>(keyValues.data()), keyValues.size() * sizeof(int32_t));
+    }
+    ++keys;
+    values += keyValues.size();
+    if (buffer.size() >= bufferBytes) {
+        flush();
+    }
+}
+
+void BulkExporter::flush() {
+    size_t written = 0;
+    while (written < buffer.size()) {
+        ssize_t n = connected
+            ? ::send(fd, buffer.data() + written, buffer.size() - written, MSG_NOSIGNAL)
+            : ::write(fd, buffer.data() + written, buffer.size() - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            throw std::runtime_error("Cannot write " + destination + ": " + strerror(errno));
+        }
+        written += n;
+    }
+    bytes += buffer.size();
+    buffer.clear();
+}
+
+void BulkExporter::finish() {
+    flush();
+    const int closing = fd;
+    fd = -1;
+    if (::close(closing) != 0) {
+        throw std::runtime_error("Cannot write " + destination + ": " + strerror(errno));
+    }
+}
+
+uint64_t BulkExporter::getKeys() const {
+    return keys;
+}
+
+uint64_t BulkExporter::getValues() const {
+    return values;
+}
+
+uint64_t BulkExporter::getBytes() const {
+    return bytes;
+}
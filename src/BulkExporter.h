@@ -0,0 +1,46 @@
+#pragma once
+
+#include "BulkLoader.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Writes keys and their values to a file or a TCP connection, in the
+// formats BulkLoader reads, so that an export can be imported elsewhere.
+// Records are encoded into a buffer that is written out whenever it fills.
+class BulkExporter {
+public:
+    // `destination` is a file path, or `tcp:<host>:<port>` to connect to.
+    // Throws std::runtime_error if it cannot be opened.
+    BulkExporter(const std::string& destination, BulkLoader::Format format,
+                 size_t bufferBytes = 1 << 20);
+    ~BulkExporter();
+
+    BulkExporter(const BulkExporter&) = delete;
+    BulkExporter& operator=(const BulkExporter&) = delete;
+
+    // Throws std::runtime_error if a write fails, or for a key that CSV
+    // cannot hold (one with ',', '\n' or '\r', or starting with '#').
+    // CSV has no record for a key without values.
+    void add(const std::string& key, const std::vector<int>& values);
+    // Writes out the rest of the buffer and closes the destination.
+    void finish();
+
+    uint64_t getKeys() const;
+    uint64_t getValues() const;
+    uint64_t getBytes() const;
+
+private:
+    void flush();
+
+    std::string destination;
+    BulkLoader::Format format;
+    int fd;
+    bool connected;
+    std::string buffer;
+    size_t bufferBytes;
+    uint64_t keys = 0;
+    uint64_t values = 0;
+    uint64_t bytes = 0;
+};
@@ -0,0 +1,294 @@
+#include "BulkLoader.h"
+#include "TaskRunner.h"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <queue>
+#include <stdexcept>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace {
+
+// Smaller files are not worth a thread per part.
+const size_t MIN_PART_BYTES = 1 << 20;
+
+using KeyMap = std::unordered_map<std::string, std::vector<int>>;
+
+std::runtime_error invalidRecord(const char* what, size_t offset) {
+    return std::runtime_error(std::string(what) + " at byte " + std::to_string(offset));
+}
+
+// Part boundaries at line starts, from 0 to `size`.
+std::vector<size_t> csvParts(const char* data, size_t size, size_t parts) {
+    std::vector<size_t> bounds = {0};
+    for (size_t ii = 1; ii < parts; ++ii) {
+        size_t at = std::max(bounds.back(), size / parts * ii);
+        const void* eol = at < size ? memchr(data + at, '\n', size - at) : nullptr;
+        at = eol ? static_cast<const char*>(eol) - data + 1 : size;
+        if (at > bounds.back() && at < size) bounds.push_back(at);
+    }
+    bounds.push_back(size);
+    return bounds;
+}
+
+// Part boundaries at record starts. Finding them takes a walk over the
+// record headers, which is much cheaper than parsing the records.
+std::vector<size_t> binaryParts(const char* data, size_t size, size_t parts) {
+    std::vector<size_t> bounds = {0};
+    const size_t partBytes = size / parts + 1;
+    size_t at = 0;
+    while (at < size) {
+        uint32_t keySize = 0, count = 0;
+        if (size - at < sizeof(keySize)) break;
+        memcpy(&keySize, data + at, sizeof(keySize));
+        const size_t countAt = at + sizeof(keySize) + keySize;
+        if (countAt + sizeof(count) > size) break;
+        memcpy(&count, data + countAt, sizeof(count));
+        at = countAt + sizeof(count) + size_t(count) * sizeof(int32_t);
+        if (at < size && at - bounds.back() >= partBytes) bounds.push_back(at);
+    }
+    // A truncated record is reported by the part that contains it.
+    bounds.push_back(size);
+    return bounds;
+}
+
+// Values of `key` in `partitions`, with `last` to skip the lookup for
+// consecutive records of one key.
+struct Grouper {
+    std::vector<KeyMap>& partitions;
+    std::string_view lastKey;
+    std::vector<int>* last = nullptr;
+
+    std::vector<int>& values(std::string_view key) {
+        if (last == nullptr || key != lastKey) {
+            KeyMap& partition = partitions[std::hash<std::string_view>()(key) % partitions.size()];
+            last = &partition[std::string(key)];
+            lastKey = key;
+        }
+        return *last;
+    }
+};
+
+void parseCsv(const char* data, size_t begin, size_t end, Grouper& grouper) {
+    const char* line = data + begin;
+    const char* stop = data + end;
+    while (line < stop) {
+        const char* eol = static_cast<const char*>(memchr(line, '\n', stop - line));
+        if (eol == nullptr) eol = stop;
+        const char* last = eol;
+        if (last > line && last[-1] == '\r') --last;
+        if (last == line || *line == '#') {
+            line = eol + 1;
+            continue;
+        }
+        const char* comma = static_cast<const char*>(memchr(line, ',', last - line));
+        if (comma == nullptr) {
+            throw invalidRecord("CSV record without values", line - data);
+        }
+        std::vector<int>& values = grouper.values(std::string_view(line, comma - line));
+        const char* at = comma + 1;
+        while (at < last) {
+            while (at < last && *at == ' ') ++at;
+            int value = 0;
+            auto parsed = std::from_chars(at, last, value);
+            if (parsed.ec != std::errc()) {
+                throw invalidRecord("Invalid value in CSV record", at - data);
+            }
+            values.push_back(value);
+            at = parsed.ptr;
+            if (at < last && *at++ != ',') {
+                throw invalidRecord("Invalid value in CSV record", at - 1 - data);
+            }
+        }
+        line = eol + 1;
+    }
+}
+
+void parseBinary(const char* data, size_t begin, size_t end, Grouper& grouper) {
+    size_t at = begin;
+    while (at < end) {
+        uint32_t keySize = 0, count = 0;
+        if (end - at < sizeof(keySize)) {
+            throw invalidRecord("Truncated binary record", at);
+        }
+        memcpy(&keySize, data + at, sizeof(keySize));
+        if (end - at - sizeof(keySize) < size_t(keySize) + sizeof(count)) {
+            throw invalidRecord("Truncated binary record", at);
+        }
+        std::string_view key(data + at + sizeof(keySize), keySize);
+        const size_t countAt = at + sizeof(keySize) + keySize;
+        memcpy(&count, data + countAt, sizeof(count));
+        const size_t valuesAt = countAt + sizeof(count);
+        if ((end - valuesAt) / sizeof(int32_t) < count) {
+            throw invalidRecord("Truncated binary record", at);
+        }
+        std::vector<int>& values = grouper.values(key);
+        const size_t first = values.size();
+        values.resize(first + count);
+        memcpy(values.data() + first, data + valuesAt, size_t(count) * sizeof(int32_t));
+        at = valuesAt + size_t(count) * sizeof(int32_t);
+    }
+}
+
+// Unmaps the file when the load is done.
+struct Mapping {
+    void* data = MAP_FAILED;
+    size_t size = 0;
+    ~Mapping() {
+        if (data != MAP_FAILED) munmap(data, size);
+    }
+};
+
+} // namespace
+
+BulkLoader::Format BulkLoader::parseFormat(const std::string& name) {
+    if (name == "csv") return Csv;
+    if (name == "binary") return Binary;
+    throw std::runtime_error("Unknown bulk load format " + name + ", expected csv or binary");
+}
+
+BulkLoader::Format BulkLoader::formatOf(const std::string& path) {
+    const std::string suffix = ".csv";
+    return path.size() >= suffix.size() &&
+           path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0 ? Csv : Binary;
+}
+
+BulkLoader::BulkLoader(size_t threads)
+    : threads(threads ? threads : std::max(1u, std::thread::hardware_concurrency())) {}
+
+size_t BulkLoader::getThreads() const {
+    return threads;
+}
+
+BulkLoader::Groups BulkLoader::load(const std::string& path, Format format) const {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open " + path + ": " + strerror(errno));
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        std::string error = strerror(errno);
+        close(fd);
+        throw std::runtime_error("Cannot read " + path + ": " + error);
+    }
+    Mapping mapping;
+    mapping.size = static_cast<size_t>(info.st_size);
+    if (mapping.size > 0) {
+        mapping.data = mmap(nullptr, mapping.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (mapping.size == 0) return Groups();
+    if (mapping.data == MAP_FAILED) {
+        throw std::runtime_error("Cannot map " + path + ": " + strerror(errno));
+    }
+    // Every page is read once, each part front to back.
+    madvise(mapping.data, mapping.size, MADV_WILLNEED);
+    try {
+        return parse(static_cast<const char*>(mapping.data), mapping.size, format);
+    } catch (const std::runtime_error& e) {
+        throw std::runtime_error(path + ": " + e.what());
+    }
+}
+
+BulkLoader::Groups BulkLoader::parse(const char* data, size_t size, Format format) const {
+    const size_t wanted = std::max<size_t>(1, std::min(threads, size / MIN_PART_BYTES));
+    const std::vector<size_t> bounds = format == Csv ? csvParts(data, size, wanted)
+                                                     : binaryParts(data, size, wanted);
+    const size_t parts = bounds.size() - 1;
+
+    // Each part groups its records into one map per hash partition of the keys...
+    std::vector<std::vector<KeyMap>> grouped(parts, std::vector<KeyMap>(parts));
+    runTasks(parts, true, [&](size_t part) {
+        Grouper grouper{grouped[part]};
+        if (format == Csv) {
+            parseCsv(data, bounds[part], bounds[part + 1], grouper);
+        } else {
+            parseBinary(data, bounds[part], bounds[part + 1], grouper);
+        }
+    });
+
+    // ...then each partition merges its maps, in file order, and sorts its keys.
+    std::vector<Groups> sorted(parts);
+    runTasks(parts, true, [&](size_t partition) {
+        KeyMap& merged = grouped[0][partition];
+        for (size_t part = 1; part < parts; ++part) {
+            for (auto& entry : grouped[part][partition]) {
+                std::vector<int>& values = merged[entry.first];
+                if (values.empty()) {
+                    values.swap(entry.second);
+                } else {
+                    values.insert(values.end(), entry.second.begin(), entry.second.end());
+                }
+            }
+            KeyMap().swap(grouped[part][partition]);
+        }
+        Groups& out = sorted[partition];
+        out.reserve(merged.size());
+        for (auto& entry : merged) {
+            out.emplace_back(entry.first, std::move(entry.second));
+        }
+        KeyMap().swap(merged);
+        std::sort(out.begin(), out.end(), [](const auto& a, const auto& b) {
+            return a.first < b.first;
+        });
+    });
+
+    if (parts == 1) return std::move(sorted[0]);
+    // The partitions hold disjoint keys; merge them into one key order.
+    size_t total = 0;
+    for (const auto& partition : sorted) total += partition.size();
+    Groups result;
+    result.reserve(total);
+    std::vector<size_t> next(parts, 0);
+    auto later = [&](size_t a, size_t b) {
+        return sorted[a][next[a]].first > sorted[b][next[b]].first;
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heads(later);
+    for (size_t partition = 0; partition < parts; ++partition) {
+        if (!sorted[partition].empty()) heads.push(partition);
+    }
+    while (!heads.empty()) {
+        const size_t partition = heads.top();
+        heads.pop();
+        result.push_back(std::move(sorted[partition][next[partition]++]));
+        if (next[partition] < sorted[partition].size()) heads.push(partition);
+    }
+    return result;
+}
+
+std::vector<BulkLoader::Groups> BulkLoader::split(Groups&& groups, size_t maxValues) {
+    maxValues = std::max<size_t>(1, maxValues);
+    std::vector<Groups> batches(1);
+    size_t inBatch = 0;
+    for (auto& group : groups) {
+        std::vector<int>& values = group.second;
+        size_t taken = 0;
+        do {
+            if (inBatch == maxValues) {
+                batches.emplace_back();
+                inBatch = 0;
+            }
+            const size_t count = std::min(values.size() - taken, maxValues - inBatch);
+            if (taken == 0 && count == values.size()) {
+                batches.back().emplace_back(group.first, std::move(values));
+            } else {
+                batches.back().emplace_back(group.first,
+                    std::vector<int>(values.begin() + taken, values.begin() + taken + count));
+            }
+            taken += count;
+            inBatch += count;
+        } while (taken < values.size());
+    }
+    if (batches.back().empty()) batches.pop_back();
+    groups.clear();
+    return batches;
+}
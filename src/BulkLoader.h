@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Reads the values of a bulk load from a file, grouped by key. The file is
+// mapped into memory and split into parts that are parsed on their own
+// threads; the keys are then merged by hash partition, also in parallel.
+//
+//   csv     One `key,value[,value...]` line per record. Empty lines and
+//           lines starting with '#' are skipped.
+//   binary  Records of a 32-bit key length, the key, a 32-bit value count
+//           and that many 32-bit values, all in host byte order.
+//
+// A key may appear in any number of records; its values keep their order
+// in the file.
+class BulkLoader {
+public:
+    enum Format { Csv, Binary };
+
+    // Keys in order, each with its values.
+    using Groups = std::vector<std::pair<std::string, std::vector<int>>>;
+
+    // Throws std::runtime_error for a name other than csv or binary.
+    static Format parseFormat(const std::string& name);
+    // Csv for a `.csv` file, Binary otherwise.
+    static Format formatOf(const std::string& path);
+
+    // 0 threads for one per core.
+    explicit BulkLoader(size_t threads = 0);
+
+    // Throws std::runtime_error if the file cannot be read or a record is invalid.
+    Groups load(const std::string& path, Format format) const;
+    Groups parse(const char* data, size_t size, Format format) const;
+
+    // Splits `groups` into batches of at most `maxValues` values, in key
+    // order. The values of a key with more are split across batches.
+    static std::vector<Groups> split(Groups&& groups, size_t maxValues);
+
+    size_t getThreads() const;
+
+private:
+    size_t threads;
+};
@@ -0,0 +1,237 @@
+#include "ContinuousAggregate.h"
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+const std::map<std::string, int> REDUCERS = {
+    {"sum", 0}, {"count", 1}, {"sum_of_squares", 2}, {"min", 3}, {"max", 4}, {"distinct", 5}
+};
+
+// Two's complement addition without signed overflow.
+int64_t wrappingAdd(int64_t value, uint64_t delta) {
+    return static_cast<int64_t>(static_cast<uint64_t>(value) + delta);
+}
+
+} // namespace
+
+ContinuousAggregate::ContinuousAggregate(const std::string& mapOp,
+                                         const std::string& reduceOp,
+                                         const KeySelector& selector)
+    : mapOp(mapOp), reduceOp(reduceOp), selector(selector),
+      pipeline(MapPipeline::parse(mapOp)) {
+    auto reducerIt = REDUCERS.find(reduceOp);
+    if (reducerIt != REDUCERS.end()) {
+        reducer = static_cast<Reducer>(reducerIt->second);
+    } else if (TDigest::parseQuantile(reduceOp, quantile)) {
+        reducer = Quantile;
+    } else {
+        throw std::runtime_error("Reduce operation cannot be maintained incrementally: " + reduceOp);
+    }
+    if (selector.kind == KeySelector::Keys) {
+        selectedKeys.insert(selector.keys.begin(), selector.keys.end());
+        for (const auto& key : selectedKeys) {
+            results[key] = identity();
+        }
+    } else {
+        selector.bounds(rangeBegin, rangeEnd);
+    }
+}
+
+bool ContinuousAggregate::isSupported(const std::string& reduceOp) {
+    double quantile;
+    return REDUCERS.find(reduceOp) != REDUCERS.end() || TDigest::parseQuantile(reduceOp, quantile);
+}
+
+void ContinuousAggregate::rebuild(const KeyValueStore& kvStore) {
+    results.clear();
+    orderedValues.clear();
+    distinctSketches.clear();
+    quantileSketches.clear();
+    auto addValues = [&](const std::string& key, const std::vector<int>& values) {
+        results[key] = identity();
+        for (int value : values) {
+            int64_t mappedValue;
+            if (mapValue(value, mappedValue)) {
+                add(key, mappedValue);
+            }
+        }
+    };
+    if (selector.kind == KeySelector::Keys) {
+        for (const auto& key : selectedKeys) {
+            std::vector<int> values;
+            try {
+                values = kvStore.getValues(key);
+            } catch (const std::runtime_error& e) {
+                // Missing keys keep the identity element, as in MapReduce.
+            }
+            addValues(key, values);
+        }
+    } else {
+        kvStore.scan(rangeBegin, rangeEnd, kvStore.getVersion(), addValues);
+    }
+}
+
+void ContinuousAggregate::onInsert(const std::string& key, int value) {
+    if (!selects(key)) {
+        return;
+    }
+    // A key exists from its first insert on, even if the value is filtered out.
+    results.emplace(key, identity());
+    int64_t mappedValue;
+    if (mapValue(value, mappedValue)) {
+        add(key, mappedValue);
+    }
+}
+
+bool ContinuousAggregate::onRemoveValue(const std::string& key, int value) {
+    int64_t mappedValue;
+    if (selects(key) && mapValue(value, mappedValue)) {
+        return remove(key, mappedValue);
+    }
+    return true;
+}
+
+void ContinuousAggregate::onRemoveKey(const std::string& key) {
+    if (!selects(key)) {
+        return;
+    }
+    clearKey(key);
+    if (selector.kind == KeySelector::Keys) {
+        results[key] = identity();
+    } else {
+        results.erase(key);
+    }
+}
+
+void ContinuousAggregate::rebuildKey(const std::string& key, const std::vector<int>& values) {
+    if (!selects(key)) {
+        return;
+    }
+    clearKey(key);
+    results[key] = identity();
+    for (int value : values) {
+        int64_t mappedValue;
+        if (mapValue(value, mappedValue)) {
+            add(key, mappedValue);
+        }
+    }
+}
+
+bool ContinuousAggregate::selects(const std::string& key) const {
+    if (selector.kind == KeySelector::Keys) {
+        return selectedKeys.count(key) > 0;
+    }
+    return key >= rangeBegin && (rangeEnd.empty() || key < rangeEnd);
+}
+
+const std::map<std::string, int64_t>& ContinuousAggregate::getResults() const {
+    return results;
+}
+
+bool ContinuousAggregate::getResult(const std::string& key, int64_t& result) const {
+    auto it = results.find(key);
+    if (it == results.end()) {
+        return false;
+    }
+    result = it->second;
+    return true;
+}
+
+const std::string& ContinuousAggregate::getMapOp() const {
+    return mapOp;
+}
+
+const std::string& ContinuousAggregate::getReduceOp() const {
+    return reduceOp;
+}
+
+const KeySelector& ContinuousAggregate::getSelector() const {
+    return selector;
+}
+
+int64_t ContinuousAggregate::identity() const {
+    switch (reducer) {
+        case Min: return std::numeric_limits<int64_t>::max();
+        case Max: return std::numeric_limits<int64_t>::min();
+        default: return 0;
+    }
+}
+
+bool ContinuousAggregate::mapValue(int value, int64_t& result) const {
+    mapped.clear();
+    pipeline.apply(&value, 1, mapped);
+    if (mapped.empty()) {
+        return false;
+    }
+    result = mapped[0];
+    return true;
+}
+
+void ContinuousAggregate::add(const std::string& key, int64_t value) {
+    int64_t& result = results[key];
+    const uint64_t delta = static_cast<uint64_t>(value);
+    switch (reducer) {
+        case Sum: result = wrappingAdd(result, delta); break;
+        case Count: result = wrappingAdd(result, 1); break;
+        case SumOfSquares: result = wrappingAdd(result, delta * delta); break;
+        case Min:
+        case Max: {
+            std::multiset<int64_t>& values = orderedValues[key];
+            values.insert(value);
+            result = reducer == Min ? *values.begin() : *values.rbegin();
+            break;
+        }
+        case Distinct: {
+            HyperLogLog& sketch = distinctSketches[key];
+            sketch.add(value);
+            result = std::llround(sketch.estimate());
+            break;
+        }
+        case Quantile: {
+            TDigest& digest = quantileSketches[key];
+            digest.add(static_cast<double>(value));
+            result = std::llround(digest.quantile(quantile));
+            break;
+        }
+    }
+}
+
+bool ContinuousAggregate::remove(const std::string& key, int64_t value) {
+    auto resultIt = results.find(key);
+    if (resultIt == results.end()) {
+        return true;
+    }
+    int64_t& result = resultIt->second;
+    const uint64_t delta = static_cast<uint64_t>(value);
+    switch (reducer) {
+        case Sum: result = wrappingAdd(result, -delta); break;
+        case Count: result = wrappingAdd(result, -1); break;
+        case SumOfSquares: result = wrappingAdd(result, -(delta * delta)); break;
+        case Min:
+        case Max: {
+            std::multiset<int64_t>& values = orderedValues[key];
+            auto it = values.find(value);
+            if (it != values.end()) {
+                values.erase(it);
+            }
+            if (values.empty()) {
+                result = identity();
+            } else {
+                result = reducer == Min ? *values.begin() : *values.rbegin();
+            }
+            break;
+        }
+        case Distinct:
+        case Quantile:
+            return false;
+    }
+    return true;
+}
+
+void ContinuousAggregate::clearKey(const std::string& key) {
+    orderedValues.erase(key);
+    distinctSketches.erase(key);
+    quantileSketches.erase(key);
+}
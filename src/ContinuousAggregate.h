@@ -0,0 +1,75 @@
+#pragma once
+
+#include "KeyValueStore.h"
+#include "MapPipeline.h"
+#include "Sketches.h"
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// A registered MapReduce whose per-key results are kept up to date on every
+// insert and removal, instead of rescanning the values on each query.
+//
+// sum, count and sum_of_squares are updated by adding or subtracting the
+// mapped value (in wrapping 64-bit arithmetic, so removals invert inserts
+// exactly). min and max keep a sorted multiset of each key's mapped values.
+// distinct (HyperLogLog) and quantiles such as p99 (t-digest, rounded to
+// an integer) keep a sketch per key; sketches cannot forget a value, so
+// a removal makes the caller rebuild the key with `rebuildKey`.
+class ContinuousAggregate {
+public:
+    ContinuousAggregate(const std::string& mapOp,
+                        const std::string& reduceOp,
+                        const KeySelector& selector);
+
+    static bool isSupported(const std::string& reduceOp);
+
+    // Recomputes every result from the store.
+    void rebuild(const KeyValueStore& kvStore);
+
+    void onInsert(const std::string& key, int value);
+    // Returns false if the removal cannot be applied incrementally.
+    bool onRemoveValue(const std::string& key, int value);
+    void onRemoveKey(const std::string& key);
+    // Recomputes the result of one key from its current values.
+    void rebuildKey(const std::string& key, const std::vector<int>& values);
+
+    bool selects(const std::string& key) const;
+    const std::map<std::string, int64_t>& getResults() const;
+    // Returns false if `key` has no result.
+    bool getResult(const std::string& key, int64_t& result) const;
+
+    const std::string& getMapOp() const;
+    const std::string& getReduceOp() const;
+    const KeySelector& getSelector() const;
+
+private:
+    enum Reducer { Sum, Count, SumOfSquares, Min, Max, Distinct, Quantile };
+
+    std::string mapOp;
+    std::string reduceOp;
+    KeySelector selector;
+    MapPipeline pipeline;
+    Reducer reducer;
+    double quantile = 0;  // Quantile only
+    std::string rangeBegin;
+    std::string rangeEnd;
+    std::set<std::string> selectedKeys;
+
+    std::map<std::string, int64_t> results;
+    // Mapped values of each key, for min and max only.
+    std::map<std::string, std::multiset<int64_t>> orderedValues;
+    std::map<std::string, HyperLogLog> distinctSketches;
+    std::map<std::string, TDigest> quantileSketches;
+    mutable std::vector<int64_t> mapped;
+
+    int64_t identity() const;
+    // False if the value is dropped by a filter in the map pipeline.
+    bool mapValue(int value, int64_t& result) const;
+    void add(const std::string& key, int64_t value);
+    // Returns false if the reducer cannot forget a value.
+    bool remove(const std::string& key, int64_t value);
+    void clearKey(const std::string& key);
+};
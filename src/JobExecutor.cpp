@@ -0,0 +1,163 @@
+#include "JobExecutor.h"
+#include <algorithm>
+#include <stdexcept>
+
+JobExecutor::JobExecutor(size_t maxConcurrentJobs, size_t maxEndedJobs)
+    : maxEndedJobs(std::max<size_t>(1, maxEndedJobs)) {
+    for (size_t i = 0; i < std::max<size_t>(1, maxConcurrentJobs); ++i) {
+        workers.emplace_back(&JobExecutor::workerLoop, this);
+    }
+}
+
+JobExecutor::~JobExecutor() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+        for (auto& entry : jobs) {
+            entry.second.cancelled->store(true);
+        }
+    }
+    workAvailable.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void JobExecutor::submit(uint64_t id, Task task, Callback onDone) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (jobs.count(id)) {
+            throw std::runtime_error("Job " + std::to_string(id) + " already exists");
+        }
+        jobs[id] = {std::move(task), std::move(onDone), Status::Queued, "",
+                    std::make_shared<std::atomic<bool>>(false)};
+        queue.push_back(id);
+    }
+    workAvailable.notify_one();
+}
+
+bool JobExecutor::cancel(uint64_t id) {
+    Callback onDone;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = jobs.find(id);
+        if (it == jobs.end() || hasEnded(it->second.status)) {
+            return false;
+        }
+        Job& job = it->second;
+        job.cancelled->store(true);
+        if (job.status == Status::Running) {
+            // The worker sets the final status when the task returns.
+            return true;
+        }
+        queue.erase(std::find(queue.begin(), queue.end(), id));
+        job.status = Status::Cancelled;
+        job.task = nullptr;
+        onDone = std::move(job.onDone);
+        addEnded(id);
+    }
+    jobEnded.notify_all();
+    if (onDone) onDone(id, Status::Cancelled, "");
+    return true;
+}
+
+bool JobExecutor::wait(uint64_t id, std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> guard(lock);
+    return jobEnded.wait_for(guard, timeout, [&] {
+        auto it = jobs.find(id);
+        return it == jobs.end() || hasEnded(it->second.status);
+    });
+}
+
+JobExecutor::Status JobExecutor::getStatus(uint64_t id) const {
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = jobs.find(id);
+    return it == jobs.end() ? Status::Unknown : it->second.status;
+}
+
+std::string JobExecutor::getError(uint64_t id) const {
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = jobs.find(id);
+    return it == jobs.end() ? "" : it->second.error;
+}
+
+std::map<uint64_t, JobExecutor::Status> JobExecutor::getJobs() const {
+    std::lock_guard<std::mutex> guard(lock);
+    std::map<uint64_t, Status> statuses;
+    for (const auto& entry : jobs) {
+        statuses.emplace_hint(statuses.end(), entry.first, entry.second.status);
+    }
+    return statuses;
+}
+
+size_t JobExecutor::getMaxConcurrentJobs() const {
+    return workers.size();
+}
+
+const char* JobExecutor::statusName(Status status) {
+    switch (status) {
+        case Status::Queued: return "queued";
+        case Status::Running: return "running";
+        case Status::Done: return "done";
+        case Status::Failed: return "failed";
+        case Status::Cancelled: return "cancelled";
+        default: return "unknown";
+    }
+}
+
+void JobExecutor::workerLoop() {
+    while (true) {
+        uint64_t id;
+        Task task;
+        std::shared_ptr<std::atomic<bool>> cancelled;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            workAvailable.wait(guard, [this] { return stopping || !queue.empty(); });
+            if (stopping) return;
+            id = queue.front();
+            queue.pop_front();
+            Job& job = jobs[id];
+            job.status = Status::Running;
+            task = std::move(job.task);
+            cancelled = job.cancelled;
+        }
+
+        Status status = Status::Done;
+        std::string error;
+        try {
+            task(*cancelled);
+        } catch (const std::exception& e) {
+            status = Status::Failed;
+            error = e.what();
+        }
+        // A task that stops by throwing after a cancellation was cancelled, not failed.
+        if (status == Status::Failed && cancelled->load()) {
+            status = Status::Cancelled;
+            error.clear();
+        }
+
+        Callback onDone;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            Job& job = jobs[id];
+            job.status = status;
+            job.error = error;
+            onDone = std::move(job.onDone);
+            addEnded(id);
+        }
+        if (onDone) onDone(id, status, error);
+        jobEnded.notify_all();
+    }
+}
+
+void JobExecutor::addEnded(uint64_t id) {
+    ended.push_back(id);
+    if (ended.size() > maxEndedJobs) {
+        jobs.erase(ended.front());
+        ended.pop_front();
+    }
+}
+
+bool JobExecutor::hasEnded(Status status) {
+    return status == Status::Done || status == Status::Failed || status == Status::Cancelled;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Runs jobs on a fixed number of worker threads, in submission order.
+// At most `maxConcurrentJobs` jobs run at once; the others wait in a queue.
+// Only the last `maxEndedJobs` jobs to end are kept; older ones become unknown.
+class JobExecutor {
+public:
+    enum class Status : uint8_t {
+        Unknown = 0,
+        Queued = 1,
+        Running = 2,
+        Done = 3,
+        Failed = 4,
+        Cancelled = 5
+    };
+
+    // A task should stop early by throwing once `cancelled` is set.
+    using Task = std::function<void(const std::atomic<bool>& cancelled)>;
+    // Called on the worker thread when a job ends, or by `cancel` for a
+    // job that never started. `error` is set for failed jobs.
+    using Callback = std::function<void(uint64_t id, Status status, const std::string& error)>;
+
+    explicit JobExecutor(size_t maxConcurrentJobs, size_t maxEndedJobs = 1000);
+    // Cancels all jobs and waits for the running ones.
+    ~JobExecutor();
+
+    JobExecutor(const JobExecutor&) = delete;
+    JobExecutor& operator=(const JobExecutor&) = delete;
+
+    // Throws if a job with this `id` was already submitted.
+    void submit(uint64_t id, Task task, Callback onDone = nullptr);
+    // Returns false if the job is unknown or has already ended.
+    bool cancel(uint64_t id);
+    // Waits until the job has ended; false on timeout.
+    bool wait(uint64_t id, std::chrono::milliseconds timeout);
+
+    Status getStatus(uint64_t id) const;
+    std::string getError(uint64_t id) const;
+    std::map<uint64_t, Status> getJobs() const;
+    size_t getMaxConcurrentJobs() const;
+
+    static const char* statusName(Status status);
+
+private:
+    struct Job {
+        Task task;
+        Callback onDone;
+        Status status;
+        std::string error;
+        std::shared_ptr<std::atomic<bool>> cancelled;
+    };
+
+    mutable std::mutex lock;
+    std::condition_variable workAvailable;
+    std::condition_variable jobEnded;
+    std::map<uint64_t, Job> jobs;
+    std::deque<uint64_t> queue;
+    // Ended jobs, oldest first.
+    std::deque<uint64_t> ended;
+    size_t maxEndedJobs;
+    std::vector<std::thread> workers;
+    bool stopping = false;
+
+    void workerLoop();
+    // Called with `lock` held.
+    void addEnded(uint64_t id);
+    static bool hasEnded(Status status);
+};
@@ -0,0 +1,66 @@
+#include "KeyGrouper.h"
+#include <stdexcept>
+
+KeyGrouper KeyGrouper::parse(const std::string& spec) {
+    KeyGrouper grouper;
+    grouper.spec = spec;
+
+    if (spec.rfind("prefix:", 0) == 0) {
+        const std::string args = spec.substr(7);
+        size_t parsed = 0;
+        long depth = 0;
+        try {
+            depth = std::stol(args, &parsed);
+        } catch (const std::logic_error& e) {
+            throw std::runtime_error("Invalid group-by depth: " + spec);
+        }
+        if (depth < 1) {
+            throw std::runtime_error("Invalid group-by depth: " + spec);
+        }
+        if (parsed < args.size()) {
+            if (args[parsed] != ':' || args.size() != parsed + 2) {
+                throw std::runtime_error("Group-by separator must be a single character: " + spec);
+            }
+            grouper.separator = args[parsed + 1];
+        }
+        grouper.depth = static_cast<size_t>(depth);
+        return grouper;
+    }
+
+    if (spec.rfind("regex:", 0) == 0) {
+        try {
+            grouper.pattern = std::make_shared<const std::regex>(spec.substr(6));
+        } catch (const std::regex_error& e) {
+            throw std::runtime_error("Invalid group-by regex: " + spec);
+        }
+        return grouper;
+    }
+
+    throw std::runtime_error("Unknown group-by: " + spec);
+}
+
+bool KeyGrouper::group(const std::string& key, std::string& groupOut) const {
+    if (pattern) {
+        std::smatch match;
+        if (!std::regex_search(key, match, *pattern)) {
+            return false;
+        }
+        const size_t capture = match.size() > 1 ? 1 : 0;
+        groupOut = match[capture].str();
+        return true;
+    }
+
+    size_t end = 0;
+    for (size_t found = 0; found < depth; ++found) {
+        end = key.find(separator, found == 0 ? 0 : end + 1);
+        if (end == std::string::npos) {
+            return false;
+        }
+    }
+    groupOut.assign(key, 0, end);
+    return true;
+}
+
+const std::string& KeyGrouper::getSpec() const {
+    return spec;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <regex>
+#include <string>
+
+// Derives a group name from a key, for reductions across keys.
+//
+//   prefix:N[:<separator>]  The key up to its Nth separator (default `/`),
+//                           e.g. prefix:1 maps `eu/dev7/temp` to `eu`.
+//   regex:<pattern>         The first capture group of the first match,
+//                           or the whole match if the pattern has none.
+//
+// Keys without an Nth separator, or without a match, belong to no group.
+class KeyGrouper {
+public:
+    // Throws std::runtime_error for an unknown spec or an invalid pattern.
+    static KeyGrouper parse(const std::string& spec);
+
+    // Returns false if `key` belongs to no group.
+    bool group(const std::string& key, std::string& groupOut) const;
+
+    const std::string& getSpec() const;
+
+private:
+    std::string spec;
+    size_t depth = 0;
+    char separator = '/';
+    // Shared so that copies stay cheap; matching a const regex is thread-safe.
+    std::shared_ptr<const std::regex> pattern;
+};
@@ -1,47 +1,108 @@
 #include "KeyValueStore.h"
+#include <algorithm>
+#include <limits>
 #include <stdexcept>
 
-void KeyValueStore::insert(const std::string& key, int value) {
-    if (store.find(key) == store.end()) {
-        store[key] = std::vector<int>();
+KeySelector KeySelector::keyList(const std::vector<std::string>& keys) {
+    KeySelector selector(Keys);
+    selector.keys = keys;
+    return selector;
+}
+
+KeySelector KeySelector::allKeys() {
+    return KeySelector(All);
+}
+
+KeySelector KeySelector::prefix(const std::string& prefix) {
+    KeySelector selector(Prefix);
+    selector.begin = prefix;
+    return selector;
+}
+
+KeySelector KeySelector::range(const std::string& begin, const std::string& end) {
+    KeySelector selector(Range);
+    selector.begin = begin;
+    selector.end = end;
+    return selector;
+}
+
+void KeySelector::bounds(std::string& rangeBegin, std::string& rangeEnd) const {
+    rangeBegin.clear();
+    rangeEnd.clear();
+    if (kind == Range) {
+        rangeBegin = begin;
+        rangeEnd = end;
+    } else if (kind == Prefix) {
+        // Keys with the prefix end before the prefix with its last
+        // non-0xff byte incremented.
+        rangeBegin = begin;
+        rangeEnd = begin;
+        while (!rangeEnd.empty() && static_cast<unsigned char>(rangeEnd.back()) == 0xff) {
+            rangeEnd.pop_back();
+        }
+        if (!rangeEnd.empty()) {
+            rangeEnd.back() = static_cast<char>(static_cast<unsigned char>(rangeEnd.back()) + 1);
+        }
     }
-    store[key].push_back(value);
+}
+
+void KeyValueStore::insert(const std::string& key, int value) {
+    writableValues(key).push_back(value);
+    ++valueCount;
 }
 
 void KeyValueStore::insertMany(const std::string& key, const std::vector<int>& values) {
-    if (store.find(key) == store.end()) {
-        store[key] = std::vector<int>();
-    }
-    store[key].insert(store[key].end(), values.begin(), values.end());
+    std::vector<int>& storeValues = writableValues(key);
+    storeValues.insert(storeValues.end(), values.begin(), values.end());
+    valueCount += values.size();
 }
 
 bool KeyValueStore::removeValue(const std::string& key, int value) {
-    if (store.find(key) == store.end()) {
+    const std::vector<int>* current = latestValues(key);
+    if (current == nullptr) {
         return false;
     }
-    std::vector<int>& values = store[key];
-    for (auto it = values.begin(); it != values.end(); ++it) {
-        if (*it == value) {
-            values.erase(it);
-            return true;
-        }
+    // Look the value up first so that a miss does not copy a shared version.
+    auto pos = std::find(current->begin(), current->end(), value);
+    if (pos == current->end()) {
+        return false;
     }
-    return false;
+    std::vector<int>& values = writableValues(key);
+    values.erase(values.begin() + (pos - current->begin()));
+    --valueCount;
+    return true;
 }
 
 bool KeyValueStore::removeKey(const std::string& key) {
-    return store.erase(key) > 0;
+    auto it = store.find(key);
+    if (it == store.end() || !it->second.back().values) {
+        return false;
+    }
+    std::vector<Version>& versions = it->second;
+    --keyCount;
+    valueCount -= versions.back().values->size();
+    if (versions.back().index == version) {
+        versions.back().values = nullptr;
+    } else {
+        versions.push_back({version, nullptr});
+    }
+    prune(versions);
+    if (versions.size() == 1 && !versions.back().values && versions.back().index <= gcHorizon) {
+        store.erase(it);
+    }
+    return true;
 }
 
 bool KeyValueStore::removeMany(const std::string& key, const std::vector<int>& values) {
-    if (store.find(key) == store.end()) {
+    if (latestValues(key) == nullptr) {
         return false;
     }
-    std::vector<int>& storeValues = store[key];
+    std::vector<int>& storeValues = writableValues(key);
     for (int value : values) {
         for (auto it = storeValues.begin(); it != storeValues.end(); ++it) {
             if (*it == value) {
                 storeValues.erase(it);
+                --valueCount;
                 break;
             }
         }
@@ -50,20 +111,266 @@ bool KeyValueStore::removeMany(const std::string& key, const std::vector<int>& v
 }
 
 std::vector<int> KeyValueStore::getValues(const std::string& key) const {
-    if (store.find(key) == store.end()) {
+    const std::vector<int>* values = latestValues(key);
+    if (values == nullptr) {
         throw std::runtime_error("Key " + key + " not found");
     }
-    return store.at(key);
+    return *values;
 }
 
-const std::map<std::string, std::vector<int>>& KeyValueStore::getAll() const {
-    return store;
+std::map<std::string, std::vector<int>> KeyValueStore::getAll() const {
+    std::map<std::string, std::vector<int>> all;
+    for (const auto& pair : store) {
+        if (pair.second.back().values) {
+            all.emplace_hint(all.end(), pair.first, *pair.second.back().values);
+        }
+    }
+    return all;
 }
 
 const KeyValueStore KeyValueStore::getCopy() const {
     KeyValueStore copy;
-    for (const auto& pair : store) {
+    for (const auto& pair : getAll()) {
         copy.insertMany(pair.first, pair.second);
     }
     return copy;
-}
\ No newline at end of file
+}
+
+size_t KeyValueStore::getKeyCount() const {
+    return keyCount;
+}
+
+size_t KeyValueStore::getValueCount() const {
+    return valueCount;
+}
+
+void KeyValueStore::setVersion(uint64_t newVersion) {
+    version = newVersion;
+}
+
+uint64_t KeyValueStore::getVersion() const {
+    return version;
+}
+
+void KeyValueStore::setGcHorizon(uint64_t horizon) {
+    // Old versions are dropped lazily, when their key is next written,
+    // or all at once by `collectGarbage`.
+    gcHorizon = horizon;
+}
+
+uint64_t KeyValueStore::getGcHorizon() const {
+    return gcHorizon;
+}
+
+void KeyValueStore::collectGarbage() {
+    for (auto it = store.begin(); it != store.end();) {
+        std::vector<Version>& versions = it->second;
+        prune(versions);
+        if (versions.size() == 1 && !versions.back().values && versions.back().index <= gcHorizon) {
+            it = store.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+std::vector<int> KeyValueStore::getValuesAt(const std::string& key, uint64_t atVersion) const {
+    const std::vector<int>* values = valuesAt(key, atVersion);
+    if (values == nullptr) {
+        throw std::runtime_error("Key " + key + " not found at version " + std::to_string(atVersion));
+    }
+    return *values;
+}
+
+std::map<std::string, std::vector<int>> KeyValueStore::getAllAt(uint64_t atVersion) const {
+    std::map<std::string, std::vector<int>> all;
+    for (const auto& pair : store) {
+        const std::vector<int>* values = valuesAt(pair.first, atVersion);
+        if (values != nullptr) {
+            all.emplace_hint(all.end(), pair.first, *values);
+        }
+    }
+    return all;
+}
+
+void KeyValueStore::scan(const std::string& begin, const std::string& end, uint64_t atVersion,
+                         const std::function<void(const std::string&, const std::vector<int>&)>& visit) const {
+    std::string next;
+    scanPage(begin, end, atVersion, std::numeric_limits<size_t>::max(), next, visit);
+}
+
+bool KeyValueStore::scanPage(const std::string& begin, const std::string& end, uint64_t atVersion,
+                             size_t limit, std::string& nextOut,
+                             const std::function<void(const std::string&, const std::vector<int>&)>& visit) const {
+    if (atVersion < gcHorizon) {
+        throw std::runtime_error("Version " + std::to_string(atVersion) +
+                                 " is older than the GC horizon " + std::to_string(gcHorizon));
+    }
+    if (!end.empty() && end <= begin) {
+        return false;
+    }
+    auto last = end.empty() ? store.end() : store.lower_bound(end);
+    size_t visited = 0;
+    for (auto it = store.lower_bound(begin); it != last; ++it) {
+        if (visited == limit) {
+            nextOut = it->first;
+            return true;
+        }
+        const std::vector<int>* values = visibleAt(it->second, atVersion);
+        if (values != nullptr) {
+            visit(it->first, *values);
+            ++visited;
+        }
+    }
+    return false;
+}
+
+bool KeyValueStore::copyPage(const std::string& begin, const std::string& end, uint64_t atVersion,
+                             size_t limit, std::string& nextOut, KeyValueStore& into) const {
+    if (atVersion < gcHorizon) {
+        throw std::runtime_error("Version " + std::to_string(atVersion) +
+                                 " is older than the GC horizon " + std::to_string(gcHorizon));
+    }
+    if (!end.empty() && end <= begin) {
+        return false;
+    }
+    auto last = end.empty() ? store.end() : store.lower_bound(end);
+    size_t copied = 0;
+    for (auto it = store.lower_bound(begin); it != last; ++it) {
+        if (copied == limit) {
+            nextOut = it->first;
+            return true;
+        }
+        const Version* visible = versionAt(it->second, atVersion);
+        if (visible != nullptr && visible->values) {
+            const size_t keys = into.store.size();
+            into.store.emplace_hint(into.store.end(), it->first, std::vector<Version>{*visible});
+            if (into.store.size() > keys) {
+                ++into.keyCount;
+                into.valueCount += visible->values->size();
+            }
+            ++copied;
+        }
+    }
+    return false;
+}
+
+std::vector<std::string> KeyValueStore::splitRange(const std::string& begin, const std::string& end,
+                                                   size_t parts, size_t minKeysPerPart) const {
+    if (!end.empty() && end <= begin) {
+        return {begin, end};
+    }
+    auto first = store.lower_bound(begin);
+    auto last = end.empty() ? store.end() : store.lower_bound(end);
+    size_t count = std::distance(first, last);
+    parts = std::max<size_t>(1, std::min(parts, count / std::max<size_t>(1, minKeysPerPart)));
+
+    std::vector<std::string> boundaries = {begin};
+    size_t position = 0;
+    auto it = first;
+    for (size_t part = 1; part < parts; ++part) {
+        size_t target = count * part / parts;
+        std::advance(it, target - position);
+        position = target;
+        boundaries.push_back(it->first);
+    }
+    boundaries.push_back(end);
+    return boundaries;
+}
+
+std::vector<KeySelector> KeyValueStore::partition(const KeySelector& selector, size_t parts) const {
+    std::vector<KeySelector> partitions;
+    parts = std::max<size_t>(1, parts);
+    if (selector.kind == KeySelector::Keys) {
+        const std::vector<std::string>& keys = selector.keys;
+        size_t count = std::min(parts, std::max<size_t>(1, keys.size()));
+        for (size_t part = 0; part < count; ++part) {
+            auto first = keys.begin() + keys.size() * part / count;
+            auto last = keys.begin() + keys.size() * (part + 1) / count;
+            partitions.push_back(KeySelector::keyList({first, last}));
+        }
+        return partitions;
+    }
+    std::string begin, end;
+    selector.bounds(begin, end);
+    std::vector<std::string> boundaries = splitRange(begin, end, parts);
+    for (size_t part = 0; part + 1 < boundaries.size(); ++part) {
+        partitions.push_back(KeySelector::range(boundaries[part], boundaries[part + 1]));
+    }
+    return partitions;
+}
+
+std::vector<int>& KeyValueStore::writableValues(const std::string& key) {
+    std::vector<Version>& versions = store[key];
+    if (versions.empty() || !versions.back().values) {
+        ++keyCount;
+        if (!versions.empty() && versions.back().index == version) {
+            versions.back().values = std::make_shared<std::vector<int>>();
+        } else {
+            versions.push_back({version, std::make_shared<std::vector<int>>()});
+        }
+    } else {
+        Version& latest = versions.back();
+        // Another store copy (snapshot, running job) still reads this version.
+        bool shared = latest.values.use_count() > 1;
+        // Readers at indexes between the latest version and now may still ask for it.
+        bool retained = latest.index != version && version > gcHorizon;
+        if (retained) {
+            versions.push_back({version, std::make_shared<std::vector<int>>(*latest.values)});
+        } else {
+            if (shared) {
+                latest.values = std::make_shared<std::vector<int>>(*latest.values);
+            }
+            latest.index = std::max(latest.index, version);
+        }
+    }
+    prune(versions);
+    return *versions.back().values;
+}
+
+const std::vector<int>* KeyValueStore::latestValues(const std::string& key) const {
+    auto it = store.find(key);
+    if (it == store.end()) {
+        return nullptr;
+    }
+    return it->second.back().values.get();
+}
+
+const std::vector<int>* KeyValueStore::valuesAt(const std::string& key, uint64_t atVersion) const {
+    if (atVersion < gcHorizon) {
+        throw std::runtime_error("Version " + std::to_string(atVersion) +
+                                 " is older than the GC horizon " + std::to_string(gcHorizon));
+    }
+    auto it = store.find(key);
+    if (it == store.end()) {
+        return nullptr;
+    }
+    return visibleAt(it->second, atVersion);
+}
+
+const std::vector<int>* KeyValueStore::visibleAt(const std::vector<Version>& versions, uint64_t atVersion) const {
+    const Version* visible = versionAt(versions, atVersion);
+    return visible == nullptr ? nullptr : visible->values.get();
+}
+
+const KeyValueStore::Version* KeyValueStore::versionAt(const std::vector<Version>& versions,
+                                                       uint64_t atVersion) const {
+    // The version visible at `atVersion` is the last one written at or before it.
+    auto next = std::upper_bound(versions.begin(), versions.end(), atVersion,
+                                 [](uint64_t v, const Version& entry) { return v < entry.index; });
+    if (next == versions.begin()) {
+        return nullptr;
+    }
+    return &*std::prev(next);
+}
+
+void KeyValueStore::prune(std::vector<Version>& versions) const {
+    // Everything before the last version at or below the horizon is unreachable.
+    size_t keepFrom = 0;
+    for (size_t i = 1; i < versions.size() && versions[i].index <= gcHorizon; ++i) {
+        keepFrom = i;
+    }
+    if (keepFrom > 0) {
+        versions.erase(versions.begin(), versions.begin() + keepFrom);
+    }
+}
@@ -1,9 +1,40 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <map>
+#include <memory>
 #include <vector>
 #include <string>
 
+// Which keys a MapReduce job reads: an explicit list, every key,
+// every key with a prefix, or a key range.
+struct KeySelector {
+    enum Kind : uint8_t {
+        Keys = 0,
+        All = 1,
+        Prefix = 2,
+        Range = 3
+    };
+
+    KeySelector() : kind(Keys) {}
+    explicit KeySelector(Kind kind) : kind(kind) {}
+    static KeySelector keyList(const std::vector<std::string>& keys);
+    static KeySelector allKeys();
+    static KeySelector prefix(const std::string& prefix);
+    // [begin, end); an empty `end` means no upper bound.
+    static KeySelector range(const std::string& begin, const std::string& end);
+
+    // The key range covered by an All, Prefix or Range selector.
+    void bounds(std::string& begin, std::string& end) const;
+
+    Kind kind;
+    std::vector<std::string> keys;  // Keys
+    std::string begin;              // Prefix: the prefix, Range: first key
+    std::string end;                // Range: end key (exclusive)
+};
+
 class KeyValueStore {
 public:
     void insert(const std::string& key, int value);
@@ -12,8 +43,65 @@ public:
     bool removeMany(const std::string& key, const std::vector<int>& values);
     bool removeKey(const std::string& key);
     std::vector<int> getValues(const std::string& key) const;
-    const std::map<std::string, std::vector<int>>& getAll() const;
+    std::map<std::string, std::vector<int>> getAll() const;
     const KeyValueStore getCopy() const;
+    // Keys and values of the latest version, kept up to date on every write.
+    size_t getKeyCount() const;
+    size_t getValueCount() const;
+
+    // Versioned reads (MVCC).
+    // Every mutation is tagged with the current version (the Raft log index
+    // being committed). Older versions are kept until they fall below the
+    // garbage-collection horizon, so readers can query a consistent past index.
+    void setVersion(uint64_t version);
+    uint64_t getVersion() const;
+    void setGcHorizon(uint64_t horizon);
+    uint64_t getGcHorizon() const;
+    void collectGarbage();
+    std::vector<int> getValuesAt(const std::string& key, uint64_t version) const;
+    std::map<std::string, std::vector<int>> getAllAt(uint64_t version) const;
+
+    // Ordered scan of the keys in [begin, end) as of `version`.
+    // An empty `end` means no upper bound.
+    void scan(const std::string& begin, const std::string& end, uint64_t version,
+              const std::function<void(const std::string&, const std::vector<int>&)>& visit) const;
+    // The same, one page at a time: visits at most `limit` keys and returns
+    // true if it stopped there, with the key to resume from in `nextOut`.
+    bool scanPage(const std::string& begin, const std::string& end, uint64_t version, size_t limit,
+                  std::string& nextOut,
+                  const std::function<void(const std::string&, const std::vector<int>&)>& visit) const;
+    // Like scanPage, but adds the keys to `into` as they were at `version`,
+    // sharing their value lists instead of copying them.
+    bool copyPage(const std::string& begin, const std::string& end, uint64_t version, size_t limit,
+                  std::string& nextOut, KeyValueStore& into) const;
+    // Splits [begin, end) into at most `parts` ranges with about the same
+    // number of keys, at least `minKeysPerPart` each. Returns the boundaries,
+    // starting with `begin` and ending with `end`.
+    std::vector<std::string> splitRange(const std::string& begin, const std::string& end,
+                                        size_t parts, size_t minKeysPerPart = 1) const;
+    // Splits the keys of `selector` into at most `parts` disjoint selectors:
+    // slices of an explicit key list, or key ranges of about the same size.
+    std::vector<KeySelector> partition(const KeySelector& selector, size_t parts) const;
+
 private:
-    std::map<std::string, std::vector<int>> store;
+    struct Version {
+        uint64_t index;
+        // Shared between copies of the store, copied on write.
+        // `nullptr` marks a removed key.
+        std::shared_ptr<std::vector<int>> values;
+    };
+
+    // key -> versions, oldest first.
+    std::map<std::string, std::vector<Version>> store;
+    uint64_t version = 0;
+    uint64_t gcHorizon = 0;
+    size_t keyCount = 0;
+    size_t valueCount = 0;
+
+    std::vector<int>& writableValues(const std::string& key);
+    const std::vector<int>* latestValues(const std::string& key) const;
+    const std::vector<int>* valuesAt(const std::string& key, uint64_t version) const;
+    const std::vector<int>* visibleAt(const std::vector<Version>& versions, uint64_t version) const;
+    const Version* versionAt(const std::vector<Version>& versions, uint64_t version) const;
+    void prune(std::vector<Version>& versions) const;
 };
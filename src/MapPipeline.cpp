@@ -0,0 +1,239 @@
+#include "MapPipeline.h"
+#include "PluginRegistry.h"
+#include <map>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+// Compile-time implementation of each stage. Returns false to drop the value.
+template <MapStage::Kind K> struct StageOp;
+
+template <> struct StageOp<MapStage::Square> {
+    static bool apply(uint64_t& v, int64_t) { v *= v; return true; }
+};
+template <> struct StageOp<MapStage::Double> {
+    static bool apply(uint64_t& v, int64_t) { v *= 2; return true; }
+};
+template <> struct StageOp<MapStage::Triple> {
+    static bool apply(uint64_t& v, int64_t) { v *= 3; return true; }
+};
+template <> struct StageOp<MapStage::Add> {
+    static bool apply(uint64_t& v, int64_t k) { v += static_cast<uint64_t>(k); return true; }
+};
+template <> struct StageOp<MapStage::Mul> {
+    static bool apply(uint64_t& v, int64_t k) { v *= static_cast<uint64_t>(k); return true; }
+};
+template <> struct StageOp<MapStage::Gt> {
+    static bool apply(uint64_t& v, int64_t k) { return static_cast<int64_t>(v) > k; }
+};
+
+// Kernel for one fixed sequence of stages. Only the operands are read at run time.
+template <MapStage::Kind... Kinds>
+struct Fused {
+    static constexpr size_t N = sizeof...(Kinds);
+
+    template <size_t... I>
+    static bool applyAll(uint64_t& v, const int64_t* operands, std::index_sequence<I...>) {
+        bool keep = true;
+        ((keep &= StageOp<Kinds>::apply(v, operands[I])), ...);
+        return keep;
+    }
+
+    static void kernel(const MapStage* stages, const int* values, size_t count,
+                       std::vector<int64_t>& out) {
+        int64_t operands[N];
+        for (size_t i = 0; i < N; ++i) {
+            operands[i] = stages[i].operand;
+        }
+        const size_t base = out.size();
+        out.resize(base + count);
+        int64_t* dst = out.data() + base;
+        size_t kept = 0;
+        for (size_t i = 0; i < count; ++i) {
+            uint64_t v = static_cast<uint64_t>(static_cast<int64_t>(values[i]));
+            bool keep = applyAll(v, operands, std::make_index_sequence<N>());
+            // Branch-free filtering: always store, only advance on a keep.
+            dst[kept] = static_cast<int64_t>(v);
+            kept += keep;
+        }
+        out.resize(base + kept);
+    }
+};
+
+using KernelTable = std::map<std::vector<MapStage::Kind>, MapPipeline::Kernel>;
+
+template <MapStage::Kind... Kinds>
+void registerKernel(KernelTable& table) {
+    table[{Kinds...}] = &Fused<Kinds...>::kernel;
+}
+
+template <MapStage::Kind... Prefix>
+void registerWithLastStage(KernelTable& table) {
+    registerKernel<Prefix..., MapStage::Square>(table);
+    registerKernel<Prefix..., MapStage::Double>(table);
+    registerKernel<Prefix..., MapStage::Triple>(table);
+    registerKernel<Prefix..., MapStage::Add>(table);
+    registerKernel<Prefix..., MapStage::Mul>(table);
+    registerKernel<Prefix..., MapStage::Gt>(table);
+}
+
+template <MapStage::Kind... Suffix>
+void registerWithFirstStage(KernelTable& table) {
+    registerWithLastStage<MapStage::Square, Suffix...>(table);
+    registerWithLastStage<MapStage::Double, Suffix...>(table);
+    registerWithLastStage<MapStage::Triple, Suffix...>(table);
+    registerWithLastStage<MapStage::Add, Suffix...>(table);
+    registerWithLastStage<MapStage::Mul, Suffix...>(table);
+    registerWithLastStage<MapStage::Gt, Suffix...>(table);
+}
+
+// Fused sequences: every single stage, every pair of stages,
+// and some common three-stage chains around a filter.
+const KernelTable& fusedKernels() {
+    static const KernelTable table = [] {
+        KernelTable t;
+        registerWithLastStage<>(t);
+        registerWithFirstStage<>(t);
+        registerKernel<MapStage::Square, MapStage::Square, MapStage::Gt>(t);
+        registerKernel<MapStage::Square, MapStage::Double, MapStage::Gt>(t);
+        registerKernel<MapStage::Square, MapStage::Triple, MapStage::Gt>(t);
+        registerKernel<MapStage::Square, MapStage::Add, MapStage::Gt>(t);
+        registerKernel<MapStage::Square, MapStage::Mul, MapStage::Gt>(t);
+        registerKernel<MapStage::Mul, MapStage::Add, MapStage::Gt>(t);
+        registerKernel<MapStage::Add, MapStage::Mul, MapStage::Gt>(t);
+        registerKernel<MapStage::Gt, MapStage::Square, MapStage::Add>(t);
+        registerKernel<MapStage::Gt, MapStage::Mul, MapStage::Add>(t);
+        return t;
+    }();
+    return table;
+}
+
+MapStage parseStage(const std::string& token) {
+    static const std::map<std::string, MapStage::Kind> simple = {
+        {"square", MapStage::Square}, {"double", MapStage::Double}, {"triple", MapStage::Triple}
+    };
+    static const std::map<std::string, MapStage::Kind> withOperand = {
+        {"add", MapStage::Add}, {"mul", MapStage::Mul}, {"gt", MapStage::Gt}
+    };
+
+    auto simpleIt = simple.find(token);
+    if (simpleIt != simple.end()) {
+        return {simpleIt->second, 0};
+    }
+    size_t colon = token.find(':');
+    if (colon != std::string::npos) {
+        auto it = withOperand.find(token.substr(0, colon));
+        std::string operand = token.substr(colon + 1);
+        size_t parsed = 0;
+        if (it != withOperand.end() && !operand.empty()) {
+            try {
+                int64_t k = std::stoll(operand, &parsed);
+                if (parsed == operand.size()) {
+                    return {it->second, k};
+                }
+            } catch (const std::logic_error& e) {
+                // Falls through to the error below.
+            }
+        }
+    }
+    mr_map_kernel plugin = nullptr;
+    if (PluginRegistry::instance().findMap(token, plugin)) {
+        return {MapStage::Plugin, 0, plugin};
+    }
+    throw std::runtime_error("Map operation not found: " + token);
+}
+
+// Applies one built-in stage; returns false to drop the value.
+inline bool applyStage(const MapStage& stage, uint64_t& v) {
+    switch (stage.kind) {
+        case MapStage::Square: v *= v; return true;
+        case MapStage::Double: v *= 2; return true;
+        case MapStage::Triple: v *= 3; return true;
+        case MapStage::Add: v += static_cast<uint64_t>(stage.operand); return true;
+        case MapStage::Mul: v *= static_cast<uint64_t>(stage.operand); return true;
+        case MapStage::Gt: return static_cast<int64_t>(v) > stage.operand;
+        default: return true;
+    }
+}
+
+} // namespace
+
+MapPipeline MapPipeline::parse(const std::string& spec) {
+    MapPipeline pipeline;
+    size_t begin = 0;
+    while (true) {
+        size_t end = spec.find('|', begin);
+        std::string token = spec.substr(begin, end == std::string::npos ? end : end - begin);
+        pipeline.stages.push_back(parseStage(token));
+        if (pipeline.stages.back().kind == MapStage::Plugin && pipeline.stages.size() > 1) {
+            throw std::runtime_error("Plugin map operation must be the first stage: " + token);
+        }
+        if (end == std::string::npos) break;
+        begin = end + 1;
+    }
+
+    std::vector<MapStage::Kind> kinds;
+    for (const MapStage& stage : pipeline.stages) {
+        kinds.push_back(stage.kind);
+    }
+    auto kernelIt = fusedKernels().find(kinds);
+    if (kernelIt != fusedKernels().end()) {
+        pipeline.fusedKernel = kernelIt->second;
+    }
+    return pipeline;
+}
+
+void MapPipeline::apply(const int* values, size_t count, std::vector<int64_t>& out) const {
+    if (fusedKernel != nullptr) {
+        fusedKernel(stages.data(), values, count, out);
+    } else {
+        interpret(values, count, out);
+    }
+}
+
+void MapPipeline::interpret(const int* values, size_t count, std::vector<int64_t>& out) const {
+    if (hasPlugin()) {
+        // The plugin maps the whole batch, then the other stages run in place.
+        const size_t base = out.size();
+        out.resize(base + count);
+        size_t mapped = stages[0].plugin(values, count, out.data() + base);
+        int64_t* dst = out.data() + base;
+        size_t kept = 0;
+        for (size_t i = 0; i < mapped; ++i) {
+            uint64_t v = static_cast<uint64_t>(dst[i]);
+            bool keep = true;
+            for (size_t s = 1; s < stages.size(); ++s) {
+                keep &= applyStage(stages[s], v);
+            }
+            dst[kept] = static_cast<int64_t>(v);
+            kept += keep;
+        }
+        out.resize(base + kept);
+        return;
+    }
+
+    out.reserve(out.size() + count);
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t v = static_cast<uint64_t>(static_cast<int64_t>(values[i]));
+        bool keep = true;
+        for (const MapStage& stage : stages) {
+            keep &= applyStage(stage, v);
+        }
+        if (keep) {
+            out.push_back(static_cast<int64_t>(v));
+        }
+    }
+}
+
+bool MapPipeline::isFused() const {
+    return fusedKernel != nullptr;
+}
+
+bool MapPipeline::hasPlugin() const {
+    return !stages.empty() && stages[0].kind == MapStage::Plugin;
+}
+
+const std::vector<MapStage>& MapPipeline::getStages() const {
+    return stages;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "OperatorPlugin.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// One step of a map pipeline.
+struct MapStage {
+    enum Kind : uint8_t {
+        Square,
+        Double,
+        Triple,
+        Add,    // add:k
+        Mul,    // mul:k
+        Gt,     // gt:k, keeps values greater than k
+        Plugin  // A map operator loaded from a plugin, see PluginRegistry
+    };
+    Kind kind;
+    int64_t operand;
+    mr_map_kernel plugin = nullptr;
+};
+
+// A chain of map stages such as `square|triple|gt:100`, applied left to right.
+// Arithmetic wraps around in 64 bits.
+//
+// Known stage sequences run through a kernel instantiated for exactly that
+// sequence, so the whole chain is a single loop the compiler can inline.
+// Any other chain falls back to an interpreter.
+//
+// A plugin map operator reads the stored int values, so it can only be
+// the first stage; built-in stages may follow it.
+class MapPipeline {
+public:
+    static MapPipeline parse(const std::string& spec);
+
+    // Appends the mapped values that pass every filter to `out`.
+    void apply(const int* values, size_t count, std::vector<int64_t>& out) const;
+    void interpret(const int* values, size_t count, std::vector<int64_t>& out) const;
+
+    bool isFused() const;
+    bool hasPlugin() const;
+    const std::vector<MapStage>& getStages() const;
+
+    using Kernel = void (*)(const MapStage* stages, const int* values, size_t count,
+                            std::vector<int64_t>& out);
+
+private:
+    std::vector<MapStage> stages;
+    Kernel fusedKernel = nullptr;
+};
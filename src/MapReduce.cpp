@@ -1,62 +1,533 @@
 #include "MapReduce.h"
+#include "Sketches.h"
+#include "TaskRunner.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <stdexcept>
 #include <iostream>
+#include <memory>
+#include <thread>
 
-MapReduce::MapReduce(const KeyValueStore& store) : kvStore(store) {
-    initOperations();
+namespace {
+
+const int64_t INT64_MAX_VALUE = std::numeric_limits<int64_t>::max();
+const int64_t INT64_MIN_VALUE = std::numeric_limits<int64_t>::min();
+
+// Scans smaller than this are not worth a thread.
+const size_t MIN_KEYS_PER_TASK = 1024;
+
+// Everything the statistics need, gathered in one pass.
+struct Moments {
+    uint64_t count = 0;
+    __int128 sum = 0;
+    int64_t min = INT64_MAX_VALUE;
+    int64_t max = INT64_MIN_VALUE;
+    // Sums of deviations from the first value, which keeps the variance
+    // numerically stable without a second pass over the data.
+    double shiftedSum = 0;
+    double shiftedSquares = 0;
+    long double squares = 0;
+};
+
+Moments computeMoments(const int64_t* values, size_t count) {
+    Moments moments;
+    moments.count = count;
+    if (count == 0) {
+        return moments;
+    }
+    const int64_t shift = values[0];
+    for (size_t i = 0; i < count; ++i) {
+        const int64_t value = values[i];
+        moments.sum += value;
+        moments.min = std::min(moments.min, value);
+        moments.max = std::max(moments.max, value);
+        const double deviation = static_cast<double>(value - shift);
+        moments.shiftedSum += deviation;
+        moments.shiftedSquares += deviation * deviation;
+        moments.squares += static_cast<long double>(value) * value;
+    }
+    return moments;
 }
 
-void MapReduce::initOperations() {
-    mapFunctions["square"] = [](int x) { return x * x; };
-    mapFunctions["double"] = [](int x) { return x * 2; };
-    mapFunctions["triple"] = [](int x) { return x * 3; };
+const std::vector<std::string> STATISTICS = {
+    "count", "sum", "min", "max", "mean", "variance", "stddev", "sum_of_squares", "distinct"
+};
 
-    reduceFunctions["sum"] = {{[](int x, int y) { return x + y; }}, 0};
-    reduceFunctions["product"] = {{[](int x, int y) { return x * y; }}, 1};
+double statistic(const Moments& moments, const std::string& name) {
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    const double n = static_cast<double>(moments.count);
+    if (name == "count") return n;
+    if (name == "sum") return static_cast<double>(moments.sum);
+    if (name == "sum_of_squares") return static_cast<double>(moments.squares);
+    if (moments.count == 0) return nan;
+    if (name == "min") return static_cast<double>(moments.min);
+    if (name == "max") return static_cast<double>(moments.max);
+    if (name == "mean") return static_cast<double>(moments.sum) / n;
+    double variance = (moments.shiftedSquares - moments.shiftedSum * moments.shiftedSum / n) / n;
+    variance = std::max(variance, 0.0);
+    if (name == "variance") return variance;
+    if (name == "stddev") return std::sqrt(variance);
+    return nan;
 }
 
+// Orders a ranking: best result first, ties broken by key so that
+// every replica returns the same keys.
+struct RankOrder {
+    bool lowest;
 
-std::map<std::string, int> MapReduce::performMapReduce(
-    const std::string& mapOp,
-    const std::string& reduceOp,
-    const std::vector<std::string>& keys) {
-    auto mapFunctionIt = mapFunctions.find(mapOp);
-    if (mapFunctionIt == mapFunctions.end()) {
-        throw std::runtime_error("Map operation not found: " + mapOp);
+    bool operator()(const std::pair<std::string, int64_t>& a,
+                    const std::pair<std::string, int64_t>& b) const {
+        if (a.second != b.second) {
+            return lowest ? a.second < b.second : a.second > b.second;
+        }
+        return a.first < b.first;
     }
-    auto reduceFunctionIt = reduceFunctions.find(reduceOp);
-    if (reduceFunctionIt == reduceFunctions.end()) {
-        throw std::runtime_error("Reduce operation not found: " + reduceOp);
+};
+
+// Keeps the `k` best entries in `heap`, with the worst one on top.
+void offer(MapReduce::Ranking& heap, size_t k, std::pair<std::string, int64_t>&& entry,
+           const RankOrder& order) {
+    if (heap.size() < k) {
+        heap.push_back(std::move(entry));
+        std::push_heap(heap.begin(), heap.end(), order);
+    } else if (k > 0 && order(entry, heap.front())) {
+        std::pop_heap(heap.begin(), heap.end(), order);
+        heap.back() = std::move(entry);
+        std::push_heap(heap.begin(), heap.end(), order);
     }
+}
+
+// Partial result of one group. Distinct counts cannot be combined
+// from per-key counts, so they keep a sketch of the values.
+struct GroupPartial {
+    int64_t value = 0;
+    std::shared_ptr<HyperLogLog> sketch;
+};
 
-    std::map<std::string, int> results;
-    for (const auto& key : keys) {
-        std::vector<int> values;
+// Reducer that combines two partial results of a reducer, where it differs.
+const std::map<std::string, std::string> GROUP_COMBINERS = {
+    {"count", "sum"},
+    {"sum_of_squares", "sum"},
+};
+
+// Reduces the mapped values of one key with an operator resolved once per job.
+struct KeyReducer {
+    ReduceOperator op;
+    OverflowPolicy overflow;
+
+    int64_t operator()(const std::string& key, const std::vector<int64_t>& mappedValues) const {
+        if (mappedValues.empty()) {
+            // If there are no values to reduce, use the identity element for the reduce operation.
+            return op.getIdentity();
+        }
         try {
-            values = kvStore.getValues(key);
-        } catch (const std::runtime_error& e) {
-            results[key] = reduceFunctionIt->second.second;
+            return op.reduce(mappedValues.data(), mappedValues.size(), overflow);
+        } catch (const std::overflow_error& e) {
+            throw std::overflow_error(std::string(e.what()) + " for key " + key);
         }
+    }
+};
 
-        if (values.empty()) {
-            // If there are no values to reduce, use the identity element for the reduce operation.
-            results[key] = reduceFunctionIt->second.second;
-            continue;
+} // namespace
+
+template <>
+struct PartialCodec<GroupPartial> {
+    static void encode(const GroupPartial& partial, std::string& out) {
+        if (partial.sketch) {
+            out.push_back(1);
+            out += partial.sketch->serialize();
+        } else {
+            out.push_back(0);
+            out.append(reinterpret_cast<const char*>(&partial.value), sizeof(partial.value));
+        }
+    }
+
+    static void decode(const std::string& in, GroupPartial& out) {
+        if (!in.empty() && in[0] == 1) {
+            out.sketch = std::make_shared<HyperLogLog>(HyperLogLog::deserialize(in.substr(1)));
+        } else if (in.size() == 1 + sizeof(out.value)) {
+            std::memcpy(&out.value, in.data() + 1, sizeof(out.value));
+        } else {
+            throw std::runtime_error("Invalid spilled group partial");
+        }
+    }
+};
+
+MapReduce::MapReduce(const KeyValueStore& store)
+    : MapReduce(store, std::numeric_limits<uint64_t>::max()) {}
+
+MapReduce::MapReduce(KeyValueStore store, uint64_t version)
+    : kvStore(std::move(store)), readVersion(version),
+      parallelism(std::max(1u, std::thread::hardware_concurrency())) {
+    if (readVersion < kvStore.getGcHorizon()) {
+        throw std::runtime_error("Version " + std::to_string(readVersion) +
+                                 " is no longer available");
+    }
+}
+
+void MapReduce::setParallelism(size_t threads) {
+    parallelism = std::max<size_t>(1, threads);
+}
+
+void MapReduce::setMemoryLimit(size_t bytes, const std::string& directory) {
+    setMemoryBudget(bytes > 0 ? std::make_shared<MemoryBudget>(bytes) : nullptr, directory);
+}
+
+void MapReduce::setMemoryBudget(std::shared_ptr<MemoryBudget> budget, const std::string& directory) {
+    memoryBudget = std::move(budget);
+    spillDirectory = directory;
+}
+
+const MapReduce::SpillStats& MapReduce::getSpillStats() const {
+    return spillStats;
+}
+
+void MapReduce::setCancellation(const std::atomic<bool>* flag) {
+    cancelled = flag;
+}
+
+void MapReduce::checkCancelled() const {
+    if (cancelled != nullptr && cancelled->load(std::memory_order_relaxed)) {
+        throw MapReduceCancelled();
+    }
+}
+
+bool MapReduce::hasReduceOperation(const std::string& reduceOp) const {
+    return ReduceOperator::exists(reduceOp);
+}
+
+bool MapReduce::isStatistic(const std::string& name) {
+    double quantile;
+    return std::find(STATISTICS.begin(), STATISTICS.end(), name) != STATISTICS.end()
+        || TDigest::parseQuantile(name, quantile);
+}
+
+void MapReduce::mapValues(const std::string& key,
+                          const MapPipeline& pipeline,
+                          std::vector<int64_t>& mappedValues) const {
+    mappedValues.clear();
+    std::vector<int> values;
+    try {
+        values = kvStore.getValuesAt(key, readVersion);
+    } catch (const std::runtime_error& e) {
+        return;
+    }
+    pipeline.apply(values.data(), values.size(), mappedValues);
+}
+
+
+template <typename Partial, typename Visit>
+std::vector<Partial> MapReduce::scanSelected(const KeySelector& selector,
+                                             const MapPipeline& pipeline,
+                                             const Visit& visit,
+                                             const Partial& initial) const {
+    if (selector.kind == KeySelector::Keys) {
+        std::vector<Partial> partials(1, initial);
+        std::vector<int64_t> mappedValues;
+        for (const auto& key : selector.keys) {
+            checkCancelled();
+            mapValues(key, pipeline, mappedValues);
+            visit(partials[0], key, mappedValues);
+        }
+        return partials;
+    }
+
+    std::string begin, end;
+    selector.bounds(begin, end);
+    std::vector<std::string> boundaries = kvStore.splitRange(begin, end, parallelism, MIN_KEYS_PER_TASK);
+    const size_t tasks = boundaries.size() - 1;
+    std::vector<Partial> partials(tasks, initial);
+    runTasks(tasks, true, [&](size_t task) {
+        Partial& partial = partials[task];
+        std::vector<int64_t> mappedValues;
+        kvStore.scan(boundaries[task], boundaries[task + 1], readVersion,
+                     [&](const std::string& key, const std::vector<int>& values) {
+            checkCancelled();
+            mappedValues.clear();
+            pipeline.apply(values.data(), values.size(), mappedValues);
+            visit(partial, key, mappedValues);
+        });
+    });
+    return partials;
+}
+
+template <typename Value, typename Partial, typename MapKey, typename Combine, typename Finish>
+std::map<std::string, Value> MapReduce::shuffleReduce(const KeySelector& selector,
+                                                      const MapPipeline& pipeline,
+                                                      const MapKey& mapKey,
+                                                      const Combine& combine,
+                                                      const Finish& finish) {
+    // Map and combine: every scan task fills its own buffer, and spills it
+    // when it takes the memory budget over its limit.
+    const size_t partitions = parallelism;
+    std::unique_ptr<MemoryBudget::Charge> charge;
+    if (memoryBudget) charge.reset(new MemoryBudget::Charge(*memoryBudget));
+    std::vector<ShuffleBuffer<Partial>> buffers = scanSelected<ShuffleBuffer<Partial>>(
+        selector, pipeline,
+        [&](ShuffleBuffer<Partial>& buffer, const std::string& key,
+            const std::vector<int64_t>& mappedValues) {
+            const size_t before = buffer.getBytes();
+            mapKey(buffer, key, mappedValues);
+            if (charge && charge->add(buffer.getBytes() - before)) {
+                charge->release(buffer.getBytes());
+                buffer.spill(spillDirectory);
+            }
+        },
+        ShuffleBuffer<Partial>(partitions));
+
+    spillStats = SpillStats();
+    for (const auto& buffer : buffers) {
+        for (size_t partition = 0; partition < partitions; ++partition) {
+            for (const auto& run : buffer.spilled(partition)) {
+                spillStats.runs++;
+                spillStats.bytes += run->getBytes();
+                spillStats.entries += run->getEntries();
+            }
         }
+    }
 
-        std::vector<int> mappedValues;
-        for (int value : values) {
-            mappedValues.push_back(mapFunctionIt->second(value));
+    // Shuffle and reduce: one task per partition merges it across buffers.
+    std::vector<std::vector<std::pair<std::string, Value>>> reduced(partitions);
+    runTasks(partitions, buffers.size() > 1, [&](size_t partition) {
+        auto merged = std::move(buffers[0].partition(partition));
+        typename ShuffleBuffer<Partial>::Runs runs = buffers[0].spilled(partition);
+        for (size_t buffer = 1; buffer < buffers.size(); ++buffer) {
+            checkCancelled();
+            for (auto& entry : buffers[buffer].partition(partition)) {
+                auto it = merged.find(entry.first);
+                if (it == merged.end()) {
+                    merged.emplace(entry.first, std::move(entry.second));
+                } else {
+                    combine(entry.first, it->second, entry.second);
+                }
+            }
+            buffers[buffer].partition(partition).clear();
+            const auto& spilled = buffers[buffer].spilled(partition);
+            runs.insert(runs.end(), spilled.begin(), spilled.end());
+        }
+        auto& results = reduced[partition];
+        if (!runs.empty()) {
+            // External merge of the runs and what is still in memory, in group order.
+            std::vector<std::pair<std::string, Partial>> entries;
+            entries.reserve(merged.size());
+            for (auto& entry : merged) {
+                entries.emplace_back(entry.first, std::move(entry.second));
+            }
+            decltype(merged)().swap(merged);
+            mergeRuns<Partial>(runs, entries, combine,
+                               [&](const std::string& group, const Partial& partial) {
+                                   checkCancelled();
+                                   results.emplace_back(group, finish(partial));
+                               },
+                               spillDirectory);
+            return;
         }
+        results.reserve(merged.size());
+        for (auto& entry : merged) {
+            results.emplace_back(entry.first, finish(entry.second));
+        }
+        std::sort(results.begin(), results.end(),
+                  [](const std::pair<std::string, Value>& a, const std::pair<std::string, Value>& b) {
+                      return a.first < b.first;
+                  });
+    });
 
-        int reducedValue = reduceFunctionIt->second.second; // Assume reduce operation is such that starting with 0 is appropriate
-        auto reduceFunction = reduceFunctionIt->second.first;
-        for (int mappedValue : mappedValues) {
-            reducedValue = reduceFunction(reducedValue, mappedValue);
+    // Partitions hold disjoint groups.
+    std::map<std::string, Value> results;
+    for (auto& partition : reduced) {
+        for (auto& entry : partition) {
+            results.emplace(std::move(entry.first), std::move(entry.second));
         }
+    }
+    return results;
+}
 
-        results[key] = reducedValue;
+template <typename Value, typename ReduceKey>
+std::map<std::string, Value> MapReduce::collect(const KeySelector& selector,
+                                                const MapPipeline& pipeline,
+                                                const ReduceKey& reduceKey) const {
+    std::vector<std::map<std::string, Value>> partials = scanSelected<std::map<std::string, Value>>(
+        selector, pipeline,
+        [&](std::map<std::string, Value>& partial, const std::string& key,
+            const std::vector<int64_t>& mappedValues) {
+            partial.emplace_hint(partial.end(), key, reduceKey(key, mappedValues));
+        });
+    if (partials.size() == 1) {
+        return std::move(partials[0]);
     }
 
+    // Ranges are ordered and disjoint, so each partial goes to the end.
+    std::map<std::string, Value> results;
+    for (auto& partial : partials) {
+        for (auto& kv : partial) {
+            results.emplace_hint(results.end(), kv.first, std::move(kv.second));
+        }
+    }
     return results;
-}
\ No newline at end of file
+}
+
+std::map<std::string, int64_t> MapReduce::performMapReduce(
+    const std::string& mapOp,
+    const std::string& reduceOp,
+    const std::vector<std::string>& keys,
+    OverflowPolicy overflow) {
+    return performMapReduce(mapOp, reduceOp, KeySelector::keyList(keys), overflow);
+}
+
+std::map<std::string, int64_t> MapReduce::performMapReduce(
+    const std::string& mapOp,
+    const std::string& reduceOp,
+    const KeySelector& selector,
+    OverflowPolicy overflow) {
+    const MapPipeline pipeline = MapPipeline::parse(mapOp);
+    return collect<int64_t>(selector, pipeline,
+                            KeyReducer{ReduceOperator::resolve(reduceOp), overflow});
+}
+
+std::map<std::string, int64_t> MapReduce::performGroupBy(
+    const std::string& mapOp,
+    const std::string& reduceOp,
+    const KeySelector& selector,
+    const KeyGrouper& grouper,
+    OverflowPolicy overflow) {
+    const MapPipeline pipeline = MapPipeline::parse(mapOp);
+    const KeyReducer reduceKey{ReduceOperator::resolve(reduceOp), overflow};
+    const bool distinct = reduceOp == "distinct";
+    auto combinerIt = GROUP_COMBINERS.find(reduceOp);
+    const ReduceOperator combiner =
+        ReduceOperator::resolve(combinerIt == GROUP_COMBINERS.end() ? reduceOp : combinerIt->second);
+
+    auto combine = [&](const std::string& group, int64_t& into, int64_t value) {
+        const int64_t pair[2] = {into, value};
+        try {
+            into = combiner.reduce(pair, 2, overflow);
+        } catch (const std::overflow_error& e) {
+            throw std::overflow_error(std::string(e.what()) + " for group " + group);
+        }
+    };
+
+    return shuffleReduce<int64_t, GroupPartial>(selector, pipeline,
+        [&](ShuffleBuffer<GroupPartial>& buffer, const std::string& key,
+            const std::vector<int64_t>& mappedValues) {
+            std::string group;
+            if (!grouper.group(key, group)) return;
+            bool isNew = false;
+            GroupPartial& partial = buffer.emit(group, isNew);
+            if (distinct) {
+                if (isNew) {
+                    partial.sketch = std::make_shared<HyperLogLog>();
+                    buffer.account(partial.sketch->memoryUsage());
+                }
+                for (int64_t value : mappedValues) {
+                    partial.sketch->add(value);
+                }
+            } else if (isNew) {
+                partial.value = reduceKey(key, mappedValues);
+            } else {
+                combine(group, partial.value, reduceKey(key, mappedValues));
+            }
+        },
+        [&](const std::string& group, GroupPartial& into, GroupPartial& from) {
+            if (distinct) {
+                into.sketch->merge(*from.sketch);
+            } else {
+                combine(group, into.value, from.value);
+            }
+        },
+        [&](const GroupPartial& partial) {
+            return distinct ? std::llround(partial.sketch->estimate()) : partial.value;
+        });
+}
+
+MapReduce::Ranking MapReduce::performTopK(
+    const std::string& mapOp,
+    const std::string& reduceOp,
+    const KeySelector& selector,
+    size_t k,
+    bool lowest,
+    OverflowPolicy overflow) {
+    const MapPipeline pipeline = MapPipeline::parse(mapOp);
+    const KeyReducer reduceKey{ReduceOperator::resolve(reduceOp), overflow};
+    const RankOrder order{lowest};
+    // A key named twice in a list would otherwise take two places in a heap.
+    KeySelector unique = selector;
+    if (unique.kind == KeySelector::Keys) {
+        std::sort(unique.keys.begin(), unique.keys.end());
+        unique.keys.erase(std::unique(unique.keys.begin(), unique.keys.end()), unique.keys.end());
+    }
+
+    // Each task keeps a bounded heap instead of a result per key.
+    std::vector<Ranking> heaps = scanSelected<Ranking>(unique, pipeline,
+        [&](Ranking& heap, const std::string& key, const std::vector<int64_t>& mappedValues) {
+            offer(heap, k, {key, reduceKey(key, mappedValues)}, order);
+        });
+    return mergeTopK(heaps, k, lowest);
+}
+
+MapReduce::Ranking MapReduce::mergeTopK(const std::vector<Ranking>& rankings, size_t k, bool lowest) {
+    const RankOrder order{lowest};
+    std::map<std::string, int64_t> seen;
+    Ranking heap;
+    for (const Ranking& ranking : rankings) {
+        for (const auto& entry : ranking) {
+            // Rankings of overlapping key sets hold some keys twice.
+            if (seen.emplace(entry.first, entry.second).second) {
+                offer(heap, k, std::pair<std::string, int64_t>(entry), order);
+            }
+        }
+    }
+    std::sort_heap(heap.begin(), heap.end(), order);
+    return heap;
+}
+
+std::map<std::string, std::map<std::string, double>> MapReduce::performStatistics(
+    const std::string& mapOp,
+    const std::vector<std::string>& statistics,
+    const std::vector<std::string>& keys) {
+    return performStatistics(mapOp, statistics, KeySelector::keyList(keys));
+}
+
+std::map<std::string, std::map<std::string, double>> MapReduce::performStatistics(
+    const std::string& mapOp,
+    const std::vector<std::string>& statistics,
+    const KeySelector& selector) {
+    const MapPipeline pipeline = MapPipeline::parse(mapOp);
+    bool needDistinct = false;
+    bool needQuantiles = false;
+    for (const auto& name : statistics) {
+        double quantile;
+        if (!isStatistic(name)) {
+            throw std::runtime_error("Reduce operation not found: " + name);
+        }
+        needDistinct |= name == "distinct";
+        needQuantiles |= TDigest::parseQuantile(name, quantile);
+    }
+
+    return collect<std::map<std::string, double>>(selector, pipeline,
+                                                  [&](const std::string&, const std::vector<int64_t>& mappedValues) {
+        Moments moments = computeMoments(mappedValues.data(), mappedValues.size());
+        // Sketches are only filled when asked for; an unused HyperLogLog
+        // gets the smallest precision.
+        HyperLogLog distinct(needDistinct ? 12 : 4);
+        TDigest digest;
+        if (needDistinct || needQuantiles) {
+            for (int64_t value : mappedValues) {
+                if (needDistinct) distinct.add(value);
+                if (needQuantiles) digest.add(static_cast<double>(value));
+            }
+        }
+        std::map<std::string, double> keyResults;
+        for (const auto& name : statistics) {
+            double quantile;
+            if (name == "distinct") {
+                keyResults[name] = std::round(distinct.estimate());
+            } else if (TDigest::parseQuantile(name, quantile)) {
+                keyResults[name] = digest.quantile(quantile);
+            } else {
+                keyResults[name] = statistic(moments, name);
+            }
+        }
+        return keyResults;
+    });
+}
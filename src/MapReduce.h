@@ -1,24 +1,161 @@
 #pragma once
 
 
+#include "KeyGrouper.h"
 #include "KeyValueStore.h" // Include your KeyValueStore header
-#include <functional>
+#include "MapPipeline.h"
+#include "ReduceOperator.h"
+#include "ShuffleBuffer.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
 #include <map>
+#include <memory>
+#include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
 
+// Thrown by a job whose cancellation flag was set.
+class MapReduceCancelled : public std::runtime_error {
+public:
+    MapReduceCancelled() : std::runtime_error("MapReduce cancelled") {}
+};
+
 class MapReduce {
 public:
+    // Keys with their results, best first.
+    using Ranking = std::vector<std::pair<std::string, int64_t>>;
+
+    // Intermediate results written to disk by the last job.
+    struct SpillStats {
+        size_t runs = 0;
+        size_t bytes = 0;
+        size_t entries = 0;
+    };
+
+    // `mapOp` is a single map operation or a pipeline of them,
+    // e.g. `square|triple|gt:100` (see MapPipeline).
     MapReduce(const KeyValueStore& kvStore);
-    std::map<std::string, int> performMapReduce(
+    // Reads the store as it was at `version` (a committed log index).
+    // The copy shares value lists with `kvStore`, but still takes time in
+    // the number of keys; pass an rvalue to take over a copy already made.
+    MapReduce(KeyValueStore kvStore, uint64_t version);
+    std::map<std::string, int64_t> performMapReduce(
+        const std::string& mapOp,
+        const std::string& reduceOp,
+        const std::vector<std::string>& keys = std::vector<std::string>(),
+        OverflowPolicy overflow = OverflowPolicy::Wrap);
+    // Listed keys that do not exist get the identity element. Keys matched
+    // by an All, Prefix or Range selector are scanned in order, split into
+    // key ranges that run in parallel.
+    std::map<std::string, int64_t> performMapReduce(
+        const std::string& mapOp,
+        const std::string& reduceOp,
+        const KeySelector& selector,
+        OverflowPolicy overflow = OverflowPolicy::Wrap);
+
+    // Reduces the selected keys by group (see KeyGrouper) instead of by key:
+    // each group's result is the reduction of the mapped values of all its
+    // keys. Keys in no group are skipped. Runs as map, combine, shuffle and
+    // reduce (see shuffleReduce), within the memory limit if one is set.
+    // Not available for statistics.
+    std::map<std::string, int64_t> performGroupBy(
         const std::string& mapOp,
         const std::string& reduceOp,
+        const KeySelector& selector,
+        const KeyGrouper& grouper,
+        OverflowPolicy overflow = OverflowPolicy::Wrap);
+
+    // The `k` selected keys with the largest results, or with `lowest` the
+    // smallest. Ties go to the smaller key. Each parallel task keeps a heap
+    // of at most `k` keys, so memory does not grow with the number of keys.
+    Ranking performTopK(
+        const std::string& mapOp,
+        const std::string& reduceOp,
+        const KeySelector& selector,
+        size_t k,
+        bool lowest = false,
+        OverflowPolicy overflow = OverflowPolicy::Wrap);
+    // Merges rankings of disjoint or overlapping key sets into the `k` best.
+    static Ranking mergeTopK(const std::vector<Ranking>& rankings, size_t k, bool lowest);
+
+    // Computes several statistics of each key's mapped values in one pass:
+    // count, sum, min, max, mean, variance, stddev and sum_of_squares.
+    // Variance and stddev are population statistics.
+    // `distinct` (HyperLogLog) and quantiles like `p50` or `p99.9`
+    // (t-digest) are approximate, see Sketches.h.
+    std::map<std::string, std::map<std::string, double>> performStatistics(
+        const std::string& mapOp,
+        const std::vector<std::string>& statistics,
         const std::vector<std::string>& keys = std::vector<std::string>());
+    std::map<std::string, std::map<std::string, double>> performStatistics(
+        const std::string& mapOp,
+        const std::vector<std::string>& statistics,
+        const KeySelector& selector);
+
+    // Upper bound on threads used by one job.
+    void setParallelism(size_t threads);
+    // Caps the memory of intermediate group partials at about `bytes`,
+    // shared by the scan tasks. A task that adds to them past the cap
+    // spills its partials to sorted run files in `spillDirectory`, which the
+    // reduce phase merges back group by group. 0 means no limit.
+    void setMemoryLimit(size_t bytes, const std::string& spillDirectory = "/tmp");
+    // Like setMemoryLimit, with a cap shared with other jobs, e.g. every
+    // job on a node. Null means no limit.
+    void setMemoryBudget(std::shared_ptr<MemoryBudget> budget,
+                         const std::string& spillDirectory = "/tmp");
+    const SpillStats& getSpillStats() const;
+    // Jobs check `cancelled` between keys and throw MapReduceCancelled once it is set.
+    void setCancellation(const std::atomic<bool>* cancelled);
+
+    // Reduce operators are resolved once per job (see ReduceOperator),
+    // including those loaded from plugins (see PluginRegistry). With
+    // group-by, a plugin reducer is applied to partial results too, so it
+    // should be associative.
+    bool hasReduceOperation(const std::string& reduceOp) const;
+    static bool isStatistic(const std::string& name);
 
 private:
     KeyValueStore kvStore;
-    std::map<std::string, std::function<int(int)>> mapFunctions;
-    std::map<std::string, std::pair<std::function<int(int, int)>, int>> reduceFunctions;
+    uint64_t readVersion;
+    size_t parallelism;
+    const std::atomic<bool>* cancelled = nullptr;
+    std::shared_ptr<MemoryBudget> memoryBudget;
+    std::string spillDirectory;
+    SpillStats spillStats;
 
-    void initOperations();
+    void checkCancelled() const;
+    // Mapped values of `key`, or an empty list if it does not exist.
+    void mapValues(const std::string& key,
+                   const MapPipeline& pipeline,
+                   std::vector<int64_t>& mappedValues) const;
+    // Maps the values of every selected key and calls
+    // `visit(partial, key, mappedValues)`. Scans are split into key ranges
+    // that run in parallel, each with its own partial result (a copy of
+    // `initial`), in key order.
+    template <typename Partial, typename Visit>
+    std::vector<Partial> scanSelected(const KeySelector& selector,
+                                      const MapPipeline& pipeline,
+                                      const Visit& visit,
+                                      const Partial& initial = Partial()) const;
+    // Map, combine, shuffle and reduce across keys. Each scan task calls
+    // `mapKey(buffer, key, mappedValues)`, which emits partials into the
+    // task's ShuffleBuffer and combines them in place. Then one task per
+    // partition merges that partition of every buffer with
+    // `combine(group, into, from)`, and `finish(partial)` gives the result.
+    // With a memory limit, buffers spill and Partial needs a PartialCodec.
+    template <typename Value, typename Partial, typename MapKey, typename Combine, typename Finish>
+    std::map<std::string, Value> shuffleReduce(const KeySelector& selector,
+                                               const MapPipeline& pipeline,
+                                               const MapKey& mapKey,
+                                               const Combine& combine,
+                                               const Finish& finish);
+    // Maps the values of every selected key and reduces them with
+    // `reduceKey(key, mappedValues)`.
+    template <typename Value, typename ReduceKey>
+    std::map<std::string, Value> collect(const KeySelector& selector,
+                                         const MapPipeline& pipeline,
+                                         const ReduceKey& reduceKey) const;
 };
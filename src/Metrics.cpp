@@ -0,0 +1,220 @@
+#include "Metrics.h"
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+uint64_t MetricCounter::value() const {
+    uint64_t total = 0;
+    for (const auto& shard : shards) {
+        total += shard.value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+void MetricCounter::reset() {
+    for (auto& shard : shards) {
+        shard.value.store(0, std::memory_order_relaxed);
+    }
+}
+
+size_t MetricCounter::shardIndex() {
+    static std::atomic<size_t> nextThread(0);
+    thread_local size_t index = nextThread.fetch_add(1, std::memory_order_relaxed) % METRIC_SHARDS;
+    return index;
+}
+
+LatencyHistogram::LatencyHistogram() : shards(new Shard[METRIC_SHARDS]) {
+    reset();
+}
+
+size_t LatencyHistogram::bucketOf(uint64_t nanos) {
+    if (nanos < SUB_BUCKETS) {
+        return nanos;
+    }
+    // The top SUB_BUCKET_BITS + 1 bits select the bucket.
+    const int exponent = 63 - __builtin_clzll(nanos);
+    const int shift = exponent - SUB_BUCKET_BITS;
+    return (shift + 1) * SUB_BUCKETS + ((nanos >> shift) & (SUB_BUCKETS - 1));
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(size_t index) {
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+    const int shift = static_cast<int>(index / SUB_BUCKETS) - 1;
+    const uint64_t lower = (SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+    return lower + ((uint64_t(1) << shift) - 1);
+}
+
+void LatencyHistogram::record(uint64_t nanos) {
+    Shard& shard = shards[MetricCounter::shardIndex()];
+    shard.counts[bucketOf(nanos)].fetch_add(1, std::memory_order_relaxed);
+    shard.sum.fetch_add(nanos, std::memory_order_relaxed);
+    uint64_t max = shard.max.load(std::memory_order_relaxed);
+    while (nanos > max && !shard.max.compare_exchange_weak(max, nanos, std::memory_order_relaxed)) {
+    }
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const {
+    Snapshot snapshot;
+    snapshot.buckets.assign(BUCKETS, 0);
+    for (size_t s = 0; s < METRIC_SHARDS; ++s) {
+        const Shard& shard = shards[s];
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            const uint64_t count = shard.counts[i].load(std::memory_order_relaxed);
+            snapshot.buckets[i] += count;
+            snapshot.count += count;
+        }
+        snapshot.sum += shard.sum.load(std::memory_order_relaxed);
+        snapshot.max = std::max(snapshot.max, shard.max.load(std::memory_order_relaxed));
+    }
+    return snapshot;
+}
+
+void LatencyHistogram::reset() {
+    for (size_t s = 0; s < METRIC_SHARDS; ++s) {
+        Shard& shard = shards[s];
+        for (auto& count : shard.counts) {
+            count.store(0, std::memory_order_relaxed);
+        }
+        shard.sum.store(0, std::memory_order_relaxed);
+        shard.max.store(0, std::memory_order_relaxed);
+    }
+}
+
+uint64_t LatencyHistogram::Snapshot::percentile(double q) const {
+    if (count == 0) {
+        return 0;
+    }
+    const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * count)));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return std::min(bucketUpperBound(i), max);
+        }
+    }
+    return max;
+}
+
+double LatencyHistogram::Snapshot::mean() const {
+    return count == 0 ? 0 : static_cast<double>(sum) / count;
+}
+
+MetricsRegistry& MetricsRegistry::instance() {
+    static MetricsRegistry registry;
+    return registry;
+}
+
+MetricsRegistry::~MetricsRegistry() {
+    stopDump();
+}
+
+MetricCounter& MetricsRegistry::counter(const std::string& name) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto& entry = counters[name];
+    if (!entry) entry.reset(new MetricCounter());
+    return *entry;
+}
+
+LatencyHistogram& MetricsRegistry::histogram(const std::string& name) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto& entry = histograms[name];
+    if (!entry) entry.reset(new LatencyHistogram());
+    return *entry;
+}
+
+void MetricsRegistry::gauge(const std::string& name, std::function<double()> read) {
+    std::lock_guard<std::mutex> guard(lock);
+    gauges[name] = std::move(read);
+}
+
+void MetricsRegistry::forEachCounter(
+    const std::function<void(const std::string&, const MetricCounter&)>& visit) const {
+    std::lock_guard<std::mutex> guard(lock);
+    for (const auto& entry : counters) {
+        visit(entry.first, *entry.second);
+    }
+}
+
+void MetricsRegistry::forEachHistogram(
+    const std::function<void(const std::string&, const LatencyHistogram&)>& visit) const {
+    std::lock_guard<std::mutex> guard(lock);
+    for (const auto& entry : histograms) {
+        visit(entry.first, *entry.second);
+    }
+}
+
+void MetricsRegistry::forEachGauge(const std::function<void(const std::string&, double)>& visit) const {
+    // Read without the lock: a gauge may take locks of its own.
+    std::map<std::string, std::function<double()>> current;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        current = gauges;
+    }
+    for (const auto& entry : current) {
+        visit(entry.first, entry.second());
+    }
+}
+
+std::string MetricsRegistry::report() const {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    forEachCounter([&](const std::string& name, const MetricCounter& counter) {
+        out << name << ": " << counter.value() << "\n";
+    });
+    forEachGauge([&](const std::string& name, double value) {
+        out << name << ": " << std::defaultfloat << value << std::fixed << "\n";
+    });
+    forEachHistogram([&](const std::string& name, const LatencyHistogram& histogram) {
+        const LatencyHistogram::Snapshot s = histogram.snapshot();
+        if (s.count == 0) return;
+        out << name << " (us): count " << s.count
+            << ", mean " << s.mean() / 1000
+            << ", p50 " << s.percentile(0.5) / 1000.0
+            << ", p90 " << s.percentile(0.9) / 1000.0
+            << ", p99 " << s.percentile(0.99) / 1000.0
+            << ", p99.9 " << s.percentile(0.999) / 1000.0
+            << ", max " << s.max / 1000.0 << "\n";
+    });
+    return out.str();
+}
+
+void MetricsRegistry::reset() {
+    forEachCounter([](const std::string&, const MetricCounter& counter) {
+        const_cast<MetricCounter&>(counter).reset();
+    });
+    forEachHistogram([](const std::string&, const LatencyHistogram& histogram) {
+        const_cast<LatencyHistogram&>(histogram).reset();
+    });
+}
+
+void MetricsRegistry::startDump(const std::string& path, std::chrono::seconds interval) {
+    stopDump();
+    std::lock_guard<std::mutex> guard(dumpLock);
+    stopping = false;
+    dumper = std::thread([this, path, interval] {
+        std::unique_lock<std::mutex> waiting(dumpLock);
+        while (!dumpStopped.wait_for(waiting, interval, [this] { return stopping; })) {
+            std::time_t now = std::time(nullptr);
+            std::tm local;
+            localtime_r(&now, &local);
+            std::ofstream out(path, std::ofstream::app);
+            out << "=== " << std::put_time(&local, "%Y-%m-%dT%H:%M:%S") << "\n" << report() << "\n";
+        }
+    });
+}
+
+void MetricsRegistry::stopDump() {
+    {
+        std::lock_guard<std::mutex> guard(dumpLock);
+        stopping = true;
+    }
+    dumpStopped.notify_all();
+    if (dumper.joinable()) {
+        dumper.join();
+    }
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Process-wide counters and latency histograms. A metric is looked up by
+// name once, typically into a static reference, and then updated without
+// locks. Each thread updates its own one of METRIC_SHARDS copies, so
+// threads rarely contend on a cache line; reads sum the shards.
+
+const size_t METRIC_SHARDS = 8;
+
+class MetricCounter {
+public:
+    void add(uint64_t n = 1) {
+        shards[shardIndex()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+    uint64_t value() const;
+    void reset();
+
+    // The calling thread's shard.
+    static size_t shardIndex();
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> value{0};
+    };
+    std::array<Shard, METRIC_SHARDS> shards;
+};
+
+// Distribution of durations in nanoseconds, in HDR-style log-linear
+// buckets: values below 16 have their own bucket, larger ones share one
+// of 16 buckets per power of two. A percentile is the upper bound of its
+// bucket, within 1/16 (6.25%) of the recorded value.
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BUCKET_BITS = 4;
+    static constexpr size_t SUB_BUCKETS = size_t(1) << SUB_BUCKET_BITS;
+    static constexpr size_t BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    struct Snapshot {
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t max = 0;
+        std::vector<uint64_t> buckets;
+
+        // `q` in [0, 1]; 0 if nothing was recorded.
+        uint64_t percentile(double q) const;
+        double mean() const;
+    };
+
+    LatencyHistogram();
+
+    void record(uint64_t nanos);
+    Snapshot snapshot() const;
+    void reset();
+
+    static size_t bucketOf(uint64_t nanos);
+    // Largest value in bucket `index`.
+    static uint64_t bucketUpperBound(size_t index);
+
+private:
+    struct alignas(64) Shard {
+        std::array<std::atomic<uint64_t>, BUCKETS> counts;
+        std::atomic<uint64_t> sum;
+        std::atomic<uint64_t> max;
+    };
+    std::unique_ptr<Shard[]> shards;
+};
+
+// Records the time from construction to destruction into a histogram.
+class ScopedLatency {
+public:
+    explicit ScopedLatency(LatencyHistogram& histogram)
+        : histogram(histogram), start(std::chrono::steady_clock::now()) {}
+    ~ScopedLatency() {
+        histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count());
+    }
+
+    ScopedLatency(const ScopedLatency&) = delete;
+    ScopedLatency& operator=(const ScopedLatency&) = delete;
+
+private:
+    LatencyHistogram& histogram;
+    std::chrono::steady_clock::time_point start;
+};
+
+// All metrics of the process, by name.
+class MetricsRegistry {
+public:
+    static MetricsRegistry& instance();
+    ~MetricsRegistry();
+
+    // Registered on first use. References stay valid for the life of the process.
+    MetricCounter& counter(const std::string& name);
+    LatencyHistogram& histogram(const std::string& name);
+    // A value owned elsewhere, e.g. the Raft term, read only when reported.
+    // Replaces an earlier gauge of the same name.
+    void gauge(const std::string& name, std::function<double()> read);
+
+    void forEachCounter(const std::function<void(const std::string&, const MetricCounter&)>& visit) const;
+    void forEachHistogram(const std::function<void(const std::string&, const LatencyHistogram&)>& visit) const;
+    void forEachGauge(const std::function<void(const std::string&, double)>& visit) const;
+
+    // Every metric by name: counter and gauge values, and the count, mean,
+    // percentiles and maximum of each histogram in microseconds.
+    std::string report() const;
+    void reset();
+
+    // Appends a timestamped `report()` to `path` every `interval`, on a
+    // background thread, until `stopDump`. Replaces an earlier dump.
+    void startDump(const std::string& path, std::chrono::seconds interval);
+    void stopDump();
+
+private:
+    MetricsRegistry() = default;
+
+    mutable std::mutex lock;
+    std::map<std::string, std::unique_ptr<MetricCounter>> counters;
+    std::map<std::string, std::unique_ptr<LatencyHistogram>> histograms;
+    std::map<std::string, std::function<double()>> gauges;
+
+    std::mutex dumpLock;
+    std::condition_variable dumpStopped;
+    bool stopping = false;
+    std::thread dumper;
+};
@@ -0,0 +1,158 @@
+#include "MetricsHttpServer.h"
+#include <arpa/inet.h>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+const int FIRST_BUCKET_SHIFT = 10;   // 1024 ns
+const int LAST_BUCKET_SHIFT = 36;    // ~68.7 s
+
+std::string metricName(const std::string& prefix, const std::string& name) {
+    std::string result = prefix + name;
+    for (char& c : result) {
+        if (!isalnum(static_cast<unsigned char>(c)) && c != '_') c = '_';
+    }
+    return result;
+}
+
+void writeAll(int fd, const std::string& data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = ::send(fd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+        if (n <= 0) return;
+        written += n;
+    }
+}
+
+} // namespace
+
+MetricsHttpServer::MetricsHttpServer(const std::string& address, uint16_t port)
+    : listener(-1), port(port), stopping(false) {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+        throw std::runtime_error("Invalid metrics address " + address);
+    }
+    listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0) {
+        throw std::runtime_error(std::string("Cannot create metrics socket: ") + strerror(errno));
+    }
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (::bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        ::listen(listener, 16) != 0) {
+        std::string error = strerror(errno);
+        ::close(listener);
+        throw std::runtime_error("Cannot listen on " + address + ":" + std::to_string(port) +
+                                 " for metrics: " + error);
+    }
+    socklen_t length = sizeof(addr);
+    getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &length);
+    this->port = ntohs(addr.sin_port);
+    thread = std::thread(&MetricsHttpServer::serve, this);
+}
+
+MetricsHttpServer::~MetricsHttpServer() {
+    stopping = true;
+    if (thread.joinable()) {
+        thread.join();
+    }
+    ::close(listener);
+}
+
+uint16_t MetricsHttpServer::getPort() const {
+    return port;
+}
+
+void MetricsHttpServer::serve() {
+    pollfd waiting = {listener, POLLIN, 0};
+    while (!stopping) {
+        // Wakes up regularly to notice `stopping`.
+        if (::poll(&waiting, 1, 100) <= 0) continue;
+        int connection = ::accept(listener, nullptr, nullptr);
+        if (connection < 0) continue;
+        timeval timeout = {1, 0};
+        setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        respond(connection);
+        ::close(connection);
+    }
+}
+
+void MetricsHttpServer::respond(int connection) {
+    // Only the request line matters; the rest of the header is read and ignored.
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+        ssize_t n = ::recv(connection, buffer, sizeof(buffer), 0);
+        if (n <= 0) break;
+        request.append(buffer, n);
+    }
+
+    std::istringstream line(request.substr(0, request.find("\r\n")));
+    std::string method, target;
+    line >> method >> target;
+    std::string path = target.substr(0, target.find('?'));
+
+    std::string status, body;
+    if (method == "GET" && path == "/metrics") {
+        status = "200 OK";
+        body = format(MetricsRegistry::instance());
+    } else {
+        status = "404 Not Found";
+        body = "Metrics are at /metrics\n";
+    }
+    writeAll(connection, "HTTP/1.1 " + status + "\r\n"
+                         "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                         "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                         "Connection: close\r\n\r\n" + body);
+}
+
+std::string MetricsHttpServer::format(const MetricsRegistry& registry, const std::string& prefix) {
+    std::ostringstream out;
+    out.precision(9);
+    registry.forEachCounter([&](const std::string& name, const MetricCounter& counter) {
+        const std::string metric = metricName(prefix, name) + "_total";
+        out << "# TYPE " << metric << " counter\n"
+            << metric << " " << counter.value() << "\n";
+    });
+    registry.forEachGauge([&](const std::string& name, double value) {
+        const std::string metric = metricName(prefix, name);
+        out << "# TYPE " << metric << " gauge\n"
+            << metric << " " << value << "\n";
+    });
+    registry.forEachHistogram([&](const std::string& name, const LatencyHistogram& histogram) {
+        const std::string metric = metricName(prefix, name) + "_seconds";
+        const LatencyHistogram::Snapshot s = histogram.snapshot();
+        out << "# TYPE " << metric << " histogram\n";
+        // Each `le` bound is a power of two, and so the lower end of a
+        // histogram bucket. That bucket is counted in full, so `le` is
+        // approximate to one sub-bucket: it also counts values up to 1/16
+        // of the bound above it.
+        uint64_t cumulative = 0;
+        size_t bucket = 0;
+        for (int shift = FIRST_BUCKET_SHIFT; shift <= LAST_BUCKET_SHIFT; ++shift) {
+            const uint64_t bound = uint64_t(1) << shift;
+            for (; bucket < s.buckets.size() &&
+                   (bucket == 0 ? 0 : LatencyHistogram::bucketUpperBound(bucket - 1) + 1) <= bound;
+                 ++bucket) {
+                cumulative += s.buckets[bucket];
+            }
+            out << metric << "_bucket{le=\"" << bound / 1e9 << "\"} " << cumulative << "\n";
+        }
+        out << metric << "_bucket{le=\"+Inf\"} " << s.count << "\n"
+            << metric << "_sum " << s.sum / 1e9 << "\n"
+            << metric << "_count " << s.count << "\n";
+    });
+    return out.str();
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "Metrics.h"
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+// Minimal HTTP listener for Prometheus scrapes: answers GET /metrics with
+// the metrics of MetricsRegistry::instance() in the text exposition
+// format, one connection at a time, on a thread of its own. Metrics are
+// only read here, so serving them adds nothing to the paths that update them.
+class MetricsHttpServer {
+public:
+    // Listens on `address`:`port` (0 for any free port).
+    // Throws std::runtime_error if it cannot.
+    MetricsHttpServer(const std::string& address, uint16_t port);
+    ~MetricsHttpServer();
+
+    MetricsHttpServer(const MetricsHttpServer&) = delete;
+    MetricsHttpServer& operator=(const MetricsHttpServer&) = delete;
+
+    uint16_t getPort() const;
+
+    // `registry` in the Prometheus text format. Names get `prefix`, with
+    // characters other than [a-zA-Z0-9_] replaced by '_'. Counters end in
+    // _total; histograms are in seconds, with a bucket per power of two
+    // nanoseconds from about 1 us to 69 s.
+    static std::string format(const MetricsRegistry& registry, const std::string& prefix = "mapreduce_");
+
+private:
+    void serve();
+    void respond(int connection);
+
+    int listener;
+    uint16_t port;
+    std::atomic<bool> stopping;
+    std::thread thread;
+};
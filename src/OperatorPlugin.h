@@ -0,0 +1,58 @@
+#pragma once
+
+// C ABI for operator plugins: shared objects that add map and reduce
+// operators without rebuilding the server. A plugin exports
+//
+//   extern "C" const mr_plugin* mr_plugin_entry(void);
+//
+// returning a description that stays valid while the process runs.
+// Kernels work on whole batches of values, never on single elements,
+// and must be thread-safe: several jobs may call them at once.
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Changes with any incompatible change to the types below.
+#define MR_PLUGIN_ABI_VERSION 1
+#define MR_PLUGIN_ENTRY "mr_plugin_entry"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Maps `count` values into `out`, which has room for `count` results.
+// Returns the number of results written; a filter writes fewer.
+typedef size_t (*mr_map_kernel)(const int* values, size_t count, int64_t* out);
+
+// Reduces `count` mapped values into `*result`. `overflow` is the job's
+// OverflowPolicy (0 wrap, 1 saturate, 2 checked). Returns nonzero only
+// for an overflow under the checked policy.
+typedef int (*mr_reduce_kernel)(const int64_t* values, size_t count, uint8_t overflow,
+                                int64_t* result);
+
+typedef struct {
+    const char* name;
+    mr_map_kernel kernel;
+} mr_map_operator;
+
+typedef struct {
+    const char* name;
+    mr_reduce_kernel kernel;
+    int64_t identity;  // Result for a key without values.
+} mr_reduce_operator;
+
+typedef struct {
+    uint32_t abi_version;  // MR_PLUGIN_ABI_VERSION
+    const char* name;
+    uint32_t version;      // Of the operators' behaviour; jobs pin it.
+    const mr_map_operator* map_operators;
+    size_t num_map_operators;
+    const mr_reduce_operator* reduce_operators;
+    size_t num_reduce_operators;
+} mr_plugin;
+
+typedef const mr_plugin* (*mr_plugin_entry_fn)(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,180 @@
+#include "PluginRegistry.h"
+#include <dlfcn.h>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+std::vector<std::string> split(const std::string& ops, char separator) {
+    std::vector<std::string> ret;
+    std::istringstream ss(ops);
+    std::string op;
+    while (std::getline(ss, op, separator)) {
+        ret.push_back(op.substr(0, op.find(':')));
+    }
+    return ret;
+}
+
+} // namespace
+
+PluginRegistry& PluginRegistry::instance() {
+    static PluginRegistry registry;
+    return registry;
+}
+
+PluginRegistry::Plugin PluginRegistry::load(const std::string& path) {
+    // Loading the same file twice returns the same handle.
+    void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr) {
+        throw std::runtime_error("Cannot load plugin " + path + ": " + dlerror());
+    }
+    Plugin plugin;
+    const mr_plugin* description = &describe(handle, path, plugin);
+
+    std::lock_guard<std::mutex> guard(lock);
+    auto loaded = plugins.find(plugin.name);
+    if (loaded != plugins.end() && loaded->second.version == plugin.version) {
+        return loaded->second;
+    }
+    checkOwners(plugin);
+
+    if (loaded != plugins.end()) {
+        // Another version: its operators may have changed.
+        for (const auto& name : loaded->second.mapOperators) {
+            mapOwners.erase(name);
+            mapKernels.erase(name);
+        }
+        for (const auto& name : loaded->second.reduceOperators) {
+            reduceOwners.erase(name);
+            reduceOperators.erase(name);
+        }
+    }
+    for (size_t i = 0; i < description->num_map_operators; ++i) {
+        const mr_map_operator& op = description->map_operators[i];
+        mapOwners[op.name] = plugin.name;
+        mapKernels[op.name] = op.kernel;
+    }
+    for (size_t i = 0; i < description->num_reduce_operators; ++i) {
+        const mr_reduce_operator& op = description->reduce_operators[i];
+        reduceOwners[op.name] = plugin.name;
+        reduceOperators[op.name] = op;
+    }
+    plugins[plugin.name] = plugin;
+    return plugin;
+}
+
+PluginRegistry::Plugin PluginRegistry::check(const std::string& path) const {
+    void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr) {
+        throw std::runtime_error("Cannot load plugin " + path + ": " + dlerror());
+    }
+    Plugin plugin;
+    try {
+        describe(handle, path, plugin);
+        std::lock_guard<std::mutex> guard(lock);
+        checkOwners(plugin);
+    } catch (const std::runtime_error&) {
+        dlclose(handle);
+        throw;
+    }
+    // A loaded plugin stays open: dlopen counted this handle.
+    dlclose(handle);
+    return plugin;
+}
+
+bool PluginRegistry::findMap(const std::string& name, mr_map_kernel& kernelOut) const {
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = mapKernels.find(name);
+    if (it == mapKernels.end()) return false;
+    kernelOut = it->second;
+    return true;
+}
+
+bool PluginRegistry::findReduce(const std::string& name, mr_reduce_operator& operatorOut) const {
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = reduceOperators.find(name);
+    if (it == reduceOperators.end()) return false;
+    operatorOut = it->second;
+    return true;
+}
+
+std::vector<std::string> PluginRegistry::requiredBy(const std::string& mapOp,
+                                                    const std::string& reduceOp) const {
+    std::lock_guard<std::mutex> guard(lock);
+    std::set<std::string> required;
+    for (const auto& op : split(mapOp, '|')) {
+        std::string provider = providerOf(mapOwners, op);
+        if (!provider.empty()) required.insert(provider);
+    }
+    for (const auto& op : split(reduceOp, ',')) {
+        std::string provider = providerOf(reduceOwners, op);
+        if (!provider.empty()) required.insert(provider);
+    }
+    return std::vector<std::string>(required.begin(), required.end());
+}
+
+bool PluginRegistry::isLoaded(const std::string& plugin) const {
+    std::lock_guard<std::mutex> guard(lock);
+    size_t at = plugin.rfind('@');
+    auto it = plugins.find(plugin.substr(0, at));
+    return at != std::string::npos && it != plugins.end()
+        && std::to_string(it->second.version) == plugin.substr(at + 1);
+}
+
+std::vector<PluginRegistry::Plugin> PluginRegistry::list() const {
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector<Plugin> ret;
+    for (const auto& entry : plugins) {
+        ret.push_back(entry.second);
+    }
+    return ret;
+}
+
+const mr_plugin& PluginRegistry::describe(void* handle, const std::string& path,
+                                         Plugin& pluginOut) {
+    auto entry = reinterpret_cast<mr_plugin_entry_fn>(dlsym(handle, MR_PLUGIN_ENTRY));
+    const mr_plugin* description = entry ? entry() : nullptr;
+    if (description == nullptr) {
+        throw std::runtime_error("Not an operator plugin: " + path);
+    }
+    if (description->abi_version != MR_PLUGIN_ABI_VERSION) {
+        throw std::runtime_error("Plugin " + path + " has ABI version " +
+                                 std::to_string(description->abi_version) + ", expected " +
+                                 std::to_string(MR_PLUGIN_ABI_VERSION));
+    }
+    pluginOut = Plugin{description->name, description->version, path, {}, {}};
+    for (size_t i = 0; i < description->num_map_operators; ++i) {
+        pluginOut.mapOperators.push_back(description->map_operators[i].name);
+    }
+    for (size_t i = 0; i < description->num_reduce_operators; ++i) {
+        pluginOut.reduceOperators.push_back(description->reduce_operators[i].name);
+    }
+    return *description;
+}
+
+// Called with `lock` held.
+void PluginRegistry::checkOwners(const Plugin& plugin) const {
+    for (const auto& name : plugin.mapOperators) {
+        auto owner = mapOwners.find(name);
+        if (owner != mapOwners.end() && owner->second != plugin.name) {
+            throw std::runtime_error("Map operation " + name + " is already defined by plugin " +
+                                     owner->second);
+        }
+    }
+    for (const auto& name : plugin.reduceOperators) {
+        auto owner = reduceOwners.find(name);
+        if (owner != reduceOwners.end() && owner->second != plugin.name) {
+            throw std::runtime_error("Reduce operation " + name + " is already defined by plugin " +
+                                     owner->second);
+        }
+    }
+}
+
+// Called with `lock` held.
+std::string PluginRegistry::providerOf(const std::map<std::string, std::string>& owners,
+                                       const std::string& op) const {
+    auto owner = owners.find(op);
+    if (owner == owners.end()) return "";
+    return owner->second + "@" + std::to_string(plugins.at(owner->second).version);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "OperatorPlugin.h"
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Operators loaded from plugins (see OperatorPlugin.h), shared by the
+// whole process. Built-in operators take precedence over plugin
+// operators of the same name. Plugins are never unloaded, since a
+// running job may still use their kernels.
+class PluginRegistry {
+public:
+    struct Plugin {
+        std::string name;
+        uint32_t version;
+        std::string path;
+        std::vector<std::string> mapOperators;
+        std::vector<std::string> reduceOperators;
+    };
+
+    static PluginRegistry& instance();
+
+    // Loads the plugin at `path`. Loading the same version of a loaded
+    // plugin again does nothing; another version replaces its operators.
+    // Throws std::runtime_error if the plugin cannot be loaded, has another
+    // ABI version, or defines an operator another plugin already defines.
+    Plugin load(const std::string& path);
+    // Whether `load` would succeed, without registering anything: opens
+    // the plugin to read its description, then closes it again. Throws
+    // std::runtime_error like `load`.
+    Plugin check(const std::string& path) const;
+
+    bool findMap(const std::string& name, mr_map_kernel& kernelOut) const;
+    bool findReduce(const std::string& name, mr_reduce_operator& operatorOut) const;
+
+    // `name@version` of each plugin providing one of the operators in
+    // `mapOp` (a pipeline) or `reduceOp` (an operation or a list of them).
+    std::vector<std::string> requiredBy(const std::string& mapOp, const std::string& reduceOp) const;
+    // Whether `plugin` (`name@version`) is loaded.
+    bool isLoaded(const std::string& plugin) const;
+
+    std::vector<Plugin> list() const;
+
+private:
+    PluginRegistry() = default;
+
+    mutable std::mutex lock;
+    std::map<std::string, Plugin> plugins;
+    // Operator name to its plugin name.
+    std::map<std::string, std::string> mapOwners;
+    std::map<std::string, std::string> reduceOwners;
+    std::map<std::string, mr_map_kernel> mapKernels;
+    std::map<std::string, mr_reduce_operator> reduceOperators;
+
+    // The description of the plugin opened at `handle`, checked for its ABI version.
+    static const mr_plugin& describe(void* handle, const std::string& path, Plugin& pluginOut);
+    // Called with `lock` held. Throws if another plugin defines one of the operators.
+    void checkOwners(const Plugin& plugin) const;
+    std::string providerOf(const std::map<std::string, std::string>& owners,
+                           const std::string& op) const;
+};
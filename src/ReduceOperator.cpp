@@ -0,0 +1,236 @@
+#include "ReduceOperator.h"
+#include "PluginRegistry.h"
+#include "Sketches.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+const int64_t INT64_MAX_VALUE = std::numeric_limits<int64_t>::max();
+const int64_t INT64_MIN_VALUE = std::numeric_limits<int64_t>::min();
+
+template <OverflowPolicy P>
+int64_t narrow(__int128 value, const char* op) {
+    if (value >= INT64_MIN_VALUE && value <= INT64_MAX_VALUE) {
+        return static_cast<int64_t>(value);
+    }
+    if (P == OverflowPolicy::Saturate) {
+        return value < 0 ? INT64_MIN_VALUE : INT64_MAX_VALUE;
+    }
+    if (P == OverflowPolicy::Checked) {
+        throw std::overflow_error(std::string("Integer overflow in ") + op);
+    }
+    return static_cast<int64_t>(static_cast<uint64_t>(value));
+}
+
+struct SumOp {
+    template <OverflowPolicy P>
+    static int64_t run(const int64_t* values, size_t count) {
+        if (P == OverflowPolicy::Wrap) {
+            // Unsigned arithmetic wraps without UB and vectorizes.
+            uint64_t sum = 0;
+            for (size_t i = 0; i < count; ++i) {
+                sum += static_cast<uint64_t>(values[i]);
+            }
+            return static_cast<int64_t>(sum);
+        }
+        // Fewer than 2^63 values of magnitude below 2^63 cannot overflow 128 bits,
+        // so only the final result needs to be checked.
+        __int128 sum = 0;
+        for (size_t i = 0; i < count; ++i) {
+            sum += values[i];
+        }
+        return narrow<P>(sum, "sum");
+    }
+};
+
+struct ProductOp {
+    template <OverflowPolicy P>
+    static int64_t run(const int64_t* values, size_t count) {
+        if (P == OverflowPolicy::Wrap) {
+            uint64_t product = 1;
+            for (size_t i = 0; i < count; ++i) {
+                product *= static_cast<uint64_t>(values[i]);
+            }
+            return static_cast<int64_t>(product);
+        }
+        int64_t product = 1;
+        bool negative = false;
+        bool overflowed = false;
+        for (size_t i = 0; i < count; ++i) {
+            if (values[i] == 0) {
+                // Zero wins even after an overflow.
+                return 0;
+            }
+            negative ^= values[i] < 0;
+            if (!overflowed && __builtin_mul_overflow(product, values[i], &product)) {
+                if (P == OverflowPolicy::Checked) {
+                    throw std::overflow_error("Integer overflow in product");
+                }
+                overflowed = true;
+            }
+        }
+        if (overflowed) {
+            return negative ? INT64_MIN_VALUE : INT64_MAX_VALUE;
+        }
+        return product;
+    }
+};
+
+struct MinOp {
+    template <OverflowPolicy>
+    static int64_t run(const int64_t* values, size_t count) {
+        int64_t result = INT64_MAX_VALUE;
+        for (size_t i = 0; i < count; ++i) {
+            result = std::min(result, values[i]);
+        }
+        return result;
+    }
+};
+
+struct MaxOp {
+    template <OverflowPolicy>
+    static int64_t run(const int64_t* values, size_t count) {
+        int64_t result = INT64_MIN_VALUE;
+        for (size_t i = 0; i < count; ++i) {
+            result = std::max(result, values[i]);
+        }
+        return result;
+    }
+};
+
+struct CountOp {
+    template <OverflowPolicy>
+    static int64_t run(const int64_t*, size_t count) {
+        return static_cast<int64_t>(count);
+    }
+};
+
+struct SumOfSquaresOp {
+    template <OverflowPolicy P>
+    static int64_t run(const int64_t* values, size_t count) {
+        if (P == OverflowPolicy::Wrap) {
+            uint64_t sum = 0;
+            for (size_t i = 0; i < count; ++i) {
+                sum += static_cast<uint64_t>(values[i]) * static_cast<uint64_t>(values[i]);
+            }
+            return static_cast<int64_t>(sum);
+        }
+        // Each square fits 126 bits, but their sum may not.
+        __int128 sum = 0;
+        for (size_t i = 0; i < count; ++i) {
+            __int128 square = static_cast<__int128>(values[i]) * values[i];
+            if (__builtin_add_overflow(sum, square, &sum)) {
+                return narrow<P>(INT64_MAX_VALUE + static_cast<__int128>(1), "sum_of_squares");
+            }
+        }
+        return narrow<P>(sum, "sum_of_squares");
+    }
+};
+
+struct DistinctOp {
+    template <OverflowPolicy>
+    static int64_t run(const int64_t* values, size_t count) {
+        HyperLogLog sketch;
+        for (size_t i = 0; i < count; ++i) {
+            sketch.add(values[i]);
+        }
+        return std::llround(sketch.estimate());
+    }
+};
+
+using KernelsByPolicy = std::array<ReduceOperator::Kernel, 3>;
+
+template <typename Op>
+constexpr KernelsByPolicy instantiate() {
+    return {&Op::template run<OverflowPolicy::Wrap>,
+            &Op::template run<OverflowPolicy::Saturate>,
+            &Op::template run<OverflowPolicy::Checked>};
+}
+
+struct BuiltIn {
+    const char* name;
+    int64_t identity;
+    KernelsByPolicy kernels;
+};
+
+// Indexed by ReduceOperator::Id.
+const BuiltIn BUILT_INS[] = {
+    {"sum", 0, instantiate<SumOp>()},
+    {"product", 1, instantiate<ProductOp>()},
+    {"min", INT64_MAX_VALUE, instantiate<MinOp>()},
+    {"max", INT64_MIN_VALUE, instantiate<MaxOp>()},
+    {"count", 0, instantiate<CountOp>()},
+    {"sum_of_squares", 0, instantiate<SumOfSquaresOp>()},
+    {"distinct", 0, instantiate<DistinctOp>()},
+};
+
+} // namespace
+
+OverflowPolicy parseOverflowPolicy(const std::string& name) {
+    if (name == "wrap") return OverflowPolicy::Wrap;
+    if (name == "saturate") return OverflowPolicy::Saturate;
+    if (name == "checked") return OverflowPolicy::Checked;
+    throw std::runtime_error("Overflow policy not found: " + name);
+}
+
+OverflowPolicy overflowPolicyOf(uint8_t value) {
+    if (value > static_cast<uint8_t>(OverflowPolicy::Checked)) {
+        throw std::runtime_error("Invalid overflow policy " + std::to_string(value));
+    }
+    return static_cast<OverflowPolicy>(value);
+}
+
+ReduceOperator ReduceOperator::resolve(const std::string& name) {
+    ReduceOperator op;
+    op.name = name;
+    for (uint8_t id = Sum; id < Plugin; ++id) {
+        if (name == BUILT_INS[id].name) {
+            op.id = static_cast<Id>(id);
+            op.identity = BUILT_INS[id].identity;
+            return op;
+        }
+    }
+    mr_reduce_operator plugin;
+    if (!PluginRegistry::instance().findReduce(name, plugin)) {
+        throw std::runtime_error("Reduce operation not found: " + name);
+    }
+    op.id = Plugin;
+    op.identity = plugin.identity;
+    op.plugin = plugin.kernel;
+    return op;
+}
+
+bool ReduceOperator::exists(const std::string& name) {
+    for (const BuiltIn& builtIn : BUILT_INS) {
+        if (name == builtIn.name) return true;
+    }
+    mr_reduce_operator plugin;
+    return PluginRegistry::instance().findReduce(name, plugin);
+}
+
+int64_t ReduceOperator::reduce(const int64_t* values, size_t count, OverflowPolicy overflow) const {
+    if (id == Plugin) {
+        int64_t result = 0;
+        if (plugin(values, count, static_cast<uint8_t>(overflow), &result) != 0) {
+            throw std::overflow_error("Integer overflow in " + name);
+        }
+        return result;
+    }
+    return BUILT_INS[id].kernels[static_cast<size_t>(overflow)](values, count);
+}
+
+ReduceOperator::Id ReduceOperator::getId() const {
+    return id;
+}
+
+const std::string& ReduceOperator::getName() const {
+    return name;
+}
+
+int64_t ReduceOperator::getIdentity() const {
+    return identity;
+}
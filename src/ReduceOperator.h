@@ -0,0 +1,58 @@
+#pragma once
+
+#include "OperatorPlugin.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// How a reduction handles results that do not fit into 64 bits.
+enum class OverflowPolicy : uint8_t {
+    Wrap = 0,      // Two's complement wrap-around.
+    Saturate = 1,  // Clamp to the int64_t range.
+    Checked = 2    // Throw std::overflow_error.
+};
+
+OverflowPolicy parseOverflowPolicy(const std::string& name);
+// The policy encoded as `value`, e.g. in a log entry; throws std::runtime_error
+// for a value that is not one.
+OverflowPolicy overflowPolicyOf(uint8_t value);
+
+// A reduce operator, resolved from its name once per job. Reducing a key
+// is then a single call on the span of its mapped values, with no name
+// lookup and no std::function. The built-in kernels are instantiated
+// from templates for each overflow policy, so the loops over the values
+// are specialized and vectorized at compile time.
+class ReduceOperator {
+public:
+    enum Id : uint8_t {
+        Sum,
+        Product,
+        Min,
+        Max,
+        Count,
+        SumOfSquares,
+        Distinct,   // Approximate, see HyperLogLog
+        Plugin      // Loaded from a plugin, see PluginRegistry
+    };
+
+    // Built-in operators take precedence over plugin operators.
+    // Throws std::runtime_error if there is no such operator.
+    static ReduceOperator resolve(const std::string& name);
+    static bool exists(const std::string& name);
+
+    // Throws std::overflow_error on an overflow under OverflowPolicy::Checked.
+    int64_t reduce(const int64_t* values, size_t count, OverflowPolicy overflow) const;
+
+    Id getId() const;
+    const std::string& getName() const;
+    // The result for no values at all.
+    int64_t getIdentity() const;
+
+    using Kernel = int64_t (*)(const int64_t* values, size_t count);
+
+private:
+    Id id = Sum;
+    std::string name;
+    int64_t identity = 0;
+    mr_reduce_kernel plugin = nullptr;
+};
@@ -0,0 +1,266 @@
+#pragma once
+
+#include "SpillRun.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Converts a partial result to and from the bytes of a spill run.
+// Specialize it for every Partial type that is spilled:
+//   static void encode(const Partial& partial, std::string& out);
+//   static void decode(const std::string& in, Partial& out);
+template <typename Partial>
+struct PartialCodec;
+
+// Memory for the partials of every shuffle buffer charged to it, e.g. of
+// all the group-by jobs on a node. A map task spills its buffer when the
+// buffers together go over the limit.
+class MemoryBudget {
+public:
+    explicit MemoryBudget(size_t limit) : limit(limit) {}
+
+    MemoryBudget(const MemoryBudget&) = delete;
+    MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+    size_t getLimit() const {
+        return limit;
+    }
+
+    size_t getUsed() const {
+        return used;
+    }
+
+    // The bytes one job has charged, released when it ends.
+    class Charge {
+    public:
+        explicit Charge(MemoryBudget& budget) : budget(budget) {}
+        ~Charge() {
+            budget.used -= bytes;
+        }
+
+        Charge(const Charge&) = delete;
+        Charge& operator=(const Charge&) = delete;
+
+        // Returns true when the budget is over its limit with `n` more bytes.
+        bool add(size_t n) {
+            bytes += n;
+            return budget.used.fetch_add(n) + n > budget.limit;
+        }
+
+        void release(size_t n) {
+            bytes -= n;
+            budget.used -= n;
+        }
+
+    private:
+        MemoryBudget& budget;
+        std::atomic<size_t> bytes{0};
+    };
+
+private:
+    const size_t limit;
+    std::atomic<size_t> used{0};
+};
+
+// Intermediate results of one map task: a partial result per group, split
+// by group hash into one buffer per reduce partition. Emitting a group
+// again combines into its existing partial (the combiner), so a buffer
+// holds one entry per group rather than one per key. Every map task uses
+// the same number of partitions, so reduce task `p` merges partition `p`
+// of every buffer and no two reduce tasks see the same group.
+//
+// When a buffer grows too large, `spill` writes each partition to a run
+// file sorted by group and empties it; see mergeRuns.
+template <typename Partial>
+class ShuffleBuffer {
+public:
+    using Partition = std::unordered_map<std::string, Partial>;
+    using Runs = std::vector<std::shared_ptr<SpillRun>>;
+
+    explicit ShuffleBuffer(size_t partitions = 1)
+        : partitions(partitions == 0 ? 1 : partitions), runs(this->partitions.size()) {}
+
+    // The partial of `group`, value-initialized when the group is new.
+    Partial& emit(const std::string& group, bool& isNew) {
+        auto result = partitions[partitionOf(group)].try_emplace(group);
+        isNew = result.second;
+        if (isNew) {
+            bytes += sizeof(typename Partition::value_type) + 2 * sizeof(void*) + group.size();
+        }
+        return result.first->second;
+    }
+
+    // Adds memory a partial holds outside of the buffer, e.g. a sketch.
+    void account(size_t extraBytes) {
+        bytes += extraBytes;
+    }
+
+    // Approximate memory held by the buffered partials.
+    size_t getBytes() const {
+        return bytes;
+    }
+
+    // Writes every non-empty partition to a new run in `directory` and
+    // empties the buffer. Throws std::runtime_error on a write error.
+    void spill(const std::string& directory) {
+        std::string payload;
+        for (size_t index = 0; index < partitions.size(); ++index) {
+            Partition& partition = partitions[index];
+            if (partition.empty()) continue;
+            std::vector<const typename Partition::value_type*> entries;
+            entries.reserve(partition.size());
+            for (const auto& entry : partition) {
+                entries.push_back(&entry);
+            }
+            std::sort(entries.begin(), entries.end(),
+                      [](const typename Partition::value_type* a, const typename Partition::value_type* b) {
+                          return a->first < b->first;
+                      });
+            auto run = std::make_shared<SpillRun>(directory);
+            for (const auto* entry : entries) {
+                payload.clear();
+                PartialCodec<Partial>::encode(entry->second, payload);
+                run->append(entry->first, payload);
+            }
+            run->finish();
+            runs[index].push_back(std::move(run));
+            Partition().swap(partition);
+        }
+        bytes = 0;
+    }
+
+    size_t partitionOf(const std::string& group) const {
+        return std::hash<std::string>()(group) % partitions.size();
+    }
+
+    size_t numPartitions() const {
+        return partitions.size();
+    }
+
+    Partition& partition(size_t index) {
+        return partitions[index];
+    }
+
+    // Runs spilled from partition `index`, oldest first.
+    const Runs& spilled(size_t index) const {
+        return runs[index];
+    }
+
+private:
+    std::vector<Partition> partitions;
+    std::vector<Runs> runs;
+    size_t bytes = 0;
+};
+
+// Runs merged at once, each with an open file while it is read.
+const size_t MAX_MERGE_RUNS = 64;
+
+// One pass of mergeRuns, over every run at once.
+template <typename Partial, typename Combine, typename Emit>
+void mergeSorted(const std::vector<std::shared_ptr<SpillRun>>& runs,
+                 std::vector<std::pair<std::string, Partial>>& entries,
+                 const Combine& combine,
+                 const Emit& emit) {
+    // Source `runs.size()` is `entries`; the others are the runs.
+    std::vector<std::unique_ptr<SpillRun::Reader>> readers;
+    std::vector<std::string> keys(runs.size() + 1);
+    std::vector<std::string> payloads(keys.size() - 1);
+    size_t nextEntry = 0;
+    auto advance = [&](size_t source) {
+        if (source == runs.size()) {
+            if (nextEntry == entries.size()) return false;
+            keys[source] = entries[nextEntry].first;
+            return true;
+        }
+        return readers[source]->next(keys[source], payloads[source]);
+    };
+
+    auto later = [&](size_t a, size_t b) {
+        return keys[a] != keys[b] ? keys[a] > keys[b] : a > b;
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heads(later);
+    for (const auto& run : runs) {
+        readers.emplace_back(new SpillRun::Reader(*run));
+    }
+    for (size_t source = 0; source <= runs.size(); ++source) {
+        if (advance(source)) heads.push(source);
+    }
+
+    std::string group;
+    Partial current;
+    bool hasGroup = false;
+    while (!heads.empty()) {
+        const size_t source = heads.top();
+        heads.pop();
+        Partial partial;
+        if (source == runs.size()) {
+            partial = std::move(entries[nextEntry++].second);
+        } else {
+            PartialCodec<Partial>::decode(payloads[source], partial);
+        }
+        if (hasGroup && keys[source] == group) {
+            combine(group, current, partial);
+        } else {
+            if (hasGroup) emit(group, current);
+            group = keys[source];
+            current = std::move(partial);
+            hasGroup = true;
+        }
+        if (advance(source)) heads.push(source);
+    }
+    if (hasGroup) emit(group, current);
+}
+
+// Streams the partials of sorted `runs` and of `entries` (sorted in place
+// here) in group order, combines those of the same group with
+// `combine(group, into, from)` and calls `emit(group, partial)` once per
+// group. Only one partial per run is in memory at a time. With more than
+// `maxRuns` runs, earlier passes first merge them `maxRuns` at a time
+// into new runs in `directory`.
+template <typename Partial, typename Combine, typename Emit>
+void mergeRuns(const std::vector<std::shared_ptr<SpillRun>>& runs,
+               std::vector<std::pair<std::string, Partial>>& entries,
+               const Combine& combine,
+               const Emit& emit,
+               const std::string& directory = "/tmp",
+               size_t maxRuns = MAX_MERGE_RUNS) {
+    std::sort(entries.begin(), entries.end(),
+              [](const std::pair<std::string, Partial>& a, const std::pair<std::string, Partial>& b) {
+                  return a.first < b.first;
+              });
+
+    maxRuns = std::max<size_t>(2, maxRuns);
+    std::vector<std::shared_ptr<SpillRun>> pending = runs;
+    std::vector<std::pair<std::string, Partial>> none;
+    std::string payload;
+    while (pending.size() > maxRuns) {
+        std::vector<std::shared_ptr<SpillRun>> merged;
+        for (size_t first = 0; first < pending.size(); first += maxRuns) {
+            const size_t last = std::min(first + maxRuns, pending.size());
+            if (last - first == 1) {
+                merged.push_back(pending[first]);
+                continue;
+            }
+            auto run = std::make_shared<SpillRun>(directory);
+            const std::vector<std::shared_ptr<SpillRun>> group(pending.begin() + first,
+                                                               pending.begin() + last);
+            mergeSorted<Partial>(group, none, combine,
+                                 [&](const std::string& group, const Partial& partial) {
+                                     payload.clear();
+                                     PartialCodec<Partial>::encode(partial, payload);
+                                     run->append(group, payload);
+                                 });
+            run->finish();
+            merged.push_back(std::move(run));
+        }
+        pending.swap(merged);
+    }
+    mergeSorted<Partial>(pending, entries, combine, emit);
+}
@@ -0,0 +1,187 @@
+#include "Sketches.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+// splitmix64 finalizer: spreads consecutive integers over all 64 bits.
+uint64_t hashValue(int64_t value) {
+    uint64_t x = static_cast<uint64_t>(value) + 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+} // namespace
+
+HyperLogLog::HyperLogLog(uint8_t precision)
+    : precision(std::min<uint8_t>(18, std::max<uint8_t>(4, precision))),
+      registers(size_t(1) << this->precision, 0) {}
+
+void HyperLogLog::add(int64_t value) {
+    const uint64_t hash = hashValue(value);
+    const size_t index = hash >> (64 - precision);
+    // The guard bit bounds the rank when the remaining bits are all zero.
+    const uint64_t rest = (hash << precision) | (uint64_t(1) << (precision - 1));
+    const uint8_t rank = static_cast<uint8_t>(__builtin_clzll(rest) + 1);
+    registers[index] = std::max(registers[index], rank);
+}
+
+void HyperLogLog::merge(const HyperLogLog& other) {
+    if (other.precision != precision) {
+        throw std::runtime_error("Cannot merge HyperLogLog sketches of different precision");
+    }
+    for (size_t i = 0; i < registers.size(); ++i) {
+        registers[i] = std::max(registers[i], other.registers[i]);
+    }
+}
+
+double HyperLogLog::estimate() const {
+    const double m = static_cast<double>(registers.size());
+    double sum = 0;
+    size_t zeros = 0;
+    for (uint8_t rank : registers) {
+        sum += std::ldexp(1.0, -rank);
+        zeros += rank == 0;
+    }
+    const double alpha = 0.7213 / (1 + 1.079 / m);
+    const double estimate = alpha * m * m / sum;
+    if (estimate <= 2.5 * m && zeros > 0) {
+        // Linear counting is more accurate for small cardinalities.
+        return m * std::log(m / static_cast<double>(zeros));
+    }
+    return estimate;
+}
+
+size_t HyperLogLog::memoryUsage() const {
+    return sizeof(*this) + registers.capacity();
+}
+
+std::string HyperLogLog::serialize() const {
+    std::string data(1, static_cast<char>(precision));
+    data.append(registers.begin(), registers.end());
+    return data;
+}
+
+HyperLogLog HyperLogLog::deserialize(const std::string& data) {
+    if (data.empty()) {
+        throw std::runtime_error("Empty HyperLogLog sketch");
+    }
+    HyperLogLog sketch(static_cast<uint8_t>(data[0]));
+    if (sketch.precision != static_cast<uint8_t>(data[0])
+        || data.size() != 1 + sketch.registers.size()) {
+        throw std::runtime_error("Invalid HyperLogLog sketch");
+    }
+    std::copy(data.begin() + 1, data.end(), sketch.registers.begin());
+    return sketch;
+}
+
+TDigest::TDigest(double compression)
+    : compression(std::max(10.0, compression)),
+      min(std::numeric_limits<double>::infinity()),
+      max(-std::numeric_limits<double>::infinity()) {}
+
+void TDigest::add(double value, double weight) {
+    unmerged.push_back({value, weight});
+    this->weight += weight;
+    min = std::min(min, value);
+    max = std::max(max, value);
+    if (unmerged.size() >= static_cast<size_t>(5 * compression)) {
+        compress();
+    }
+}
+
+void TDigest::merge(const TDigest& other) {
+    other.compress();
+    unmerged.insert(unmerged.end(), other.centroids.begin(), other.centroids.end());
+    weight += other.weight;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+    compress();
+}
+
+double TDigest::totalWeight() const {
+    return weight;
+}
+
+void TDigest::compress() const {
+    if (unmerged.empty()) {
+        return;
+    }
+    unmerged.insert(unmerged.end(), centroids.begin(), centroids.end());
+    std::sort(unmerged.begin(), unmerged.end(),
+              [](const Centroid& a, const Centroid& b) { return a.mean < b.mean; });
+
+    centroids.clear();
+    centroids.push_back(unmerged[0]);
+    double before = 0;  // Weight of all centroids before the last one.
+    for (size_t i = 1; i < unmerged.size(); ++i) {
+        Centroid& last = centroids.back();
+        const double proposed = last.weight + unmerged[i].weight;
+        const double q0 = before / weight;
+        const double q1 = (before + proposed) / weight;
+        // A centroid may hold at most 4 * weight * q * (1 - q) / compression,
+        // so centroids at the tails stay small.
+        const double limit = 4 * weight * std::min(q0 * (1 - q0), q1 * (1 - q1)) / compression;
+        if (proposed <= limit) {
+            last.mean += (unmerged[i].mean - last.mean) * unmerged[i].weight / proposed;
+            last.weight = proposed;
+        } else {
+            before += last.weight;
+            centroids.push_back(unmerged[i]);
+        }
+    }
+    unmerged.clear();
+}
+
+bool TDigest::parseQuantile(const std::string& name, double& q) {
+    if (name.size() < 2 || name[0] != 'p' || !std::isdigit(static_cast<unsigned char>(name[1]))) {
+        return false;
+    }
+    try {
+        size_t parsed = 0;
+        double percent = std::stod(name.substr(1), &parsed);
+        if (parsed != name.size() - 1 || percent > 100) {
+            return false;
+        }
+        q = percent / 100;
+        return true;
+    } catch (const std::logic_error& e) {
+        return false;
+    }
+}
+
+double TDigest::quantile(double q) const {
+    compress();
+    if (centroids.empty()) {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    if (centroids.size() == 1) {
+        return centroids[0].mean;
+    }
+    q = std::min(1.0, std::max(0.0, q));
+    const double target = q * weight;
+
+    // Interpolates between centroid centers, and towards min/max at the ends.
+    const Centroid& first = centroids.front();
+    if (target < first.weight / 2) {
+        return min + (first.mean - min) * target / (first.weight / 2);
+    }
+    const Centroid& last = centroids.back();
+    if (target > weight - last.weight / 2) {
+        return max - (max - last.mean) * (weight - target) / (last.weight / 2);
+    }
+    double center = first.weight / 2;
+    for (size_t i = 0; i + 1 < centroids.size(); ++i) {
+        const double nextCenter = center + (centroids[i].weight + centroids[i + 1].weight) / 2;
+        if (target <= nextCenter) {
+            const double t = (target - center) / (nextCenter - center);
+            return centroids[i].mean + t * (centroids[i + 1].mean - centroids[i].mean);
+        }
+        center = nextCenter;
+    }
+    return last.mean;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Fixed-size, mergeable summaries of a stream of values, used for
+// approximate reductions that would otherwise hash or sort every value.
+
+// Estimates the number of distinct values with 2^precision one-byte
+// registers. The relative error is about 1.04 / sqrt(2^precision),
+// 1.6% at the default precision.
+class HyperLogLog {
+public:
+    explicit HyperLogLog(uint8_t precision = 12);
+
+    void add(int64_t value);
+    // Throws std::runtime_error if the precisions differ.
+    void merge(const HyperLogLog& other);
+    double estimate() const;
+
+    // Approximate heap and object size in bytes.
+    size_t memoryUsage() const;
+    // The precision and registers, for spilling a partial result to disk.
+    std::string serialize() const;
+    // Throws std::runtime_error if `data` is not a serialized sketch.
+    static HyperLogLog deserialize(const std::string& data);
+
+private:
+    uint8_t precision;
+    std::vector<uint8_t> registers;
+};
+
+// Estimates quantiles with a merging t-digest (Dunning). Centroids are
+// small near both tails, so extreme quantiles like p99 stay accurate.
+// Keeps about `compression` centroids plus a bounded insert buffer.
+class TDigest {
+public:
+    explicit TDigest(double compression = 100);
+
+    void add(double value, double weight = 1);
+    void merge(const TDigest& other);
+    // `q` in [0, 1]. NaN if no value was added.
+    double quantile(double q) const;
+    double totalWeight() const;
+
+    // Parses a quantile name, `p<percent>` such as p50 or p99.9,
+    // into `q` in [0, 1]. Returns false for any other name.
+    static bool parseQuantile(const std::string& name, double& q);
+
+private:
+    struct Centroid {
+        double mean;
+        double weight;
+    };
+
+    double compression;
+    // Sorted by mean, after `compress`.
+    mutable std::vector<Centroid> centroids;
+    mutable std::vector<Centroid> unmerged;
+    double weight = 0;
+    double min;
+    double max;
+
+    void compress() const;
+};
@@ -0,0 +1,100 @@
+#include "SpillRun.h"
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+bool readString(std::FILE* file, std::string& out) {
+    uint32_t size = 0;
+    if (std::fread(&size, sizeof(size), 1, file) != 1) {
+        return false;
+    }
+    out.resize(size);
+    if (size > 0 && std::fread(&out[0], 1, size, file) != size) {
+        throw std::runtime_error("Spill run is truncated");
+    }
+    return true;
+}
+
+} // namespace
+
+SpillRun::SpillRun(const std::string& directory) {
+    std::vector<char> name(directory.begin(), directory.end());
+    const std::string suffix = "/mapreduce-spill-XXXXXX";
+    name.insert(name.end(), suffix.begin(), suffix.end());
+    name.push_back('\0');
+    int fd = mkstemp(name.data());
+    if (fd < 0) {
+        throw std::runtime_error("Cannot create a spill file in " + directory);
+    }
+    path = name.data();
+    file = fdopen(fd, "w+b");
+    if (file == nullptr) {
+        close(fd);
+        unlink(path.c_str());
+        throw std::runtime_error("Cannot open spill file " + path);
+    }
+}
+
+SpillRun::~SpillRun() {
+    if (file != nullptr) {
+        std::fclose(file);
+    }
+    unlink(path.c_str());
+}
+
+void SpillRun::append(const std::string& key, const std::string& payload) {
+    if (file == nullptr) {
+        throw std::runtime_error("Spill file " + path + " is finished");
+    }
+    const uint32_t keySize = static_cast<uint32_t>(key.size());
+    const uint32_t payloadSize = static_cast<uint32_t>(payload.size());
+    bool ok = std::fwrite(&keySize, sizeof(keySize), 1, file) == 1
+           && std::fwrite(key.data(), 1, keySize, file) == keySize
+           && std::fwrite(&payloadSize, sizeof(payloadSize), 1, file) == 1
+           && std::fwrite(payload.data(), 1, payloadSize, file) == payloadSize;
+    if (!ok) {
+        throw std::runtime_error("Cannot write spill file " + path);
+    }
+    bytes += 2 * sizeof(uint32_t) + keySize + payloadSize;
+    ++entries;
+}
+
+void SpillRun::finish() {
+    std::FILE* written = file;
+    file = nullptr;
+    if (std::fclose(written) != 0) {
+        throw std::runtime_error("Cannot write spill file " + path);
+    }
+}
+
+size_t SpillRun::getBytes() const {
+    return bytes;
+}
+
+size_t SpillRun::getEntries() const {
+    return entries;
+}
+
+SpillRun::Reader::Reader(const SpillRun& run) : file(std::fopen(run.path.c_str(), "rb")) {
+    if (file == nullptr) {
+        throw std::runtime_error("Cannot read spill file " + run.path);
+    }
+}
+
+SpillRun::Reader::~Reader() {
+    std::fclose(file);
+}
+
+bool SpillRun::Reader::next(std::string& keyOut, std::string& payloadOut) {
+    if (!readString(file, keyOut)) {
+        return false;
+    }
+    if (!readString(file, payloadOut)) {
+        throw std::runtime_error("Spill run is truncated");
+    }
+    return true;
+}
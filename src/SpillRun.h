@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+
+// A run of (key, payload) records spilled to a temporary file, written
+// once in key order and then read back sequentially. The file is removed
+// when the run is destroyed.
+class SpillRun {
+public:
+    // Creates an empty run file in `directory`. Throws std::runtime_error.
+    explicit SpillRun(const std::string& directory);
+    ~SpillRun();
+
+    SpillRun(const SpillRun&) = delete;
+    SpillRun& operator=(const SpillRun&) = delete;
+
+    // Throws std::runtime_error if the write fails, e.g. on a full disk.
+    void append(const std::string& key, const std::string& payload);
+    // Flushes and closes the file; no more appends after this. Readers
+    // open it again, so a finished run holds no file descriptor.
+    void finish();
+
+    size_t getBytes() const;
+    size_t getEntries() const;
+
+    // Reads the records back in the order they were appended. Any number
+    // of readers may read a finished run.
+    class Reader {
+    public:
+        explicit Reader(const SpillRun& run);
+        ~Reader();
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        // Returns false at the end of the run.
+        bool next(std::string& keyOut, std::string& payloadOut);
+
+    private:
+        std::FILE* file;
+    };
+
+private:
+    std::string path;
+    std::FILE* file;
+    size_t bytes = 0;
+    size_t entries = 0;
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+
+// Runs `task(0)` to `task(tasks - 1)`, on their own threads if `parallel`,
+// and rethrows the first exception any of them threw.
+template <typename Task>
+void runTasks(size_t tasks, bool parallel, const Task& task) {
+    std::vector<std::exception_ptr> errors(tasks);
+    auto run = [&](size_t index) {
+        try {
+            task(index);
+        } catch (...) {
+            errors[index] = std::current_exception();
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t index = 1; index < tasks; ++index) {
+        if (parallel) {
+            threads.emplace_back(run, index);
+        } else {
+            run(index);
+        }
+    }
+    if (tasks > 0) run(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (const auto& error : errors) {
+        if (error) std::rethrow_exception(error);
+    }
+}
@@ -0,0 +1,125 @@
+#include "Tracer.h"
+#include <chrono>
+
+namespace {
+
+// Ids are the node in the top 16 bits and a per-node sequence number.
+const int NODE_SHIFT = 48;
+const uint64_t SEQUENCE_MASK = (uint64_t(1) << NODE_SHIFT) - 1;
+
+} // namespace
+
+Tracer& Tracer::instance() {
+    static Tracer tracer;
+    return tracer;
+}
+
+void Tracer::setSampling(uint32_t every) {
+    sampling.store(every, std::memory_order_relaxed);
+}
+
+uint32_t Tracer::getSampling() const {
+    return sampling.load(std::memory_order_relaxed);
+}
+
+void Tracer::setNode(int32_t id) {
+    node.store(id, std::memory_order_relaxed);
+}
+
+uint64_t Tracer::sample() {
+    const uint32_t every = sampling.load(std::memory_order_relaxed);
+    if (every == 0 || requests.fetch_add(1, std::memory_order_relaxed) % every != 0) {
+        return 0;
+    }
+    const uint64_t seq = (sequence.fetch_add(1, std::memory_order_relaxed) + 1) & SEQUENCE_MASK;
+    return (static_cast<uint64_t>(static_cast<uint16_t>(node.load(std::memory_order_relaxed))) << NODE_SHIFT)
+           | (seq ? seq : 1);
+}
+
+void Tracer::setIdReader(std::function<uint64_t(const unsigned char*, size_t)> reader) {
+    idReader = std::move(reader);
+}
+
+uint64_t Tracer::idOf(const unsigned char* data, size_t len) const {
+    return idReader ? idReader(data, len) : 0;
+}
+
+uint64_t Tracer::now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void Tracer::span(uint64_t id, const char* name, uint64_t begin, uint64_t end) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (spans.size() >= MAX_SPANS) {
+        ++dropped;
+        return;
+    }
+    spans.push_back({id, name, begin, end < begin ? begin : end});
+}
+
+void Tracer::mark(uint64_t id, uint64_t time) {
+    std::lock_guard<std::mutex> guard(lock);
+    marks[id] = {time, ++marked};
+    markOrder.emplace_back(id, marked);
+    auto live = [this](const std::pair<uint64_t, uint64_t>& entry) {
+        auto found = marks.find(entry.first);
+        return found != marks.end() && found->second.order == entry.second;
+    };
+    while (marks.size() > MAX_MARKS) {
+        if (live(markOrder.front())) {
+            marks.erase(markOrder.front().first);
+            ++dropped;
+        }
+        markOrder.pop_front();
+    }
+    if (markOrder.size() > 2 * MAX_MARKS) {
+        // Forget the marks taken or made again since.
+        std::deque<std::pair<uint64_t, uint64_t>> order;
+        for (const auto& entry : markOrder) {
+            if (live(entry)) order.push_back(entry);
+        }
+        markOrder.swap(order);
+    }
+}
+
+bool Tracer::take(uint64_t id, uint64_t& time) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto entry = marks.find(id);
+    if (entry == marks.end()) return false;
+    time = entry->second.time;
+    marks.erase(entry);
+    return true;
+}
+
+size_t Tracer::exportChrome(std::ostream& out) {
+    std::vector<Span> recorded;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        recorded.swap(spans);
+    }
+    const int32_t pid = node.load(std::memory_order_relaxed);
+    // One row (thread) per request in each node's process, named by trace id.
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (size_t ii = 0; ii < recorded.size(); ++ii) {
+        const Span& s = recorded[ii];
+        out << (ii ? ",\n" : "\n")
+            << "{\"name\":\"" << s.name << "\",\"cat\":\"raft\",\"ph\":\"X\""
+            << ",\"ts\":" << s.begin << ",\"dur\":" << s.end - s.begin
+            << ",\"pid\":" << pid << ",\"tid\":" << (s.id & SEQUENCE_MASK)
+            << ",\"args\":{\"trace_id\":\"" << (s.id >> NODE_SHIFT) << "-" << (s.id & SEQUENCE_MASK)
+            << "\"}}";
+    }
+    out << "\n]}\n";
+    return recorded.size();
+}
+
+size_t Tracer::getRecorded() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return spans.size();
+}
+
+uint64_t Tracer::getDropped() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return dropped;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Sampled tracing of requests through the Raft pipeline. The node that
+// receives a request gives one in every `sampling` of them a trace id,
+// which travels in its log entry; every node with tracing on then records
+// timed spans for that entry (append, replicate, apply, ...). The spans are
+// exported as Chrome trace-event JSON, for chrome://tracing or Perfetto.
+//
+// An unsampled request costs one atomic increment where it is received and
+// a flag check elsewhere. Spans are kept in a bounded buffer; those that
+// do not fit are dropped and counted.
+class Tracer {
+public:
+    static Tracer& instance();
+
+    // Trace one request in every `every`; 0 turns tracing off on this node.
+    void setSampling(uint32_t every);
+    uint32_t getSampling() const;
+    bool enabled() const {
+        return sampling.load(std::memory_order_relaxed) != 0;
+    }
+
+    // This node, the process id of its spans and part of its trace ids.
+    void setNode(int32_t node);
+
+    // The trace id for a new request, 0 if it is not sampled.
+    uint64_t sample();
+
+    // Finds the trace id in the bytes of a log entry, for code that does not
+    // decode entries, such as the log store. Set once at start-up.
+    void setIdReader(std::function<uint64_t(const unsigned char* data, size_t len)> reader);
+    uint64_t idOf(const unsigned char* data, size_t len) const;
+
+    // Wall-clock microseconds, so the spans of different nodes line up.
+    static uint64_t now();
+
+    // Records `name` (a string literal) for request `id`, from `begin` to `end`.
+    void span(uint64_t id, const char* name, uint64_t begin, uint64_t end);
+
+    // Remembers a time of request `id` for a span that ends in another call.
+    // Beyond MAX_MARKS, e.g. for overwritten entries that never reach their
+    // end, the oldest mark is forgotten and its span counted as dropped.
+    void mark(uint64_t id, uint64_t time);
+    // The time marked for `id`, forgotten here. False if there is none.
+    bool take(uint64_t id, uint64_t& time);
+
+    // Writes the recorded spans as Chrome trace-event JSON and forgets them.
+    // Returns the number of spans written.
+    size_t exportChrome(std::ostream& out);
+
+    size_t getRecorded() const;
+    uint64_t getDropped() const;
+
+    // Spans kept until exported.
+    static const size_t MAX_SPANS = 1 << 20;
+    static const size_t MAX_MARKS = 1 << 16;
+
+private:
+    Tracer() = default;
+
+    struct Span {
+        uint64_t id;
+        const char* name;
+        uint64_t begin;
+        uint64_t end;
+    };
+
+    std::atomic<uint32_t> sampling{0};
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> sequence{0};
+    std::atomic<int32_t> node{0};
+    std::function<uint64_t(const unsigned char*, size_t)> idReader;
+
+    mutable std::mutex lock;
+    std::vector<Span> spans;
+    struct Mark {
+        uint64_t time;
+        uint64_t order;
+    };
+    std::unordered_map<uint64_t, Mark> marks;
+    // (id, order) of the marks in the order they were made, including some
+    // already taken; only the entry whose order matches the mark is live.
+    std::deque<std::pair<uint64_t, uint64_t>> markOrder;
+    uint64_t marked = 0;
+    uint64_t dropped = 0;
+};
+
+// Records a span from construction to destruction if `id` is nonzero.
+class TraceSpan {
+public:
+    TraceSpan(uint64_t id, const char* name)
+        : id(id), name(name), begin(id ? Tracer::now() : 0) {}
+    ~TraceSpan() {
+        if (id) Tracer::instance().span(id, name, begin, Tracer::now());
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    uint64_t id;
+    const char* name;
+    uint64_t begin;
+};
@@ -0,0 +1,131 @@
+#include <benchmark/benchmark.h>
+#include "KeyValueStore.h"
+
+#include <string>
+#include <vector>
+
+namespace {
+
+std::vector<std::string> makeKeys(size_t count) {
+    std::vector<std::string> keys;
+    keys.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        keys.push_back("key" + std::to_string(i));
+    }
+    return keys;
+}
+
+// `keys` keys with `values` values each, written at version 1.
+KeyValueStore makeStore(const std::vector<std::string>& keys, size_t values) {
+    KeyValueStore store;
+    store.setVersion(1);
+    std::vector<int> row(values);
+    for (size_t i = 0; i < values; ++i) {
+        row[i] = static_cast<int>(i);
+    }
+    for (const auto& key : keys) {
+        store.insertMany(key, row);
+    }
+    return store;
+}
+
+// Arg: number of keys. One iteration inserts one value into each key, as a
+// new log index, so copy-on-write versions are created as on commit.
+void BM_KVInsert(benchmark::State& state) {
+    std::vector<std::string> keys = makeKeys(state.range(0));
+    KeyValueStore store;
+    uint64_t version = 0;
+    for (auto _ : state) {
+        store.setVersion(++version);
+        store.setGcHorizon(version);
+        for (const auto& key : keys) {
+            store.insert(key, static_cast<int>(version));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+// Arg: values per call, into 1024 keys.
+void BM_KVInsertMany(benchmark::State& state) {
+    std::vector<std::string> keys = makeKeys(1024);
+    std::vector<int> values(state.range(0), 7);
+    for (auto _ : state) {
+        state.PauseTiming();
+        KeyValueStore store;
+        state.ResumeTiming();
+        for (const auto& key : keys) {
+            store.insertMany(key, values);
+        }
+        benchmark::DoNotOptimize(store);
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size() * values.size());
+}
+
+// Arg: values per key. Removes the last value of 1024 keys (the longest
+// search), then puts it back with the timer paused.
+void BM_KVRemoveValue(benchmark::State& state) {
+    const int values = static_cast<int>(state.range(0));
+    std::vector<std::string> keys = makeKeys(1024);
+    KeyValueStore store = makeStore(keys, values);
+    for (auto _ : state) {
+        for (const auto& key : keys) {
+            benchmark::DoNotOptimize(store.removeValue(key, values - 1));
+        }
+        state.PauseTiming();
+        for (const auto& key : keys) {
+            store.insert(key, values - 1);
+        }
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+// Arg: values per key, of which half are removed from each of 1024 keys.
+void BM_KVRemoveMany(benchmark::State& state) {
+    const size_t values = state.range(0);
+    std::vector<std::string> keys = makeKeys(1024);
+    std::vector<int> removed;
+    for (size_t i = 0; i < values; i += 2) {
+        removed.push_back(static_cast<int>(i));
+    }
+    for (auto _ : state) {
+        state.PauseTiming();
+        KeyValueStore store = makeStore(keys, values);
+        state.ResumeTiming();
+        for (const auto& key : keys) {
+            store.removeMany(key, removed);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size() * removed.size());
+}
+
+// Arg: values per key. Reads every one of 1024 keys.
+void BM_KVGetValues(benchmark::State& state) {
+    std::vector<std::string> keys = makeKeys(1024);
+    KeyValueStore store = makeStore(keys, state.range(0));
+    for (auto _ : state) {
+        for (const auto& key : keys) {
+            benchmark::DoNotOptimize(store.getValues(key));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+// Arg: number of keys, with 16 values each.
+void BM_KVGetCopy(benchmark::State& state) {
+    std::vector<std::string> keys = makeKeys(state.range(0));
+    KeyValueStore store = makeStore(keys, 16);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(store.getCopy());
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+} // namespace
+
+BENCHMARK(BM_KVInsert)->Arg(1 << 10)->Arg(1 << 16);
+BENCHMARK(BM_KVInsertMany)->Arg(1)->Arg(64)->Arg(1024);
+BENCHMARK(BM_KVRemoveValue)->Arg(16)->Arg(1024);
+BENCHMARK(BM_KVRemoveMany)->Arg(16)->Arg(256);
+BENCHMARK(BM_KVGetValues)->Arg(16)->Arg(1024);
+BENCHMARK(BM_KVGetCopy)->Arg(1 << 10)->Arg(1 << 16);
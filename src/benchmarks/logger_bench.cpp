@@ -0,0 +1,96 @@
+#include <benchmark/benchmark.h>
+#include "logger.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <unistd.h>
+
+namespace {
+
+// One logger per mode, shared by all threads of a benchmark.
+SimpleLogger* startLogger(SimpleLogger::LogMode mode) {
+    static std::mutex lock;
+    static SimpleLogger* loggers[3] = {};
+    std::lock_guard<std::mutex> guard(lock);
+    SimpleLogger*& logger = loggers[mode];
+    if (!logger) {
+        std::string path = "/tmp/mapreduce_logger_bench." + std::to_string(getpid()) +
+                           "." + std::to_string(mode) + ".log";
+        std::remove(path.c_str());
+        logger = new SimpleLogger(path, 1024, 0, 1);
+        logger->setLogMode(mode);
+        logger->setDispLevel(-1);
+        logger->start();
+        logger->setLogLevel(6);
+    }
+    return logger;
+}
+
+// ns per log call at trace level, from 1 to 64 threads logging at once.
+// The argument is the SimpleLogger::LogMode. The ring is drained with the
+// timer paused, so calls are not measured as cheap drops and the flush
+// (including deferred formatting) is left out.
+void BM_LoggerPut(benchmark::State& state) {
+    SimpleLogger* logger = startLogger(static_cast<SimpleLogger::LogMode>(state.range(0)));
+    const uint64_t dropped = logger->getDroppedLogs();
+    int64_t index = 0;
+    for (auto _ : state) {
+        _log_trace(logger, "append_entries: term %lu, log index %ld, %d entries",
+                   7ul, index, 32);
+        if (++index % 1024 == 0) {
+            state.PauseTiming();
+            logger->flushAll();
+            state.ResumeTiming();
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) {
+        state.counters["dropped"] = static_cast<double>(logger->getDroppedLogs() - dropped);
+    }
+}
+BENCHMARK(BM_LoggerPut)
+    ->ArgName("mode")
+    ->Arg(SimpleLogger::TEXT_MODE)
+    ->Arg(SimpleLogger::DEFERRED_MODE)
+    ->Arg(SimpleLogger::BINARY_MODE)
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
+
+// Formats into a std::string, as NuRaft does before calling put_details.
+std::string formatMessage(const char* format, ...) {
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    return message;
+}
+
+// Like BM_LoggerPut, for the messages of NuRaft: formatted on the calling
+// thread, then logged the way logger_wrapper::put_details logs them.
+void BM_LoggerPutDetails(benchmark::State& state) {
+    SimpleLogger* logger = startLogger(static_cast<SimpleLogger::LogMode>(state.range(0)));
+    int64_t index = 0;
+    for (auto _ : state) {
+        const std::string msg = formatMessage("append_entries: term %lu, log index %ld, %d entries",
+                                              7ul, index, 32);
+        logger->put(6, __FILE__, __func__, __LINE__, "%s", msg.c_str());
+        if (++index % 1024 == 0) {
+            state.PauseTiming();
+            logger->flushAll();
+            state.ResumeTiming();
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LoggerPutDetails)
+    ->ArgName("mode")
+    ->Arg(SimpleLogger::TEXT_MODE)
+    ->Arg(SimpleLogger::DEFERRED_MODE)
+    ->Arg(SimpleLogger::BINARY_MODE)
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
+
+} // namespace
@@ -0,0 +1,56 @@
+#include <benchmark/benchmark.h>
+#include "MapPipeline.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+const char* const PIPELINES[] = {
+    "square",
+    "square|triple",
+    "square|add:1|gt:100",
+};
+
+std::vector<int> makeValues(size_t count) {
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> dist(-1000, 1000);
+    std::vector<int> values(count);
+    for (int& value : values) {
+        value = dist(rng);
+    }
+    return values;
+}
+
+// Args: pipeline index, number of values.
+void BM_MapPipelineFused(benchmark::State& state) {
+    MapPipeline pipeline = MapPipeline::parse(PIPELINES[state.range(0)]);
+    std::vector<int> values = makeValues(state.range(1));
+    std::vector<int64_t> out;
+    for (auto _ : state) {
+        out.clear();
+        pipeline.apply(values.data(), values.size(), out);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetLabel(PIPELINES[state.range(0)]);
+    state.SetItemsProcessed(state.iterations() * values.size());
+}
+
+void BM_MapPipelineInterpreted(benchmark::State& state) {
+    MapPipeline pipeline = MapPipeline::parse(PIPELINES[state.range(0)]);
+    std::vector<int> values = makeValues(state.range(1));
+    std::vector<int64_t> out;
+    for (auto _ : state) {
+        out.clear();
+        pipeline.interpret(values.data(), values.size(), out);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetLabel(PIPELINES[state.range(0)]);
+    state.SetItemsProcessed(state.iterations() * values.size());
+}
+
+} // namespace
+
+BENCHMARK(BM_MapPipelineFused)->ArgsProduct({{0, 1, 2}, {1 << 10, 1 << 16}});
+BENCHMARK(BM_MapPipelineInterpreted)->ArgsProduct({{0, 1, 2}, {1 << 10, 1 << 16}});
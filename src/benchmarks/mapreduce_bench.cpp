@@ -0,0 +1,44 @@
+#include <benchmark/benchmark.h>
+#include "KeyValueStore.h"
+#include "MapReduce.h"
+
+#include <random>
+#include <string>
+
+namespace {
+
+const char* const MAP_OPS[] = {"square", "double|add:1", "square|gt:100"};
+const char* const REDUCE_OPS[] = {"sum", "max", "sum_of_squares", "distinct"};
+
+// 256 keys with `values` random values each.
+KeyValueStore makeStore(size_t values) {
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> dist(-1000, 1000);
+    KeyValueStore store;
+    for (int key = 0; key < 256; ++key) {
+        std::vector<int> row(values);
+        for (int& value : row) {
+            value = dist(rng);
+        }
+        store.insertMany("key" + std::to_string(key), row);
+    }
+    return store;
+}
+
+// Args: map operation index, reduce operation index, values per key.
+// One iteration is one job over every key, as a MAP_REDUCE entry runs.
+void BM_PerformMapReduce(benchmark::State& state) {
+    const char* map = MAP_OPS[state.range(0)];
+    const char* reduce = REDUCE_OPS[state.range(1)];
+    KeyValueStore store = makeStore(state.range(2));
+    for (auto _ : state) {
+        MapReduce mr(store);
+        benchmark::DoNotOptimize(mr.performMapReduce(map, reduce, KeySelector::allKeys()));
+    }
+    state.SetLabel(std::string(map) + " " + reduce);
+    state.SetItemsProcessed(state.iterations() * 256 * state.range(2));
+}
+
+} // namespace
+
+BENCHMARK(BM_PerformMapReduce)->ArgsProduct({{0, 1, 2}, {0, 1, 2, 3}, {16, 1024}})->UseRealTime();
@@ -0,0 +1,125 @@
+#include <benchmark/benchmark.h>
+#include "nuraft.hxx"
+#include "in_memory_log_store.hxx"
+#include "mr_state_machine.cpp"
+
+#include <string>
+#include <vector>
+
+using namespace nuraft;
+using mapreduce_server::mr_state_machine;
+
+namespace {
+
+// Args: entry kind (0: `+ key value`, 1: MAP_REDUCE over a key list),
+// number of listed keys.
+mr_state_machine::op_payload makePayload(int kind, size_t keys) {
+    mr_state_machine::op_payload payload = {mr_state_machine::INSERT_VALUE, "books", 42};
+    if (kind == 1) {
+        payload.type_ = mr_state_machine::MAP_REDUCE;
+        payload.key_.clear();
+        payload.map_op_ = "square|add:1";
+        payload.reduce_op_ = "sum";
+        std::vector<std::string> list;
+        for (size_t i = 0; i < keys; ++i) {
+            list.push_back("key" + std::to_string(i));
+        }
+        payload.selector_ = KeySelector::keyList(list);
+    }
+    return payload;
+}
+
+void BM_EncLog(benchmark::State& state) {
+    mr_state_machine::op_payload payload = makePayload(state.range(0), state.range(1));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(mr_state_machine::enc_log(payload));
+    }
+    state.SetBytesProcessed(state.iterations() * mr_state_machine::enc_log(payload)->size());
+}
+
+void BM_DecLog(benchmark::State& state) {
+    ptr<buffer> log = mr_state_machine::enc_log(makePayload(state.range(0), state.range(1)));
+    for (auto _ : state) {
+        mr_state_machine::op_payload payload;
+        log->pos(0);
+        mr_state_machine::dec_log(*log, payload);
+        benchmark::DoNotOptimize(payload);
+    }
+    state.SetBytesProcessed(state.iterations() * log->size());
+}
+
+// Arg: number of keys, with 16 values each.
+KeyValueStore makeStore(size_t keys) {
+    KeyValueStore store;
+    std::vector<int> values(16, 12345);
+    for (size_t i = 0; i < keys; ++i) {
+        store.insertMany("key" + std::to_string(i), values);
+    }
+    return store;
+}
+
+void BM_SnapshotSerialize(benchmark::State& state) {
+    KeyValueStore store = makeStore(state.range(0));
+    size_t bytes = 0;
+    for (auto _ : state) {
+        std::string data = mr_state_machine::serialize_kv_store(store);
+        bytes = data.size();
+        benchmark::DoNotOptimize(data);
+    }
+    state.SetBytesProcessed(state.iterations() * bytes);
+}
+
+void BM_SnapshotDeserialize(benchmark::State& state) {
+    std::string data = mr_state_machine::serialize_kv_store(makeStore(state.range(0)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(mr_state_machine::deserialize_kv_store(data));
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+ptr<log_entry> makeEntry() {
+    return cs_new<log_entry>(1, mr_state_machine::enc_log(makePayload(0, 0)));
+}
+
+// Appends to a log store that is compacted every 64K entries, as after
+// a snapshot, so its size stays bounded.
+void BM_LogStoreAppend(benchmark::State& state) {
+    inmem_log_store store;
+    ptr<log_entry> entry = makeEntry();
+    for (auto _ : state) {
+        ulong index = store.append(entry);
+        if (index % 65536 == 0) {
+            state.PauseTiming();
+            store.compact(index);
+            state.ResumeTiming();
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Arg: entries per read, from a store of 64K entries; as when a leader
+// sends entries to a lagging follower.
+void BM_LogStoreRead(benchmark::State& state) {
+    inmem_log_store store;
+    ptr<log_entry> entry = makeEntry();
+    const ulong total = 65536;
+    for (ulong i = 0; i < total; ++i) {
+        store.append(entry);
+    }
+    const ulong count = state.range(0);
+    ulong start = 1;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(store.log_entries(start, start + count));
+        start = start + 2 * count > total ? 1 : start + count;
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+
+} // namespace
+
+BENCHMARK(BM_EncLog)->Args({0, 0})->Args({1, 16})->Args({1, 1024});
+BENCHMARK(BM_DecLog)->Args({0, 0})->Args({1, 16})->Args({1, 1024});
+BENCHMARK(BM_SnapshotSerialize)->Arg(1 << 10)->Arg(1 << 16);
+BENCHMARK(BM_SnapshotDeserialize)->Arg(1 << 10)->Arg(1 << 16);
+BENCHMARK(BM_LogStoreAppend);
+BENCHMARK(BM_LogStoreRead)->Arg(1)->Arg(64)->Arg(1024);
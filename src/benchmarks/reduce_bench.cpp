@@ -0,0 +1,83 @@
+#include <benchmark/benchmark.h>
+#include "MapPipeline.h"
+#include "ReduceOperator.h"
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+const char* const REDUCE_OPS[] = {"sum", "max", "sum_of_squares"};
+
+std::vector<int> makeValues(size_t count) {
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> dist(-1000, 1000);
+    std::vector<int> values(count);
+    for (int& value : values) {
+        value = dist(rng);
+    }
+    return values;
+}
+
+// The operator tables as they were before operators were resolved once
+// per job: found by name for every job, called once per element.
+struct PerElementOperators {
+    std::map<std::string, std::function<int64_t(int64_t)>> mapFunctions;
+    std::map<std::string, std::pair<std::function<int64_t(int64_t, int64_t)>, int64_t>> reduceFunctions;
+
+    PerElementOperators() {
+        mapFunctions["square"] = [](int64_t x) { return x * x; };
+        reduceFunctions["sum"] = {[](int64_t x, int64_t y) { return x + y; }, 0};
+        reduceFunctions["max"] = {[](int64_t x, int64_t y) { return std::max(x, y); },
+                                  std::numeric_limits<int64_t>::min()};
+        reduceFunctions["sum_of_squares"] = {[](int64_t x, int64_t y) { return x + y * y; }, 0};
+    }
+};
+
+// Args: reduce operation index, number of values. One iteration is one
+// job over one key: square, then reduce.
+void BM_ReducePerElement(benchmark::State& state) {
+    PerElementOperators operators;
+    std::vector<int> values = makeValues(state.range(1));
+    std::vector<int64_t> mapped;
+    for (auto _ : state) {
+        auto& map = operators.mapFunctions.find("square")->second;
+        auto& reduce = operators.reduceFunctions.find(REDUCE_OPS[state.range(0)])->second;
+        mapped.clear();
+        for (int value : values) {
+            mapped.push_back(map(value));
+        }
+        int64_t result = reduce.second;
+        for (int64_t value : mapped) {
+            result = reduce.first(result, value);
+        }
+        benchmark::DoNotOptimize(result);
+    }
+    state.SetLabel(REDUCE_OPS[state.range(0)]);
+    state.SetItemsProcessed(state.iterations() * values.size());
+}
+
+void BM_ReduceBatch(benchmark::State& state) {
+    std::vector<int> values = makeValues(state.range(1));
+    std::vector<int64_t> mapped;
+    for (auto _ : state) {
+        MapPipeline pipeline = MapPipeline::parse("square");
+        ReduceOperator reduce = ReduceOperator::resolve(REDUCE_OPS[state.range(0)]);
+        mapped.clear();
+        pipeline.apply(values.data(), values.size(), mapped);
+        int64_t result = reduce.reduce(mapped.data(), mapped.size(), OverflowPolicy::Wrap);
+        benchmark::DoNotOptimize(result);
+    }
+    state.SetLabel(REDUCE_OPS[state.range(0)]);
+    state.SetItemsProcessed(state.iterations() * values.size());
+}
+
+} // namespace
+
+BENCHMARK(BM_ReducePerElement)->ArgsProduct({{0, 1, 2}, {1 << 10, 1 << 16}});
+BENCHMARK(BM_ReduceBatch)->ArgsProduct({{0, 1, 2}, {1 << 10, 1 << 16}});
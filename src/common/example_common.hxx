@@ -152,7 +152,7 @@ void init_raft(ptr<state_machine> sm_instance) {
     std::string log_file_name = "./srv" +
                                 std::to_string( stuff.server_id_ ) +
                                 ".log";
-    ptr<logger_wrapper> log_wrap = cs_new<logger_wrapper>( log_file_name, 4 );
+    ptr<logger_wrapper> log_wrap = cs_new<logger_wrapper>( log_file_name, 4, LOG_MODE );
     stuff.raft_logger_ = log_wrap;
 
     // State machine.
@@ -187,6 +187,8 @@ void init_raft(ptr<state_machine> sm_instance) {
     // According to this method, `append_log` function
     // should be handled differently.
     params.return_method_ = CALL_TYPE;
+    // Followers forward appended entries (partial MapReduce results) to the leader.
+    params.auto_forwarding_ = true;
 
     // Initialize Raft server.
     stuff.raft_instance_ = stuff.launcher_.init(stuff.sm_,
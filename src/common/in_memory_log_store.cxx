@@ -19,6 +19,9 @@ limitations under the License.
 
 #include "nuraft.hxx"
 
+#include "Metrics.h"
+#include "Tracer.h"
+
 #include <cassert>
 
 namespace nuraft {
@@ -83,12 +86,28 @@ ptr<log_entry> inmem_log_store::last_entry() const {
 }
 
 ulong inmem_log_store::append(ptr<log_entry>& entry) {
+    static LatencyHistogram& latency =
+        MetricsRegistry::instance().histogram("log_store.append");
+    ScopedLatency timed(latency);
+
+    uint64_t trace_id = 0;
+    if (Tracer::instance().enabled() && entry->get_val_type() == log_val_type::app_log) {
+        buffer& buf = entry->get_buf();
+        trace_id = Tracer::instance().idOf(buf.data_begin(), buf.size());
+    }
+    TraceSpan traced(trace_id, "log_append");
+
     ptr<log_entry> clone = make_clone(entry);
 
     std::lock_guard<std::mutex> l(logs_lock_);
     size_t idx = start_idx_ + logs_.size() - 1;
     logs_[idx] = clone;
 
+    if (trace_id) {
+        // Ends with the commit of the entry on this node.
+        Tracer::instance().mark(trace_id, Tracer::now());
+    }
+
     if (disk_emul_delay) {
         uint64_t cur_time = timer_helper::get_timeofday_us();
         disk_emul_logs_being_written_[cur_time + disk_emul_delay * 1000] = idx;
@@ -280,6 +299,10 @@ bool inmem_log_store::compact(ulong last_log_index) {
 }
 
 bool inmem_log_store::flush() {
+    static LatencyHistogram& latency =
+        MetricsRegistry::instance().histogram("log_store.flush");
+    ScopedLatency timed(latency);
+
     disk_emul_last_durable_index_ = next_slot() - 1;
     return true;
 }
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Lock-free multi-producer, single-consumer ring of variable-length
+// records, used by SimpleLogger.
+//
+// Producers reserve space with a CAS on `head` and never wait: if the
+// record does not fit, it is dropped and counted. Each record starts with
+// an 8-byte header word that the producer publishes (release) after
+// filling the payload. The consumer reads records in reservation order,
+// stops at the first one still being written, and zeroes what it has read
+// so that the header of a new reservation reads as "not committed" until
+// it is published. A record never wraps around the end of the buffer;
+// the space left there is skipped with a padding record.
+class LogRing {
+public:
+    // `capacity` is rounded up to a power of two, at least 4 KB.
+    explicit LogRing(size_t capacity)
+        : words(roundUp(capacity) / WORD)
+        , mask(words.size() * WORD - 1)
+        , head(0)
+        , tail(0)
+        , dropped(0)
+    {}
+
+    LogRing(const LogRing&) = delete;
+    LogRing& operator=(const LogRing&) = delete;
+
+    // Space for a payload of `len` bytes, or nullptr (counted as a drop)
+    // if the ring is full. Fill it, then `commit` it.
+    char* reserve(size_t len) {
+        const uint64_t need = WORD + alignUp(len);
+        const uint64_t capacity = mask + 1;
+        if (need > capacity / 2) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        uint64_t h = head.load(std::memory_order_relaxed);
+        uint64_t pad;
+        do {
+            const uint64_t offset = h & mask;
+            pad = (offset + need > capacity) ? capacity - offset : 0;
+            if (h + pad + need - tail.load(std::memory_order_acquire) > capacity) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+        } while (!head.compare_exchange_weak(h, h + pad + need,
+                                             std::memory_order_relaxed));
+        if (pad) {
+            publish(h, PADDING | pad);
+        }
+        return base() + ((h + pad) & mask) + WORD;
+    }
+
+    // Publishes a reserved record holding `len` bytes.
+    void commit(char* payload, size_t len) {
+        __atomic_store_n(reinterpret_cast<uint64_t*>(payload - WORD),
+                         COMMITTED | len, __ATOMIC_RELEASE);
+    }
+
+    bool write(const char* data, size_t len) {
+        char* payload = reserve(len);
+        if (!payload) return false;
+        memcpy(payload, data, len);
+        commit(payload, len);
+        return true;
+    }
+
+    // Calls `reader(data, len)` for every committed record, oldest first,
+    // and frees it. Only one thread may consume at a time.
+    // Returns the number of records read.
+    template<typename Reader>
+    size_t consume(Reader&& reader) {
+        size_t count = 0;
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        const uint64_t h = head.load(std::memory_order_acquire);
+        while (t < h) {
+            char* record = base() + (t & mask);
+            const uint64_t header = __atomic_load_n(reinterpret_cast<uint64_t*>(record),
+                                                    __ATOMIC_ACQUIRE);
+            if (!(header & COMMITTED)) break;
+
+            const uint64_t len = header & LENGTH;
+            uint64_t size = len;
+            if (!(header & PADDING)) {
+                reader(static_cast<const char*>(record + WORD), static_cast<size_t>(len));
+                size = WORD + alignUp(len);
+                ++count;
+            }
+            memset(record, 0, size);
+            t += size;
+            tail.store(t, std::memory_order_release);
+        }
+        return count;
+    }
+
+    // Bytes reserved and not yet consumed.
+    size_t used() const {
+        return head.load(std::memory_order_relaxed) - tail.load(std::memory_order_relaxed);
+    }
+
+    size_t capacity() const { return mask + 1; }
+
+    // Records dropped because the ring was full, since construction.
+    uint64_t getDropped() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    static const uint64_t WORD = sizeof(uint64_t);
+    static const uint64_t COMMITTED = uint64_t(1) << 62;
+    static const uint64_t PADDING = uint64_t(1) << 63;
+    static const uint64_t LENGTH = 0xffffffff;
+
+    static uint64_t alignUp(uint64_t len) { return (len + WORD - 1) & ~(WORD - 1); }
+
+    static size_t roundUp(size_t capacity) {
+        size_t size = 4096;
+        while (size < capacity) size <<= 1;
+        return size;
+    }
+
+    char* base() { return reinterpret_cast<char*>(words.data()); }
+
+    void publish(uint64_t pos, uint64_t header) {
+        __atomic_store_n(reinterpret_cast<uint64_t*>(base() + (pos & mask)),
+                         COMMITTED | header, __ATOMIC_RELEASE);
+    }
+
+    // Word-sized, so every header is aligned for atomic access.
+    std::vector<uint64_t> words;
+    const uint64_t mask;
+
+    // Bytes ever reserved, and ever consumed. Both only grow.
+    alignas(64) std::atomic<uint64_t> head;
+    alignas(64) std::atomic<uint64_t> tail;
+    alignas(64) std::atomic<uint64_t> dropped;
+};
@@ -28,6 +28,7 @@ limitations under the License.
 #include <algorithm>
 #include <iomanip>
 #include <iostream>
+#include <unordered_map>
 
 #include <assert.h>
 
@@ -675,6 +676,12 @@ void SimpleLoggerMgr::addCompElem(SimpleLoggerMgr::CompElem* elem) {
     }
 }
 
+void SimpleLoggerMgr::wakeFlusher() {
+    // Without the lock: a wakeup lost to a flusher that is not waiting yet
+    // only delays the flush to its next period.
+    cvFlusher.notify_all();
+}
+
 void SimpleLoggerMgr::sleepFlusher(size_t ms) {
     std::unique_lock<std::mutex> l(cvFlusherLock);
     cvFlusher.wait_for(l, std::chrono::milliseconds(ms));
@@ -746,48 +753,6 @@ struct ThreadWrapper {
 
 // ==========================================
 
-SimpleLogger::LogElem::LogElem() : len(0), status(CLEAN) {
-    memset(ctx, 0x0, MSG_SIZE);
-}
-
-// True if dirty.
-bool SimpleLogger::LogElem::needToFlush() {
-    return status.load(MOR) == DIRTY;
-}
-
-// True if no other thread is working on it.
-bool SimpleLogger::LogElem::available() {
-    Status s = status.load(MOR);
-    return s == CLEAN || s == DIRTY;
-}
-
-int SimpleLogger::LogElem::write(size_t _len, char* msg) {
-    Status exp = CLEAN;
-    Status val = WRITING;
-    if (!status.compare_exchange_strong(exp, val)) return -1;
-
-    len = (_len > MSG_SIZE) ? MSG_SIZE : _len;
-    memcpy(ctx, msg, len);
-
-    status.store(LogElem::DIRTY);
-    return 0;
-}
-
-int SimpleLogger::LogElem::flush(std::ofstream& fs) {
-    Status exp = DIRTY;
-    Status val = FLUSHING;
-    if (!status.compare_exchange_strong(exp, val)) return -1;
-
-    fs.write(ctx, len);
-
-    status.store(LogElem::CLEAN);
-    return 0;
-}
-
-
-// ==========================================
-
-
 SimpleLogger::SimpleLogger(const std::string& file_path,
                            size_t max_log_elems,
                            uint64_t log_file_size_limit,
@@ -799,8 +764,11 @@ SimpleLogger::SimpleLogger(const std::string& file_path,
     , curLogLevel(4)
     , curDispLevel(4)
     , tzGap( SimpleLoggerMgr::getTzGap() )
-    , cursor(0)
-    , logs(max_log_elems)
+    // Same memory as `max_log_elems` messages of the maximum size.
+    , logs(max_log_elems * MSG_SIZE)
+    , reportedDrops(0)
+    , flushRequested(false)
+    , logMode(TEXT_MODE)
 {
     findMinMaxRevNum(minRevnum, curRevnum);
 }
@@ -968,8 +936,7 @@ std::string SimpleLogger::getLogFilePath(size_t file_num) const {
 int SimpleLogger::start() {
     if (filePath.empty()) return 0;
 
-    // Append at the end.
-    fs.open(getLogFilePath(curRevnum), std::ofstream::out | std::ofstream::app);
+    openLogFile();
     if (!fs) return -1;
 
     SimpleLoggerMgr* mgr = SimpleLoggerMgr::get();
@@ -1027,6 +994,12 @@ void SimpleLogger::setMaxLogFiles(size_t max_log_files) {
     maxLogFiles = max_log_files;
 }
 
+void SimpleLogger::setLogMode(LogMode mode) {
+    if (fs.is_open()) return;
+
+    logMode = mode;
+}
+
 #define _snprintf(msg, avail_len, cur_len, msg_len, ...)            \
     avail_len = (avail_len > cur_len) ? (avail_len - cur_len) : 0;  \
     msg_len = snprintf( msg + cur_len, avail_len, __VA_ARGS__ );    \
@@ -1037,6 +1010,425 @@ void SimpleLogger::setMaxLogFiles(size_t max_log_files) {
     msg_len = vsnprintf( msg + cur_len, avail_len, __VA_ARGS__ );   \
     cur_len += (avail_len > msg_len) ? msg_len : avail_len
 
+// ==========================================
+// Binary records (DEFERRED_MODE and BINARY_MODE).
+
+namespace {
+
+// First byte of every record in the ring.
+const char TEXT_RECORD = 'T';
+const char BINARY_RECORD = 'B';
+
+// Record types of a BINARY_MODE file. Every file starts with a header;
+// a string is defined before the first message that refers to it.
+//   'H' magic[8] version:u32 tz_gap:i32
+//   'S' id:u64 len:u32 bytes
+//   'M' len:u32 BinaryHeader arguments
+//   'T' len:u32 text
+const char FILE_HEADER = 'H';
+const char FILE_STRING = 'S';
+const char FILE_MESSAGE = 'M';
+const char FILE_TEXT = 'T';
+const char BINARY_LOG_MAGIC[8] = {'S', 'L', 'B', 'I', 'N', 'L', 'O', 'G'};
+const uint32_t BINARY_LOG_VERSION = 1;
+
+// Tags of captured arguments.
+const char ARG_INT = 'i';       // int64_t
+const char ARG_DOUBLE = 'd';    // double
+const char ARG_LDOUBLE = 'D';   // long double
+const char ARG_STRING = 's';    // uint32_t length, then the bytes
+const char ARG_POINTER = 'p';   // uint64_t
+
+// Fixed part of a binary record. Strings are identified by their address
+// in the process that logged them.
+struct BinaryHeader {
+    uint64_t format;
+    uint64_t file;
+    uint64_t func;
+    int64_t timestampNs;
+    uint32_t tid;
+    uint32_t line;
+    uint8_t level;
+    uint8_t tidDigits;
+};
+
+const int NO_VALUE = -1;
+const int STAR_VALUE = -2;
+
+// One printf conversion, `%[flags][width][.precision][length]type`.
+struct Conversion {
+    std::string flags;
+    int width;
+    int precision;
+    std::string length;
+    char type;
+};
+
+// Parses the conversion after a '%' at `p`, returns the end of it.
+const char* parseConversion(const char* p, Conversion& c) {
+    c.flags.clear();
+    c.length.clear();
+    c.width = c.precision = NO_VALUE;
+    while (*p && strchr("-+ #0'", *p)) c.flags += *p++;
+    if (*p == '*') {
+        c.width = STAR_VALUE;
+        ++p;
+    } else if (isdigit(*p)) {
+        c.width = 0;
+        while (isdigit(*p)) c.width = c.width * 10 + (*p++ - '0');
+    }
+    if (*p == '.') {
+        ++p;
+        c.precision = 0;
+        if (*p == '*') {
+            c.precision = STAR_VALUE;
+            ++p;
+        } else {
+            while (isdigit(*p)) c.precision = c.precision * 10 + (*p++ - '0');
+        }
+    }
+    while (*p && strchr("hlLjzt", *p)) c.length += *p++;
+    c.type = *p;
+    return *p ? p + 1 : p;
+}
+
+class ArgWriter {
+public:
+    ArgWriter(char* out, size_t cap) : out(out), cap(cap), len(0), full(false) {}
+
+    template<typename T>
+    void put(char tag, T value) {
+        if (full || len + 1 + sizeof(T) > cap) {
+            full = true;
+            return;
+        }
+        out[len++] = tag;
+        memcpy(out + len, &value, sizeof(T));
+        len += sizeof(T);
+    }
+
+    void putString(const char* str, int precision) {
+        if (!str) str = "(null)";
+        if (full || len + 1 + sizeof(uint32_t) > cap) {
+            full = true;
+            return;
+        }
+        size_t str_len = (precision >= 0) ? strnlen(str, precision) : strlen(str);
+        // Truncate the last string that fits rather than drop it.
+        str_len = std::min(str_len, cap - len - 1 - sizeof(uint32_t));
+        uint32_t n = str_len;
+        out[len++] = ARG_STRING;
+        memcpy(out + len, &n, sizeof(n));
+        memcpy(out + len + sizeof(n), str, n);
+        len += sizeof(n) + n;
+    }
+
+    char* out;
+    size_t cap;
+    size_t len;
+    bool full;
+};
+
+// Copies the arguments of `format` from `args`, as tagged values.
+size_t captureArgs(const char* format, va_list args, char* out, size_t cap) {
+    ArgWriter w(out, cap);
+    Conversion c;
+    for (const char* p = format; *p && !w.full; ) {
+        if (*p++ != '%') continue;
+        if (*p == '%') {
+            ++p;
+            continue;
+        }
+        p = parseConversion(p, c);
+        if (c.width == STAR_VALUE) w.put(ARG_INT, (int64_t)va_arg(args, int));
+        int precision = c.precision;
+        if (precision == STAR_VALUE) {
+            precision = va_arg(args, int);
+            w.put(ARG_INT, (int64_t)precision);
+        }
+        switch (c.type) {
+        case 'd': case 'i': {
+            int64_t v;
+            if (c.length == "ll") v = va_arg(args, long long);
+            else if (c.length == "l") v = va_arg(args, long);
+            else if (c.length == "j") v = va_arg(args, intmax_t);
+            else if (c.length == "z") v = va_arg(args, ssize_t);
+            else if (c.length == "t") v = va_arg(args, ptrdiff_t);
+            else if (c.length == "hh") v = (signed char)va_arg(args, int);
+            else if (c.length == "h") v = (short)va_arg(args, int);
+            else v = va_arg(args, int);
+            w.put(ARG_INT, v);
+            break;
+        }
+        case 'u': case 'o': case 'x': case 'X': {
+            uint64_t v;
+            if (c.length == "ll") v = va_arg(args, unsigned long long);
+            else if (c.length == "l") v = va_arg(args, unsigned long);
+            else if (c.length == "j") v = va_arg(args, uintmax_t);
+            else if (c.length == "z") v = va_arg(args, size_t);
+            else if (c.length == "t") v = va_arg(args, ptrdiff_t);
+            else if (c.length == "hh") v = (unsigned char)va_arg(args, unsigned);
+            else if (c.length == "h") v = (unsigned short)va_arg(args, unsigned);
+            else v = va_arg(args, unsigned);
+            w.put(ARG_INT, (int64_t)v);
+            break;
+        }
+        case 'c':
+            w.put(ARG_INT, (int64_t)va_arg(args, int));
+            break;
+        case 'f': case 'F': case 'e': case 'E':
+        case 'g': case 'G': case 'a': case 'A':
+            if (c.length == "L") w.put(ARG_LDOUBLE, va_arg(args, long double));
+            else w.put(ARG_DOUBLE, va_arg(args, double));
+            break;
+        case 's':
+            w.putString(va_arg(args, const char*), precision);
+            break;
+        case 'p':
+            w.put(ARG_POINTER, (uint64_t)(uintptr_t)va_arg(args, void*));
+            break;
+        case 'n':
+            (void)va_arg(args, void*);
+            break;
+        default:
+            // Unknown conversion: the remaining arguments cannot be located.
+            return w.len;
+        }
+    }
+    return w.len;
+}
+
+class ArgReader {
+public:
+    ArgReader(const char* data, size_t len) : cur(data), end(data + len) {}
+
+    template<typename T>
+    bool get(char tag, T& value) {
+        if (cur + 1 + sizeof(T) > end || *cur != tag) {
+            cur = end;
+            return false;
+        }
+        memcpy(&value, cur + 1, sizeof(T));
+        cur += 1 + sizeof(T);
+        return true;
+    }
+
+    bool getString(std::string& value) {
+        uint32_t n = 0;
+        if (cur + 1 + sizeof(n) > end || *cur != ARG_STRING) {
+            cur = end;
+            return false;
+        }
+        memcpy(&n, cur + 1, sizeof(n));
+        const char* str = cur + 1 + sizeof(n);
+        n = std::min<size_t>(n, end - str);
+        value.assign(str, n);
+        cur = str + n;
+        return true;
+    }
+
+private:
+    const char* cur;
+    const char* end;
+};
+
+// Formats `format` with arguments captured by `captureArgs`, like
+// vsnprintf. A missing argument is printed as `<?>`.
+size_t formatArgs(const char* format, const char* args, size_t args_len,
+                  char* out, size_t cap)
+{
+    ArgReader r(args, args_len);
+    Conversion c;
+    std::string spec;
+    std::string str;
+    size_t cur_len = 0;
+    auto append = [&](const char* fmt, auto value) {
+        size_t avail = (cap > cur_len) ? cap - cur_len : 0;
+        int n = snprintf(out + cur_len, avail, fmt, value);
+        if (n > 0) cur_len += std::min<size_t>(n, avail ? avail - 1 : 0);
+    };
+    auto appendChars = [&](const char* data, size_t n) {
+        n = std::min(n, (cap > cur_len + 1) ? cap - cur_len - 1 : 0);
+        memcpy(out + cur_len, data, n);
+        cur_len += n;
+    };
+
+    const char* p = format;
+    while (*p) {
+        const char* literal = p;
+        while (*p && *p != '%') ++p;
+        appendChars(literal, p - literal);
+        if (!*p) break;
+        ++p;
+        if (*p == '%') {
+            appendChars(p++, 1);
+            continue;
+        }
+        p = parseConversion(p, c);
+        spec = "%" + c.flags;
+        int64_t star = 0;
+        if (c.width == STAR_VALUE) {
+            if (r.get(ARG_INT, star)) spec += std::to_string(star);
+        } else if (c.width != NO_VALUE) {
+            spec += std::to_string(c.width);
+        }
+        if (c.precision == STAR_VALUE) {
+            if (r.get(ARG_INT, star) && star >= 0) spec += "." + std::to_string(star);
+        } else if (c.precision != NO_VALUE) {
+            spec += "." + std::to_string(c.precision);
+        }
+
+        bool ok = true;
+        switch (c.type) {
+        case 'd': case 'i': {
+            int64_t v = 0;
+            if ((ok = r.get(ARG_INT, v))) append((spec + "ll" + c.type).c_str(), (long long)v);
+            break;
+        }
+        case 'u': case 'o': case 'x': case 'X': {
+            int64_t v = 0;
+            if ((ok = r.get(ARG_INT, v))) {
+                append((spec + "ll" + c.type).c_str(), (unsigned long long)v);
+            }
+            break;
+        }
+        case 'c': {
+            int64_t v = 0;
+            if ((ok = r.get(ARG_INT, v))) append((spec + "c").c_str(), (int)v);
+            break;
+        }
+        case 'f': case 'F': case 'e': case 'E':
+        case 'g': case 'G': case 'a': case 'A':
+            if (c.length == "L") {
+                long double v = 0;
+                if ((ok = r.get(ARG_LDOUBLE, v))) append((spec + "L" + c.type).c_str(), v);
+            } else {
+                double v = 0;
+                if ((ok = r.get(ARG_DOUBLE, v))) append((spec + c.type).c_str(), v);
+            }
+            break;
+        case 's':
+            if ((ok = r.getString(str))) append((spec + "s").c_str(), str.c_str());
+            break;
+        case 'p': {
+            uint64_t v = 0;
+            if ((ok = r.get(ARG_POINTER, v))) append((spec + "p").c_str(), (void*)(uintptr_t)v);
+            break;
+        }
+        case 'n':
+            break;
+        default:
+            ok = false;
+        }
+        if (!ok) appendChars("<?>", 3);
+    }
+    if (cap) out[std::min(cur_len, cap - 1)] = 0;
+    return cur_len;
+}
+
+// Time of a record, at `tz_gap` minutes from UTC.
+SimpleLoggerMgr::TimeInfo recordTime(int64_t timestamp_ns, int tz_gap) {
+    std::time_t raw_time = timestamp_ns / 1000000000 + tz_gap * 60;
+    std::tm new_time;
+#if defined(__linux__) || defined(__APPLE__)
+    gmtime_r(&raw_time, &new_time);
+#elif defined(WIN32) || defined(_WIN32)
+    gmtime_s(&new_time, &raw_time);
+#endif
+    SimpleLoggerMgr::TimeInfo lt(&new_time);
+    int64_t us_epoch = timestamp_ns / 1000;
+    lt.msec = (us_epoch / 1000) % 1000;
+    lt.usec = us_epoch % 1000;
+    return lt;
+}
+
+const char* LV_NAMES[7] = {"====",
+                           "FATL", "ERRO", "WARN",
+                           "INFO", "DEBG", "TRAC"};
+
+void appendFormat(char* msg, size_t& cur_len, const char* format, ...) {
+    size_t avail_len = (SimpleLogger::MSG_SIZE > cur_len)
+                       ? SimpleLogger::MSG_SIZE - cur_len : 0;
+    va_list args;
+    va_start(args, format);
+    int msg_len = vsnprintf(msg + cur_len, avail_len, format, args);
+    va_end(args);
+    if (msg_len > 0) {
+        cur_len += std::min<size_t>(msg_len, avail_len ? avail_len - 1 : 0);
+    }
+}
+
+// [time] [tid] [log type], the start of a line in the log file.
+void formatPrefix(char* msg, size_t& cur_len,
+                  const SimpleLoggerMgr::TimeInfo& lt, int tz_gap,
+                  int tid_digits, uint32_t tid_hash, int level)
+{
+    int tz_gap_abs = (tz_gap < 0) ? (tz_gap * -1) : (tz_gap);
+#ifdef __linux__
+    appendFormat( msg, cur_len,
+                  "%04d-%02d-%02dT%02d:%02d:%02d.%03d_%03d%c%02d:%02d "
+                  "[%*u] "
+                  "[%s] ",
+                  lt.year, lt.month, lt.day,
+                  lt.hour, lt.min, lt.sec, lt.msec, lt.usec,
+                  (tz_gap >= 0)?'+':'-', tz_gap_abs / 60, tz_gap_abs % 60,
+                  tid_digits, tid_hash,
+                  LV_NAMES[level] );
+#else
+    (void)tid_digits;
+    appendFormat( msg, cur_len,
+                  "%04d-%02d-%02dT%02d:%02d:%02d.%03d_%03d%c%02d:%02d "
+                  "[%04x] "
+                  "[%s] ",
+                  lt.year, lt.month, lt.day,
+                  lt.hour, lt.min, lt.sec, lt.msec, lt.usec,
+                  (tz_gap >= 0)?'+':'-', tz_gap_abs / 60, tz_gap_abs % 60,
+                  tid_hash,
+                  LV_NAMES[level] );
+#endif
+}
+
+// [source location], the end of a line in the log file.
+void formatSuffix(char* msg, size_t& cur_len,
+                  const char* source_file, const char* func_name, size_t line_number)
+{
+    if (source_file && func_name) {
+        // Print filename part only (excluding directory path).
+        const char* file_name = source_file;
+        for (const char* p = source_file; *p; ++p) {
+            if (*p == '/' || *p == '\\') file_name = p + 1;
+        }
+        appendFormat( msg, cur_len, "\t[%s:%zu, %s()]\n",
+                      file_name, line_number, func_name );
+    } else {
+        appendFormat(msg, cur_len, "\n");
+    }
+}
+
+// Formats a binary record (without its kind byte) into a line of text,
+// the same as TEXT_MODE would have written. `lookup` resolves string ids.
+template<typename Lookup>
+size_t formatRecord(const char* record, size_t len, int tz_gap,
+                    const Lookup& lookup, char* msg)
+{
+    BinaryHeader header;
+    if (len < sizeof(header)) return 0;
+    memcpy(&header, record, sizeof(header));
+
+    size_t cur_len = 0;
+    formatPrefix(msg, cur_len, recordTime(header.timestampNs, tz_gap), tz_gap,
+                 header.tidDigits, header.tid, std::min<int>(header.level, 6));
+    const char* format = lookup(header.format);
+    if (format && cur_len + 1 < SimpleLogger::MSG_SIZE) {
+        cur_len += formatArgs(format, record + sizeof(header), len - sizeof(header),
+                              msg + cur_len, SimpleLogger::MSG_SIZE - cur_len);
+    }
+    formatSuffix(msg, cur_len, lookup(header.file), lookup(header.func), header.line);
+    return cur_len;
+}
+
+} // namespace
+
 void SimpleLogger::put(int level,
                        const char* source_file,
                        const char* func_name,
@@ -1047,92 +1439,74 @@ void SimpleLogger::put(int level,
     if (level > curLogLevel.load(MOR)) return;
     if (!fs) return;
 
-    static const char* lv_names[7] = {"====",
-                                      "FATL", "ERRO", "WARN",
-                                      "INFO", "DEBG", "TRAC"};
     char msg[MSG_SIZE];
     thread_local ThreadWrapper thread_wrapper;
 #ifdef __linux__
     const int TID_DIGITS = tid_digits;
     thread_local uint32_t tid_hash = thread_wrapper.myTid;
 #else
+    const int TID_DIGITS = 4;
     thread_local std::thread::id tid = std::this_thread::get_id();
     thread_local uint32_t tid_hash = std::hash<std::thread::id>{}(tid) % 0x10000;
 #endif
 
-    // Print filename part only (excluding directory path).
-    size_t last_slash = 0;
-    for (size_t ii=0; source_file && source_file[ii] != 0; ++ii) {
-        if (source_file[ii] == '/' || source_file[ii] == '\\') last_slash = ii;
-    }
-
-    SimpleLoggerMgr::TimeInfo lt( std::chrono::system_clock::now() );
-    int tz_gap_abs = (tzGap < 0) ? (tzGap * -1) : (tzGap);
-
-    // [time] [tid] [log type] [user msg] [stack info]
-    // Timestamp: ISO 8601 format.
+    std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
     size_t cur_len = 0;
-    size_t avail_len = MSG_SIZE;
-    size_t msg_len = 0;
-
-#ifdef __linux__
-    _snprintf( msg, avail_len, cur_len, msg_len,
-               "%04d-%02d-%02dT%02d:%02d:%02d.%03d_%03d%c%02d:%02d "
-               "[%*u] "
-               "[%s] ",
-               lt.year, lt.month, lt.day,
-               lt.hour, lt.min, lt.sec, lt.msec, lt.usec,
-               (tzGap >= 0)?'+':'-', tz_gap_abs / 60, tz_gap_abs % 60,
-               TID_DIGITS, tid_hash,
-               lv_names[level] );
-#else
-    _snprintf( msg, avail_len, cur_len, msg_len,
-               "%04d-%02d-%02dT%02d:%02d:%02d.%03d_%03d%c%02d:%02d "
-               "[%04x] "
-               "[%s] ",
-               lt.year, lt.month, lt.day,
-               lt.hour, lt.min, lt.sec, lt.msec, lt.usec,
-               (tzGap >= 0)?'+':'-', tz_gap_abs / 60, tz_gap_abs % 60,
-               tid_hash,
-               lv_names[level] );
-#endif
-
     va_list args;
-    va_start(args, format);
-    _vsnprintf(msg, avail_len, cur_len, msg_len, format, args);
-    va_end(args);
 
-    if (source_file && func_name) {
-        _snprintf( msg, avail_len, cur_len, msg_len,
-                   "\t[%s:%zu, %s()]\n",
-                   source_file + ((last_slash)?(last_slash+1):0),
-                   line_number, func_name );
+    if (logMode.load(MOR) == TEXT_MODE) {
+        // [time] [tid] [log type] [user msg] [stack info]
+        // Timestamp: ISO 8601 format.
+        msg[cur_len++] = TEXT_RECORD;
+        formatPrefix(msg, cur_len, SimpleLoggerMgr::TimeInfo(now), tzGap,
+                     TID_DIGITS, tid_hash, level);
+        size_t avail_len = MSG_SIZE - cur_len;
+        va_start(args, format);
+        int msg_len = vsnprintf(msg + cur_len, avail_len, format, args);
+        va_end(args);
+        if (msg_len > 0) cur_len += std::min<size_t>(msg_len, avail_len - 1);
+        formatSuffix(msg, cur_len, source_file, func_name, line_number);
+
     } else {
-        _snprintf(msg, avail_len, cur_len, msg_len, "\n");
+        // Formatted later by the flusher (see `writeRecord`) or offline.
+        BinaryHeader header;
+        memset(&header, 0x0, sizeof(header));
+        header.format = (uint64_t)(uintptr_t)format;
+        header.file = (uint64_t)(uintptr_t)source_file;
+        header.func = (uint64_t)(uintptr_t)func_name;
+        header.timestampNs = std::chrono::duration_cast<std::chrono::nanoseconds>
+                             ( now.time_since_epoch() ).count();
+        header.tid = tid_hash;
+        header.line = line_number;
+        header.level = level;
+        header.tidDigits = TID_DIGITS;
+        msg[cur_len++] = BINARY_RECORD;
+        memcpy(msg + cur_len, &header, sizeof(header));
+        cur_len += sizeof(header);
+        va_start(args, format);
+        cur_len += captureArgs(format, args, msg + cur_len, MSG_SIZE - cur_len);
+        va_end(args);
     }
 
-    size_t num = logs.size();
-    uint64_t cursor_exp = 0, cursor_val = 0;
-    LogElem* ll = nullptr;
-    do {
-        cursor_exp = cursor.load(MOR);
-        cursor_val = (cursor_exp + 1) % num;
-        ll = &logs[cursor_exp];
-    } while ( !cursor.compare_exchange_strong(cursor_exp, cursor_val, MOR) );
-    while ( !ll->available() ) std::this_thread::yield();
-
-    if (ll->needToFlush()) {
-        // Allow only one thread to flush.
-        if (!flush(cursor_exp)) {
-            // Other threads: wait.
-            while (ll->needToFlush()) std::this_thread::yield();
-        }
+    logs.write(msg, cur_len);
+    if ( logs.used() > logs.capacity() / 2 &&
+         !flushRequested.exchange(true, MOR) ) {
+        // Drain before the ring fills up and messages are dropped.
+        SimpleLoggerMgr* mgr = SimpleLoggerMgr::getWithoutInit();
+        if (mgr) mgr->wakeFlusher();
     }
-    ll->write(cur_len, msg);
 
     if (level > curDispLevel) return;
 
     // Console part.
+    SimpleLoggerMgr::TimeInfo lt(now);
+    size_t last_slash = 0;
+    for (size_t ii=0; source_file && source_file[ii] != 0; ++ii) {
+        if (source_file[ii] == '/' || source_file[ii] == '\\') last_slash = ii;
+    }
+    size_t avail_len = MSG_SIZE;
+    size_t msg_len = 0;
+
     static const char* colored_lv_names[7] =
                        { _CL_B_BROWN("===="),
                          _CL_WHITE_FG_RED_BG("FATL"),
@@ -1240,19 +1614,19 @@ void SimpleLogger::doCompression(size_t file_num) {
     numCompJobs.fetch_sub(1);
 }
 
-bool SimpleLogger::flush(size_t start_pos) {
+bool SimpleLogger::flush() {
     std::unique_lock<std::mutex> ll(flushingLogs, std::try_to_lock);
     if (!ll.owns_lock()) return false;
 
-    size_t num = logs.size();
-    // Circular flush into file.
-    for (size_t ii=start_pos; ii<num; ++ii) {
-        LogElem& ll = logs[ii];
-        ll.flush(fs);
-    }
-    for (size_t ii=0; ii<start_pos; ++ii) {
-        LogElem& ll = logs[ii];
-        ll.flush(fs);
+    flushRequested.store(false, MOR);
+    logs.consume([this](const char* record, size_t len) {
+        writeRecord(record, len);
+    });
+    uint64_t dropped = logs.getDropped();
+    if (dropped != reportedDrops) {
+        fs << "[log ring full, dropped " << (dropped - reportedDrops)
+           << " messages]\n";
+        reportedDrops = dropped;
     }
     fs.flush();
 
@@ -1261,7 +1635,7 @@ bool SimpleLogger::flush(size_t start_pos) {
         // Exceeded limit, make a new file.
         curRevnum++;
         fs.close();
-        fs.open(getLogFilePath(curRevnum), std::ofstream::out | std::ofstream::app);
+        openLogFile();
 
         // Compress it (tar gz). Register to the global queue.
         SimpleLoggerMgr* mgr = SimpleLoggerMgr::getWithoutInit();
@@ -1276,7 +1650,117 @@ bool SimpleLogger::flush(size_t start_pos) {
     return true;
 }
 
+void SimpleLogger::openLogFile() {
+    // Append at the end.
+    fs.open( getLogFilePath(curRevnum),
+             std::ofstream::out | std::ofstream::app | std::ofstream::binary );
+    knownStrings.clear();
+    if (!fs || logMode != BINARY_MODE) return;
+
+    // Every file can be decoded on its own.
+    uint32_t version = BINARY_LOG_VERSION;
+    int32_t tz_gap = tzGap;
+    fs.put(FILE_HEADER);
+    fs.write(BINARY_LOG_MAGIC, sizeof(BINARY_LOG_MAGIC));
+    fs.write((const char*)&version, sizeof(version));
+    fs.write((const char*)&tz_gap, sizeof(tz_gap));
+}
+
+void SimpleLogger::writeString(uint64_t id) {
+    if (!id || !knownStrings.insert(id).second) return;
+
+    const char* str = (const char*)(uintptr_t)id;
+    uint32_t len = strlen(str);
+    fs.put(FILE_STRING);
+    fs.write((const char*)&id, sizeof(id));
+    fs.write((const char*)&len, sizeof(len));
+    fs.write(str, len);
+}
+
+void SimpleLogger::writeRecord(const char* record, size_t len) {
+    if (!len) return;
+    const char kind = *record++;
+    uint32_t body_len = --len;
+
+    if (logMode == BINARY_MODE) {
+        if (kind == BINARY_RECORD && len >= sizeof(BinaryHeader)) {
+            BinaryHeader header;
+            memcpy(&header, record, sizeof(header));
+            writeString(header.format);
+            writeString(header.file);
+            writeString(header.func);
+            fs.put(FILE_MESSAGE);
+        } else {
+            fs.put(FILE_TEXT);
+        }
+        fs.write((const char*)&body_len, sizeof(body_len));
+        fs.write(record, len);
+        return;
+    }
+
+    if (kind == BINARY_RECORD) {
+        // In this process, a string id is the string's address.
+        char msg[MSG_SIZE];
+        auto lookup = [](uint64_t id) { return (const char*)(uintptr_t)id; };
+        fs.write(msg, formatRecord(record, len, tzGap, lookup, msg));
+    } else {
+        fs.write(record, len);
+    }
+}
+
+int64_t SimpleLogger::decodeBinaryLog(std::istream& in, std::ostream& out) {
+    std::unordered_map<uint64_t, std::string> strings;
+    auto lookup = [&strings](uint64_t id) -> const char* {
+        auto entry = strings.find(id);
+        return (entry == strings.end()) ? nullptr : entry->second.c_str();
+    };
+
+    int64_t count = 0;
+    int32_t tz_gap = 0;
+    bool header_found = false;
+    std::string body;
+    char msg[MSG_SIZE];
+    char type;
+    while (in.get(type)) {
+        if (type == FILE_HEADER) {
+            char magic[sizeof(BINARY_LOG_MAGIC)];
+            uint32_t version = 0;
+            if ( !in.read(magic, sizeof(magic)) ||
+                 memcmp(magic, BINARY_LOG_MAGIC, sizeof(magic)) ||
+                 !in.read((char*)&version, sizeof(version)) ||
+                 version != BINARY_LOG_VERSION ||
+                 !in.read((char*)&tz_gap, sizeof(tz_gap)) ) {
+                return -1;
+            }
+            header_found = true;
+            strings.clear();
+            continue;
+        }
+        if (!header_found) return -1;
+
+        uint64_t id = 0;
+        uint32_t len = 0;
+        if (type == FILE_STRING && !in.read((char*)&id, sizeof(id))) break;
+        if (!in.read((char*)&len, sizeof(len))) break;
+        body.resize(len);
+        // A record cut short by a crash ends the log.
+        if (len && !in.read(&body[0], len)) break;
+
+        if (type == FILE_STRING) {
+            strings[id] = body;
+        } else if (type == FILE_MESSAGE) {
+            out.write(msg, formatRecord(body.data(), body.size(), tz_gap, lookup, msg));
+            count++;
+        } else if (type == FILE_TEXT) {
+            out << body;
+            count++;
+        } else {
+            return -1;
+        }
+    }
+    return header_found ? count : -1;
+}
+
 void SimpleLogger::flushAll() {
-    uint64_t start_pos = cursor.load(MOR);
-    flush(start_pos);
+    flush();
 }
@@ -33,6 +33,8 @@ limitations under the License.
 #include <unordered_set>
 #include <vector>
 
+#include "log_ring.h"
+
 #include <signal.h>
 #include <stdarg.h>
 #if defined(__linux__) || defined(__APPLE__)
@@ -147,6 +149,21 @@ public:
         UNKNOWN     = 99,
     };
 
+    // How `put` records a message.
+    enum LogMode {
+        // Formatted into text on the calling thread.
+        TEXT_MODE       = 0,
+        // The calling thread only records the format string, source
+        // location and raw arguments; the flush worker formats them into
+        // the same text. The format, file and function names must be
+        // string literals (as with the `_log_` macros), since they are
+        // read after `put` returns.
+        DEFERRED_MODE   = 1,
+        // Like DEFERRED_MODE, but the file keeps the binary records, to be
+        // formatted offline by `decodeBinaryLog` (the `mr_log_decode` tool).
+        BINARY_MODE     = 2,
+    };
+
     class LoggerStream : public std::ostream {
     public:
         LoggerStream() : std::ostream(&buf), level(0), logger(nullptr)
@@ -218,31 +235,6 @@ public:
         return _eos;
     }
 
-private:
-    struct LogElem {
-        enum Status {
-            CLEAN       = 0,
-            WRITING     = 1,
-            DIRTY       = 2,
-            FLUSHING    = 3,
-        };
-
-        LogElem();
-
-        // True if dirty.
-        bool needToFlush();
-
-        // True if no other thread is working on it.
-        bool available();
-
-        int write(size_t _len, char* msg);
-        int flush(std::ofstream& fs);
-
-        size_t len;
-        char ctx[MSG_SIZE];
-        std::atomic<Status> status;
-    };
-
 public:
     SimpleLogger(const std::string& file_path,
                  size_t max_log_elems           = 4096,
@@ -256,6 +248,10 @@ public:
     static void setStackTraceOriginOnly(bool origin_only);
     static void logStackBacktrace();
 
+    // Formats a BINARY_MODE log file from `in` as text into `out`.
+    // Returns the number of messages, or -1 if `in` is not a binary log.
+    static int64_t decodeBinaryLog(std::istream& in, std::ostream& out);
+
     static void shutdown();
     static std::string replaceString(const std::string& src_str,
                                      const std::string& before,
@@ -270,6 +266,8 @@ public:
     void setLogLevel(int level);
     void setDispLevel(int level);
     void setMaxLogFiles(size_t max_log_files);
+    // Call before `start`.
+    void setLogMode(LogMode mode);
 
     inline int getLogLevel()  const { return curLogLevel.load(MOR); }
     inline int getDispLevel() const { return curDispLevel.load(MOR); }
@@ -282,6 +280,9 @@ public:
              ...);
     void flushAll();
 
+    // Messages dropped because the ring was full.
+    uint64_t getDroppedLogs() const { return logs.getDropped(); }
+
 private:
     void calcTzGap();
     void findMinMaxRevNum(size_t& min_revnum_out,
@@ -293,7 +294,10 @@ private:
     std::string getLogFilePath(size_t file_num) const;
     void execCmd(const std::string& cmd);
     void doCompression(size_t file_num);
-    bool flush(size_t start_pos);
+    void openLogFile();
+    void writeRecord(const char* record, size_t len);
+    void writeString(uint64_t id);
+    bool flush();
 
     std::string filePath;
     size_t minRevnum;
@@ -316,9 +320,19 @@ private:
     std::mutex displayLock;
 
     int tzGap;
-    std::atomic<uint64_t> cursor;
-    std::vector<LogElem> logs;
+
+    // Formatted messages waiting for the flusher. `put` never blocks on
+    // it: a message that does not fit is dropped and counted.
+    LogRing logs;
     std::mutex flushingLogs;
+    // Drops already reported in the log file, and whether a `put` has
+    // already asked the flusher to drain a filling ring.
+    uint64_t reportedDrops;
+    std::atomic<bool> flushRequested;
+
+    std::atomic<int> logMode;
+    // Strings already defined in the current BINARY_MODE file, by address.
+    std::unordered_set<uint64_t> knownStrings;
 };
 
 // Singleton class
@@ -370,6 +384,7 @@ public:
     void addThread(uint64_t tid);
     void removeThread(uint64_t tid);
     void addCompElem(SimpleLoggerMgr::CompElem* elem);
+    void wakeFlusher();
     void sleepFlusher(size_t ms);
     void sleepCompressor(size_t ms);
     bool chkTermination() const;
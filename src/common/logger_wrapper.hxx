@@ -27,8 +27,11 @@ using namespace nuraft;
  */
 class logger_wrapper : public logger {
 public:
-    logger_wrapper(const std::string& log_file, int log_level = 6) {
+    logger_wrapper(const std::string& log_file,
+                   int log_level = 6,
+                   SimpleLogger::LogMode log_mode = SimpleLogger::TEXT_MODE) {
         my_log_ = new SimpleLogger(log_file, 1024, 32*1024*1024, 10);
+        my_log_->setLogMode(log_mode);
         my_log_->setLogLevel(log_level);
         my_log_->setDispLevel(-1);
         my_log_->setCrashDumpPath("./", true);
@@ -48,6 +51,11 @@ public:
         }
     }
 
+    // NuRaft formats `msg` on its own thread before calling this, and never
+    // passes the format string and arguments, so in DEFERRED_MODE and
+    // BINARY_MODE only the record around the message (time, thread, source)
+    // is deferred, and the message is kept as one string argument.
+    // BM_LoggerPutDetails measures this path.
     void put_details(int level,
                      const char* source_file,
                      const char* func_name,
@@ -7,8 +7,15 @@
 
 
 #include "mr_state_machine.cpp"
+#include "MetricsHttpServer.h"
+#include "BulkExporter.h"
 
+#include <charconv>
+#include <condition_variable>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <limits>
 #include <sstream>
 
 #include <stdio.h>
@@ -23,41 +30,130 @@ static raft_params::return_method_type CALL_TYPE
 
 static bool ASYNC_SNAPSHOT_CREATION = false;
 
+// Upper bound on asynchronous MapReduce jobs running at once.
+static size_t MAX_JOBS = 2;
+
+// Memory cap for the intermediate results of all group-by jobs, 0 for none.
+static size_t MEMORY_LIMIT_MB = 0;
+static std::string SPILL_DIR = "/tmp";
+
+// Partitioned jobs without a partial result for this long are cancelled.
+static int PARTITION_TIMEOUT_MS = 30000;
+
+// How the Raft log file is written, see SimpleLogger::LogMode.
+static SimpleLogger::LogMode LOG_MODE = SimpleLogger::TEXT_MODE;
+
+// Seconds between dumps of the metrics to ./srv<id>.metrics, 0 for none.
+static int METRICS_INTERVAL_SEC = 0;
+
+// Prometheus endpoint, off unless a port is given.
+static int METRICS_PORT = -1;
+static std::string METRICS_ADDRESS = "127.0.0.1";
+static std::unique_ptr<MetricsHttpServer> METRICS_HTTP;
+
+// Trace one request in this many, 0 for none.
+static uint32_t TRACE_SAMPLING = 0;
+
+// Values in each INSERT_BATCH entry of an `import`, and entries per append.
+static size_t IMPORT_BATCH_VALUES = 256 * 1024;
+static size_t IMPORT_ENTRIES_PER_APPEND = 16;
+
+// Keys copied out of the store at a time by `store`, `scan` and `export`.
+static size_t SCAN_PAGE_KEYS = 1024;
+
+// Commands of this file are run instead of the prompt, with at most
+// BATCH_WINDOW of their entries replicating at once.
+static std::string BATCH_FILE;
+static size_t BATCH_WINDOW = 64;
+
 #include "example_common.hxx"
 
 mr_state_machine* get_sm() {
     return static_cast<mr_state_machine*>( stuff.sm_.get() );
 }
 
+// `text` as a whole decimal number no larger than `max`.
+// Throws std::runtime_error naming it `what` otherwise.
+uint64_t parse_number(const std::string& text, const std::string& what,
+                      uint64_t max = std::numeric_limits<uint64_t>::max())
+{
+    uint64_t value = 0;
+    auto parsed = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (parsed.ec != std::errc() || parsed.ptr != text.data() + text.size() || value > max) {
+        throw std::runtime_error("Invalid " + what + " " + text);
+    }
+    return value;
+}
+
+void print_map_reduce_results(const mr_state_machine::mr_result& result) {
+    if (result.type_ == mr_state_machine::ERROR_RESULT) {
+        std::cout << "MapReduce failed" << std::endl;
+        return;
+    }
+    std::cout << "MapReduce results:" << std::endl;
+    for (size_t ii = 0; ii < result.ranked_.size(); ++ii) {
+        std::cout << ii + 1 << ". " << result.ranked_[ii].first << ": "
+                  << result.ranked_[ii].second << std::endl;
+    }
+    for (const auto& kv : result.values_) {
+        std::cout << kv.first << ": " << kv.second << std::endl;
+    }
+    for (const auto& kv : result.statistics_) {
+        std::cout << kv.first << ":";
+        for (const auto& stat : kv.second) {
+            std::cout << " " << stat.first << "=" << stat.second;
+        }
+        std::cout << std::endl;
+    }
+}
+
 void handle_result(ptr<TestSuite::Timer> timer,
+                   uint64_t trace_id,
+                   uint64_t trace_begin,
                    raft_result& result,
                    ptr<std::exception>& err)
 {
+    static LatencyHistogram& append_to_commit =
+        MetricsRegistry::instance().histogram("raft.append_to_commit");
+    static MetricCounter& append_failed =
+        MetricsRegistry::instance().counter("raft.append_failed");
+
+    if (trace_id) {
+        // From receiving the request to its result, on this node.
+        Tracer::instance().span(trace_id, "request", trace_begin, Tracer::now());
+    }
+
     if (result.get_result_code() != cmd_result_code::OK) {
         // Something went wrong.
+        append_failed.add();
         std::cout << "failed: " << result.get_result_code() << ", "
                   << TestSuite::usToString( timer->getTimeUs() )
                   << std::endl;
         return;
     }
 
+    append_to_commit.record(timer->getTimeUs() * 1000);
+
     ptr<buffer> buf = result.get();
-    uint64_t log_idx = buf->get_ulong(); // Log index
-    bool has_map_reduce_results = buf->get_byte() != 0; // Deserialize flag
+    ulong log_idx = 0;
+    mr_state_machine::mr_result mapReduceResult;
+    mr_state_machine::dec_results(*buf, log_idx, mapReduceResult);
 
     std::cout << "succeeded, log index: " << log_idx << std::endl;
-    if (has_map_reduce_results) {
-        std::map<std::string, int> mapReduceResults = get_sm()->get_map_reduce_results(log_idx);
-        std::cout << "MapReduce results:" << std::endl;
-        for (const auto& kv : mapReduceResults) {
-            std::cout << kv.first << ": " << kv.second << std::endl;
-        }
+    if (mapReduceResult.type_ != mr_state_machine::NO_RESULT) {
+        print_map_reduce_results(mapReduceResult);
     }
 }
 
 void append_log(mr_state_machine::op_payload& payload) {
-    // Rest of the previous append_log
-    ptr<buffer> new_log = mr_state_machine::enc_log(payload);
+    payload.trace_id_ = Tracer::instance().sample();
+    const uint64_t trace_begin = payload.trace_id_ ? Tracer::now() : 0;
+
+    ptr<buffer> new_log;
+    {
+        TraceSpan traced(payload.trace_id_, "encode");
+        new_log = mr_state_machine::enc_log(payload);
+    }
 
     // To measure the elapsed time.
     ptr<TestSuite::Timer> timer = cs_new<TestSuite::Timer>();
@@ -81,7 +177,7 @@ void append_log(mr_state_machine::op_payload& payload) {
         //   `append_entries` returns after getting a consensus,buffer_serializer
         //   so that `ret` already has the result from state machine.
         ptr<std::exception> err(nullptr);
-        handle_result(timer, *ret, err);
+        handle_result(timer, payload.trace_id_, trace_begin, *ret, err);
 
     } else if (CALL_TYPE == raft_params::async_handler) {
         // Async mode:
@@ -90,6 +186,8 @@ void append_log(mr_state_machine::op_payload& payload) {
         //   after getting a consensus.
         ret->when_ready( std::bind( handle_result,
                                     timer,
+                                    payload.trace_id_,
+                                    trace_begin,
                                     std::placeholders::_1,
                                     std::placeholders::_2 ) );
 
@@ -98,93 +196,636 @@ void append_log(mr_state_machine::op_payload& payload) {
     }
 }
 
-void handle_kv_command(const std::string& cmd,
-                const std::vector<std::string>& tokens)
-{
-    if (tokens.size() < 2) {
-        std::cerr << "Error: Invalid command format for " << cmd << std::endl;
-        return;
+// Appends an entry created by the state machine and waits for its commit.
+bool submit_log(ptr<buffer> log) {
+    if (!stuff.raft_instance_) return false;
+    ptr<raft_result> ret = stuff.raft_instance_->append_entries( {log} );
+    return ret->get_accepted() && ret->get_result_code() == cmd_result_code::OK;
+}
+
+// The entry of a `+` or `-` command.
+// Throws std::runtime_error if the command is not valid.
+mr_state_machine::op_payload make_kv_payload(const std::vector<std::string>& tokens) {
+    const std::string& cmd = tokens[0];
+    if (tokens.size() < 2 || tokens.size() > 3 || (cmd == "+" && tokens.size() != 3)) {
+        throw std::runtime_error(cmd == "+"
+            ? "Invalid command format for addition. Usage: + <key> <value>"
+            : "Invalid command format for " + cmd);
     }
 
-    const std::string& key = tokens[1];
     mr_state_machine::op_type op;
     int value = 0; // Default value
+    if (tokens.size() == 3) {
+        try {
+            size_t parsed = 0;
+            value = std::stoi(tokens[2], &parsed);
+            if (parsed != tokens[2].size()) throw std::invalid_argument(tokens[2]);
+        } catch (const std::logic_error&) {
+            throw std::runtime_error("Invalid value " + tokens[2]);
+        }
+    }
 
     if (cmd == "+") {
-        if (tokens.size() != 3) {
-            std::cerr << "Error: Invalid command format for addition. Usage: + <key> <value>" << std::endl;
-            return;
-        }
-        value = std::stoi(tokens[2]);
         op = mr_state_machine::INSERT_VALUE;
-
     } else if (cmd == "-") {
-        if (tokens.size() == 3) {
-            // Command to delete a specific value
-            value = std::stoi(tokens[2]);
-            op = mr_state_machine::DELETE_VALUE;
-        } else {
-            // Command to delete the entire key
-            op = mr_state_machine::DELETE_KEY;
-        }
-
+        // A specific value, or the entire key.
+        op = tokens.size() == 3 ? mr_state_machine::DELETE_VALUE : mr_state_machine::DELETE_KEY;
     } else {
-        std::cerr << "Error: Unknown command " << cmd << std::endl;
+        throw std::runtime_error("Unknown command " + cmd);
+    }
+    return {op, tokens[1], value};
+}
+
+void handle_kv_command(const std::string& cmd,
+                const std::vector<std::string>& tokens)
+{
+    mr_state_machine::op_payload payload;
+    try {
+        payload = make_kv_payload(tokens);
+    } catch (const std::runtime_error& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
         return;
     }
 
     // Serialize and generate Raft log to append.
-    mr_state_machine::op_payload payload = {op, key, value};
     mapreduce_server::append_log(payload);
 }
 
-void handle_map_reduce_command(const std::vector<std::string>& tokens) {
-    if (tokens.size() < 7) {
-        std::cerr << "Error: Invalid command format for mapReduce" << std::endl;
+// import <path> [csv|binary]
+// Reads the file on this server, then replicates its values in INSERT_BATCH
+// entries of about a megabyte, several per append.
+void handle_import_command(const std::vector<std::string>& tokens) {
+    if (tokens.size() < 2 || tokens.size() > 3) {
+        std::cerr << "Error: Invalid command format for import. Usage: import <path> [csv|binary]"
+                  << std::endl;
+        return;
+    }
+
+    TestSuite::Timer timer;
+    BulkLoader::Groups groups;
+    try {
+        BulkLoader::Format format = tokens.size() == 3 ? BulkLoader::parseFormat(tokens[2])
+                                                       : BulkLoader::formatOf(tokens[1]);
+        groups = BulkLoader().load(tokens[1], format);
+    } catch (const std::runtime_error& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
         return;
     }
+    const size_t keys = groups.size();
+    size_t values = 0;
+    for (const auto& group : groups) {
+        values += group.second.size();
+    }
+    const uint64_t read_us = timer.getTimeUs();
+
+    std::vector<BulkLoader::Groups> batches =
+        BulkLoader::split(std::move(groups), IMPORT_BATCH_VALUES);
+    std::vector<ptr<raft_result>> results;
+    for (size_t first = 0; first < batches.size(); first += IMPORT_ENTRIES_PER_APPEND) {
+        std::vector<ptr<buffer>> logs;
+        for (size_t ii = first; ii < std::min(batches.size(), first + IMPORT_ENTRIES_PER_APPEND); ++ii) {
+            mr_state_machine::op_payload payload = {mr_state_machine::INSERT_BATCH, "", 0};
+            payload.batch_.swap(batches[ii]);
+            logs.push_back(mr_state_machine::enc_log(payload));
+        }
+        ptr<raft_result> ret = stuff.raft_instance_->append_entries(logs);
+        if (!ret->get_accepted()) {
+            std::cout << "failed to replicate: " << ret->get_result_code()
+                      << ", after " << first << " of " << batches.size() << " entries" << std::endl;
+            return;
+        }
+        results.push_back(ret);
+    }
+    // With the async handler, the appends above did not wait for their commits.
+    for (auto& ret : results) {
+        ret->get();
+        if (ret->get_result_code() != cmd_result_code::OK) {
+            std::cout << "failed: " << ret->get_result_code() << std::endl;
+            return;
+        }
+    }
+
+    const uint64_t total_us = std::max<uint64_t>(1, timer.getTimeUs());
+    std::cout << "imported " << values << " values of " << keys << " keys in "
+              << batches.size() << " entries, "
+              << TestSuite::usToString(total_us) << " (read "
+              << TestSuite::usToString(read_us) << "), "
+              << static_cast<uint64_t>(values * 1e6 / total_us) << " values/s" << std::endl;
+}
+
+// Read-only MapReduce on this replica, at a past log index.
+// Nothing is appended to the Raft log.
+void handle_map_reduce_read(const std::string& readAt,
+                            const mr_state_machine::op_payload& job)
+{
+    mr_state_machine* sm = get_sm();
+    bool pinned = false;
+    ulong log_idx = 0;
+    if (readAt == "last") {
+        log_idx = sm->pin_read_index();
+        pinned = true;
+    } else if (readAt == "snapshot") {
+        ptr<snapshot> snp = sm->last_snapshot();
+        if (!snp) {
+            std::cerr << "Error: No snapshot available" << std::endl;
+            return;
+        }
+        log_idx = snp->get_last_log_idx();
+    } else {
+        try {
+            log_idx = parse_number(readAt, "log index");
+        } catch (const std::runtime_error& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return;
+        }
+    }
+
+    try {
+        auto results = sm->map_reduce_at(log_idx, job);
+        std::cout << "read at log index: " << log_idx << std::endl;
+        print_map_reduce_results(results);
+    } catch (const std::runtime_error& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+    }
+    if (pinned) sm->unpin_read_index(log_idx);
+}
+
+// Options shared by `mapReduce` and `aggregate add`.
+struct map_reduce_args {
+    std::string mapFunc;
+    std::string reduceFunc;
+    std::string readAt;
+    OverflowPolicy overflow = OverflowPolicy::Wrap;
+    KeySelector selector;
+    bool distributed = false;
+    int standInMs = 1000;
+    bool async = false;
+    // Only the `limit` top keys, or bottom keys if `lowest`.
+    uint32_t limit = 0;
+    bool lowest = false;
+    std::string groupBy;
+};
 
-    std::string mapFunc, reduceFunc;
-    std::vector<std::string> keys;
+mr_state_machine::op_payload make_map_reduce_payload(mr_state_machine::op_type op,
+                                                     const map_reduce_args& args)
+{
+    mr_state_machine::op_payload payload = {op, "NULL", 0,
+                                            args.mapFunc, args.reduceFunc,
+                                            args.selector, args.overflow};
+    payload.limit_ = args.limit;
+    payload.lowest_ = args.lowest;
+    payload.group_by_ = args.groupBy;
+    payload.plugins_ = PluginRegistry::instance().requiredBy(args.mapFunc, args.reduceFunc);
+    return payload;
+}
+
+// Parses the options in `tokens` from index `first` on.
+bool parse_map_reduce_args(const std::vector<std::string>& tokens,
+                           size_t first,
+                           map_reduce_args& args)
+{
     bool isKeyFlag = false;
 
-    for (size_t i = 1; i < tokens.size(); ++i) {
+    for (size_t i = first; i < tokens.size(); ++i) {
         const std::string& token = tokens[i];
 
-        if (token == "--m") {
-            mapFunc = tokens[++i];
+        if (token == "--m" && i + 1 < tokens.size()) {
+            args.mapFunc = tokens[++i];
             isKeyFlag = false;
-        } else if (token == "--r") {
-            reduceFunc = tokens[++i];
+        } else if (token == "--r" && i + 1 < tokens.size()) {
+            args.reduceFunc = tokens[++i];
             isKeyFlag = false;
         } else if (token == "--k") {
             isKeyFlag = true;
+        } else if (token == "--all") {
+            args.selector = KeySelector::allKeys();
+            isKeyFlag = false;
+        } else if (token == "--prefix" && i + 1 < tokens.size()) {
+            args.selector = KeySelector::prefix(tokens[++i]);
+            isKeyFlag = false;
+        } else if (token == "--range" && i + 1 < tokens.size()) {
+            std::string begin = tokens[++i];
+            std::string end = (i + 1 < tokens.size() && tokens[i + 1].rfind("--", 0) != 0)
+                            ? tokens[++i] : "";
+            args.selector = KeySelector::range(begin, end);
+            isKeyFlag = false;
+        } else if (token == "--overflow" && i + 1 < tokens.size()) {
+            try {
+                args.overflow = parseOverflowPolicy(tokens[++i]);
+            } catch (const std::runtime_error& e) {
+                std::cerr << "Error: " << e.what() << std::endl;
+                return false;
+            }
+            isKeyFlag = false;
+        } else if (token == "--at" && i + 1 < tokens.size()) {
+            args.readAt = tokens[++i];
+            isKeyFlag = false;
+        } else if ((token == "--top" || token == "--bottom") && i + 1 < tokens.size()) {
+            args.lowest = token == "--bottom";
+            try {
+                args.limit = static_cast<uint32_t>(parse_number(tokens[++i], "number of keys",
+                                                                std::numeric_limits<uint32_t>::max()));
+            } catch (const std::runtime_error& e) {
+                std::cerr << "Error: " << e.what() << std::endl;
+                return false;
+            }
+            isKeyFlag = false;
+        } else if (token == "--group" && i + 1 < tokens.size()) {
+            args.groupBy = tokens[++i];
+            isKeyFlag = false;
+        } else if (token == "--async") {
+            args.async = true;
+            isKeyFlag = false;
+        } else if (token == "--distributed") {
+            args.distributed = true;
+            if (i + 1 < tokens.size() && tokens[i + 1].rfind("--", 0) != 0) {
+                try {
+                    args.standInMs = static_cast<int>(parse_number(tokens[++i], "stand-in time",
+                                                                   std::numeric_limits<int>::max()));
+                } catch (const std::runtime_error& e) {
+                    std::cerr << "Error: " << e.what() << std::endl;
+                    return false;
+                }
+            }
+            isKeyFlag = false;
         } else if (isKeyFlag) {
-            keys.push_back(token);
+            args.selector.keys.push_back(token);
+        }
+    }
+
+    bool hasKeys = args.selector.kind != KeySelector::Keys || !args.selector.keys.empty();
+    return !args.mapFunc.empty() && !args.reduceFunc.empty() && hasKeys;
+}
+
+// Splits a MapReduce into one partition per server. Each server computes
+// its partition at the job's log index and commits the partial result;
+// partitions still missing after `standInMs` are computed here instead.
+// Waits for the result on this server for up to `RESULT_TIMEOUT_MS` more.
+void handle_distributed_map_reduce(const map_reduce_args& args) {
+    if (CALL_TYPE != raft_params::blocking) {
+        std::cerr << "Error: --distributed needs the blocking call type" << std::endl;
+        return;
+    }
+    if (!args.groupBy.empty()) {
+        std::cerr << "Error: --group cannot be combined with --distributed" << std::endl;
+        return;
+    }
+    mr_state_machine* sm = get_sm();
+    std::vector<ptr<srv_config>> servers;
+    stuff.raft_instance_->get_srv_config_all(servers);
+
+    mr_state_machine::op_payload payload =
+        make_map_reduce_payload(mr_state_machine::MAP_REDUCE_PARTITIONED, args);
+    // Any split covering the selector works, so it is made once here
+    // and shipped in the log entry.
+    payload.partitions_ = sm->partition(args.selector, servers.size());
+    for (size_t ii = 0; ii < payload.partitions_.size(); ++ii) {
+        payload.owners_.push_back(servers[ii % servers.size()]->get_id());
+    }
+
+    ptr<TestSuite::Timer> timer = cs_new<TestSuite::Timer>();
+    ptr<raft_result> ret = stuff.raft_instance_->append_entries( {mr_state_machine::enc_log(payload)} );
+    if (!ret->get_accepted() || ret->get_result_code() != cmd_result_code::OK) {
+        std::cout << "failed: " << ret->get_result_code() << ", "
+                  << TestSuite::usToString( timer->getTimeUs() )
+                  << std::endl;
+        return;
+    }
+    ulong job_idx = 0;
+    mr_state_machine::mr_result unused;
+    mr_state_machine::dec_results(*ret->get(), job_idx, unused);
+    std::cout << "succeeded, log index: " << job_idx << ", "
+              << payload.partitions_.size() << " partitions" << std::endl;
+
+    // On a follower the append returns once the leader commits, which may
+    // be before this server applies the entry; until then the job has
+    // neither a result nor missing partitions here.
+    const uint64_t RESULT_TIMEOUT_MS = 10000;
+    mr_state_machine::mr_result result;
+    bool found = sm->find_map_reduce_result(job_idx, result);
+    while (!found && timer->getTimeUs() < args.standInMs * 1000ULL) {
+        TestSuite::sleep_ms(10);
+        found = sm->find_map_reduce_result(job_idx, result);
+    }
+    if (!found) {
+        for (size_t partition : sm->missing_partitions(job_idx)) {
+            std::cout << "standing in for partition " << partition << std::endl;
+            if (!sm->submit_partial(job_idx, partition)
+                && !sm->find_map_reduce_result(job_idx, result)) {
+                std::cout << "MapReduce failed: partition " << partition
+                          << " was not submitted" << std::endl;
+                return;
+            }
         }
     }
+    const uint64_t deadline_us = (args.standInMs + RESULT_TIMEOUT_MS) * 1000ULL;
+    while (!found && timer->getTimeUs() < deadline_us) {
+        TestSuite::sleep_ms(10);
+        found = sm->find_map_reduce_result(job_idx, result);
+    }
+    if (!found) {
+        std::cout << "MapReduce failed: no result after "
+                  << TestSuite::usToString(timer->getTimeUs()) << std::endl;
+        return;
+    }
+    print_map_reduce_results(result);
+}
 
-    if (mapFunc.empty() || reduceFunc.empty() || keys.empty()) {
+void handle_map_reduce_command(const std::vector<std::string>& tokens) {
+    map_reduce_args args;
+    if (tokens.size() < 6 || !parse_map_reduce_args(tokens, 1, args)) {
         std::cerr << "Error: Invalid command format for mapReduce" << std::endl;
         return;
     }
 
-    mr_state_machine::op_payload payload = {mr_state_machine::MAP_REDUCE, "NULL", 0, mapFunc, reduceFunc, keys};
+    if (!args.readAt.empty()) {
+        handle_map_reduce_read(args.readAt,
+                               make_map_reduce_payload(mr_state_machine::MAP_REDUCE, args));
+        return;
+    }
+
+    if (args.distributed) {
+        handle_distributed_map_reduce(args);
+        return;
+    }
+
+    mr_state_machine::op_type op = args.async ? mr_state_machine::MAP_REDUCE_ASYNC
+                                              : mr_state_machine::MAP_REDUCE;
+    mr_state_machine::op_payload payload = make_map_reduce_payload(op, args);
     mapreduce_server::append_log(payload);
+    if (args.async) {
+        std::cout << "job id is the log index; see `job status <id>`" << std::endl;
+    }
 }
 
-void print_kv_store() {
-    auto kv_pairs = get_sm()->get_kv_store().getAll();
-    for (const auto& kv : kv_pairs) {
-        std::cout << kv.first << ": ";
-        const auto& values = kv.second;
-        for (size_t i = 0; i < values.size(); ++i) {
-            std::cout << values[i];
-            if (i < values.size() - 1) {
-                std::cout << ", ";
-            }
+// job status <id>
+// job result <id>
+// job wait <id> [<timeout ms>]
+// job cancel <id>
+// job list
+void handle_job_command(const std::vector<std::string>& tokens) {
+    const std::string sub = tokens.size() > 1 ? tokens[1] : "";
+    mr_state_machine* sm = get_sm();
+
+    if (sub == "list") {
+        for (const auto& job : sm->list_jobs()) {
+            std::cout << job.first << ": " << JobExecutor::statusName(job.second) << std::endl;
         }
+        return;
+    }
+    if (tokens.size() < 3) {
+        std::cerr << "Error: Invalid command format for job" << std::endl;
+        return;
+    }
+    ulong job_idx = 0;
+    int timeoutMs = 10000;
+    try {
+        job_idx = parse_number(tokens[2], "job id");
+        if (sub == "wait" && tokens.size() > 3) {
+            timeoutMs = static_cast<int>(parse_number(tokens[3], "timeout",
+                                                      std::numeric_limits<int>::max()));
+        }
+    } catch (const std::runtime_error& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return;
+    }
+
+    if (sub == "status") {
+        std::string error;
+        JobExecutor::Status status = sm->get_job_status(job_idx, error);
+        std::cout << job_idx << ": " << JobExecutor::statusName(status);
+        if (!error.empty()) std::cout << " (" << error << ")";
         std::cout << std::endl;
+
+    } else if (sub == "result") {
+        auto results = sm->get_map_reduce_results(job_idx);
+        if (results.type_ == mr_state_machine::NO_RESULT) {
+            std::cout << "no result for job " << job_idx << std::endl;
+        } else {
+            print_map_reduce_results(results);
+        }
+
+    } else if (sub == "wait") {
+        if (!sm->wait_for_job(job_idx, std::chrono::milliseconds(timeoutMs))) {
+            std::cout << "job " << job_idx << " is still running" << std::endl;
+            return;
+        }
+        print_map_reduce_results(sm->get_map_reduce_results(job_idx));
+
+    } else if (sub == "cancel") {
+        // Replicated, so that every server stops its copy of the job.
+        mr_state_machine::op_payload payload = {mr_state_machine::CANCEL_JOB, "NULL", 0};
+        payload.job_idx_ = job_idx;
+        mapreduce_server::append_log(payload);
+
+    } else {
+        std::cerr << "Error: Invalid command format for job" << std::endl;
+    }
+}
+
+// aggregate add <name> --m <map_func> --r <reduce_func> <keys>
+// aggregate drop <name>
+// aggregate get <name> [<key>]
+// aggregate list
+void handle_aggregate_command(const std::vector<std::string>& tokens) {
+    const std::string sub = tokens.size() > 1 ? tokens[1] : "";
+    mr_state_machine* sm = get_sm();
+
+    if (sub == "add" && tokens.size() >= 3) {
+        map_reduce_args args;
+        if (!parse_map_reduce_args(tokens, 3, args)) {
+            std::cerr << "Error: Invalid command format for aggregate add" << std::endl;
+            return;
+        }
+        try {
+            // Rejected here, so that no replica logs a failed registration.
+            ContinuousAggregate check(args.mapFunc, args.reduceFunc, args.selector);
+        } catch (const std::runtime_error& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return;
+        }
+        mr_state_machine::op_payload payload = {mr_state_machine::REGISTER_AGGREGATE, tokens[2], 0,
+                                                args.mapFunc, args.reduceFunc, args.selector};
+        payload.plugins_ = PluginRegistry::instance().requiredBy(args.mapFunc, args.reduceFunc);
+        mapreduce_server::append_log(payload);
+
+    } else if (sub == "drop" && tokens.size() == 3) {
+        mr_state_machine::op_payload payload = {mr_state_machine::DROP_AGGREGATE, tokens[2], 0};
+        mapreduce_server::append_log(payload);
+
+    } else if (sub == "get" && (tokens.size() == 3 || tokens.size() == 4)) {
+        try {
+            if (tokens.size() == 4) {
+                int64_t result = 0;
+                if (sm->get_aggregate_result(tokens[2], tokens[3], result)) {
+                    std::cout << tokens[3] << ": " << result << std::endl;
+                } else {
+                    std::cout << tokens[3] << ": (no result)" << std::endl;
+                }
+            } else {
+                for (const auto& kv : sm->get_aggregate_results(tokens[2])) {
+                    std::cout << kv.first << ": " << kv.second << std::endl;
+                }
+            }
+        } catch (const std::runtime_error& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+
+    } else if (sub == "list") {
+        for (const auto& def : sm->list_aggregates()) {
+            std::cout << def.key_ << ": --m " << def.map_op_ << " --r " << def.reduce_op_;
+            const KeySelector& selector = def.selector_;
+            switch (selector.kind) {
+                case KeySelector::Keys:
+                    std::cout << " --k";
+                    for (const auto& key : selector.keys) std::cout << " " << key;
+                    break;
+                case KeySelector::All:
+                    std::cout << " --all";
+                    break;
+                case KeySelector::Prefix:
+                    std::cout << " --prefix " << selector.begin;
+                    break;
+                case KeySelector::Range:
+                    std::cout << " --range " << selector.begin << " " << selector.end;
+                    break;
+            }
+            std::cout << std::endl;
+        }
+
+    } else {
+        std::cerr << "Error: Invalid command format for aggregate" << std::endl;
+    }
+}
+
+// Visits [begin, end) of the store as of the last committed index, a page
+// at a time, so that the store is neither copied whole nor locked throughout.
+void scan_store(const std::string& begin, const std::string& end,
+                const std::function<void(const BulkLoader::Groups&)>& visit_page)
+{
+    mr_state_machine* sm = get_sm();
+    const ulong log_idx = sm->pin_read_index();
+    try {
+        BulkLoader::Groups page;
+        std::string from = begin, next;
+        bool more = true;
+        while (more) {
+            more = sm->scan_at(log_idx, from, end, SCAN_PAGE_KEYS, page, next);
+            visit_page(page);
+            from = next;
+        }
+    } catch (...) {
+        sm->unpin_read_index(log_idx);
+        throw;
+    }
+    sm->unpin_read_index(log_idx);
+}
+
+void append_key_values(std::string& out, const std::string& key, const std::vector<int>& values) {
+    out += key;
+    out += ": ";
+    for (size_t i = 0; i < values.size(); ++i) {
+        if (i > 0) out += ", ";
+        out += std::to_string(values[i]);
+    }
+    out += '\n';
+}
+
+void print_kv_store() {
+    // A write per page and a flush at the end, rather than one per key.
+    std::string out;
+    scan_store("", "", [&](const BulkLoader::Groups& page) {
+        for (const auto& kv : page) {
+            append_key_values(out, kv.first, kv.second);
+        }
+        std::cout << out;
+        out.clear();
+    });
+    std::cout.flush();
+}
+
+// scan [<from>] [<count>]
+// One page of keys, from the first key not below `from`, and the key to
+// continue from, if any.
+void handle_scan_command(const std::vector<std::string>& tokens) {
+    if (tokens.size() > 3) {
+        std::cerr << "Error: Invalid command format for scan. Usage: scan [<from>] [<count>]"
+                  << std::endl;
+        return;
+    }
+    const std::string from = tokens.size() > 1 ? tokens[1] : "";
+    size_t count = 20;
+    try {
+        if (tokens.size() > 2) count = parse_number(tokens[2], "count");
+    } catch (const std::runtime_error& e) {
+        count = 0;
+    }
+    if (count == 0) {
+        std::cerr << "Error: Invalid count " << tokens[2]
+                  << ". Usage: scan [<from>] [<count>]" << std::endl;
+        return;
+    }
+
+    mr_state_machine* sm = get_sm();
+    const ulong log_idx = sm->pin_read_index();
+    BulkLoader::Groups page;
+    std::string next;
+    const bool more = sm->scan_at(log_idx, from, "", count, page, next);
+    sm->unpin_read_index(log_idx);
+
+    std::string out;
+    for (const auto& kv : page) {
+        append_key_values(out, kv.first, kv.second);
+    }
+    std::cout << out << "read at log index: " << log_idx << std::endl;
+    if (more) {
+        std::cout << "next: scan " << next << " " << count << std::endl;
+    }
+}
+
+// export <path|tcp:<host>:<port>> [csv|binary] [--prefix <prefix> | --range <begin> [<end>]]
+void handle_export_command(const std::vector<std::string>& tokens) {
+    if (tokens.size() < 2) {
+        std::cerr << "Error: Invalid command format for export" << std::endl;
+        return;
+    }
+    const std::string& destination = tokens[1];
+    std::string begin, end;
+    try {
+        BulkLoader::Format format = BulkLoader::formatOf(destination);
+        size_t ii = 2;
+        if (ii < tokens.size() && tokens[ii].compare(0, 2, "--") != 0) {
+            format = BulkLoader::parseFormat(tokens[ii++]);
+        }
+        if (ii + 2 == tokens.size() && tokens[ii] == "--prefix") {
+            KeySelector::prefix(tokens[ii + 1]).bounds(begin, end);
+        } else if (ii + 2 <= tokens.size() && ii + 3 >= tokens.size() && tokens[ii] == "--range") {
+            KeySelector::range(tokens[ii + 1], ii + 3 == tokens.size() ? tokens[ii + 2] : "")
+                .bounds(begin, end);
+        } else if (ii != tokens.size()) {
+            std::cerr << "Error: Invalid command format for export" << std::endl;
+            return;
+        }
+
+        TestSuite::Timer timer;
+        BulkExporter exporter(destination, format);
+        scan_store(begin, end, [&](const BulkLoader::Groups& page) {
+            for (const auto& kv : page) {
+                exporter.add(kv.first, kv.second);
+            }
+        });
+        exporter.finish();
+
+        const uint64_t elapsed_us = std::max<uint64_t>(1, timer.getTimeUs());
+        std::ostringstream rate;
+        // Bytes per microsecond are MB/s.
+        rate << std::fixed << std::setprecision(1)
+             << static_cast<double>(exporter.getBytes()) / elapsed_us;
+        std::cout << "exported " << exporter.getValues() << " values of " << exporter.getKeys()
+                  << " keys, " << exporter.getBytes() << " bytes in "
+                  << TestSuite::usToString(elapsed_us) << ", " << rate.str() << " MB/s" << std::endl;
+    } catch (const std::runtime_error& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
     }
 }
 
@@ -214,21 +855,158 @@ void print_status(const std::string& cmd,
                 ? stuff.sm_->last_snapshot()->get_last_log_idx() : 0) << std::endl
         << "last snapshot log term: "
             << (stuff.sm_->last_snapshot()
-                ? stuff.sm_->last_snapshot()->get_last_log_term() : 0) << std::endl
+                ? stuff.sm_->last_snapshot()->get_last_log_term() : 0) << std::endl;
+
+    uint64_t spilled_runs = 0, spilled_bytes = 0;
+    get_sm()->get_spill_stats(spilled_runs, spilled_bytes);
+    std::cout
+        << "spilled runs: " << spilled_runs
+            << " (" << spilled_bytes << " bytes)" << std::endl
         << "Key-Value Store Contents:" << std::endl;
         print_kv_store();
 }
 
+// Resident set size of this process.
+double resident_bytes() {
+    long pages = 0, resident = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+        if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) resident = 0;
+        fclose(statm);
+    }
+    return static_cast<double>(resident) * sysconf(_SC_PAGESIZE);
+}
+
+// Raft and store state, read when the metrics are reported.
+void register_gauges() {
+    MetricsRegistry& registry = MetricsRegistry::instance();
+    registry.gauge("raft.term", [] {
+        return static_cast<double>(stuff.raft_instance_->get_term());
+    });
+    registry.gauge("raft.leader_id", [] {
+        return static_cast<double>(stuff.raft_instance_->get_leader());
+    });
+    registry.gauge("raft.commit_index", [] {
+        return static_cast<double>(stuff.raft_instance_->get_committed_log_idx());
+    });
+    registry.gauge("raft.log_start_index", [] {
+        return static_cast<double>(stuff.smgr_->load_log_store()->start_index());
+    });
+    registry.gauge("raft.log_next_index", [] {
+        return static_cast<double>(stuff.smgr_->load_log_store()->next_slot());
+    });
+    registry.gauge("snapshot.last_index", [] {
+        ptr<snapshot> last = stuff.sm_->last_snapshot();
+        return last ? static_cast<double>(last->get_last_log_idx()) : 0.0;
+    });
+    registry.gauge("store.keys", [] {
+        size_t keys = 0, values = 0;
+        get_sm()->get_store_counts(keys, values);
+        return static_cast<double>(keys);
+    });
+    registry.gauge("store.values", [] {
+        size_t keys = 0, values = 0;
+        get_sm()->get_store_counts(keys, values);
+        return static_cast<double>(values);
+    });
+    registry.gauge("process.resident_bytes", resident_bytes);
+}
+
+// trace [status]
+// trace sample <n>
+// trace export <path>
+void handle_trace_command(const std::vector<std::string>& tokens) {
+    const std::string sub = tokens.size() > 1 ? tokens[1] : "status";
+    Tracer& tracer = Tracer::instance();
+
+    if (sub == "status" && tokens.size() <= 2) {
+        std::cout << "sampling: ";
+        if (tracer.getSampling()) {
+            std::cout << "1 in " << tracer.getSampling() << std::endl;
+        } else {
+            std::cout << "off" << std::endl;
+        }
+        std::cout << "recorded spans: " << tracer.getRecorded()
+                  << " (" << tracer.getDropped() << " dropped)" << std::endl;
+
+    } else if (sub == "sample" && tokens.size() == 3) {
+        try {
+            tracer.setSampling(static_cast<uint32_t>(
+                parse_number(tokens[2], "sampling", std::numeric_limits<uint32_t>::max())));
+        } catch (const std::runtime_error& e) {
+            std::cerr << "Error: " << e.what() << ". Usage: trace sample <n>, 0 for off"
+                      << std::endl;
+        }
+
+    } else if (sub == "export" && tokens.size() == 3) {
+        std::ofstream out(tokens[2]);
+        if (!out) {
+            std::cerr << "Error: Cannot write " << tokens[2] << std::endl;
+            return;
+        }
+        std::cout << tracer.exportChrome(out) << " spans written to " << tokens[2] << std::endl;
+
+    } else {
+        std::cerr << "Error: Invalid command format for trace" << std::endl;
+    }
+}
+
+// metrics [reset]
+void handle_metrics_command(const std::vector<std::string>& tokens) {
+    if (tokens.size() == 1) {
+        std::cout << MetricsRegistry::instance().report();
+    } else if (tokens.size() == 2 && tokens[1] == "reset") {
+        MetricsRegistry::instance().reset();
+    } else {
+        std::cerr << "Error: Invalid command format for metrics" << std::endl;
+    }
+}
+
 void help(const std::string& cmd,
           const std::vector<std::string>& tokens)
 {
     std::cout
     << "KV Store:\n"
     << "  mapReduce --m <map_func> --r <reduce_func> --k <keys> - Apply MapReduce\n"
+    << "    map_func: square, double, triple, add:k, mul:k, gt:k,\n"
+    << "    or a chain of them such as square|triple|gt:100\n"
+    << "    reduce_func: sum, product, min, max, count, sum_of_squares, distinct, or a\n"
+    << "    comma separated list of statistics computed in one pass: count, sum, min,\n"
+    << "    max, mean, variance, stddev, sum_of_squares, distinct, p<percent> (e.g. p99)\n"
+    << "  mapReduce --m <map_func> --r <reduce_func> --all - Apply MapReduce to every key\n"
+    << "  mapReduce --m <map_func> --r <reduce_func> --prefix <prefix> - ... to keys with a prefix\n"
+    << "  mapReduce --m <map_func> --r <reduce_func> --range <begin> [<end>] - ... to keys in [begin, end)\n"
+    << "  mapReduce ... --overflow <wrap|saturate|checked> - 64-bit overflow handling\n"
+    << "  mapReduce ... --at <log index|last|snapshot> - Read-only MapReduce at a past index\n"
+    << "  mapReduce ... --top|--bottom <k> - Only the k keys with the largest or smallest\n"
+    << "    result of a single reduce_func, e.g. the heaviest hitters of --all\n"
+    << "  mapReduce ... --group <prefix:N|regex:pattern> - Reduce across the keys of each\n"
+    << "    group: the key up to its Nth '/', or the first regex capture (not distributed)\n"
+    << "  mapReduce ... --distributed [<stand-in ms>] - Split the job across the servers\n"
+    << "  mapReduce ... --async - Run the job in the background; its id is the log index\n"
+    << "  job status|result|cancel <id> - Inspect or cancel an asynchronous job\n"
+    << "  job wait <id> [<timeout ms>] - Wait for a job and print its result\n"
+    << "  job list - List the asynchronous jobs\n"
+    << "  aggregate add <name> --m <map_func> --r <reduce_func> <keys> - Register an\n"
+    << "    aggregate kept up to date on every commit (sum, count, sum_of_squares, min, max,\n"
+    << "    distinct, p<percent>)\n"
+    << "  aggregate get <name> [<key>] - Read an aggregate's current results\n"
+    << "  aggregate drop <name> - Remove an aggregate\n"
+    << "  aggregate list - List the registered aggregates\n"
+    << "  plugin load <path> - Load map/reduce operators from a shared object on every\n"
+    << "    server; the path must be valid on all of them\n"
+    << "  plugin list - List the loaded plugins and their operators\n"
     << "  + <key> <value> - Add value to key\n"
+    << "  import <path> [csv|binary] - Add the values in a file: `key,value[,value...]`\n"
+    << "    lines, or binary records (see BulkLoader.h); csv if the name ends in .csv\n"
     << "  - <key> - Remove key\n"
     << "  - <key> <value> - Remove value from key\n"
     << "  store - Display all key-value pairs\n"
+    << "  scan [<from>] [<count>] - Display a page of count keys (default 20) from the\n"
+    << "    first key not below from, and the command for the next page\n"
+    << "  export <path|tcp:<host>:<port>> [csv|binary] [--prefix <prefix> | --range <begin>\n"
+    << "    [<end>]] - Write keys and values to a file or connection, in the formats of\n"
+    << "    import; csv if the path ends in .csv\n"
     << "\n"
     << "add server: add <server id> <address>:<port>\n"
     << "    e.g.) add 2 127.0.0.1:20000\n"
@@ -237,16 +1015,58 @@ void help(const std::string& cmd,
     << "\n"
     << "get the list of members: ls (or list)\n"
     << "\n"
+    << "latency and counters of this server: metrics\n"
+    << "    metrics reset - Clear them\n"
+    << "\n"
+    << "trace requests through Raft: trace sample <n> - Trace 1 in n requests (0: off)\n"
+    << "    trace export <path> - Write the spans as Chrome trace JSON and clear them\n"
+    << "    trace status - Sampling and number of spans\n"
+    << "\n"
     << "exit - Exit this program\n";
 }
 
 
+// plugin load <path>
+// plugin list
+void handle_plugin_command(const std::vector<std::string>& tokens) {
+    const std::string sub = tokens.size() > 1 ? tokens[1] : "";
+
+    if (sub == "load" && tokens.size() == 3) {
+        try {
+            // Rejected here, so that no replica commits a load that fails.
+            // The plugin is only registered once the entry commits.
+            PluginRegistry::instance().check(tokens[2]);
+        } catch (const std::runtime_error& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return;
+        }
+        // Replicated, so every server loads the plugin before any
+        // later job that uses its operators is committed.
+        mr_state_machine::op_payload payload = {mr_state_machine::LOAD_PLUGIN, tokens[2], 0};
+        mapreduce_server::append_log(payload);
+
+    } else if (sub == "list") {
+        for (const auto& plugin : PluginRegistry::instance().list()) {
+            std::cout << plugin.name << "@" << plugin.version << " (" << plugin.path << "):";
+            for (const auto& op : plugin.mapOperators) std::cout << " map " << op;
+            for (const auto& op : plugin.reduceOperators) std::cout << " reduce " << op;
+            std::cout << std::endl;
+        }
+
+    } else {
+        std::cerr << "Error: Invalid command format for plugin" << std::endl;
+    }
+}
+
 bool do_cmd(const std::vector<std::string>& tokens) {
     if (!tokens.size()) return true;
 
     const std::string& cmd = tokens[0];
 
     if (cmd == "q" || cmd == "exit") {
+        // The gauges read `stuff`.
+        METRICS_HTTP.reset();
+        MetricsRegistry::instance().stopDump();
         stuff.launcher_.shutdown(5);
         stuff.reset();
         return false;
@@ -254,12 +1074,30 @@ bool do_cmd(const std::vector<std::string>& tokens) {
     } else if (cmd == "mapReduce") {
         handle_map_reduce_command(tokens);
 
+    } else if (cmd == "job") {
+        handle_job_command(tokens);
+
+    } else if (cmd == "aggregate") {
+        handle_aggregate_command(tokens);
+
+    } else if (cmd == "plugin") {
+        handle_plugin_command(tokens);
+
     } else if (cmd == "+") {
         handle_kv_command(cmd, tokens);
 
     } else if (cmd == "-") {
         handle_kv_command(cmd, tokens);
 
+    } else if (cmd == "import") {
+        handle_import_command(tokens);
+
+    } else if (cmd == "scan") {
+        handle_scan_command(tokens);
+
+    } else if (cmd == "export") {
+        handle_export_command(tokens);
+
     } else if (cmd == "store") {
             print_kv_store();
 
@@ -273,18 +1111,255 @@ bool do_cmd(const std::vector<std::string>& tokens) {
     } else if ( cmd == "ls" || cmd == "list" ) {
         server_list(cmd, tokens);
 
+    } else if ( cmd == "metrics" ) {
+        handle_metrics_command(tokens);
+
+    } else if ( cmd == "trace" ) {
+        handle_trace_command(tokens);
+
     } else if ( cmd == "h" || cmd == "help" ) {
         help(cmd, tokens);
     }
     return true;
 }
 
+// A line of a batch file. `+` and `-` are parsed into their entry up front.
+struct batch_command {
+    size_t line;
+    std::vector<std::string> tokens;
+    bool replicated = false;
+    mr_state_machine::op_payload payload;
+};
+
+// Bounds the entries of a batch that are replicating at once, and counts
+// their results.
+class batch_window {
+public:
+    explicit batch_window(size_t size) : size_(size) {}
+
+    void acquire() {
+        std::unique_lock<std::mutex> guard(lock_);
+        cv_.wait(guard, [this] { return in_flight_ < size_; });
+        ++in_flight_;
+    }
+
+    void release(bool succeeded) {
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            --in_flight_;
+            ++(succeeded ? succeeded_ : failed_);
+        }
+        cv_.notify_all();
+    }
+
+    // Waits for every entry in flight.
+    void drain() {
+        std::unique_lock<std::mutex> guard(lock_);
+        cv_.wait(guard, [this] { return in_flight_ == 0; });
+    }
+
+    size_t succeeded() {
+        std::lock_guard<std::mutex> guard(lock_);
+        return succeeded_;
+    }
+
+    size_t failed() {
+        std::lock_guard<std::mutex> guard(lock_);
+        return failed_;
+    }
+
+private:
+    const size_t size_;
+    std::mutex lock_;
+    std::condition_variable cv_;
+    size_t in_flight_ = 0;
+    size_t succeeded_ = 0;
+    size_t failed_ = 0;
+};
+
+// Parses every line of `path`. Returns false, after reporting every invalid
+// line, if there is one.
+bool parse_batch(const std::string& path, std::vector<batch_command>& commands_out) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::cerr << "Error: Cannot read " << path << std::endl;
+        return false;
+    }
+    std::stringstream content;
+    content << in.rdbuf();
+    const std::string text = content.str();
+
+    bool valid = true;
+    size_t line = 0;
+    for (size_t begin = 0; begin < text.size(); ) {
+        size_t end = text.find('\n', begin);
+        if (end == std::string::npos) end = text.size();
+        ++line;
+        std::string command = text.substr(begin, end - begin);
+        begin = end + 1;
+        if (!command.empty() && command.back() == '\r') command.pop_back();
+        std::vector<std::string> tokens = tokenize(command.c_str());
+        if (tokens.empty() || tokens[0][0] == '#') continue;
+
+        batch_command parsed{line, std::move(tokens)};
+        if (parsed.tokens[0] == "+" || parsed.tokens[0] == "-") {
+            try {
+                parsed.payload = make_kv_payload(parsed.tokens);
+                parsed.replicated = true;
+            } catch (const std::runtime_error& e) {
+                std::cerr << path << ":" << line << ": " << e.what() << std::endl;
+                valid = false;
+            }
+        }
+        commands_out.push_back(std::move(parsed));
+    }
+    return valid;
+}
+
+// Appends the entry of `command` once the window has room for it. Its
+// result is counted when it commits, without waiting here.
+void submit_batch_command(batch_window& window, batch_command& command) {
+    static LatencyHistogram& append_to_commit =
+        MetricsRegistry::instance().histogram("raft.append_to_commit");
+    static MetricCounter& append_failed =
+        MetricsRegistry::instance().counter("raft.append_failed");
+
+    command.payload.trace_id_ = Tracer::instance().sample();
+    ptr<buffer> new_log = mr_state_machine::enc_log(command.payload);
+    window.acquire();
+    ptr<TestSuite::Timer> timer = cs_new<TestSuite::Timer>();
+    ptr<raft_result> ret = stuff.raft_instance_->append_entries( {new_log} );
+    const size_t line = command.line;
+    if (!ret->get_accepted()) {
+        append_failed.add();
+        std::cerr << "line " << line << ": failed to replicate: "
+                  << ret->get_result_code() << std::endl;
+        window.release(false);
+        return;
+    }
+    ret->when_ready([&window, timer, line](raft_result& result, ptr<std::exception>& err) {
+        const bool succeeded = result.get_result_code() == cmd_result_code::OK;
+        if (succeeded) {
+            append_to_commit.record(timer->getTimeUs() * 1000);
+        } else {
+            append_failed.add();
+            std::cerr << "line " << line << ": failed: " << result.get_result_code() << std::endl;
+        }
+        window.release(succeeded);
+    });
+}
+
+// Runs the commands of BATCH_FILE. `+` and `-` are pipelined; any other
+// command first waits for the entries before it, then runs as at the prompt.
+// Returns false if a line is invalid or an entry failed.
+bool run_batch() {
+    TestSuite::Timer timer;
+    std::vector<batch_command> commands;
+    if (!parse_batch(BATCH_FILE, commands)) {
+        return false;
+    }
+    const uint64_t parse_us = timer.getTimeUs();
+
+    // Appends are rejected until there is a leader.
+    for (size_t ii = 0; ii < 50 && stuff.raft_instance_->get_leader() < 1; ++ii) {
+        TestSuite::sleep_ms(100);
+    }
+
+    batch_window window(BATCH_WINDOW);
+    size_t replicated = 0;
+    for (auto& command : commands) {
+        if (command.replicated) {
+            submit_batch_command(window, command);
+            ++replicated;
+            continue;
+        }
+        window.drain();
+        const std::string& cmd = command.tokens[0];
+        if (cmd == "q" || cmd == "exit") break;
+        do_cmd(command.tokens);
+    }
+    window.drain();
+    // Entries of the other commands report their results on their own;
+    // give them until the client timeout to be applied.
+    const ulong last_idx = stuff.raft_instance_->get_last_log_idx();
+    for (size_t ii = 0; ii < 300 && get_sm()->last_commit_index() < last_idx; ++ii) {
+        TestSuite::sleep_ms(10);
+    }
+
+    const uint64_t elapsed_us = std::max<uint64_t>(1, timer.getTimeUs());
+    std::cout << "batch: " << commands.size() << " commands in "
+              << TestSuite::usToString(elapsed_us) << " (parse "
+              << TestSuite::usToString(parse_us) << "), "
+              << static_cast<uint64_t>(commands.size() * 1e6 / elapsed_us) << " commands/s; "
+              << replicated << " pipelined with a window of " << BATCH_WINDOW << ": "
+              << window.succeeded() << " succeeded, " << window.failed() << " failed"
+              << std::endl;
+    return window.failed() == 0;
+}
+
+void mr_server_usage(int argc, char** argv);
+
+// The value of the flag at `argv[ii]`, from `min` to `max`. Prints the
+// usage and exits for anything else.
+uint64_t parse_flag_number(int argc, char** argv, int& ii, uint64_t min, uint64_t max) {
+    const std::string flag = argv[ii++];
+    try {
+        const uint64_t value = parse_number(argv[ii], flag + " value", max);
+        if (value >= min) return value;
+    } catch (const std::runtime_error& e) {
+    }
+    std::cerr << "Error: " << flag << " takes a number from " << min << " to " << max
+              << ", not " << argv[ii] << std::endl;
+    mr_server_usage(argc, argv);
+    return min;
+}
+
 void check_additional_flags(int argc, char** argv) {
     for (int ii = 1; ii < argc; ++ii) {
         if (strcmp(argv[ii], "--async-handler") == 0) {
             CALL_TYPE = raft_params::async_handler;
         } else if (strcmp(argv[ii], "--async-snapshot-creation") == 0) {
             ASYNC_SNAPSHOT_CREATION = true;
+        } else if (strcmp(argv[ii], "--max-jobs") == 0 && ii + 1 < argc) {
+            // One worker thread each.
+            MAX_JOBS = parse_flag_number(argc, argv, ii, 1, 1024);
+        } else if (strcmp(argv[ii], "--memory-limit") == 0 && ii + 1 < argc) {
+            // 0 is no limit, so a typo must not become it.
+            MEMORY_LIMIT_MB = parse_flag_number(argc, argv, ii, 0,
+                                                std::numeric_limits<size_t>::max() >> 20);
+        } else if (strcmp(argv[ii], "--spill-dir") == 0 && ii + 1 < argc) {
+            SPILL_DIR = argv[++ii];
+        } else if (strcmp(argv[ii], "--partition-timeout") == 0 && ii + 1 < argc) {
+            PARTITION_TIMEOUT_MS = static_cast<int>(parse_flag_number(
+                argc, argv, ii, 1, std::numeric_limits<int>::max()));
+        } else if (strcmp(argv[ii], "--metrics-interval") == 0 && ii + 1 < argc) {
+            METRICS_INTERVAL_SEC = static_cast<int>(parse_flag_number(
+                argc, argv, ii, 0, std::numeric_limits<int>::max()));
+        } else if (strcmp(argv[ii], "--metrics-port") == 0 && ii + 1 < argc) {
+            METRICS_PORT = static_cast<int>(parse_flag_number(argc, argv, ii, 1, 65535));
+        } else if (strcmp(argv[ii], "--metrics-address") == 0 && ii + 1 < argc) {
+            METRICS_ADDRESS = argv[++ii];
+        } else if (strcmp(argv[ii], "--batch") == 0 && ii + 1 < argc) {
+            BATCH_FILE = argv[++ii];
+            // The window needs appends that return before their commit.
+            CALL_TYPE = raft_params::async_handler;
+        } else if (strcmp(argv[ii], "--batch-window") == 0 && ii + 1 < argc) {
+            BATCH_WINDOW = parse_flag_number(argc, argv, ii, 1,
+                                             std::numeric_limits<uint32_t>::max());
+        } else if (strcmp(argv[ii], "--trace-sample") == 0 && ii + 1 < argc) {
+            TRACE_SAMPLING = static_cast<uint32_t>(parse_flag_number(
+                argc, argv, ii, 0, std::numeric_limits<uint32_t>::max()));
+        } else if (strcmp(argv[ii], "--log-mode") == 0 && ii + 1 < argc) {
+            std::string mode = argv[++ii];
+            if (mode == "deferred") {
+                LOG_MODE = SimpleLogger::DEFERRED_MODE;
+            } else if (mode == "binary") {
+                LOG_MODE = SimpleLogger::BINARY_MODE;
+            } else if (mode == "text") {
+                LOG_MODE = SimpleLogger::TEXT_MODE;
+            } else {
+                mr_server_usage(argc, argv);
+            }
         }
     }
 }
@@ -297,6 +1372,39 @@ void mr_server_usage(int argc, char** argv) {
     ss << "    options:" << std::endl;
     ss << "      --async-handler: use async type handler." << std::endl;
     ss << "      --async-snapshot-creation: create snapshots asynchronously."
+       << std::endl;
+    ss << "      --max-jobs <n>: run up to n asynchronous MapReduce jobs at once (default 2)."
+       << std::endl;
+    ss << "      --memory-limit <MB>: cap the intermediate results of all group-by jobs,"
+       << std::endl
+       << "        spilling the rest to disk (default 0, no limit)." << std::endl;
+    ss << "      --spill-dir <path>: directory for spilled run files (default /tmp)."
+       << std::endl;
+    ss << "      --partition-timeout <ms>: cancel a distributed job that gets no partial"
+       << std::endl
+       << "        result for ms milliseconds (default 30000)." << std::endl;
+    ss << "      --log-mode text|deferred|binary: format log messages on the calling"
+       << std::endl
+       << "        thread (default), on the flush thread, or offline with mr_log_decode."
+       << std::endl;
+    ss << "      --metrics-interval <sec>: append the metrics to ./srv<id>.metrics"
+       << std::endl
+       << "        every sec seconds (default 0, never)." << std::endl;
+    ss << "      --metrics-port <port>: serve the metrics to Prometheus at"
+       << std::endl
+       << "        http://<metrics address>:<port>/metrics." << std::endl;
+    ss << "      --metrics-address <IPv4 address>: address of the metrics endpoint"
+       << std::endl
+       << "        (default 127.0.0.1)." << std::endl;
+    ss << "      --trace-sample <n>: trace 1 in n requests, see the trace command"
+       << std::endl
+       << "        (default 0, off)." << std::endl;
+    ss << "      --batch <file>: run the commands in file, one per line, then exit;"
+       << std::endl
+       << "        + and - commands are replicated without waiting for each other"
+       << std::endl
+       << "        (implies --async-handler)." << std::endl;
+    ss << "      --batch-window <n>: entries of a batch replicating at once (default 64)."
        << std::endl << std::endl;
 
     std::cout << ss.str();
@@ -322,7 +1430,38 @@ int main(int argc, char** argv) {
     if (ASYNC_SNAPSHOT_CREATION) {
         std::cout << "    snapshots are created asynchronously" << std::endl;
     }
-    init_raft( cs_new<mr_state_machine>(ASYNC_SNAPSHOT_CREATION) );
+    ptr<mr_state_machine> sm = cs_new<mr_state_machine>(ASYNC_SNAPSHOT_CREATION, MAX_JOBS);
+    sm->set_server_id(stuff.server_id_);
+    sm->set_memory_limit(MEMORY_LIMIT_MB * 1024 * 1024, SPILL_DIR);
+    sm->set_partition_timeout(std::chrono::milliseconds(PARTITION_TIMEOUT_MS));
+    sm->set_log_submitter(submit_log);
+    sm->set_job_listener([](ulong job_idx, JobExecutor::Status status) {
+        std::cout << "job " << job_idx << " " << JobExecutor::statusName(status) << std::endl;
+    });
+    Tracer::instance().setNode(stuff.server_id_);
+    Tracer::instance().setIdReader(mr_state_machine::peek_trace_id);
+    Tracer::instance().setSampling(TRACE_SAMPLING);
+    if (METRICS_INTERVAL_SEC > 0) {
+        MetricsRegistry::instance().startDump(
+            "./srv" + std::to_string(stuff.server_id_) + ".metrics",
+            std::chrono::seconds(METRICS_INTERVAL_SEC));
+    }
+    init_raft(sm);
+    register_gauges();
+    if (METRICS_PORT >= 0) {
+        try {
+            METRICS_HTTP.reset(new MetricsHttpServer(METRICS_ADDRESS, METRICS_PORT));
+            std::cout << "    metrics at http://" << METRICS_ADDRESS << ":"
+                      << METRICS_HTTP->getPort() << "/metrics" << std::endl;
+        } catch (const std::runtime_error& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+    }
+    if (!BATCH_FILE.empty()) {
+        const bool succeeded = run_batch();
+        do_cmd({"exit"});
+        return succeeded ? 0 : 1;
+    }
     loop();
 
     return 0;
@@ -4,13 +4,26 @@
 
 #include "MapReduce.h"
 #include "KeyValueStore.h"
-
+#include "ContinuousAggregate.h"
+#include "JobExecutor.h"
+#include "Metrics.h"
+#include "Tracer.h"
+#include "PluginRegistry.h"
+#include "BulkLoader.h"
+
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <functional>
 #include <iostream>
 #include <mutex>
 #include <memory>
+#include <set>
 #include <sstream>
+#include <thread>
 
 #include <string.h>
 
@@ -20,44 +33,431 @@ namespace mapreduce_server {
 
 class mr_state_machine : public state_machine {
 public:
-    mr_state_machine(bool async_snapshot = false)
-        : kv_store_(), last_committed_idx_(0), async_snapshot_(async_snapshot) {}
+    mr_state_machine(bool async_snapshot = false, size_t max_jobs = 2)
+        : kv_store_(), last_committed_idx_(0), async_snapshot_(async_snapshot)
+        , jobs_(max_jobs) {}
 
-    ~mr_state_machine() {}
+    ~mr_state_machine() {
+        {
+            std::lock_guard<std::mutex> guard(watchdog_lock_);
+            stopping_ = true;
+        }
+        watchdog_cv_.notify_all();
+        if (watchdog_.joinable()) watchdog_.join();
+    }
 
     enum op_type : int {
         INSERT_VALUE = 0x0,
         DELETE_VALUE = 0x1,
         DELETE_KEY = 0x2,
-        MAP_REDUCE = 0x3
+        MAP_REDUCE = 0x3,
+        REGISTER_AGGREGATE = 0x4,
+        DROP_AGGREGATE = 0x5,
+        MAP_REDUCE_PARTITIONED = 0x6,
+        PARTIAL_RESULT = 0x7,
+        MAP_REDUCE_ASYNC = 0x8,
+        CANCEL_JOB = 0x9,
+        LOAD_PLUGIN = 0xA,
+        INSERT_BATCH = 0xB
+    };
+
+    enum result_type : uint8_t {
+        NO_RESULT = 0x0,
+        REDUCE_RESULT = 0x1,
+        STATISTICS_RESULT = 0x2,
+        ERROR_RESULT = 0x3,
+        RANKED_RESULT = 0x4
+    };
+
+    // Result of a MAP_REDUCE entry: one int64 per key for a reduce operation,
+    // several named statistics per key, or the top keys in rank order.
+    struct mr_result {
+        result_type type_ = NO_RESULT;
+        std::map<std::string, int64_t> values_;
+        std::map<std::string, std::map<std::string, double>> statistics_;
+        MapReduce::Ranking ranked_;
     };
 
     struct op_payload {
         op_type type_;
-        std::string key_;
+        std::string key_;               // Aggregate name for *_AGGREGATE, path for LOAD_PLUGIN
         int value_;  // For INSERT_KEY
-        std::string map_op_;            // For MAP_REDUCE
-        std::string reduce_op_;         // For MAP_REDUCE
-        std::vector<std::string> keys_; // For MAP_REDUCE
+        std::string map_op_;            // For MAP_REDUCE, REGISTER_AGGREGATE
+        std::string reduce_op_;         // For MAP_REDUCE, REGISTER_AGGREGATE
+        KeySelector selector_;          // For MAP_REDUCE, REGISTER_AGGREGATE
+        OverflowPolicy overflow_ = OverflowPolicy::Wrap; // For MAP_REDUCE
+        // For MAP_REDUCE_PARTITIONED: disjoint parts of `selector_`,
+        // and the server expected to compute each of them.
+        std::vector<KeySelector> partitions_;
+        std::vector<int32_t> owners_;
+        // For PARTIAL_RESULT and CANCEL_JOB: the job's log index.
+        // For PARTIAL_RESULT: the result of partition `value_`.
+        ulong job_idx_ = 0;
+        mr_result partial_;
+        // For MAP_REDUCE*: if set, only the `limit_` keys with the largest
+        // results, or the smallest with `lowest_`.
+        uint32_t limit_ = 0;
+        bool lowest_ = false;
+        // For MAP_REDUCE*: if set, reduce by group instead of by key (see KeyGrouper).
+        std::string group_by_;
+        // For MAP_REDUCE* and REGISTER_AGGREGATE: `name@version` of every
+        // plugin whose operators the job uses, as loaded where it was submitted.
+        std::vector<std::string> plugins_;
+        // Nonzero if the request is traced, see Tracer.
+        uint64_t trace_id_ = 0;
+        // For INSERT_BATCH: the values to add, by key.
+        BulkLoader::Groups batch_;
     };
 
+    static size_t str_size(const std::string& str) {
+        // `put_str` writes a 32-bit length followed by the bytes.
+        return sizeof(uint32_t) + str.size();
+    }
+
+    // Only explicit key lists are written out, other selectors
+    // are just their kind and bounds.
+    static size_t selector_size(const KeySelector& selector) {
+        size_t size = sizeof(uint8_t) + sizeof(uint32_t)
+                    + str_size(selector.begin) + str_size(selector.end);
+        for (const auto& key : selector.keys) {
+            size += str_size(key);
+        }
+        return size;
+    }
+
+    static void put_selector(buffer_serializer& bs, const KeySelector& selector) {
+        bs.put_u8(static_cast<uint8_t>(selector.kind));
+        bs.put_u32(static_cast<uint32_t>(selector.keys.size()));
+        for (const auto& key : selector.keys) {
+            bs.put_str(key);
+        }
+        bs.put_str(selector.begin);
+        bs.put_str(selector.end);
+    }
+
+    static void get_selector(buffer_serializer& bs, KeySelector& selector_out) {
+        selector_out.kind = static_cast<KeySelector::Kind>(bs.get_u8());
+        uint32_t num_keys = bs.get_u32();
+        selector_out.keys.clear();
+        selector_out.keys.reserve(num_keys);
+        for (uint32_t ii = 0; ii < num_keys; ++ii) {
+            selector_out.keys.push_back(bs.get_str());
+        }
+        selector_out.begin = bs.get_str();
+        selector_out.end = bs.get_str();
+    }
+
     static ptr<buffer> enc_log(const op_payload& payload) {
         // Encode from payload to Raft log.
-        ptr<buffer> ret = buffer::alloc(sizeof(op_payload));
-        buffer_serializer bs(ret);
-
-        // WARNING: We don't consider endian-safety in this example.
-        bs.put_raw(&payload, sizeof(op_payload));
+        // Every field is serialized on its own; the strings and the key list
+        // live on the heap and cannot be copied as raw bytes.
+        size_t size = sizeof(uint8_t) + sizeof(uint64_t) + str_size(payload.key_) + sizeof(int32_t)
+                    + str_size(payload.map_op_) + str_size(payload.reduce_op_)
+                    + sizeof(uint8_t) + selector_size(payload.selector_) + sizeof(uint32_t)
+                    + sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint8_t)
+                    + str_size(payload.group_by_) + sizeof(uint32_t);
+        for (const auto& plugin : payload.plugins_) {
+            size += str_size(plugin);
+        }
+        for (const auto& partition : payload.partitions_) {
+            size += sizeof(int32_t) + selector_size(partition);
+        }
+        if (payload.type_ == INSERT_BATCH) {
+            size += sizeof(uint32_t);
+            for (const auto& group : payload.batch_) {
+                size += str_size(group.first) + sizeof(uint32_t)
+                      + group.second.size() * sizeof(int32_t);
+            }
+        }
+        ptr<buffer> partial = nullptr;
+        if (payload.type_ == PARTIAL_RESULT) {
+            partial = enc_results(payload.job_idx_, payload.partial_);
+            size += sizeof(uint32_t) + partial->size();
+        }
 
+        ptr<buffer> ret = buffer::alloc(size);
+        buffer_serializer bs(ret);
+        bs.put_u8(static_cast<uint8_t>(payload.type_));
+        // At a fixed offset, see peek_trace_id.
+        bs.put_u64(payload.trace_id_);
+        bs.put_str(payload.key_);
+        bs.put_i32(payload.value_);
+        bs.put_str(payload.map_op_);
+        bs.put_str(payload.reduce_op_);
+        bs.put_u8(static_cast<uint8_t>(payload.overflow_));
+        put_selector(bs, payload.selector_);
+        bs.put_u32(static_cast<uint32_t>(payload.partitions_.size()));
+        for (size_t ii = 0; ii < payload.partitions_.size(); ++ii) {
+            bs.put_i32(payload.owners_[ii]);
+            put_selector(bs, payload.partitions_[ii]);
+        }
+        bs.put_u64(payload.job_idx_);
+        bs.put_u32(payload.limit_);
+        bs.put_u8(payload.lowest_ ? 1 : 0);
+        bs.put_str(payload.group_by_);
+        bs.put_u32(static_cast<uint32_t>(payload.plugins_.size()));
+        for (const auto& plugin : payload.plugins_) {
+            bs.put_str(plugin);
+        }
+        if (partial) {
+            bs.put_bytes(partial->data_begin(), partial->size());
+        }
+        if (payload.type_ == INSERT_BATCH) {
+            bs.put_u32(static_cast<uint32_t>(payload.batch_.size()));
+            for (const auto& group : payload.batch_) {
+                bs.put_str(group.first);
+                bs.put_u32(static_cast<uint32_t>(group.second.size()));
+                for (int value : group.second) {
+                    bs.put_i32(value);
+                }
+            }
+        }
         return ret;
     }
 
     static void dec_log(buffer& log, op_payload& payload_out) {
         // Decode from Raft log to payload pair.
-        assert(log.size() == sizeof(op_payload));
-
         buffer_serializer bs(log);
-        memcpy(&payload_out, bs.get_raw(log.size()), sizeof(op_payload));
+        payload_out.type_ = static_cast<op_type>(bs.get_u8());
+        payload_out.trace_id_ = bs.get_u64();
+        payload_out.key_ = bs.get_str();
+        payload_out.value_ = bs.get_i32();
+        payload_out.map_op_ = bs.get_str();
+        payload_out.reduce_op_ = bs.get_str();
+        payload_out.overflow_ = overflowPolicyOf(bs.get_u8());
+        get_selector(bs, payload_out.selector_);
+        uint32_t num_partitions = bs.get_u32();
+        payload_out.partitions_.resize(num_partitions);
+        payload_out.owners_.resize(num_partitions);
+        for (uint32_t ii = 0; ii < num_partitions; ++ii) {
+            payload_out.owners_[ii] = bs.get_i32();
+            get_selector(bs, payload_out.partitions_[ii]);
+        }
+        payload_out.job_idx_ = bs.get_u64();
+        payload_out.limit_ = bs.get_u32();
+        payload_out.lowest_ = bs.get_u8() != 0;
+        payload_out.group_by_ = bs.get_str();
+        uint32_t num_plugins = bs.get_u32();
+        payload_out.plugins_.clear();
+        for (uint32_t ii = 0; ii < num_plugins; ++ii) {
+            payload_out.plugins_.push_back(bs.get_str());
+        }
+        if (payload_out.type_ == PARTIAL_RESULT) {
+            size_t len = 0;
+            void* bytes = bs.get_bytes(len);
+            ptr<buffer> partial = buffer::alloc(len);
+            memcpy(partial->data_begin(), bytes, len);
+            dec_results(*partial, payload_out.job_idx_, payload_out.partial_);
+        }
+        payload_out.batch_.clear();
+        if (payload_out.type_ == INSERT_BATCH) {
+            uint32_t num_keys = bs.get_u32();
+            payload_out.batch_.resize(num_keys);
+            for (auto& group : payload_out.batch_) {
+                group.first = bs.get_str();
+                uint32_t num_values = bs.get_u32();
+                group.second.resize(num_values);
+                for (int& value : group.second) {
+                    value = bs.get_i32();
+                }
+            }
+        }
+    }
+
+    // The trace id of an encoded entry without decoding the rest of it.
+    static uint64_t peek_trace_id(const unsigned char* data, size_t len) {
+        if (len < sizeof(uint8_t) + sizeof(uint64_t)) return 0;
+        // `put_u64` writes little-endian.
+        uint64_t id = 0;
+        for (size_t ii = 0; ii < sizeof(uint64_t); ++ii) {
+            id |= static_cast<uint64_t>(data[1 + ii]) << (8 * ii);
+        }
+        return id;
+    }
+
+    // Commit result: log index, result type, then the per-key results.
+    static ptr<buffer> enc_results(const ulong log_idx, const mr_result& result) {
+        size_t size = sizeof(uint64_t) + sizeof(uint8_t) + sizeof(uint32_t);
+        for (const auto& kv : result.values_) {
+            size += str_size(kv.first) + sizeof(int64_t);
+        }
+        for (const auto& kv : result.ranked_) {
+            size += str_size(kv.first) + sizeof(int64_t);
+        }
+        for (const auto& kv : result.statistics_) {
+            size += str_size(kv.first) + sizeof(uint32_t);
+            for (const auto& stat : kv.second) {
+                size += str_size(stat.first) + sizeof(uint64_t);
+            }
+        }
+
+        ptr<buffer> ret = buffer::alloc(size);
+        buffer_serializer bs(ret);
+        bs.put_u64(log_idx);
+        bs.put_u8(static_cast<uint8_t>(result.type_));
+        if (result.type_ == STATISTICS_RESULT) {
+            bs.put_u32(static_cast<uint32_t>(result.statistics_.size()));
+            for (const auto& kv : result.statistics_) {
+                bs.put_str(kv.first);
+                bs.put_u32(static_cast<uint32_t>(kv.second.size()));
+                for (const auto& stat : kv.second) {
+                    uint64_t bits;
+                    memcpy(&bits, &stat.second, sizeof(bits));
+                    bs.put_str(stat.first);
+                    bs.put_u64(bits);
+                }
+            }
+        } else if (result.type_ == RANKED_RESULT) {
+            // In rank order.
+            bs.put_u32(static_cast<uint32_t>(result.ranked_.size()));
+            for (const auto& kv : result.ranked_) {
+                bs.put_str(kv.first);
+                bs.put_i64(kv.second);
+            }
+        } else {
+            bs.put_u32(static_cast<uint32_t>(result.values_.size()));
+            for (const auto& kv : result.values_) {
+                bs.put_str(kv.first);
+                bs.put_i64(kv.second);
+            }
+        }
+        return ret;
+    }
+
+    static void dec_results(buffer& buf, ulong& log_idx_out, mr_result& result_out) {
+        buffer_serializer bs(buf);
+        log_idx_out = bs.get_u64();
+        result_out.type_ = static_cast<result_type>(bs.get_u8());
+        uint32_t num_keys = bs.get_u32();
+        for (uint32_t ii = 0; ii < num_keys; ++ii) {
+            std::string key = bs.get_str();
+            if (result_out.type_ == STATISTICS_RESULT) {
+                std::map<std::string, double>& stats = result_out.statistics_[key];
+                uint32_t num_stats = bs.get_u32();
+                for (uint32_t jj = 0; jj < num_stats; ++jj) {
+                    std::string name = bs.get_str();
+                    uint64_t bits = bs.get_u64();
+                    memcpy(&stats[name], &bits, sizeof(bits));
+                }
+            } else if (result_out.type_ == RANKED_RESULT) {
+                result_out.ranked_.emplace_back(key, bs.get_i64());
+            } else {
+                result_out.values_[key] = bs.get_i64();
+            }
+        }
+    }
+
+    // The store as sent in snapshots: `key:v1,v2,;` per key.
+    static std::string serialize_kv_store(const KeyValueStore& kv_store) {
+        std::stringstream ss;
+        for (const auto& kv : kv_store.getAll()) {
+            ss << kv.first << ":";
+            for (const auto& val : kv.second) {
+                ss << val << ",";
+            }
+            ss << ";";  // End of the key-value pair
+        }
+        return ss.str();
+    }
+
+    static KeyValueStore deserialize_kv_store(std::string& data) {
+        KeyValueStore new_kv_store;
+        std::istringstream ss(data);
+        std::string key_value_pair;
+        while (std::getline(ss, key_value_pair, ';')) {
+            std::istringstream kv_stream(key_value_pair);
+            std::string key;
+            if (!std::getline(kv_stream, key, ':')) {
+                continue; // No key found, skip
+            }
+
+            std::vector<int> values;
+            std::string value_str;
+            while (std::getline(kv_stream, value_str, ',')) {
+                if (value_str.empty()) {
+                    continue; // Skip empty strings
+                }
+                try {
+                    int value = std::stoi(value_str);
+                    values.push_back(value);
+                } catch (const std::invalid_argument& e) {
+                    // Handle or log the error
+                    continue;
+                }
+            }
+            // Store the key and values
+            new_kv_store.insertMany(key, values);
+        }
+        return new_kv_store;
+    }
+
+    // Throws unless every plugin the job was submitted with is loaded here,
+    // in the same version. Plugins are loaded by LOAD_PLUGIN entries, so
+    // this only fails for a plugin replaced by another version since.
+    static void check_plugins(const op_payload& job) {
+        for (const auto& plugin : job.plugins_) {
+            if (!PluginRegistry::instance().isLoaded(plugin)) {
+                throw std::runtime_error("Plugin " + plugin + " is not loaded on this server");
+            }
+        }
+    }
+
+    // Splits a comma separated operation list, e.g. `min,max,mean`.
+    static std::vector<std::string> split_ops(const std::string& ops) {
+        std::vector<std::string> ret;
+        std::istringstream ss(ops);
+        std::string op;
+        while (std::getline(ss, op, ',')) {
+            if (!op.empty()) ret.push_back(op);
+        }
+        return ret;
+    }
+
+    // Runs the MAP_REDUCE* `job` over `selector`: a single reduce operation,
+    // or all requested statistics together in one pass over each key's values.
+    // Optionally by group, and/or only the top (or bottom) `limit_` results.
+    // Group-by jobs spill to disk beyond the node's memory limit.
+    mr_result run_map_reduce(MapReduce& mr,
+                             const op_payload& job,
+                             const KeySelector& selector)
+    {
+        static LatencyHistogram& job_latency =
+            MetricsRegistry::instance().histogram("mapreduce.job");
+        ScopedLatency timed(job_latency);
+
+        check_plugins(job);
+        const bool single_reduce = mr.hasReduceOperation(job.reduce_op_);
+        if (!single_reduce && (job.limit_ > 0 || !job.group_by_.empty())) {
+            throw std::runtime_error("Top keys and groups need a single reduce operation, not "
+                                     + job.reduce_op_);
+        }
+        mr_result result;
+        if (!job.group_by_.empty()) {
+            mr.setMemoryBudget(memory_budget_, spill_dir_);
+            result.values_ = mr.performGroupBy(job.map_op_, job.reduce_op_, selector,
+                                               KeyGrouper::parse(job.group_by_), job.overflow_);
+            const MapReduce::SpillStats& spilled = mr.getSpillStats();
+            spilled_runs_ += spilled.runs;
+            spilled_bytes_ += spilled.bytes;
+            result.type_ = REDUCE_RESULT;
+            if (job.limit_ > 0) {
+                MapReduce::Ranking groups(result.values_.begin(), result.values_.end());
+                result.ranked_ = MapReduce::mergeTopK({groups}, job.limit_, job.lowest_);
+                result.values_.clear();
+                result.type_ = RANKED_RESULT;
+            }
+        } else if (job.limit_ > 0) {
+            result.ranked_ = mr.performTopK(job.map_op_, job.reduce_op_, selector,
+                                            job.limit_, job.lowest_, job.overflow_);
+            result.type_ = RANKED_RESULT;
+        } else if (single_reduce) {
+            result.values_ = mr.performMapReduce(job.map_op_, job.reduce_op_, selector, job.overflow_);
+            result.type_ = REDUCE_RESULT;
+        } else {
+            result.statistics_ = mr.performStatistics(job.map_op_, split_ops(job.reduce_op_), selector);
+            result.type_ = STATISTICS_RESULT;
+        }
+        return result;
     }
 
     ptr<buffer> pre_commit(const ulong log_idx, buffer& data) {
@@ -65,34 +465,157 @@ public:
         return nullptr;
     }
 
+    // Time to apply a committed entry of `type`.
+    static LatencyHistogram& apply_latency(op_type type) {
+        static const std::vector<LatencyHistogram*> histograms = [] {
+            const char* names[] = {
+                "insert_value", "delete_value", "delete_key", "map_reduce",
+                "register_aggregate", "drop_aggregate", "map_reduce_partitioned",
+                "partial_result", "map_reduce_async", "cancel_job", "load_plugin", "insert_batch",
+                "unknown"};
+            std::vector<LatencyHistogram*> all;
+            for (const char* name : names) {
+                all.push_back(&MetricsRegistry::instance().histogram(std::string("commit.") + name));
+            }
+            return all;
+        }();
+        const size_t index = static_cast<size_t>(type);
+        return *histograms[std::min(index, histograms.size() - 1)];
+    }
+
     ptr<buffer> commit(const ulong log_idx, buffer& data) {
         op_payload payload;
-        dec_log(data, payload);
+        try {
+            dec_log(data, payload);
+        } catch (const std::runtime_error& e) {
+            // The same bytes fail to decode on every replica, so all skip it.
+            std::cerr << "Invalid entry at log index " << log_idx << " skipped: "
+                      << e.what() << std::endl;
+            std::lock_guard<std::mutex> kv_lock(kv_store_lock_);
+            last_committed_idx_ = log_idx;
+            mr_result rejected;
+            rejected.type_ = ERROR_RESULT;
+            return enc_results(log_idx, rejected);
+        }
+        ScopedLatency applied(apply_latency(payload.type_));
+        if (payload.trace_id_) {
+            // Since the entry was appended to this node's log.
+            uint64_t appended = 0;
+            if (Tracer::instance().take(payload.trace_id_, appended)) {
+                Tracer::instance().span(payload.trace_id_, "replicate", appended, Tracer::now());
+            }
+        }
+        TraceSpan traced(Tracer::instance().enabled() ? payload.trace_id_ : 0, "apply");
 
         std::unique_ptr<MapReduce> mr = nullptr;
         ptr<buffer> ret;
 
-        bool has_map_reduce_results = false;
-        std::string results_str;
+        mr_result mapReduceResult;
+
+        std::unique_lock<std::mutex> kv_lock(kv_store_lock_);
+        kv_store_.setVersion(log_idx);
+        kv_store_.setGcHorizon(read_pins_.empty() ? log_idx : *read_pins_.begin());
+        // Updated under the lock, so a reader never pins an index
+        // whose version is being overwritten.
+        last_committed_idx_ = log_idx;
 
         switch (payload.type_) {
             case INSERT_VALUE:
                 kv_store_.insert(payload.key_, payload.value_);
+                for (auto& entry : aggregates_) {
+                    entry.second.onInsert(payload.key_, payload.value_);
+                }
+                break;
+
+            case INSERT_BATCH:
+                for (const auto& group : payload.batch_) {
+                    kv_store_.insertMany(group.first, group.second);
+                    for (auto& entry : aggregates_) {
+                        for (int value : group.second) {
+                            entry.second.onInsert(group.first, value);
+                        }
+                    }
+                }
                 break;
 
             case DELETE_VALUE:
-                kv_store_.removeValue(payload.key_, payload.value_);
+                if (kv_store_.removeValue(payload.key_, payload.value_)) {
+                    for (auto& entry : aggregates_) {
+                        if (!entry.second.onRemoveValue(payload.key_, payload.value_)) {
+                            entry.second.rebuildKey(payload.key_, kv_store_.getValues(payload.key_));
+                        }
+                    }
+                }
                 break;
 
             case DELETE_KEY:
-                kv_store_.removeKey(payload.key_);
+                if (kv_store_.removeKey(payload.key_)) {
+                    for (auto& entry : aggregates_) {
+                        entry.second.onRemoveKey(payload.key_);
+                    }
+                }
+                break;
+
+            case REGISTER_AGGREGATE:
+                try {
+                    check_plugins(payload);
+                    register_aggregate(payload.key_, payload.map_op_,
+                                       payload.reduce_op_, payload.selector_);
+                } catch (const std::runtime_error& e) {
+                    std::cerr << "Aggregate at log index " << log_idx
+                              << " not registered: " << e.what() << std::endl;
+                }
+                break;
+
+            case DROP_AGGREGATE:
+                aggregates_.erase(payload.key_);
+                break;
+
+            case LOAD_PLUGIN:
+                load_plugin(log_idx, payload.key_);
+                break;
+
+            case MAP_REDUCE_PARTITIONED:
+                start_partitioned_job(log_idx, payload);
+                break;
+
+            case MAP_REDUCE_ASYNC:
+                // Only the index is pinned here. The job copies the keys it
+                // reads on the executor's thread, so later entries are
+                // applied while it copies and runs.
+                read_pins_.insert(log_idx);
+                kv_store_.setGcHorizon(*read_pins_.begin());
+                kv_lock.unlock();
+                submit_job(log_idx, payload);
+                break;
+
+            case CANCEL_JOB:
+                if (abandon_partitioned_job(payload.job_idx_)) {
+                    mapReduceResult.type_ = ERROR_RESULT;
+                    store_map_reduce_result(payload.job_idx_, mapReduceResult);
+                } else {
+                    // A queued job ends here, and releases its pin.
+                    kv_lock.unlock();
+                    jobs_.cancel(payload.job_idx_);
+                }
+                break;
+
+            case PARTIAL_RESULT:
+                add_partial_result(payload, mapReduceResult);
                 break;
 
             case MAP_REDUCE: {
-                has_map_reduce_results = true;
                 mr = std::unique_ptr<MapReduce>(new MapReduce(kv_store_));
-                auto mapReduceResults = mr->performMapReduce(payload.map_op_, payload.reduce_op_, payload.keys_);
-                add_map_reduce_result(log_idx, mapReduceResults);
+                kv_lock.unlock();
+                try {
+                    mapReduceResult = run_map_reduce(*mr, payload, payload.selector_);
+                } catch (const std::runtime_error& e) {
+                    // Every replica fails the same way; the entry is still applied.
+                    std::cerr << "MapReduce at log index " << log_idx
+                              << " failed: " << e.what() << std::endl;
+                    break;
+                }
+                add_map_reduce_result(log_idx, mapReduceResult);
                 break;
             }
 
@@ -101,12 +624,7 @@ public:
                 break;
         }
 
-        ret = buffer::alloc( sizeof(log_idx) + sizeof(bool) );
-        buffer_serializer bs(ret);
-        bs.put_u64(log_idx);
-        bs.put_u8(static_cast<uint8_t>(has_map_reduce_results)); // Serialize flag indicating presence of results
-
-        last_committed_idx_ = log_idx;
+        ret = enc_results(log_idx, mapReduceResult);
         return ret;
     }
 
@@ -126,6 +644,12 @@ public:
                          ptr<buffer>& data_out,
                          bool& is_last_obj)
     {
+        static LatencyHistogram& read_latency =
+            MetricsRegistry::instance().histogram("snapshot.read_object");
+        static MetricCounter& sent_bytes =
+            MetricsRegistry::instance().counter("snapshot.sent_bytes");
+        ScopedLatency timed(read_latency);
+
         ptr<snapshot_ctx> ctx = nullptr;
         {
             std::lock_guard<std::mutex> ll(snapshots_lock_);
@@ -138,17 +662,27 @@ public:
             ctx = entry->second;
         }
 
-        // Serialize the whole KeyValueStore into a string
-        // (Consider splitting it if too large)
-        std::string kv_store_serialized = serialize_kv_store(ctx->kv_store_); // Implement this method
-
         if (obj_id == 0) {
             // First object, return the serialized key-value store.
-            data_out = buffer::alloc(kv_store_serialized.size());
+            // Serialize the whole KeyValueStore into a string
+            // (Consider splitting it if too large)
+            std::string kv_store_serialized = serialize_kv_store(ctx->kv_store_);
+            data_out = buffer::alloc(str_size(kv_store_serialized));
             buffer_serializer bs(data_out);
-            bs.put_raw(kv_store_serialized.data(), kv_store_serialized.size());
+            bs.put_str(kv_store_serialized);
+            is_last_obj = false;
+        } else if (obj_id == 1) {
+            // Second object, the paths of the loaded plugins. They are loaded
+            // before the aggregates, which may use their operators.
+            data_out = enc_plugins(ctx->plugins_);
+            is_last_obj = false;
+        } else {
+            // Third object, the registered aggregates.
+            // Only their definitions are sent; results are rebuilt from the store.
+            data_out = enc_aggregates(ctx->aggregates_);
             is_last_obj = true;
         }
+        sent_bytes.add(data_out->size());
         return 0;
     }
 
@@ -158,25 +692,70 @@ public:
                           bool is_first_obj,
                           bool is_last_obj)
 {
+    static LatencyHistogram& save_latency =
+        MetricsRegistry::instance().histogram("snapshot.save_object");
+    static MetricCounter& received_bytes =
+        MetricsRegistry::instance().counter("snapshot.received_bytes");
+    ScopedLatency timed(save_latency);
+    received_bytes.add(data.size());
+
+    std::lock_guard<std::mutex> ll(snapshots_lock_);
+    ptr<snapshot_ctx>& ctx = snapshots_[s.get_last_log_idx()];
+    if (!ctx) {
+        // First object of a snapshot received from the leader.
+        ptr<buffer> snp_buf = s.serialize();
+        ptr<snapshot> ss = snapshot::deserialize(*snp_buf);
+        ctx = cs_new<snapshot_ctx>(ss, KeyValueStore(), aggregate_map(),
+                                   std::vector<std::string>());
+    }
+
+    buffer_serializer bs(data);
     if (obj_id == 0) {
         // Object ID == 0: contains the serialized key-value store.
-        buffer_serializer bs(data);
         std::string kv_store_serialized = bs.get_str(); // Deserialize the string
-
-        std::lock_guard<std::mutex> ll(snapshots_lock_);
-        auto entry = snapshots_.find(s.get_last_log_idx());
-
-        entry->second->kv_store_ = deserialize_kv_store(kv_store_serialized); // Implement this method
+        ctx->kv_store_ = deserialize_kv_store(kv_store_serialized);
+    } else if (obj_id == 1) {
+        // Object ID == 1: the loaded plugins.
+        ctx->plugins_ = dec_plugins(data);
+        for (const auto& path : ctx->plugins_) {
+            try {
+                PluginRegistry::instance().load(path);
+            } catch (const std::runtime_error& e) {
+                plugin_load_failed(s.get_last_log_idx(), e);
+            }
+        }
+    } else {
+        // Object ID == 2: the registered aggregates.
+        ctx->aggregates_ = dec_aggregates(data);
     }
+    obj_id++;
 }
 
     bool apply_snapshot(snapshot& s) {
+        static LatencyHistogram& restore_latency =
+            MetricsRegistry::instance().histogram("snapshot.apply");
+        ScopedLatency timed(restore_latency);
+
         std::lock_guard<std::mutex> ll(snapshots_lock_);
         auto entry = snapshots_.find(s.get_last_log_idx());
         if (entry == snapshots_.end()) return false;
 
         ptr<snapshot_ctx> ctx = entry->second;
+        std::lock_guard<std::mutex> kv_lock(kv_store_lock_);
         kv_store_ = ctx->kv_store_; // Restore the key-value store from the snapshot context.
+        kv_store_.setVersion(s.get_last_log_idx());
+        kv_store_.setGcHorizon(read_pins_.empty() ? s.get_last_log_idx() : *read_pins_.begin());
+        plugins_ = ctx->plugins_;
+        aggregates_ = ctx->aggregates_;
+        for (auto& entry : aggregates_) {
+            entry.second.rebuild(kv_store_);
+        }
+        // The store no longer has the versions that older jobs read.
+        auto job = partitioned_jobs_.begin();
+        while (job != partitioned_jobs_.end() && job->first <= s.get_last_log_idx()) {
+            read_pins_.erase(read_pins_.find(job->first));
+            job = partitioned_jobs_.erase(job);
+        }
         return true;
     }
 
@@ -211,73 +790,584 @@ public:
         }
     }
 
-    KeyValueStore get_kv_store() const { return kv_store_; }
+    KeyValueStore get_kv_store() {
+        std::lock_guard<std::mutex> kv_lock(kv_store_lock_);
+        return kv_store_;
+    }
 
-    std::map<std::string, int> get_map_reduce_results(const ulong log_idx) {
+    // Splits the keys of `selector` into at most `parts` selectors, see
+    // KeyValueStore::partition, without copying the store.
+    std::vector<KeySelector> partition(const KeySelector& selector, size_t parts) {
+        std::lock_guard<std::mutex> kv_lock(kv_store_lock_);
+        return kv_store_.partition(selector, parts);
+    }
+
+    // Keeps the store readable at the last committed index until
+    // `unpin_read_index` is called, and returns that index.
+    ulong pin_read_index() {
+        std::lock_guard<std::mutex> kv_lock(kv_store_lock_);
+        ulong idx = last_committed_idx_;
+        read_pins_.insert(idx);
+        kv_store_.setGcHorizon(*read_pins_.begin());
+        return idx;
+    }
+
+    void unpin_read_index(ulong idx) {
+        std::lock_guard<std::mutex> kv_lock(kv_store_lock_);
+        auto entry = read_pins_.find(idx);
+        if (entry == read_pins_.end()) return;
+        read_pins_.erase(entry);
+        kv_store_.setGcHorizon(read_pins_.empty() ? last_committed_idx_.load()
+                                                  : *read_pins_.begin());
+        kv_store_.collectGarbage();
+    }
+
+    // One page of the store as of `log_idx`, which must be pinned: at most
+    // `limit` keys of [begin, end) with their values, copied under the lock.
+    // Returns true if there are more, from `next_out` on.
+    bool scan_at(const ulong log_idx, const std::string& begin, const std::string& end,
+                 size_t limit, BulkLoader::Groups& page_out, std::string& next_out)
+    {
+        page_out.clear();
+        std::lock_guard<std::mutex> kv_lock(kv_store_lock_);
+        return kv_store_.scanPage(begin, end, log_idx, limit, next_out,
+            [&](const std::string& key, const std::vector<int>& values) {
+                page_out.emplace_back(key, values);
+            });
+    }
+
+    // Read-only MapReduce `job` against the store as of `log_idx`, without
+    // appending a log entry. `log_idx` must be pinned, be the last committed
+    // index, or be one of the retained snapshots.
+    mr_result map_reduce_at(const ulong log_idx, const op_payload& job)
+    {
+        std::unique_ptr<MapReduce> mr;
+        bool pinned = false;
+        {
+            std::lock_guard<std::mutex> kv_lock(kv_store_lock_);
+            if (log_idx > last_committed_idx_) {
+                throw std::runtime_error("Log index " + std::to_string(log_idx) +
+                                         " is not committed yet");
+            }
+            if (log_idx >= kv_store_.getGcHorizon()) {
+                // Kept readable while the selected keys are copied.
+                read_pins_.insert(log_idx);
+                kv_store_.setGcHorizon(*read_pins_.begin());
+                pinned = true;
+            }
+        }
+        if (pinned) {
+            KeyValueStore copy;
+            try {
+                copy = copy_selected_at(log_idx, job.selector_);
+            } catch (const std::runtime_error& e) {
+                unpin(log_idx);
+                throw;
+            }
+            unpin(log_idx);
+            mr = std::unique_ptr<MapReduce>(new MapReduce(std::move(copy), log_idx));
+        } else {
+            std::lock_guard<std::mutex> ll(snapshots_lock_);
+            auto entry = snapshots_.find(log_idx);
+            if (entry == snapshots_.end()) {
+                throw std::runtime_error("Log index " + std::to_string(log_idx) +
+                                         " is no longer readable");
+            }
+            mr = std::unique_ptr<MapReduce>(new MapReduce(entry->second->kv_store_));
+        }
+        // The job runs on its own copy-on-write view, outside of both locks.
+        return run_map_reduce(*mr, job, job.selector_);
+    }
+
+    // Current results of a registered aggregate, without scanning the store.
+    std::map<std::string, int64_t> get_aggregate_results(const std::string& name) {
+        std::lock_guard<std::mutex> kv_lock(kv_store_lock_);
+        return find_aggregate(name).getResults();
+    }
+
+    // Returns false if the aggregate has no result for `key`.
+    bool get_aggregate_result(const std::string& name, const std::string& key, int64_t& result_out) {
+        std::lock_guard<std::mutex> kv_lock(kv_store_lock_);
+        return find_aggregate(name).getResult(key, result_out);
+    }
+
+    // Definitions of the registered aggregates, as REGISTER_AGGREGATE payloads.
+    std::vector<op_payload> list_aggregates() {
+        std::lock_guard<std::mutex> kv_lock(kv_store_lock_);
+        std::vector<op_payload> ret;
+        for (const auto& entry : aggregates_) {
+            const ContinuousAggregate& aggregate = entry.second;
+            ret.push_back({REGISTER_AGGREGATE, entry.first, 0, aggregate.getMapOp(),
+                           aggregate.getReduceOp(), aggregate.getSelector()});
+        }
+        return ret;
+    }
+
+    // Status of the MAP_REDUCE_ASYNC job at `job_idx`. Its result is
+    // available from `get_map_reduce_results` once it is done.
+    JobExecutor::Status get_job_status(const ulong job_idx, std::string& error_out) {
+        error_out = jobs_.getError(job_idx);
+        return jobs_.getStatus(job_idx);
+    }
+
+    std::map<uint64_t, JobExecutor::Status> list_jobs() {
+        return jobs_.getJobs();
+    }
+
+    bool wait_for_job(const ulong job_idx, std::chrono::milliseconds timeout) {
+        return jobs_.wait(job_idx, timeout);
+    }
+
+    // Called on the executor's thread whenever an asynchronous job ends.
+    void set_job_listener(std::function<void(ulong, JobExecutor::Status)> listener) {
         std::lock_guard<std::mutex> ll(snapshots_lock_);
-        auto entry = map_reduce_results_.find(log_idx);
-        if (entry == map_reduce_results_.end()) {
-            return std::map<std::string, int>();
+        job_listener_ = listener;
+    }
+
+    // Partitioned jobs with no partial result committed for this long are
+    // cancelled through the log, releasing the version they read.
+    void set_partition_timeout(std::chrono::milliseconds timeout) {
+        partition_timeout_ms_ = static_cast<uint64_t>(timeout.count());
+    }
+
+    void set_server_id(int32_t server_id) {
+        server_id_ = server_id;
+    }
+
+    // Memory for the intermediate results of all the group-by jobs running
+    // on this node, 0 for no limit. Beyond it they spill to run files in
+    // `spill_dir`.
+    void set_memory_limit(size_t bytes, const std::string& spill_dir) {
+        memory_budget_ = bytes > 0 ? std::make_shared<MemoryBudget>(bytes) : nullptr;
+        spill_dir_ = spill_dir;
+    }
+
+    // Keys and values in the store at the last committed index.
+    void get_store_counts(size_t& keys, size_t& values) {
+        std::lock_guard<std::mutex> kv_lock(kv_store_lock_);
+        keys = kv_store_.getKeyCount();
+        values = kv_store_.getValueCount();
+    }
+
+    // Totals over all jobs run on this node.
+    void get_spill_stats(uint64_t& runs, uint64_t& bytes) const {
+        runs = spilled_runs_;
+        bytes = spilled_bytes_;
+    }
+
+    // Used to append the PARTIAL_RESULT entries of partitioned jobs.
+    // On a follower the entry has to be forwarded to the leader.
+    void set_log_submitter(std::function<bool(ptr<buffer>)> submit_log) {
+        submit_log_ = submit_log;
+    }
+
+    // Computes one partition of the MAP_REDUCE_PARTITIONED job at `job_idx`
+    // and appends its PARTIAL_RESULT entry. Any replica can compute any
+    // partition, e.g. to stand in for a slow owner; the first result
+    // committed for a partition is used. Returns false if the job is
+    // already complete or the entry was not accepted.
+    bool submit_partial(const ulong job_idx, size_t partition) {
+        op_payload payload;
+        payload.type_ = PARTIAL_RESULT;
+        payload.value_ = static_cast<int>(partition);
+        payload.job_idx_ = job_idx;
+        try {
+            payload.partial_ = compute_partition(job_idx, partition);
+        } catch (const std::runtime_error& e) {
+            return false;
         }
-        return entry->second;
+        return submit_log_ && submit_log_(enc_log(payload));
+    }
+
+    // Partitions of the job at `job_idx` without a committed result.
+    // Empty once the job is complete (or if there is no such job).
+    std::vector<size_t> missing_partitions(const ulong job_idx) {
+        std::lock_guard<std::mutex> kv_lock(kv_store_lock_);
+        std::vector<size_t> ret;
+        auto entry = partitioned_jobs_.find(job_idx);
+        if (entry == partitioned_jobs_.end()) return ret;
+        for (size_t ii = 0; ii < entry->second.done_.size(); ++ii) {
+            if (!entry->second.done_[ii]) ret.push_back(ii);
+        }
+        return ret;
+    }
+
+    mr_result get_map_reduce_results(const ulong log_idx) {
+        mr_result ret;
+        find_map_reduce_result(log_idx, ret);
+        return ret;
+    }
+
+    // Returns false if the job at `log_idx` has no result (or ERROR_RESULT)
+    // on this node yet, e.g. before its entry is applied here.
+    bool find_map_reduce_result(const ulong log_idx, mr_result& result_out) {
+        std::lock_guard<std::mutex> kv_lock(kv_store_lock_);
+        auto entry = map_reduce_results_.find(log_idx);
+        if (entry == map_reduce_results_.end()) return false;
+        result_out = entry->second;
+        return true;
     }
 
 private:
+    using aggregate_map = std::map<std::string, ContinuousAggregate>;
+
     struct snapshot_ctx {
-        snapshot_ctx(ptr<snapshot>& s, const KeyValueStore& kv_store)
-            : snapshot_(s), kv_store_(kv_store) {}
+        snapshot_ctx(ptr<snapshot>& s, const KeyValueStore& kv_store,
+                     const aggregate_map& aggregates, const std::vector<std::string>& plugins)
+            : snapshot_(s), kv_store_(kv_store), aggregates_(aggregates), plugins_(plugins) {}
 
         ptr<snapshot> snapshot_;
         KeyValueStore kv_store_;
+        aggregate_map aggregates_;
+        std::vector<std::string> plugins_;
     };
 
-    std::string serialize_kv_store(const KeyValueStore& kv_store) {
-        std::stringstream ss;
-        for (const auto& kv : kv_store.getAll()) {
-            ss << kv.first << ":";
-            for (const auto& val : kv.second) {
-                ss << val << ",";
+    // Called with `kv_store_lock_` held.
+    void load_plugin(const ulong log_idx, const std::string& path) {
+        try {
+            PluginRegistry::instance().load(path);
+        } catch (const std::runtime_error& e) {
+            plugin_load_failed(log_idx, e);
+        }
+        if (std::find(plugins_.begin(), plugins_.end(), path) == plugins_.end()) {
+            plugins_.push_back(path);
+        }
+    }
+
+    // The other servers have loaded the plugin, and later entries that use
+    // its operators would apply differently here; so this server stops
+    // rather than diverge. It can rejoin once the plugin file is in place.
+    [[noreturn]] static void plugin_load_failed(const ulong log_idx, const std::runtime_error& e) {
+        std::cerr << "Cannot apply the plugin at log index " << log_idx << ", stopping: "
+                  << e.what() << std::endl;
+        std::abort();
+    }
+
+    // Called with `kv_store_lock_` held.
+    void register_aggregate(const std::string& name,
+                            const std::string& map_op,
+                            const std::string& reduce_op,
+                            const KeySelector& selector)
+    {
+        if (aggregates_.count(name)) {
+            throw std::runtime_error("Aggregate " + name + " already exists");
+        }
+        ContinuousAggregate aggregate(map_op, reduce_op, selector);
+        aggregate.rebuild(kv_store_);
+        aggregates_.emplace(name, std::move(aggregate));
+    }
+
+    // Called with `kv_store_lock_` held.
+    const ContinuousAggregate& find_aggregate(const std::string& name) const {
+        auto entry = aggregates_.find(name);
+        if (entry == aggregates_.end()) {
+            throw std::runtime_error("Aggregate " + name + " not found");
+        }
+        return entry->second;
+    }
+
+    // The store must be pinned at `log_idx`. The pin is released once the
+    // job has copied the keys it reads, or when it ends without a copy.
+    void submit_job(const ulong log_idx, const op_payload& payload) {
+        auto pinned = std::make_shared<std::atomic<bool>>(true);
+        auto release = [this, log_idx, pinned] {
+            if (pinned->exchange(false)) unpin(log_idx);
+        };
+        auto task = [this, log_idx, payload, release](const std::atomic<bool>& cancelled) {
+            MapReduce mr(copy_selected_at(log_idx, payload.selector_), log_idx);
+            release();
+            mr.setCancellation(&cancelled);
+            mr_result result = run_map_reduce(mr, payload, payload.selector_);
+            add_map_reduce_result(log_idx, result);
+        };
+        auto on_done = [this, release](uint64_t job_idx, JobExecutor::Status status,
+                                       const std::string& error) {
+            release();
+            if (status == JobExecutor::Status::Failed) {
+                std::cerr << "MapReduce job at log index " << job_idx
+                          << " failed: " << error << std::endl;
+                mr_result failed;
+                failed.type_ = ERROR_RESULT;
+                add_map_reduce_result(job_idx, failed);
             }
-            ss << ";";  // End of the key-value pair
+            std::function<void(ulong, JobExecutor::Status)> listener;
+            {
+                std::lock_guard<std::mutex> ll(snapshots_lock_);
+                listener = job_listener_;
+            }
+            if (listener) listener(job_idx, status);
+        };
+        try {
+            jobs_.submit(log_idx, task, on_done);
+        } catch (const std::runtime_error& e) {
+            // The entry is applied again, e.g. after a restart.
+            release();
         }
-        return ss.str();
     }
 
-    KeyValueStore deserialize_kv_store(std::string& data) {
-        KeyValueStore new_kv_store;
-        std::istringstream ss(data);
-        std::string key_value_pair;
-        while (std::getline(ss, key_value_pair, ';')) {
-            std::istringstream kv_stream(key_value_pair);
-            std::string key;
-            if (!std::getline(kv_stream, key, ':')) {
-                continue; // No key found, skip
+    // The keys of `selector` as of `log_idx`, which must be pinned. They are
+    // copied a page at a time, so that commits wait for the lock only
+    // briefly however large the store is. The copy shares value lists.
+    KeyValueStore copy_selected_at(const ulong log_idx, const KeySelector& selector) {
+        static const size_t PAGE_KEYS = 4096;
+        KeyValueStore copy;
+        std::string next;
+        if (selector.kind == KeySelector::Keys) {
+            const std::vector<std::string>& keys = selector.keys;
+            for (size_t first = 0; first < keys.size(); first += PAGE_KEYS) {
+                std::lock_guard<std::mutex> kv_lock(kv_store_lock_);
+                for (size_t ii = first; ii < std::min(keys.size(), first + PAGE_KEYS); ++ii) {
+                    // Just the key itself: nothing sorts between it and key + '\0'.
+                    kv_store_.copyPage(keys[ii], keys[ii] + '\0', log_idx, 1, next, copy);
+                }
             }
+            return copy;
+        }
+        std::string begin, end;
+        selector.bounds(begin, end);
+        bool more = true;
+        while (more) {
+            std::lock_guard<std::mutex> kv_lock(kv_store_lock_);
+            more = kv_store_.copyPage(begin, end, log_idx, PAGE_KEYS, next, copy);
+            begin = next;
+        }
+        return copy;
+    }
 
-            std::vector<int> values;
-            std::string value_str;
-            while (std::getline(kv_stream, value_str, ',')) {
-                if (value_str.empty()) {
-                    continue; // Skip empty strings
+    // Releases a pin taken for a job or a read, under the lock.
+    void unpin(const ulong log_idx) {
+        std::lock_guard<std::mutex> kv_lock(kv_store_lock_);
+        release_job_pin(log_idx);
+    }
+
+    // A MAP_REDUCE_PARTITIONED job waiting for its partial results.
+    struct partitioned_job {
+        op_payload job_;
+        std::vector<bool> done_;
+        size_t remaining_;
+        mr_result result_;
+        // When the job started or last got a partial result, on this replica.
+        std::chrono::steady_clock::time_point progress_;
+    };
+
+    // Called with `kv_store_lock_` held.
+    void start_partitioned_job(const ulong log_idx, const op_payload& payload) {
+        partitioned_job& job = partitioned_jobs_[log_idx];
+        job.job_ = payload;
+        job.done_.assign(payload.partitions_.size(), false);
+        job.remaining_ = payload.partitions_.size();
+        job.progress_ = std::chrono::steady_clock::now();
+        // Every partition reads the store as of this index, so its
+        // version is kept until the last partial result is committed.
+        read_pins_.insert(log_idx);
+        kv_store_.setGcHorizon(*read_pins_.begin());
+        if (!watchdog_.joinable()) {
+            watchdog_ = std::thread([this] { watch_partitioned_jobs(); });
+        }
+
+        for (size_t ii = 0; ii < payload.partitions_.size(); ++ii) {
+            if (payload.owners_[ii] != server_id_) continue;
+            // Not on the commit thread: appending the result waits for
+            // this replica to commit it.
+            std::thread t_hdl([this, log_idx, ii] {
+                submit_partial(log_idx, ii);
+            });
+            t_hdl.detach();
+        }
+    }
+
+    mr_result compute_partition(const ulong job_idx, size_t partition) {
+        op_payload job;
+        {
+            std::lock_guard<std::mutex> kv_lock(kv_store_lock_);
+            auto entry = partitioned_jobs_.find(job_idx);
+            if (entry == partitioned_jobs_.end() || partition >= entry->second.done_.size()) {
+                throw std::runtime_error("No partition " + std::to_string(partition) +
+                                         " of a job at log index " + std::to_string(job_idx));
+            }
+            job = entry->second.job_;
+        }
+        // The job's pin keeps its version until the job ends. If it ends
+        // during the copy, the copy throws and no result is submitted.
+        MapReduce mr(copy_selected_at(job_idx, job.partitions_[partition]), job_idx);
+        try {
+            if (!job.group_by_.empty()) {
+                // A group may span partitions, and the partial results are
+                // combined as a union of keys.
+                throw std::runtime_error("Groups are not supported for partitioned jobs");
+            }
+            return run_map_reduce(mr, job, job.partitions_[partition]);
+        } catch (const std::runtime_error& e) {
+            std::cerr << "MapReduce at log index " << job_idx << ", partition "
+                      << partition << " failed: " << e.what() << std::endl;
+            mr_result failed;
+            failed.type_ = ERROR_RESULT;
+            return failed;
+        }
+    }
+
+    // Called with `kv_store_lock_` held. Returns true, with the combined
+    // result, when this was the job's last missing partition. The result is
+    // stored under the same lock that drops the job, so a client sees one
+    // or the other.
+    bool add_partial_result(const op_payload& payload, mr_result& result_out) {
+        auto entry = partitioned_jobs_.find(payload.job_idx_);
+        size_t partition = static_cast<size_t>(payload.value_);
+        if (entry == partitioned_jobs_.end() || partition >= entry->second.done_.size()
+            || entry->second.done_[partition]) {
+            // Late duplicate from a stand-in.
+            return false;
+        }
+        partitioned_job& job = entry->second;
+        job.done_[partition] = true;
+        --job.remaining_;
+        job.progress_ = std::chrono::steady_clock::now();
+
+        // Partitions are disjoint, so combining is a union of the per-key
+        // results, or for top keys the best of both rankings.
+        const mr_result& partial = payload.partial_;
+        if (partial.type_ == ERROR_RESULT || job.result_.type_ == ERROR_RESULT) {
+            job.result_ = mr_result();
+            job.result_.type_ = ERROR_RESULT;
+        } else if (partial.type_ == RANKED_RESULT) {
+            job.result_.type_ = RANKED_RESULT;
+            job.result_.ranked_ = MapReduce::mergeTopK({job.result_.ranked_, partial.ranked_},
+                                                       job.job_.limit_, job.job_.lowest_);
+        } else {
+            job.result_.type_ = partial.type_;
+            job.result_.values_.insert(partial.values_.begin(), partial.values_.end());
+            job.result_.statistics_.insert(partial.statistics_.begin(), partial.statistics_.end());
+        }
+        if (job.remaining_ > 0) return false;
+
+        result_out = std::move(job.result_);
+        store_map_reduce_result(payload.job_idx_, result_out);
+        partitioned_jobs_.erase(entry);
+        release_job_pin(payload.job_idx_);
+        return true;
+    }
+
+    // Called with `kv_store_lock_` held. Drops the partitioned job at
+    // `job_idx` without its result; false if there is no such job.
+    bool abandon_partitioned_job(const ulong job_idx) {
+        auto entry = partitioned_jobs_.find(job_idx);
+        if (entry == partitioned_jobs_.end()) return false;
+        partitioned_jobs_.erase(entry);
+        release_job_pin(job_idx);
+        std::cout << "partitioned job at log index " << job_idx << " abandoned" << std::endl;
+        return true;
+    }
+
+    // Called with `kv_store_lock_` held.
+    void release_job_pin(const ulong job_idx) {
+        read_pins_.erase(read_pins_.find(job_idx));
+        kv_store_.setGcHorizon(read_pins_.empty() ? last_committed_idx_.load()
+                                                  : *read_pins_.begin());
+    }
+
+    // Appends a CANCEL_JOB entry for every partitioned job that has had no
+    // partial result for `partition_timeout_ms_`, e.g. because its owner and
+    // the server that would stand in for it are both gone. Every replica
+    // watches; the first entry committed drops the job, later ones do nothing.
+    void watch_partitioned_jobs() {
+        std::unique_lock<std::mutex> guard(watchdog_lock_);
+        while (!watchdog_cv_.wait_for(guard, std::chrono::milliseconds(100),
+                                      [this] { return stopping_; })) {
+            const auto now = std::chrono::steady_clock::now();
+            const auto timeout = std::chrono::milliseconds(partition_timeout_ms_.load());
+            std::vector<ulong> stalled;
+            {
+                std::lock_guard<std::mutex> kv_lock(kv_store_lock_);
+                for (auto& entry : partitioned_jobs_) {
+                    if (now - entry.second.progress_ < timeout) continue;
+                    stalled.push_back(entry.first);
+                    // Not again until another timeout, if this one is lost.
+                    entry.second.progress_ = now;
                 }
-                try {
-                    int value = std::stoi(value_str);
-                    values.push_back(value);
-                } catch (const std::invalid_argument& e) {
-                    // Handle or log the error
-                    continue;
+            }
+            guard.unlock();
+            for (ulong job_idx : stalled) {
+                op_payload cancel = {CANCEL_JOB, "", 0};
+                cancel.job_idx_ = job_idx;
+                if (!submit_log_ || !submit_log_(enc_log(cancel))) {
+                    std::cerr << "Cannot cancel the stalled job at log index "
+                              << job_idx << std::endl;
                 }
             }
-            // Store the key and values
-            new_kv_store.insertMany(key, values);
+            guard.lock();
         }
-        return new_kv_store;
+    }
+
+    static ptr<buffer> enc_aggregates(const aggregate_map& aggregates) {
+        size_t size = sizeof(uint32_t);
+        for (const auto& entry : aggregates) {
+            size += str_size(entry.first) + str_size(entry.second.getMapOp())
+                  + str_size(entry.second.getReduceOp())
+                  + selector_size(entry.second.getSelector());
+        }
+        ptr<buffer> ret = buffer::alloc(size);
+        buffer_serializer bs(ret);
+        bs.put_u32(static_cast<uint32_t>(aggregates.size()));
+        for (const auto& entry : aggregates) {
+            bs.put_str(entry.first);
+            bs.put_str(entry.second.getMapOp());
+            bs.put_str(entry.second.getReduceOp());
+            put_selector(bs, entry.second.getSelector());
+        }
+        return ret;
+    }
+
+    static ptr<buffer> enc_plugins(const std::vector<std::string>& plugins) {
+        size_t size = sizeof(uint32_t);
+        for (const auto& path : plugins) {
+            size += str_size(path);
+        }
+        ptr<buffer> ret = buffer::alloc(size);
+        buffer_serializer bs(ret);
+        bs.put_u32(static_cast<uint32_t>(plugins.size()));
+        for (const auto& path : plugins) {
+            bs.put_str(path);
+        }
+        return ret;
+    }
+
+    static std::vector<std::string> dec_plugins(buffer& buf) {
+        std::vector<std::string> ret;
+        buffer_serializer bs(buf);
+        uint32_t num_plugins = bs.get_u32();
+        for (uint32_t ii = 0; ii < num_plugins; ++ii) {
+            ret.push_back(bs.get_str());
+        }
+        return ret;
+    }
+
+    static aggregate_map dec_aggregates(buffer& buf) {
+        aggregate_map ret;
+        buffer_serializer bs(buf);
+        uint32_t num_aggregates = bs.get_u32();
+        for (uint32_t ii = 0; ii < num_aggregates; ++ii) {
+            std::string name = bs.get_str();
+            std::string map_op = bs.get_str();
+            std::string reduce_op = bs.get_str();
+            KeySelector selector;
+            get_selector(bs, selector);
+            ret.emplace(name, ContinuousAggregate(map_op, reduce_op, selector));
+        }
+        return ret;
     }
 
     void create_snapshot_internal(ptr<snapshot> ss) {
+        static LatencyHistogram& create_latency =
+            MetricsRegistry::instance().histogram("snapshot.create");
+        ScopedLatency timed(create_latency);
+
         std::lock_guard<std::mutex> ll(snapshots_lock_);
 
-        ptr<snapshot_ctx> ctx = cs_new<snapshot_ctx>(ss, kv_store_);
+        ptr<snapshot_ctx> ctx = nullptr;
+        {
+            std::lock_guard<std::mutex> kv_lock(kv_store_lock_);
+            ctx = cs_new<snapshot_ctx>(ss, kv_store_, aggregates_, plugins_);
+        }
         snapshots_[ss->get_last_log_idx()] = ctx;
 
         // Maintain last 3 snapshots only.
@@ -330,16 +1420,43 @@ private:
         t_hdl.detach();
     }
 
-    void add_map_reduce_result(const ulong log_idx, std::map<std::string, int>& results) {
-        std::lock_guard<std::mutex> ll(snapshots_lock_);
+    void add_map_reduce_result(const ulong log_idx, const mr_result& results) {
+        std::lock_guard<std::mutex> kv_lock(kv_store_lock_);
+        store_map_reduce_result(log_idx, results);
+    }
+
+    // Called with `kv_store_lock_` held.
+    void store_map_reduce_result(const ulong log_idx, const mr_result& results) {
         map_reduce_results_[log_idx] = results;
+        if (map_reduce_results_.size() > MAX_RESULTS) {
+            map_reduce_results_.erase(map_reduce_results_.begin());
+        }
     }
 
     // Key-value store.
     KeyValueStore kv_store_;
 
-    // MapReduce results (log_index : results, where result -> key : value)
-    std::map< ulong, std::map<std::string, int> > map_reduce_results_;
+    // Continuous aggregates by name, updated on every commit.
+    aggregate_map aggregates_;
+
+    // Paths of the plugins loaded by LOAD_PLUGIN entries, in load order.
+    std::vector<std::string> plugins_;
+
+    // Partitioned jobs by log index, until all their partial results are committed.
+    std::map<ulong, partitioned_job> partitioned_jobs_;
+
+    // Mutex for `kv_store_`, `aggregates_`, `plugins_`, `partitioned_jobs_`,
+    // `read_pins_` and `map_reduce_results_`.
+    std::mutex kv_store_lock_;
+
+    // Log indexes that read-only queries are currently using.
+    // The store keeps old versions back to the smallest of them.
+    std::multiset<ulong> read_pins_;
+
+    // MapReduce results (log_index : results, where result -> key : value),
+    // for the last `MAX_RESULTS` jobs by log index.
+    static const size_t MAX_RESULTS = 1000;
+    std::map< ulong, mr_result > map_reduce_results_;
 
     // Last committed Raft log number.
     std::atomic<uint64_t> last_committed_idx_;
@@ -347,11 +1464,39 @@ private:
     // Keeps the last 3 snapshots, by their Raft log numbers.
     std::map< uint64_t, ptr<snapshot_ctx> > snapshots_;
 
-    // Mutex for `snapshots_`.
+    // Mutex for `snapshots_` and `job_listener_`.
     std::mutex snapshots_lock_;
 
+    std::function<void(ulong, JobExecutor::Status)> job_listener_;
+
     // If `true`, snapshot will be created asynchronously.
     bool async_snapshot_;
+
+    // ID of this server; partitions owned by it are computed here.
+    int32_t server_id_ = 0;
+
+    // Set before the server starts, read by jobs.
+    std::shared_ptr<MemoryBudget> memory_budget_;
+    std::string spill_dir_ = "/tmp";
+
+    // Partitioned jobs without progress for this long are cancelled.
+    std::atomic<uint64_t> partition_timeout_ms_{30000};
+
+    // Runs `watch_partitioned_jobs` from the first partitioned job on.
+    std::thread watchdog_;
+    std::mutex watchdog_lock_;
+    std::condition_variable watchdog_cv_;
+    bool stopping_ = false;
+
+    std::atomic<uint64_t> spilled_runs_{0};
+    std::atomic<uint64_t> spilled_bytes_{0};
+
+    // Appends a log entry on behalf of the state machine.
+    std::function<bool(ptr<buffer>)> submit_log_;
+
+    // Runs MAP_REDUCE_ASYNC jobs, keyed by log index, off the commit thread.
+    // Declared last, so its workers stop before the members they use go away.
+    JobExecutor jobs_;
 };
 
 }; // namespace mapreduce_server
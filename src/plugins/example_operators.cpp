@@ -0,0 +1,77 @@
+// Example operator plugin, built as `mr_example_plugin`:
+//   plugin load ./libmr_example_plugin.so
+//   mapReduce --m abs --r spread --all
+#include "OperatorPlugin.h"
+#include <cstdlib>
+#include <limits>
+
+namespace {
+
+// |value|, in 64 bits so that INT_MIN has one.
+size_t absKernel(const int* values, size_t count, int64_t* out) {
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = std::llabs(static_cast<int64_t>(values[i]));
+    }
+    return count;
+}
+
+// Keeps the even values.
+size_t evenKernel(const int* values, size_t count, int64_t* out) {
+    size_t kept = 0;
+    for (size_t i = 0; i < count; ++i) {
+        out[kept] = values[i];
+        kept += (values[i] & 1) == 0;
+    }
+    return kept;
+}
+
+// max - min, the spread of the values.
+int spreadKernel(const int64_t* values, size_t count, uint8_t overflow, int64_t* result) {
+    if (count == 0) {
+        *result = 0;
+        return 0;
+    }
+    int64_t min = values[0];
+    int64_t max = values[0];
+    for (size_t i = 1; i < count; ++i) {
+        min = values[i] < min ? values[i] : min;
+        max = values[i] > max ? values[i] : max;
+    }
+    int64_t spread;
+    if (!__builtin_sub_overflow(max, min, &spread)) {
+        *result = spread;
+        return 0;
+    }
+    switch (overflow) {
+        case 1: *result = std::numeric_limits<int64_t>::max(); return 0;
+        case 2: return 1;
+        default:
+            *result = static_cast<int64_t>(static_cast<uint64_t>(max) - static_cast<uint64_t>(min));
+            return 0;
+    }
+}
+
+const mr_map_operator MAP_OPERATORS[] = {
+    {"abs", absKernel},
+    {"even", evenKernel},
+};
+
+const mr_reduce_operator REDUCE_OPERATORS[] = {
+    {"spread", spreadKernel, 0},
+};
+
+const mr_plugin PLUGIN = {
+    MR_PLUGIN_ABI_VERSION,
+    "example",
+    1,
+    MAP_OPERATORS,
+    sizeof(MAP_OPERATORS) / sizeof(MAP_OPERATORS[0]),
+    REDUCE_OPERATORS,
+    sizeof(REDUCE_OPERATORS) / sizeof(REDUCE_OPERATORS[0]),
+};
+
+} // namespace
+
+extern "C" const mr_plugin* mr_plugin_entry(void) {
+    return &PLUGIN;
+}
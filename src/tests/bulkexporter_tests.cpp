@@ -0,0 +1,102 @@
+#include <gtest/gtest.h>
+#include "BulkExporter.h"
+
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstring>
+#include <netinet/in.h>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+class BulkExporterTest : public ::testing::Test {
+protected:
+    std::string path;
+
+    void SetUp() override {
+        char name[] = "/tmp/bulkexporter-XXXXXX";
+        int fd = mkstemp(name);
+        ASSERT_GE(fd, 0);
+        close(fd);
+        path = name;
+    }
+
+    void TearDown() override {
+        std::remove(path.c_str());
+    }
+
+    static void exportGroups(BulkExporter& exporter, const BulkLoader::Groups& groups) {
+        for (const auto& group : groups) {
+            exporter.add(group.first, group.second);
+        }
+        exporter.finish();
+    }
+};
+
+// Test that an export in either format imports back to the same keys and values
+TEST_F(BulkExporterTest, RoundTrip) {
+    BulkLoader::Groups groups;
+    for (int i = 0; i < 5000; ++i) {
+        groups.emplace_back("key" + std::to_string(10000 + i), std::vector<int>({i, -i, 2147483647}));
+    }
+    for (BulkLoader::Format format : {BulkLoader::Csv, BulkLoader::Binary}) {
+        // A small buffer, written out many times.
+        BulkExporter exporter(path, format, 4096);
+        exportGroups(exporter, groups);
+        ASSERT_EQ(exporter.getKeys(), 5000u);
+        ASSERT_EQ(exporter.getValues(), 15000u);
+        ASSERT_GT(exporter.getBytes(), 4096u);
+        ASSERT_EQ(BulkLoader().load(path, format), groups);
+    }
+}
+
+// Test the CSV records, and the keys that CSV cannot hold
+TEST_F(BulkExporterTest, Csv) {
+    {
+        BulkExporter exporter(path, BulkLoader::Csv);
+        exportGroups(exporter, {{"a", {1, -2}}, {"empty", {}}, {"b", {3}}});
+        ASSERT_EQ(exporter.getKeys(), 2u);
+    }
+    FILE* file = fopen(path.c_str(), "r");
+    char content[64] = {0};
+    ASSERT_EQ(fread(content, 1, sizeof(content) - 1, file), 11u);
+    fclose(file);
+    ASSERT_STREQ(content, "a,1,-2\nb,3\n");
+
+    BulkExporter exporter(path, BulkLoader::Csv);
+    ASSERT_THROW(exporter.add("a,b", {1}), std::runtime_error);
+    ASSERT_THROW(exporter.add("#a", {1}), std::runtime_error);
+    ASSERT_THROW(BulkExporter("/nonexistent/dir/file", BulkLoader::Csv), std::runtime_error);
+}
+
+// Test streaming an export to a TCP listener
+TEST_F(BulkExporterTest, Tcp) {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0);
+    ASSERT_EQ(listen(listener, 1), 0);
+    socklen_t length = sizeof(addr);
+    getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &length);
+
+    std::string received;
+    std::thread reader([&] {
+        int connection = accept(listener, nullptr, nullptr);
+        char buffer[4096];
+        ssize_t n;
+        while ((n = recv(connection, buffer, sizeof(buffer), 0)) > 0) {
+            received.append(buffer, n);
+        }
+        close(connection);
+    });
+    BulkExporter exporter("tcp:127.0.0.1:" + std::to_string(ntohs(addr.sin_port)), BulkLoader::Csv);
+    exportGroups(exporter, {{"x", {7}}, {"y", {8, 9}}});
+    reader.join();
+    close(listener);
+    ASSERT_EQ(received, "x,7\ny,8,9\n");
+    ASSERT_EQ(exporter.getBytes(), received.size());
+}
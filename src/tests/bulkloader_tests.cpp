@@ -0,0 +1,109 @@
+#include <gtest/gtest.h>
+#include "BulkLoader.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+class BulkLoaderTest : public ::testing::Test {
+protected:
+    static BulkLoader::Groups parse(const std::string& data, BulkLoader::Format format,
+                                    size_t threads = 1) {
+        return BulkLoader(threads).parse(data.data(), data.size(), format);
+    }
+
+    static void putRecord(std::string& out, const std::string& key, const std::vector<int>& values) {
+        const uint32_t keySize = key.size();
+        const uint32_t count = values.size();
+        out.append(reinterpret_cast<const char*>(&keySize), sizeof(keySize));
+        out += key;
+        out.append(reinterpret_cast<const char*>(&count), sizeof(count));
+        out.append(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(int));
+    }
+};
+
+// Test that CSV records are grouped by key, in key order, keeping the file order of values
+TEST_F(BulkLoaderTest, Csv) {
+    BulkLoader::Groups groups = parse("b,3\n# comment\na,1, 2\r\n\nb,-4,5\na,6,\n",
+                                      BulkLoader::Csv);
+    BulkLoader::Groups expected = {{"a", {1, 2, 6}}, {"b", {3, -4, 5}}};
+    ASSERT_EQ(groups, expected);
+
+    ASSERT_THROW(parse("a\n", BulkLoader::Csv), std::runtime_error);
+    ASSERT_THROW(parse("a,1x\n", BulkLoader::Csv), std::runtime_error);
+    ASSERT_THROW(parse("a,99999999999\n", BulkLoader::Csv), std::runtime_error);
+}
+
+// Test binary records, and that a truncated one is rejected
+TEST_F(BulkLoaderTest, Binary) {
+    std::string data;
+    putRecord(data, "k2", {7});
+    putRecord(data, "k1", {1, 2});
+    putRecord(data, "k2", {8, 9});
+    BulkLoader::Groups expected = {{"k1", {1, 2}}, {"k2", {7, 8, 9}}};
+    ASSERT_EQ(parse(data, BulkLoader::Binary), expected);
+
+    ASSERT_THROW(parse(data.substr(0, data.size() - 1), BulkLoader::Binary), std::runtime_error);
+    ASSERT_THROW(parse(data + "x", BulkLoader::Binary), std::runtime_error);
+}
+
+// Test that parsing in parts on several threads gives the same groups as one thread
+TEST_F(BulkLoaderTest, Parallel) {
+    std::string csv, binary;
+    for (int i = 0; i < 400000; ++i) {
+        const std::string key = "key" + std::to_string(i % 1000 * 7919 % 1000);
+        csv += key + "," + std::to_string(i) + "\n";
+        putRecord(binary, key, {i, -i});
+    }
+    ASSERT_GT(csv.size(), 4u << 20);
+
+    BulkLoader::Groups single = parse(csv, BulkLoader::Csv, 1);
+    ASSERT_EQ(single.size(), 1000u);
+    ASSERT_EQ(single[0].first, "key0");
+    ASSERT_EQ(single[0].second.size(), 400u);
+    ASSERT_EQ(parse(csv, BulkLoader::Csv, 4), single);
+
+    BulkLoader::Groups fromBinary = parse(binary, BulkLoader::Binary, 4);
+    ASSERT_EQ(fromBinary.size(), 1000u);
+    ASSERT_EQ(fromBinary, parse(binary, BulkLoader::Binary, 1));
+    ASSERT_EQ(fromBinary[0].second[0], 0);
+    ASSERT_EQ(fromBinary[0].second[2], 1000);
+    ASSERT_EQ(fromBinary[0].second[3], -1000);
+}
+
+// Test splitting groups into batches of bounded size, across a large key if needed
+TEST_F(BulkLoaderTest, Split) {
+    BulkLoader::Groups groups = {{"a", {1}}, {"b", {1, 2, 3, 4, 5}}, {"c", {6, 7}}};
+    std::vector<BulkLoader::Groups> batches = BulkLoader::split(std::move(groups), 3);
+    std::vector<BulkLoader::Groups> expected = {
+        {{"a", {1}}, {"b", {1, 2}}},
+        {{"b", {3, 4, 5}}},
+        {{"c", {6, 7}}},
+    };
+    ASSERT_EQ(batches, expected);
+    ASSERT_TRUE(BulkLoader::split(BulkLoader::Groups(), 3).empty());
+}
+
+// Test loading a mapped file, and the format from the file name
+TEST_F(BulkLoaderTest, Load) {
+    char path[] = "/tmp/bulkloader-XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    {
+        std::ofstream out(path);
+        out << "x,1,2\ny,3\n";
+    }
+    BulkLoader::Groups expected = {{"x", {1, 2}}, {"y", {3}}};
+    ASSERT_EQ(BulkLoader().load(path, BulkLoader::Csv), expected);
+    std::remove(path);
+    ASSERT_THROW(BulkLoader().load(path, BulkLoader::Csv), std::runtime_error);
+
+    ASSERT_EQ(BulkLoader::formatOf("data/values.csv"), BulkLoader::Csv);
+    ASSERT_EQ(BulkLoader::formatOf("values.bin"), BulkLoader::Binary);
+    ASSERT_EQ(BulkLoader::parseFormat("binary"), BulkLoader::Binary);
+    ASSERT_THROW(BulkLoader::parseFormat("json"), std::runtime_error);
+}
@@ -0,0 +1,122 @@
+#include <gtest/gtest.h>
+#include "ContinuousAggregate.h"
+#include "MapReduce.h"
+
+#include <stdexcept>
+
+class ContinuousAggregateTest : public ::testing::Test {
+protected:
+    KeyValueStore kvStore;
+    std::vector<ContinuousAggregate> aggregates;
+
+    // Applies each mutation to the store and, like the state machine,
+    // to the aggregates only if the store changed.
+    void insert(const std::string& key, int value) {
+        kvStore.insert(key, value);
+        for (auto& aggregate : aggregates) aggregate.onInsert(key, value);
+    }
+
+    void removeValue(const std::string& key, int value) {
+        if (kvStore.removeValue(key, value)) {
+            for (auto& aggregate : aggregates) aggregate.onRemoveValue(key, value);
+        }
+    }
+
+    void removeKey(const std::string& key) {
+        if (kvStore.removeKey(key)) {
+            for (auto& aggregate : aggregates) aggregate.onRemoveKey(key);
+        }
+    }
+
+    void expectMatchesMapReduce() {
+        MapReduce mapReduce(kvStore);
+        for (const auto& aggregate : aggregates) {
+            auto expected = mapReduce.performMapReduce(aggregate.getMapOp(), aggregate.getReduceOp(),
+                                                       aggregate.getSelector());
+            EXPECT_EQ(aggregate.getResults(), expected)
+                << aggregate.getMapOp() << " / " << aggregate.getReduceOp();
+        }
+    }
+};
+
+// Test that sum and count follow inserts and removals
+TEST_F(ContinuousAggregateTest, SumAndCount) {
+    KeySelector keys = KeySelector::keyList({"a", "b", "missing"});
+    aggregates.emplace_back("square", "sum", keys);
+    aggregates.emplace_back("square|gt:4", "count", keys);
+    aggregates.emplace_back("double", "sum_of_squares", KeySelector::allKeys());
+
+    insert("a", 1);
+    insert("a", 3);
+    insert("b", -2);
+    expectMatchesMapReduce();
+
+    removeValue("a", 1);
+    removeValue("a", 7);  // Not in the store
+    insert("b", 5);
+    expectMatchesMapReduce();
+
+    removeKey("b");
+    expectMatchesMapReduce();
+}
+
+// Test that min and max fall back to the next value when the extreme is removed
+TEST_F(ContinuousAggregateTest, MinAndMax) {
+    aggregates.emplace_back("double", "min", KeySelector::prefix("k"));
+    aggregates.emplace_back("double", "max", KeySelector::prefix("k"));
+
+    insert("k1", 4);
+    insert("k1", -3);
+    insert("k1", -3);
+    insert("k2", 10);
+    insert("x", -100);
+    expectMatchesMapReduce();
+
+    removeValue("k1", -3);
+    expectMatchesMapReduce();
+    removeValue("k1", -3);
+    removeValue("k2", 10);
+    expectMatchesMapReduce();
+}
+
+// Test that a registration over an existing store starts from its contents
+TEST_F(ContinuousAggregateTest, RebuildFromStore) {
+    kvStore.insertMany("a", {1, 2, 3});
+    kvStore.insertMany("b", {4});
+    aggregates.emplace_back("triple", "sum", KeySelector::range("a", "b"));
+    aggregates.back().rebuild(kvStore);
+    expectMatchesMapReduce();
+
+    insert("a", 10);
+    insert("b", 10);
+    expectMatchesMapReduce();
+
+    int64_t result = 0;
+    ASSERT_TRUE(aggregates.back().getResult("a", result));
+    ASSERT_EQ(result, 48);
+    ASSERT_FALSE(aggregates.back().getResult("b", result));
+}
+
+// Test that only invertible reducers and min/max can be registered
+TEST_F(ContinuousAggregateTest, UnsupportedReducer) {
+    ASSERT_FALSE(ContinuousAggregate::isSupported("product"));
+    ASSERT_THROW(ContinuousAggregate("square", "product", KeySelector::allKeys()), std::runtime_error);
+    ASSERT_THROW(ContinuousAggregate("cube", "sum", KeySelector::allKeys()), std::runtime_error);
+}
+
+// Test that sketch aggregates rebuild a key on removal
+TEST_F(ContinuousAggregateTest, DistinctSketch) {
+    aggregates.emplace_back("square", "distinct", KeySelector::allKeys());
+    ASSERT_TRUE(aggregates.back().onRemoveValue("a", 1));  // Nothing to remove yet
+
+    for (int value = -50; value <= 50; ++value) {
+        insert("a", value);
+    }
+    expectMatchesMapReduce();
+
+    ASSERT_FALSE(aggregates.back().onRemoveValue("a", 50));
+    kvStore.removeValue("a", 50);
+    kvStore.removeValue("a", -50);
+    aggregates.back().rebuildKey("a", kvStore.getValues("a"));
+    expectMatchesMapReduce();
+}
@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+#include "JobExecutor.h"
+
+#include <stdexcept>
+
+using Status = JobExecutor::Status;
+
+class JobExecutorTest : public ::testing::Test {
+protected:
+    const std::chrono::milliseconds timeout{5000};
+
+    // A task that runs until it is cancelled.
+    static void untilCancelled(const std::atomic<bool>& cancelled) {
+        while (!cancelled) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        throw std::runtime_error("cancelled");
+    }
+};
+
+// Test that a job runs and reports its status to the callback
+TEST_F(JobExecutorTest, RunsJob) {
+    JobExecutor executor(2);
+    std::atomic<int> result(0);
+    std::atomic<Status> reported(Status::Unknown);
+    executor.submit(1, [&](const std::atomic<bool>&) { result = 42; },
+                    [&](uint64_t, Status status, const std::string&) { reported = status; });
+    ASSERT_TRUE(executor.wait(1, timeout));
+    ASSERT_EQ(result, 42);
+    ASSERT_EQ(executor.getStatus(1), Status::Done);
+    ASSERT_EQ(reported, Status::Done);
+    ASSERT_EQ(executor.getStatus(2), Status::Unknown);
+    ASSERT_THROW(executor.submit(1, [](const std::atomic<bool>&) {}), std::runtime_error);
+}
+
+// Test that an exception fails the job with its message
+TEST_F(JobExecutorTest, FailedJob) {
+    JobExecutor executor(1);
+    executor.submit(1, [](const std::atomic<bool>&) { throw std::runtime_error("no such key"); });
+    ASSERT_TRUE(executor.wait(1, timeout));
+    ASSERT_EQ(executor.getStatus(1), Status::Failed);
+    ASSERT_EQ(executor.getError(1), "no such key");
+}
+
+// Test that no more than the configured number of jobs run at once
+TEST_F(JobExecutorTest, ConcurrencyLimit) {
+    JobExecutor executor(2);
+    std::atomic<int> running(0), maxRunning(0);
+    for (uint64_t id = 1; id <= 8; ++id) {
+        executor.submit(id, [&](const std::atomic<bool>&) {
+            int now = ++running;
+            int seen = maxRunning;
+            while (now > seen && !maxRunning.compare_exchange_weak(seen, now)) {}
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            --running;
+        });
+    }
+    for (uint64_t id = 1; id <= 8; ++id) {
+        ASSERT_TRUE(executor.wait(id, timeout));
+    }
+    ASSERT_LE(maxRunning, 2);
+}
+
+// Test cancelling a running job and a queued one
+TEST_F(JobExecutorTest, Cancel) {
+    JobExecutor executor(1);
+    executor.submit(1, untilCancelled);
+    executor.submit(2, [](const std::atomic<bool>&) {});
+    while (executor.getStatus(1) != Status::Running) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_EQ(executor.getStatus(2), Status::Queued);
+    ASSERT_TRUE(executor.cancel(2));
+    ASSERT_EQ(executor.getStatus(2), Status::Cancelled);
+    ASSERT_TRUE(executor.cancel(1));
+    ASSERT_TRUE(executor.wait(1, timeout));
+    ASSERT_EQ(executor.getStatus(1), Status::Cancelled);
+    ASSERT_FALSE(executor.cancel(1));
+}
+
+// Test that only the last jobs to end are kept
+TEST_F(JobExecutorTest, KeepsLastEndedJobs) {
+    JobExecutor executor(1, 2);
+    for (uint64_t id = 1; id <= 3; ++id) {
+        executor.submit(id, [](const std::atomic<bool>&) {});
+        ASSERT_TRUE(executor.wait(id, timeout));
+    }
+    ASSERT_EQ(executor.getStatus(1), Status::Unknown);
+    ASSERT_EQ(executor.getStatus(2), Status::Done);
+    ASSERT_EQ(executor.getJobs().size(), 2u);
+}
@@ -0,0 +1,46 @@
+#include <gtest/gtest.h>
+#include "KeyGrouper.h"
+
+#include <stdexcept>
+
+class KeyGrouperTest : public ::testing::Test {
+protected:
+    static std::string groupOf(const KeyGrouper& grouper, const std::string& key) {
+        std::string group;
+        return grouper.group(key, group) ? group : "<none>";
+    }
+};
+
+// Test grouping by the key up to its Nth separator
+TEST_F(KeyGrouperTest, Prefix) {
+    KeyGrouper region = KeyGrouper::parse("prefix:1");
+    ASSERT_EQ(groupOf(region, "eu/dev7/temp"), "eu");
+    ASSERT_EQ(groupOf(region, "/dev7"), "");
+    ASSERT_EQ(groupOf(region, "eu"), "<none>");
+
+    KeyGrouper device = KeyGrouper::parse("prefix:2");
+    ASSERT_EQ(groupOf(device, "eu/dev7/temp"), "eu/dev7");
+    ASSERT_EQ(groupOf(device, "eu/dev7"), "<none>");
+
+    KeyGrouper dotted = KeyGrouper::parse("prefix:1:.");
+    ASSERT_EQ(groupOf(dotted, "eu.dev7/temp"), "eu");
+}
+
+// Test grouping by a regex capture
+TEST_F(KeyGrouperTest, Regex) {
+    KeyGrouper metric = KeyGrouper::parse("regex:/([a-z]+)$");
+    ASSERT_EQ(groupOf(metric, "eu/dev7/temp"), "temp");
+    ASSERT_EQ(groupOf(metric, "eu/dev7/t1"), "<none>");
+
+    KeyGrouper whole = KeyGrouper::parse("regex:dev[0-9]");
+    ASSERT_EQ(groupOf(whole, "eu/dev7/temp"), "dev7");
+}
+
+// Test that malformed specs are rejected
+TEST_F(KeyGrouperTest, InvalidSpec) {
+    ASSERT_THROW(KeyGrouper::parse("prefix:0"), std::runtime_error);
+    ASSERT_THROW(KeyGrouper::parse("prefix:x"), std::runtime_error);
+    ASSERT_THROW(KeyGrouper::parse("prefix:1:ab"), std::runtime_error);
+    ASSERT_THROW(KeyGrouper::parse("regex:("), std::runtime_error);
+    ASSERT_THROW(KeyGrouper::parse("suffix:1"), std::runtime_error);
+}
@@ -76,3 +76,187 @@ TEST_F(KeyValueStoreTest, CopyKeyValueStore) {
     ASSERT_EQ(copy.getValues("Books")[0], 100);
     ASSERT_EQ(copy.getValues("Electronics")[0], 200);
 }
+
+// Test reading values at a past version
+TEST_F(KeyValueStoreTest, ReadAtPastVersion) {
+    kvStore.setVersion(1);
+    kvStore.insert("Books", 100);
+    kvStore.setVersion(2);
+    kvStore.insert("Books", 200);
+    kvStore.setVersion(3);
+    kvStore.removeValue("Books", 100);
+    ASSERT_EQ(kvStore.getValuesAt("Books", 1), std::vector<int>({100}));
+    ASSERT_EQ(kvStore.getValuesAt("Books", 2), std::vector<int>({100, 200}));
+    ASSERT_EQ(kvStore.getValuesAt("Books", 3), std::vector<int>({200}));
+    ASSERT_EQ(kvStore.getValues("Books"), std::vector<int>({200}));
+}
+
+// Test that a removed key is still visible at versions before the removal
+TEST_F(KeyValueStoreTest, ReadRemovedKeyAtPastVersion) {
+    kvStore.setVersion(1);
+    kvStore.insert("Books", 100);
+    kvStore.setVersion(2);
+    kvStore.removeKey("Books");
+    ASSERT_EQ(kvStore.getValuesAt("Books", 1), std::vector<int>({100}));
+    EXPECT_THROW(kvStore.getValuesAt("Books", 2), std::runtime_error);
+    EXPECT_THROW(kvStore.getValuesAt("Books", 0), std::runtime_error);
+    ASSERT_TRUE(kvStore.getAll().empty());
+    ASSERT_EQ(kvStore.getAllAt(1).size(), 1);
+}
+
+// Test that versions below the GC horizon are dropped
+TEST_F(KeyValueStoreTest, GarbageCollectOldVersions) {
+    kvStore.setVersion(1);
+    kvStore.insert("Books", 100);
+    kvStore.setVersion(2);
+    kvStore.insert("Books", 200);
+    kvStore.setGcHorizon(2);
+    kvStore.collectGarbage();
+    EXPECT_THROW(kvStore.getValuesAt("Books", 1), std::runtime_error);
+    ASSERT_EQ(kvStore.getValuesAt("Books", 2), std::vector<int>({100, 200}));
+}
+
+// Test that a copy keeps its values when the original is modified in place
+TEST_F(KeyValueStoreTest, CopyIsIsolatedFromWrites) {
+    kvStore.insert("Books", 100);
+    KeyValueStore copy = kvStore;
+    kvStore.insert("Books", 200);
+    kvStore.removeValue("Books", 100);
+    ASSERT_EQ(copy.getValues("Books"), std::vector<int>({100}));
+    ASSERT_EQ(kvStore.getValues("Books"), std::vector<int>({200}));
+}
+
+// Test an ordered scan of a key range
+TEST_F(KeyValueStoreTest, ScanRange) {
+    kvStore.insert("a", 1);
+    kvStore.insert("b", 2);
+    kvStore.insert("c", 3);
+    kvStore.insert("d", 4);
+    std::vector<std::string> keys;
+    kvStore.scan("b", "d", kvStore.getVersion(), [&](const std::string& key, const std::vector<int>&) {
+        keys.push_back(key);
+    });
+    ASSERT_EQ(keys, std::vector<std::string>({"b", "c"}));
+    keys.clear();
+    kvStore.scan("c", "", kvStore.getVersion(), [&](const std::string& key, const std::vector<int>&) {
+        keys.push_back(key);
+    });
+    ASSERT_EQ(keys, std::vector<std::string>({"c", "d"}));
+}
+
+// Test paging through a range, skipping keys removed as of the scanned version
+TEST_F(KeyValueStoreTest, ScanPage) {
+    kvStore.setVersion(1);
+    for (const char* key : {"a", "b", "c", "d", "e"}) {
+        kvStore.insert(key, 1);
+    }
+    kvStore.setVersion(2);
+    kvStore.removeKey("b");
+
+    std::vector<std::string> keys;
+    auto visit = [&](const std::string& key, const std::vector<int>&) {
+        keys.push_back(key);
+    };
+    std::string next;
+    ASSERT_TRUE(kvStore.scanPage("a", "", 2, 2, next, visit));
+    ASSERT_EQ(next, "d");
+    ASSERT_FALSE(kvStore.scanPage(next, "", 2, 2, next, visit));
+    ASSERT_EQ(keys, std::vector<std::string>({"a", "c", "d", "e"}));
+
+    keys.clear();
+    ASSERT_TRUE(kvStore.scanPage("a", "d", 1, 2, next, visit));
+    ASSERT_FALSE(kvStore.scanPage(next, "d", 1, 2, next, visit));
+    ASSERT_EQ(keys, std::vector<std::string>({"a", "b", "c"}));
+}
+
+// Test copying a range in pages as of a past version, unaffected by later writes
+TEST_F(KeyValueStoreTest, CopyPage) {
+    kvStore.setVersion(1);
+    for (const char* key : {"a", "b", "c", "d"}) {
+        kvStore.insert(key, 1);
+    }
+    kvStore.setVersion(2);
+    kvStore.insert("a", 2);
+    kvStore.removeKey("c");
+
+    KeyValueStore copy;
+    std::string next;
+    ASSERT_TRUE(kvStore.copyPage("a", "", 1, 3, next, copy));
+    ASSERT_EQ(next, "d");
+    ASSERT_FALSE(kvStore.copyPage(next, "", 1, 3, next, copy));
+    // A key copied twice is counted once.
+    ASSERT_FALSE(kvStore.copyPage("b", std::string("b") + '\0', 1, 1, next, copy));
+    kvStore.setVersion(3);
+    kvStore.insert("b", 3);
+    ASSERT_EQ(copy.getKeyCount(), 4u);
+    ASSERT_EQ(copy.getValueCount(), 4u);
+    ASSERT_EQ(copy.getValuesAt("a", 1), std::vector<int>({1}));
+    ASSERT_EQ(copy.getValuesAt("b", 1), std::vector<int>({1}));
+    ASSERT_EQ(copy.getValuesAt("c", 1), std::vector<int>({1}));
+}
+
+// Test prefix selector bounds
+TEST_F(KeyValueStoreTest, PrefixBounds) {
+    std::string begin, end;
+    KeySelector::prefix("eu/").bounds(begin, end);
+    ASSERT_EQ(begin, "eu/");
+    ASSERT_EQ(end, "eu0");
+    KeySelector::prefix(std::string("a\xff", 2)).bounds(begin, end);
+    ASSERT_EQ(end, "b");
+    KeySelector::allKeys().bounds(begin, end);
+    ASSERT_TRUE(begin.empty() && end.empty());
+}
+
+// Test splitting a key range into parts of similar size
+TEST_F(KeyValueStoreTest, SplitRange) {
+    for (int i = 0; i < 10; ++i) {
+        kvStore.insert("key" + std::to_string(i), i);
+    }
+    auto boundaries = kvStore.splitRange("", "", 3);
+    ASSERT_EQ(boundaries, std::vector<std::string>({"", "key3", "key6", ""}));
+    ASSERT_EQ(kvStore.splitRange("", "", 3, 5).size(), 3); // Only 2 parts of 5 keys
+    ASSERT_EQ(kvStore.splitRange("z", "a", 3).size(), 2);
+}
+
+// Test that partitions cover each selected key exactly once
+TEST_F(KeyValueStoreTest, Partition) {
+    for (int i = 0; i < 10; ++i) {
+        kvStore.insert("key" + std::to_string(i), i);
+    }
+    auto ranges = kvStore.partition(KeySelector::prefix("key"), 3);
+    ASSERT_EQ(ranges.size(), 3);
+    ASSERT_EQ(ranges[0].begin, "key");
+    ASSERT_EQ(ranges[1].begin, "key3");
+    ASSERT_EQ(ranges[2].end, "kez");
+
+    auto lists = kvStore.partition(KeySelector::keyList({"a", "b", "c", "d", "e"}), 2);
+    ASSERT_EQ(lists.size(), 2);
+    ASSERT_EQ(lists[0].keys, std::vector<std::string>({"a", "b"}));
+    ASSERT_EQ(lists[1].keys, std::vector<std::string>({"c", "d", "e"}));
+    ASSERT_EQ(kvStore.partition(KeySelector::keyList({"a"}), 4).size(), 1);
+}
+
+// Test that key and value counts follow every kind of write across versions
+TEST_F(KeyValueStoreTest, Counts) {
+    kvStore.setVersion(1);
+    kvStore.insert("a", 1);
+    kvStore.insertMany("b", {1, 2, 3});
+    kvStore.setVersion(2);
+    kvStore.insert("a", 2);
+    kvStore.removeValue("b", 2);
+    kvStore.removeValue("b", 42);
+    ASSERT_EQ(kvStore.getKeyCount(), 2);
+    ASSERT_EQ(kvStore.getValueCount(), 4);
+
+    kvStore.setVersion(3);
+    kvStore.removeMany("a", {1, 7});
+    kvStore.removeKey("b");
+    kvStore.removeKey("b");
+    ASSERT_EQ(kvStore.getKeyCount(), 1);
+    ASSERT_EQ(kvStore.getValueCount(), 1);
+
+    kvStore.insert("b", 5);
+    KeyValueStore copy = kvStore.getCopy();
+    ASSERT_EQ(copy.getKeyCount(), 2);
+    ASSERT_EQ(copy.getValueCount(), 2);
+}
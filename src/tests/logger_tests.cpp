@@ -0,0 +1,78 @@
+#include <gtest/gtest.h>
+#include "logger.h"
+
+#include <climits>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+class LoggerTest : public ::testing::Test {
+protected:
+    std::string path = "/tmp/mapreduce_logger_test." + std::to_string(getpid());
+
+    void TearDown() override {
+        std::remove(path.c_str());
+    }
+
+    // Logs the same messages in `mode` to a new file at `path`.
+    std::string logMessages(SimpleLogger::LogMode mode) {
+        std::remove(path.c_str());
+
+        SimpleLogger* l = new SimpleLogger(path, 64, 0, 1);
+        l->setLogMode(mode);
+        l->setDispLevel(-1);
+        l->start();
+        l->setLogLevel(6);
+        _log_info(l, "int %d, neg %i, unsigned %u, hex %#x, char %c",
+                  42, -7, 4000000000u, 255, 'z');
+        _log_warn(l, "long %ld, llong %lld, size %zu, short %hd, byte %hhu",
+                  -1234567890123L, LLONG_MIN, (size_t)123, (short)-3, (unsigned char)200);
+        _log_debug(l, "double %.3f, exp %e, general %g, width [%8.2f], ldouble %Lf",
+                   3.14159, 1e-9, 0.5, -2.5, 1.5L);
+        _log_trace(l, "star [%*d] [%-*d] [%.*s], string %s, padded [%-8s], %% %p",
+                   6, 17, 4, 3, 3, "abcdef", "hello", "ab", (void*)0x1234);
+        _s_err(l) << "stream " << 12 << ' ' << 2.5;
+        delete l;
+        return path;
+    }
+
+    // Lines of a log without the time and thread id.
+    static std::vector<std::string> messages(std::istream& in) {
+        std::vector<std::string> lines;
+        std::string line;
+        while (std::getline(in, line)) {
+            size_t pos = line.find("] [");
+            lines.push_back(pos == std::string::npos ? line : line.substr(pos));
+        }
+        return lines;
+    }
+
+    static std::vector<std::string> messages(const std::string& path) {
+        std::ifstream in(path);
+        return messages(in);
+    }
+};
+
+// Test that deferred and binary logs read the same as text logs
+TEST_F(LoggerTest, DeferredFormatting) {
+    auto text = messages(logMessages(SimpleLogger::TEXT_MODE));
+    ASSERT_EQ(text.size(), 7u);  // With start and stop messages
+    ASSERT_NE(text[1].find("hex 0xff, char z"), std::string::npos) << text[1];
+
+    ASSERT_EQ(messages(logMessages(SimpleLogger::DEFERRED_MODE)), text);
+
+    std::ifstream binary(logMessages(SimpleLogger::BINARY_MODE), std::ifstream::binary);
+    std::stringstream decoded;
+    ASSERT_EQ(SimpleLogger::decodeBinaryLog(binary, decoded), 7);
+    ASSERT_EQ(messages(decoded), text);
+}
+
+// Test that only binary logs can be decoded
+TEST_F(LoggerTest, DecodeTextLog) {
+    std::ifstream text(logMessages(SimpleLogger::TEXT_MODE));
+    std::stringstream decoded;
+    ASSERT_EQ(SimpleLogger::decodeBinaryLog(text, decoded), -1);
+}
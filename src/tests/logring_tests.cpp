@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+#include "log_ring.h"
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+class LogRingTest : public ::testing::Test {
+protected:
+    LogRing ring{4096};
+
+    std::vector<std::string> drain() {
+        std::vector<std::string> records;
+        ring.consume([&](const char* data, size_t len) { records.emplace_back(data, len); });
+        return records;
+    }
+};
+
+// Test that records of any length come back in order, across the end of the buffer
+TEST_F(LogRingTest, VariableLengthRecords) {
+    for (int round = 0; round < 50; ++round) {
+        std::vector<std::string> written;
+        for (size_t len : {0, 1, 7, 8, 9, 100, 333}) {
+            written.push_back(std::string(len, static_cast<char>('a' + round % 26)));
+            ASSERT_TRUE(ring.write(written.back().data(), written.back().size()));
+        }
+        ASSERT_EQ(drain(), written);
+        ASSERT_EQ(ring.used(), 0u);
+    }
+    ASSERT_EQ(ring.getDropped(), 0u);
+}
+
+// Test that a full ring drops and counts records instead of waiting
+TEST_F(LogRingTest, DropsWhenFull) {
+    const std::string record(200, 'x');
+    size_t written = 0;
+    while (ring.write(record.data(), record.size())) ++written;
+    ASSERT_GT(written, 0u);
+    ASSERT_EQ(ring.getDropped(), 1u);
+    ASSERT_FALSE(ring.write(std::string(ring.capacity(), 'y').data(), ring.capacity()));
+    ASSERT_EQ(ring.getDropped(), 2u);
+
+    ASSERT_EQ(drain().size(), written);
+    ASSERT_TRUE(ring.write(record.data(), record.size()));
+}
+
+// Test that concurrent producers lose nothing but drops, and keep their own order
+TEST_F(LogRingTest, ConcurrentProducers) {
+    const int producers = 8;
+    const int perProducer = 20000;
+    std::atomic<int> running(producers);
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&, p] {
+            char msg[32];
+            for (int i = 0; i < perProducer; ++i) {
+                int len = snprintf(msg, sizeof(msg), "%d:%d", p, i);
+                ring.write(msg, len);
+            }
+            running--;
+        });
+    }
+
+    std::vector<int> last(producers, -1);
+    size_t received = 0;
+    auto check = [&](const char* data, size_t len) {
+        int p = 0, i = 0;
+        ASSERT_EQ(sscanf(std::string(data, len).c_str(), "%d:%d", &p, &i), 2);
+        ASSERT_GT(i, last[p]);
+        last[p] = i;
+        ++received;
+    };
+    while (running > 0) {
+        ring.consume(check);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    ring.consume(check);
+    ASSERT_EQ(received + ring.getDropped(), size_t(producers) * perProducer);
+    ASSERT_EQ(ring.used(), 0u);
+}
@@ -0,0 +1,64 @@
+#include <gtest/gtest.h>
+#include "MapPipeline.h"
+
+#include <stdexcept>
+
+class MapPipelineTest : public ::testing::Test {
+protected:
+    std::vector<int> values = {-3, -1, 0, 2, 5, 10};
+
+    std::vector<int64_t> applyFused(const std::string& spec) {
+        std::vector<int64_t> out;
+        MapPipeline::parse(spec).apply(values.data(), values.size(), out);
+        return out;
+    }
+
+    std::vector<int64_t> applyInterpreted(const std::string& spec) {
+        std::vector<int64_t> out;
+        MapPipeline::parse(spec).interpret(values.data(), values.size(), out);
+        return out;
+    }
+};
+
+// Test a single map operation
+TEST_F(MapPipelineTest, SingleStage) {
+    ASSERT_EQ(applyFused("square"), std::vector<int64_t>({9, 1, 0, 4, 25, 100}));
+    ASSERT_EQ(applyFused("double"), std::vector<int64_t>({-6, -2, 0, 4, 10, 20}));
+    ASSERT_EQ(applyFused("triple"), std::vector<int64_t>({-9, -3, 0, 6, 15, 30}));
+}
+
+// Test that stages are applied left to right: triple(square(x))
+TEST_F(MapPipelineTest, ChainIsAppliedLeftToRight) {
+    ASSERT_EQ(applyFused("square|triple"), std::vector<int64_t>({27, 3, 0, 12, 75, 300}));
+    ASSERT_EQ(applyFused("add:1|mul:2"), std::vector<int64_t>({-4, 0, 2, 6, 12, 22}));
+}
+
+// Test that a filter drops values
+TEST_F(MapPipelineTest, FilterDropsValues) {
+    ASSERT_EQ(applyFused("gt:0"), std::vector<int64_t>({2, 5, 10}));
+    ASSERT_EQ(applyFused("square|gt:4|add:-1"), std::vector<int64_t>({8, 24, 99}));
+}
+
+// Test that known chains are fused and others are interpreted
+TEST_F(MapPipelineTest, FusedAndInterpretedPaths) {
+    ASSERT_TRUE(MapPipeline::parse("square|triple").isFused());
+    ASSERT_TRUE(MapPipeline::parse("square|add:1|gt:3").isFused());
+    ASSERT_FALSE(MapPipeline::parse("double|double|double|double").isFused());
+}
+
+// Test that both paths give the same results
+TEST_F(MapPipelineTest, FusedMatchesInterpreter) {
+    for (const std::string spec : {"square", "square|triple", "gt:0|mul:-2",
+                                   "square|add:1|gt:3", "double|double|double|gt:-10"}) {
+        ASSERT_EQ(applyFused(spec), applyInterpreted(spec)) << spec;
+    }
+}
+
+// Test invalid pipelines
+TEST_F(MapPipelineTest, InvalidPipeline) {
+    EXPECT_THROW(MapPipeline::parse("cube"), std::runtime_error);
+    EXPECT_THROW(MapPipeline::parse("square|"), std::runtime_error);
+    EXPECT_THROW(MapPipeline::parse("add:"), std::runtime_error);
+    EXPECT_THROW(MapPipeline::parse("mul:2x"), std::runtime_error);
+    EXPECT_THROW(MapPipeline::parse(""), std::runtime_error);
+}
@@ -1,4 +1,5 @@
 #include <gtest/gtest.h>
+#include <cmath>
 #include "MapReduce.h"
 #include "KeyValueStore.h"
 
@@ -135,3 +136,267 @@ TEST_F(MapReduceTest, ProductReduceSingleValue) {
     auto results = mapReduce->performMapReduce("double", "product", keys);
     ASSERT_EQ(results["Category2"], 60); // 30*2
 }
+
+// Test MapReduce against a past version of the store
+TEST_F(MapReduceTest, ReadAtPastVersion) {
+    KeyValueStore store;
+    store.setVersion(1);
+    store.insert("Books", 1);
+    store.setVersion(2);
+    store.insert("Books", 2);
+    MapReduce past(store, 1);
+    ASSERT_EQ(past.performMapReduce("double", "sum", {"Books"})["Books"], 2);
+    MapReduce latest(store, 2);
+    ASSERT_EQ(latest.performMapReduce("double", "sum", {"Books"})["Books"], 6);
+    store.setGcHorizon(2);
+    EXPECT_THROW(MapReduce(store, 1), std::runtime_error);
+}
+
+// Test that square + sum no longer overflows 32 bits
+TEST_F(MapReduceTest, SumAccumulatesIn64Bits) {
+    kvStore.insert("Large", 2000000000);
+    kvStore.insert("Large", 2000000000);
+    MapReduce mr(kvStore);
+    auto results = mr.performMapReduce("square", "sum", {"Large"});
+    ASSERT_EQ(results["Large"], 8000000000000000000LL); // 2 * (2e9)^2
+}
+
+// Test the overflow policies for a product that does not fit 64 bits
+TEST_F(MapReduceTest, ProductOverflowPolicies) {
+    kvStore.insert("Large", 2000000000);
+    kvStore.insert("Large", -2000000000);
+    kvStore.insert("Large", 2000000000);
+    MapReduce mr(kvStore);
+    auto saturated = mr.performMapReduce("double", "product", {"Large"}, OverflowPolicy::Saturate);
+    ASSERT_EQ(saturated["Large"], std::numeric_limits<int64_t>::min());
+    EXPECT_THROW(mr.performMapReduce("double", "product", {"Large"}, OverflowPolicy::Checked),
+                 std::overflow_error);
+    auto wrapped = mr.performMapReduce("double", "product", {"Large"}, OverflowPolicy::Wrap);
+    uint64_t expected = 4000000000ULL * static_cast<uint64_t>(-4000000000LL) * 4000000000ULL;
+    ASSERT_EQ(wrapped["Large"], static_cast<int64_t>(expected));
+}
+
+// Test the overflow policies for a sum that does not fit 64 bits
+TEST_F(MapReduceTest, SumOverflowPolicies) {
+    kvStore.insert("Large", 2147483647);
+    kvStore.insert("Large", 2147483647);
+    KeyValueStore many;
+    for (int i = 0; i < 4; ++i) {
+        many.insert("Large", -2147483647 - 1);
+    }
+    // 4 * (2^31)^2 = 2^64 overflows; 2 * (2^31 - 1)^2 does not.
+    MapReduce mr(many);
+    EXPECT_THROW(mr.performMapReduce("square", "sum", {"Large"}, OverflowPolicy::Checked),
+                 std::overflow_error);
+    auto saturated = mr.performMapReduce("square", "sum", {"Large"}, OverflowPolicy::Saturate);
+    ASSERT_EQ(saturated["Large"], std::numeric_limits<int64_t>::max());
+    MapReduce fits(kvStore);
+    auto checked = fits.performMapReduce("square", "sum", {"Large"}, OverflowPolicy::Checked);
+    ASSERT_EQ(checked["Large"], 2 * 2147483647LL * 2147483647LL);
+}
+
+// Test that an unknown overflow policy name or encoded value is rejected
+TEST_F(MapReduceTest, ParseOverflowPolicy) {
+    ASSERT_EQ(parseOverflowPolicy("saturate"), OverflowPolicy::Saturate);
+    EXPECT_THROW(parseOverflowPolicy("clamp"), std::runtime_error);
+    ASSERT_EQ(overflowPolicyOf(2), OverflowPolicy::Checked);
+    EXPECT_THROW(overflowPolicyOf(3), std::runtime_error);
+}
+
+// Test the min, max, count and sum_of_squares reduce operations
+TEST_F(MapReduceTest, MinMaxCountSumOfSquares) {
+    std::vector<std::string> keys = {"MixedCategory"};
+    ASSERT_EQ(mapReduce->performMapReduce("double", "min", keys)["MixedCategory"], -6);
+    ASSERT_EQ(mapReduce->performMapReduce("double", "max", keys)["MixedCategory"], 4);
+    ASSERT_EQ(mapReduce->performMapReduce("double", "count", keys)["MixedCategory"], 3);
+    ASSERT_EQ(mapReduce->performMapReduce("double", "sum_of_squares", keys)["MixedCategory"], 56); // 4 + 16 + 36
+    ASSERT_EQ(mapReduce->performMapReduce("double", "count", {"NonExistentKey"})["NonExistentKey"], 0);
+}
+
+// Test computing several statistics together
+TEST_F(MapReduceTest, Statistics) {
+    std::vector<std::string> stats = {"count", "sum", "min", "max", "mean", "variance", "stddev", "sum_of_squares"};
+    auto results = mapReduce->performStatistics("double", stats, {"Category1", "MixedCategory"});
+    ASSERT_DOUBLE_EQ(results["Category1"]["count"], 2);
+    ASSERT_DOUBLE_EQ(results["Category1"]["sum"], 60);
+    ASSERT_DOUBLE_EQ(results["Category1"]["min"], 20);
+    ASSERT_DOUBLE_EQ(results["Category1"]["max"], 40);
+    ASSERT_DOUBLE_EQ(results["Category1"]["mean"], 30);
+    ASSERT_DOUBLE_EQ(results["Category1"]["variance"], 100);
+    ASSERT_DOUBLE_EQ(results["Category1"]["stddev"], 10);
+    ASSERT_DOUBLE_EQ(results["Category1"]["sum_of_squares"], 2000);
+    ASSERT_DOUBLE_EQ(results["MixedCategory"]["mean"], 0);
+    ASSERT_DOUBLE_EQ(results["MixedCategory"]["variance"], 56.0 / 3);
+}
+
+// Test statistics of a key without values
+TEST_F(MapReduceTest, StatisticsNoValues) {
+    auto results = mapReduce->performStatistics("double", {"count", "mean"}, {"NonExistentKey"});
+    ASSERT_DOUBLE_EQ(results["NonExistentKey"]["count"], 0);
+    ASSERT_TRUE(std::isnan(results["NonExistentKey"]["mean"]));
+    EXPECT_THROW(mapReduce->performStatistics("double", {"median"}, {"Category1"}), std::runtime_error);
+}
+
+// Test a map pipeline in a MapReduce job
+TEST_F(MapReduceTest, MapPipeline) {
+    std::vector<std::string> keys = {"Category1", "MixedCategory"};
+    auto results = mapReduce->performMapReduce("square|triple|gt:10", "sum", keys);
+    ASSERT_EQ(results["Category1"], 1500); // 3*100 + 3*400
+    ASSERT_EQ(results["MixedCategory"], 39); // 3*4 + 3*9, 3*1 is filtered out
+}
+
+// Test MapReduce over every key
+TEST_F(MapReduceTest, AllKeysSelector) {
+    auto results = mapReduce->performMapReduce("double", "sum", KeySelector::allKeys());
+    ASSERT_EQ(results.size(), 3);
+    ASSERT_EQ(results["Category1"], 60);
+    ASSERT_EQ(results["Category2"], 60);
+    ASSERT_EQ(results["MixedCategory"], 0);
+}
+
+// Test MapReduce over keys with a prefix and over a key range
+TEST_F(MapReduceTest, PrefixAndRangeSelectors) {
+    auto prefixed = mapReduce->performMapReduce("double", "sum", KeySelector::prefix("Category"));
+    ASSERT_EQ(prefixed.size(), 2);
+    ASSERT_EQ(prefixed.count("MixedCategory"), 0);
+    auto ranged = mapReduce->performMapReduce("double", "sum", KeySelector::range("Category2", "N"));
+    ASSERT_EQ(ranged.size(), 2);
+    ASSERT_EQ(ranged["Category2"], 60);
+    ASSERT_EQ(ranged["MixedCategory"], 0);
+}
+
+// Test that a parallel scan gives the same results as a serial one
+TEST_F(MapReduceTest, ParallelScanMatchesSerial) {
+    KeyValueStore store;
+    for (int i = 0; i < 5000; ++i) {
+        store.insert("key" + std::to_string(i), i);
+        store.insert("key" + std::to_string(i), -2 * i);
+    }
+    MapReduce serial(store);
+    serial.setParallelism(1);
+    MapReduce parallel(store);
+    parallel.setParallelism(4);
+    auto expected = serial.performMapReduce("square", "sum", KeySelector::allKeys());
+    ASSERT_EQ(expected.size(), 5000);
+    ASSERT_EQ(parallel.performMapReduce("square", "sum", KeySelector::allKeys()), expected);
+    auto stats = parallel.performStatistics("double", {"mean"}, KeySelector::prefix("key1"));
+    ASSERT_EQ(stats.size(), 1111);
+    ASSERT_DOUBLE_EQ(stats["key10"]["mean"], -10);
+}
+
+// Test that a job stops once its cancellation flag is set
+TEST_F(MapReduceTest, Cancellation) {
+    std::atomic<bool> cancelled(true);
+    mapReduce->setCancellation(&cancelled);
+    ASSERT_THROW(mapReduce->performMapReduce("square", "sum", {"Category1"}), MapReduceCancelled);
+    ASSERT_THROW(mapReduce->performMapReduce("square", "sum", KeySelector::allKeys()), MapReduceCancelled);
+    cancelled = false;
+    ASSERT_EQ(mapReduce->performMapReduce("square", "sum", {"Category1"})["Category1"], 500);
+}
+
+// Test the approximate distinct count and quantiles
+TEST_F(MapReduceTest, SketchReductions) {
+    for (int i = 1; i <= 1000; ++i) {
+        kvStore.insert("Big", i % 250);
+    }
+    MapReduce sketches(kvStore);
+    auto distinct = sketches.performMapReduce("double", "distinct", {"Big", "Missing"});
+    ASSERT_NEAR(distinct["Big"], 250, 10);
+    ASSERT_EQ(distinct["Missing"], 0);
+
+    auto results = sketches.performStatistics("double", {"p50", "p99", "distinct"}, {"Big", "Missing"});
+    ASSERT_NEAR(results["Big"]["p50"], 250, 5);
+    ASSERT_NEAR(results["Big"]["p99"], 495, 5);
+    ASSERT_EQ(results["Big"]["distinct"], distinct["Big"]);
+    ASSERT_TRUE(std::isnan(results["Missing"]["p50"]));
+    ASSERT_THROW(sketches.performStatistics("double", {"p200"}, {"Big"}), std::runtime_error);
+}
+
+// Test top-K and bottom-K, also across parallel scan tasks
+TEST_F(MapReduceTest, TopK) {
+    using Ranking = MapReduce::Ranking;
+    ASSERT_EQ(mapReduce->performTopK("square", "sum", KeySelector::allKeys(), 2),
+              (Ranking{{"Category2", 900}, {"Category1", 500}}));
+    ASSERT_EQ(mapReduce->performTopK("square", "sum", KeySelector::allKeys(), 2, true),
+              (Ranking{{"MixedCategory", 14}, {"Category1", 500}}));
+    ASSERT_EQ(mapReduce->performTopK("square", "sum", KeySelector::keyList({"Category1", "Missing"}), 5),
+              (Ranking{{"Category1", 500}, {"Missing", 0}}));
+    ASSERT_EQ(mapReduce->performTopK("square", "sum",
+                                     KeySelector::keyList({"Category2", "Category2", "Category1"}), 2),
+              (Ranking{{"Category2", 900}, {"Category1", 500}}));
+    ASSERT_TRUE(mapReduce->performTopK("square", "sum", KeySelector::allKeys(), 0).empty());
+
+    for (int i = 0; i < 10000; ++i) {
+        kvStore.insert("key" + std::to_string(i), i % 1000);
+    }
+    MapReduce parallel(kvStore);
+    parallel.setParallelism(4);
+    Ranking top = parallel.performTopK("double", "max", KeySelector::prefix("key"), 3);
+    // Ties on 1998 go to the smallest keys.
+    ASSERT_EQ(top, (Ranking{{"key1999", 1998}, {"key2999", 1998}, {"key3999", 1998}}));
+}
+
+// Test group-by against rolling up per-key results by hand
+TEST_F(MapReduceTest, GroupBy) {
+    KeyValueStore store;
+    for (int i = 0; i < 6000; ++i) {
+        std::string key = std::string(i % 2 ? "eu" : "us") + "/dev" + std::to_string(i) + "/temp";
+        store.insertMany(key, {i % 7, i % 11});
+    }
+    store.insert("orphan", 5);
+    MapReduce parallel(store);
+    parallel.setParallelism(4);
+    KeyGrouper region = KeyGrouper::parse("prefix:1");
+
+    for (const std::string reduceOp : {"sum", "count", "sum_of_squares", "min", "max", "product"}) {
+        std::map<std::string, int64_t> expected;
+        auto perKey = parallel.performMapReduce("double", reduceOp, KeySelector::allKeys());
+        for (const auto& kv : perKey) {
+            std::string group;
+            if (!region.group(kv.first, group)) continue;
+            auto it = expected.find(group);
+            if (it == expected.end()) {
+                expected[group] = kv.second;
+            } else {
+                // Combine the two partials the way the reducer would.
+                if (reduceOp == "min") it->second = std::min(it->second, kv.second);
+                else if (reduceOp == "max") it->second = std::max(it->second, kv.second);
+                else if (reduceOp == "product") it->second *= kv.second;
+                else it->second += kv.second;
+            }
+        }
+        ASSERT_EQ(parallel.performGroupBy("double", reduceOp, KeySelector::allKeys(), region), expected)
+            << reduceOp;
+    }
+
+    auto distinct = parallel.performGroupBy("double", "distinct", KeySelector::prefix("eu/"), region);
+    ASSERT_EQ(distinct.size(), 1u);
+    ASSERT_NEAR(distinct["eu"], 11, 1);
+
+    auto listed = mapReduce->performGroupBy("square", "sum", KeySelector::keyList({"Category1", "Category2"}),
+                                            KeyGrouper::parse("regex:^[A-Za-z]+"));
+    ASSERT_EQ(listed, (std::map<std::string, int64_t>{{"Category", 1400}}));
+}
+
+// Test that group-by under a small memory limit spills and still gives the same results
+TEST_F(MapReduceTest, GroupBySpill) {
+    KeyValueStore store;
+    for (int i = 0; i < 8000; ++i) {
+        store.insertMany("dev" + std::to_string(i), {i % 13, i});
+    }
+    MapReduce mapReduce(store);
+    mapReduce.setParallelism(4);
+    KeyGrouper byHundred = KeyGrouper::parse("regex:^dev[0-9]{1,2}");
+
+    for (const std::string reduceOp : {"sum", "max", "distinct"}) {
+        mapReduce.setMemoryLimit(0);
+        auto expected = mapReduce.performGroupBy("square", reduceOp, KeySelector::allKeys(), byHundred);
+        ASSERT_EQ(mapReduce.getSpillStats().runs, 0u);
+
+        mapReduce.setMemoryLimit(4 * 1024, "/tmp");
+        ASSERT_EQ(mapReduce.performGroupBy("square", reduceOp, KeySelector::allKeys(), byHundred), expected)
+            << reduceOp;
+        ASSERT_GT(mapReduce.getSpillStats().runs, 0u) << reduceOp;
+        ASSERT_GT(mapReduce.getSpillStats().bytes, 0u) << reduceOp;
+    }
+}
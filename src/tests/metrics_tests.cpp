@@ -0,0 +1,176 @@
+#include <gtest/gtest.h>
+#include "Metrics.h"
+#include "MetricsHttpServer.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+class MetricsTest : public ::testing::Test {
+protected:
+    LatencyHistogram histogram;
+};
+
+// Test that every value falls in a bucket whose bounds hold it within 1/16
+TEST_F(MetricsTest, BucketBounds) {
+    for (uint64_t value : {0ull, 1ull, 15ull, 16ull, 17ull, 31ull, 32ull, 1000ull,
+                           123456789ull, 1ull << 40, ~0ull}) {
+        const size_t bucket = LatencyHistogram::bucketOf(value);
+        ASSERT_LT(bucket, LatencyHistogram::BUCKETS);
+        const uint64_t upper = LatencyHistogram::bucketUpperBound(bucket);
+        ASSERT_GE(upper, value);
+        ASSERT_LE(upper - value, value / 16);
+        if (bucket > 0) {
+            ASSERT_LT(LatencyHistogram::bucketUpperBound(bucket - 1), value);
+        }
+    }
+}
+
+// Test count, mean, max and percentiles of recorded values
+TEST_F(MetricsTest, Percentiles) {
+    for (uint64_t value = 1; value <= 1000; ++value) {
+        histogram.record(value * 1000);
+    }
+    const LatencyHistogram::Snapshot s = histogram.snapshot();
+    ASSERT_EQ(s.count, 1000u);
+    ASSERT_DOUBLE_EQ(s.mean(), 500500.0);
+    ASSERT_EQ(s.max, 1000000u);
+    ASSERT_NEAR(s.percentile(0.5), 500000.0, 500000.0 / 16);
+    ASSERT_NEAR(s.percentile(0.99), 990000.0, 990000.0 / 16);
+    ASSERT_EQ(s.percentile(1.0), 1000000u);
+
+    histogram.reset();
+    ASSERT_EQ(histogram.snapshot().count, 0u);
+    ASSERT_EQ(histogram.snapshot().percentile(0.5), 0u);
+}
+
+// Test that updates from many threads are all counted
+TEST_F(MetricsTest, ConcurrentUpdates) {
+    MetricCounter& counter = MetricsRegistry::instance().counter("test.concurrent");
+    counter.reset();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 16; ++t) {
+        threads.emplace_back([&] {
+            for (int i = 0; i < 10000; ++i) {
+                counter.add();
+                histogram.record(i);
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    ASSERT_EQ(counter.value(), 160000u);
+    ASSERT_EQ(histogram.snapshot().count, 160000u);
+}
+
+// Test that the registry returns the same metric for a name and reports it
+TEST_F(MetricsTest, RegistryReport) {
+    MetricsRegistry& registry = MetricsRegistry::instance();
+    ASSERT_EQ(&registry.histogram("test.report"), &registry.histogram("test.report"));
+    registry.histogram("test.report").reset();
+    {
+        ScopedLatency timed(registry.histogram("test.report"));
+    }
+    registry.counter("test.events").reset();
+    registry.counter("test.events").add(3);
+
+    const std::string report = registry.report();
+    ASSERT_NE(report.find("test.events: 3\n"), std::string::npos);
+    ASSERT_NE(report.find("test.report (us): count 1,"), std::string::npos);
+}
+
+// Test that the periodic dump appends reports to a file until stopped
+TEST_F(MetricsTest, PeriodicDump) {
+    const std::string path = "/tmp/mapreduce_metrics_test." + std::to_string(getpid());
+    std::remove(path.c_str());
+    MetricsRegistry::instance().counter("test.dumped").add();
+    MetricsRegistry::instance().startDump(path, std::chrono::seconds(1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+    MetricsRegistry::instance().stopDump();
+
+    std::ifstream in(path);
+    std::stringstream contents;
+    contents << in.rdbuf();
+    ASSERT_NE(contents.str().find("=== "), std::string::npos);
+    ASSERT_NE(contents.str().find("test.dumped: "), std::string::npos);
+    std::remove(path.c_str());
+}
+
+// Test the Prometheus names, types and cumulative histogram buckets
+TEST_F(MetricsTest, PrometheusFormat) {
+    MetricsRegistry& registry = MetricsRegistry::instance();
+    registry.counter("test.prom-events").reset();
+    registry.counter("test.prom-events").add(2);
+    registry.gauge("test.prom_gauge", [] { return 7.5; });
+    LatencyHistogram& latency = registry.histogram("test.prom_latency");
+    latency.reset();
+    latency.record(1500);          // 1.5 us
+    latency.record(3000000);       // 3 ms
+
+    const std::string text = MetricsHttpServer::format(registry);
+    ASSERT_NE(text.find("# TYPE mapreduce_test_prom_events_total counter\n"
+                        "mapreduce_test_prom_events_total 2\n"), std::string::npos);
+    ASSERT_NE(text.find("mapreduce_test_prom_gauge 7.5\n"), std::string::npos);
+    ASSERT_NE(text.find("# TYPE mapreduce_test_prom_latency_seconds histogram\n"
+                        "mapreduce_test_prom_latency_seconds_bucket{le=\"1.024e-06\"} 0\n"
+                        "mapreduce_test_prom_latency_seconds_bucket{le=\"2.048e-06\"} 1\n"),
+              std::string::npos);
+    ASSERT_NE(text.find("mapreduce_test_prom_latency_seconds_bucket{le=\"0.004194304\"} 2\n"),
+              std::string::npos);
+    ASSERT_NE(text.find("mapreduce_test_prom_latency_seconds_bucket{le=\"+Inf\"} 2\n"
+                        "mapreduce_test_prom_latency_seconds_sum 0.0030015\n"
+                        "mapreduce_test_prom_latency_seconds_count 2\n"), std::string::npos);
+}
+
+// Test that a value equal to an `le` bound is counted in it
+TEST_F(MetricsTest, PrometheusBucketBound) {
+    MetricsRegistry& registry = MetricsRegistry::instance();
+    LatencyHistogram& latency = registry.histogram("test.prom_bound");
+    latency.reset();
+    latency.record(1023);
+    latency.record(1 << 10);
+    latency.record(1100);          // Beyond the sub-bucket that starts at 1024
+
+    const std::string text = MetricsHttpServer::format(registry);
+    ASSERT_NE(text.find("mapreduce_test_prom_bound_seconds_bucket{le=\"1.024e-06\"} 2\n"
+                        "mapreduce_test_prom_bound_seconds_bucket{le=\"2.048e-06\"} 3\n"),
+              std::string::npos);
+}
+
+// Test that the endpoint serves /metrics over HTTP and 404s anything else
+TEST_F(MetricsTest, HttpEndpoint) {
+    MetricsRegistry::instance().counter("test.scraped").add();
+    MetricsHttpServer server("127.0.0.1", 0);
+    ASSERT_GT(server.getPort(), 0);
+
+    auto get = [&](const std::string& path) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(server.getPort());
+        inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+        EXPECT_EQ(connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0);
+        const std::string request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        EXPECT_EQ(send(fd, request.data(), request.size(), 0), static_cast<ssize_t>(request.size()));
+        std::string response;
+        char buffer[4096];
+        ssize_t n;
+        while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) response.append(buffer, n);
+        close(fd);
+        return response;
+    };
+
+    const std::string metrics = get("/metrics");
+    ASSERT_EQ(metrics.find("HTTP/1.1 200 OK\r\n"), 0u);
+    ASSERT_NE(metrics.find("mapreduce_test_scraped_total "), std::string::npos);
+    ASSERT_EQ(get("/other").find("HTTP/1.1 404 Not Found\r\n"), 0u);
+
+    ASSERT_THROW(MetricsHttpServer("not an address", 0), std::runtime_error);
+}
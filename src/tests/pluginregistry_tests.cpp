@@ -0,0 +1,73 @@
+#include <gtest/gtest.h>
+#include "MapReduce.h"
+#include "PluginRegistry.h"
+
+#include <stdexcept>
+
+// Built by the mr_example_plugin target.
+#ifndef EXAMPLE_PLUGIN_PATH
+#define EXAMPLE_PLUGIN_PATH "libmr_example_plugin.so"
+#endif
+
+class PluginRegistryTest : public ::testing::Test {
+protected:
+    KeyValueStore kvStore;
+
+    void SetUp() override {
+        PluginRegistry::instance().load(EXAMPLE_PLUGIN_PATH);
+        kvStore.insertMany("a", {-3, 4, 7});
+        kvStore.insertMany("b", {-10, 2});
+    }
+};
+
+// Test that loading registers the plugin's operators, and again is a no-op
+TEST_F(PluginRegistryTest, Load) {
+    PluginRegistry& registry = PluginRegistry::instance();
+    PluginRegistry::Plugin plugin = registry.load(EXAMPLE_PLUGIN_PATH);
+    ASSERT_EQ(plugin.name, "example");
+    ASSERT_EQ(plugin.mapOperators, (std::vector<std::string>{"abs", "even"}));
+    ASSERT_EQ(plugin.reduceOperators, (std::vector<std::string>{"spread"}));
+    ASSERT_EQ(registry.list().size(), 1u);
+    ASSERT_TRUE(registry.isLoaded("example@1"));
+    ASSERT_FALSE(registry.isLoaded("example@2"));
+
+    ASSERT_THROW(registry.load("/nonexistent/plugin.so"), std::runtime_error);
+}
+
+// Test checking a plugin without registering it
+TEST_F(PluginRegistryTest, Check) {
+    PluginRegistry& registry = PluginRegistry::instance();
+    PluginRegistry::Plugin plugin = registry.check(EXAMPLE_PLUGIN_PATH);
+    ASSERT_EQ(plugin.name, "example");
+    ASSERT_EQ(plugin.version, 1u);
+    ASSERT_EQ(registry.list().size(), 1u);
+    ASSERT_THROW(registry.check("/nonexistent/plugin.so"), std::runtime_error);
+
+    // Still open for the registered operators.
+    MapReduce mapReduce(kvStore);
+    ASSERT_EQ(mapReduce.performMapReduce("abs", "sum", {"a"}),
+              (std::map<std::string, int64_t>{{"a", 14}}));
+}
+
+// Test that jobs use plugin operators like built-in ones
+TEST_F(PluginRegistryTest, PluginOperators) {
+    MapReduce mapReduce(kvStore);
+    ASSERT_TRUE(mapReduce.hasReduceOperation("spread"));
+    ASSERT_EQ(mapReduce.performMapReduce("abs", "sum", {"a", "b"}),
+              (std::map<std::string, int64_t>{{"a", 14}, {"b", 12}}));
+    ASSERT_EQ(mapReduce.performMapReduce("even|square", "spread", {"a", "b", "c"}),
+              (std::map<std::string, int64_t>{{"a", 0}, {"b", 96}, {"c", 0}}));
+    ASSERT_EQ(mapReduce.performMapReduce("abs|gt:3", "count", {"a", "b"}),
+              (std::map<std::string, int64_t>{{"a", 2}, {"b", 1}}));
+
+    // A plugin stage reads the stored ints, so it has to come first.
+    ASSERT_THROW(mapReduce.performMapReduce("square|abs", "sum", {"a"}), std::runtime_error);
+}
+
+// Test the operator versions a job depends on
+TEST_F(PluginRegistryTest, RequiredBy) {
+    PluginRegistry& registry = PluginRegistry::instance();
+    ASSERT_EQ(registry.requiredBy("abs|gt:1", "spread"), (std::vector<std::string>{"example@1"}));
+    ASSERT_TRUE(registry.requiredBy("square|gt:1", "sum").empty());
+    ASSERT_TRUE(registry.requiredBy("square", "min,max,p99").empty());
+}
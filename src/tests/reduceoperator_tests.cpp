@@ -0,0 +1,44 @@
+#include <gtest/gtest.h>
+#include "ReduceOperator.h"
+
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+class ReduceOperatorTest : public ::testing::Test {
+protected:
+    const int64_t MAX = std::numeric_limits<int64_t>::max();
+
+    int64_t reduce(const std::string& name, const std::vector<int64_t>& values,
+                   OverflowPolicy overflow = OverflowPolicy::Wrap) {
+        return ReduceOperator::resolve(name).reduce(values.data(), values.size(), overflow);
+    }
+};
+
+// Test that names resolve to built-in operator ids and identities
+TEST_F(ReduceOperatorTest, Resolve) {
+    ReduceOperator min = ReduceOperator::resolve("min");
+    ASSERT_EQ(min.getId(), ReduceOperator::Min);
+    ASSERT_EQ(min.getName(), "min");
+    ASSERT_EQ(min.getIdentity(), MAX);
+    ASSERT_EQ(ReduceOperator::resolve("product").getIdentity(), 1);
+    ASSERT_TRUE(ReduceOperator::exists("sum_of_squares"));
+    ASSERT_FALSE(ReduceOperator::exists("mean"));
+    ASSERT_THROW(ReduceOperator::resolve("mean"), std::runtime_error);
+}
+
+// Test each kernel under the overflow policies
+TEST_F(ReduceOperatorTest, Kernels) {
+    ASSERT_EQ(reduce("sum", {1, -2, 40}), 39);
+    ASSERT_EQ(reduce("product", {3, -2, 5}), -30);
+    ASSERT_EQ(reduce("min", {3, -2, 5}), -2);
+    ASSERT_EQ(reduce("max", {3, -2, 5}), 5);
+    ASSERT_EQ(reduce("count", {3, -2, 5}), 3);
+    ASSERT_EQ(reduce("sum_of_squares", {3, -2, 5}), 38);
+    ASSERT_EQ(reduce("distinct", {3, 3, 5}), 2);
+
+    ASSERT_EQ(reduce("sum", {MAX, 1}), std::numeric_limits<int64_t>::min());
+    ASSERT_EQ(reduce("sum", {MAX, 1}, OverflowPolicy::Saturate), MAX);
+    ASSERT_THROW(reduce("sum", {MAX, 1}, OverflowPolicy::Checked), std::overflow_error);
+    ASSERT_EQ(reduce("product", {MAX, -2}, OverflowPolicy::Saturate), std::numeric_limits<int64_t>::min());
+}
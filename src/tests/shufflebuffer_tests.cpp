@@ -0,0 +1,118 @@
+#include <gtest/gtest.h>
+#include "ShuffleBuffer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+template <>
+struct PartialCodec<int> {
+    static void encode(const int& partial, std::string& out) {
+        out.append(reinterpret_cast<const char*>(&partial), sizeof(partial));
+    }
+    static void decode(const std::string& in, int& out) {
+        std::memcpy(&out, in.data(), sizeof(out));
+    }
+};
+
+class ShuffleBufferTest : public ::testing::Test {
+protected:
+    ShuffleBuffer<int> buffer{4};
+};
+
+// Test that a group always lands in the same partition and is combined there
+TEST_F(ShuffleBufferTest, CombinesByGroup) {
+    for (int i = 0; i < 100; ++i) {
+        bool isNew = false;
+        int& partial = buffer.emit("group" + std::to_string(i % 10), isNew);
+        ASSERT_EQ(isNew, i < 10);
+        partial += i;
+    }
+
+    size_t groups = 0;
+    ShuffleBuffer<int> other(4);
+    for (size_t p = 0; p < buffer.numPartitions(); ++p) {
+        for (const auto& entry : buffer.partition(p)) {
+            ASSERT_EQ(buffer.partitionOf(entry.first), p);
+            ASSERT_EQ(other.partitionOf(entry.first), p);
+            ++groups;
+        }
+    }
+    ASSERT_EQ(groups, 10u);
+    bool isNew = true;
+    ASSERT_EQ(buffer.emit("group3", isNew), 3 + 13 + 23 + 33 + 43 + 53 + 63 + 73 + 83 + 93);
+    ASSERT_FALSE(isNew);
+}
+
+// Test that spilled runs and the partials left in memory merge back in group order
+TEST_F(ShuffleBufferTest, SpillAndMerge) {
+    std::map<std::string, int> expected;
+    for (int i = 0; i < 300; ++i) {
+        std::string group = "g" + std::to_string(i % 37);
+        bool isNew = false;
+        buffer.emit(group, isNew) += i;
+        expected[group] += i;
+        if (i % 100 == 99) {
+            ASSERT_GT(buffer.getBytes(), 0u);
+            buffer.spill("/tmp");
+            ASSERT_EQ(buffer.getBytes(), 0u);
+        }
+    }
+
+    std::vector<std::pair<std::string, int>> merged;
+    for (size_t p = 0; p < buffer.numPartitions(); ++p) {
+        ASSERT_EQ(buffer.spilled(p).size(), 3u);
+        std::vector<std::pair<std::string, int>> entries(buffer.partition(p).begin(),
+                                                         buffer.partition(p).end());
+        size_t before = merged.size();
+        mergeRuns<int>(buffer.spilled(p), entries,
+                       [](const std::string&, int& into, int from) { into += from; },
+                       [&](const std::string& group, int partial) { merged.emplace_back(group, partial); });
+        ASSERT_TRUE(std::is_sorted(merged.begin() + before, merged.end()));
+    }
+    ASSERT_EQ((std::map<std::string, int>(merged.begin(), merged.end())), expected);
+    ASSERT_EQ(merged.size(), expected.size());
+}
+
+// Test merging more runs than are open at once, in several passes
+TEST_F(ShuffleBufferTest, MultiPassMerge) {
+    std::map<std::string, int> expected;
+    for (int i = 0; i < 1000; ++i) {
+        std::string group = "g" + std::to_string(i * 7 % 53);
+        bool isNew = false;
+        buffer.emit(group, isNew) += i;
+        expected[group] += i;
+        if (i % 10 == 9) buffer.spill("/tmp");
+    }
+
+    std::vector<std::pair<std::string, int>> merged;
+    for (size_t p = 0; p < buffer.numPartitions(); ++p) {
+        ASSERT_GT(buffer.spilled(p).size(), 9u);
+        std::vector<std::pair<std::string, int>> entries;
+        size_t before = merged.size();
+        mergeRuns<int>(buffer.spilled(p), entries,
+                       [](const std::string&, int& into, int from) { into += from; },
+                       [&](const std::string& group, int partial) { merged.emplace_back(group, partial); },
+                       "/tmp", 3);
+        ASSERT_TRUE(std::is_sorted(merged.begin() + before, merged.end()));
+    }
+    ASSERT_EQ((std::map<std::string, int>(merged.begin(), merged.end())), expected);
+    ASSERT_EQ(merged.size(), expected.size());
+}
+
+// Test that a shared budget counts the bytes of every charge until it ends
+TEST_F(ShuffleBufferTest, MemoryBudget) {
+    MemoryBudget budget(100);
+    {
+        MemoryBudget::Charge first(budget);
+        MemoryBudget::Charge second(budget);
+        ASSERT_FALSE(first.add(60));
+        ASSERT_TRUE(second.add(60));
+        second.release(60);
+        ASSERT_EQ(budget.getUsed(), 60u);
+        ASSERT_FALSE(second.add(30));
+    }
+    ASSERT_EQ(budget.getUsed(), 0u);
+}
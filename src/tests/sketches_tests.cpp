@@ -0,0 +1,70 @@
+#include <gtest/gtest.h>
+#include "Sketches.h"
+
+#include <cmath>
+#include <stdexcept>
+
+class SketchesTest : public ::testing::Test {
+protected:
+    static double relativeError(double estimate, double exact) {
+        return std::abs(estimate - exact) / exact;
+    }
+};
+
+// Test the distinct count estimate over small and large cardinalities
+TEST_F(SketchesTest, HyperLogLogEstimate) {
+    HyperLogLog sketch;
+    ASSERT_EQ(sketch.estimate(), 0);
+    for (int round = 0; round < 3; ++round) {
+        for (int64_t value = 0; value < 100; ++value) sketch.add(value);
+    }
+    ASSERT_LT(relativeError(sketch.estimate(), 100), 0.05);
+    for (int64_t value = 0; value < 200000; ++value) sketch.add(value * 7919);
+    ASSERT_LT(relativeError(sketch.estimate(), 200000), 0.05);
+}
+
+// Test that merged sketches estimate the union
+TEST_F(SketchesTest, HyperLogLogMerge) {
+    HyperLogLog left, right;
+    for (int64_t value = 0; value < 60000; ++value) left.add(value);
+    for (int64_t value = 40000; value < 100000; ++value) right.add(value);
+    left.merge(right);
+    ASSERT_LT(relativeError(left.estimate(), 100000), 0.05);
+    ASSERT_THROW(left.merge(HyperLogLog(10)), std::runtime_error);
+}
+
+// Test quantiles of a uniform distribution, including the tails
+TEST_F(SketchesTest, TDigestQuantiles) {
+    TDigest digest;
+    ASSERT_TRUE(std::isnan(digest.quantile(0.5)));
+    for (int value = 100000; value >= 1; --value) digest.add(value);
+    ASSERT_NEAR(digest.quantile(0.5), 50000, 500);
+    ASSERT_NEAR(digest.quantile(0.99), 99000, 100);
+    ASSERT_NEAR(digest.quantile(0.999), 99900, 20);
+    ASSERT_EQ(digest.quantile(0), 1);
+    ASSERT_EQ(digest.quantile(1), 100000);
+    ASSERT_EQ(digest.totalWeight(), 100000);
+}
+
+// Test that merging digests of two halves matches one digest of the whole
+TEST_F(SketchesTest, TDigestMerge) {
+    TDigest low, high;
+    for (int value = 1; value <= 50000; ++value) low.add(value);
+    for (int value = 50001; value <= 100000; ++value) high.add(value);
+    low.merge(high);
+    ASSERT_NEAR(low.quantile(0.25), 25000, 500);
+    ASSERT_NEAR(low.quantile(0.99), 99000, 100);
+}
+
+// Test parsing of quantile names
+TEST_F(SketchesTest, ParseQuantile) {
+    double q = 0;
+    ASSERT_TRUE(TDigest::parseQuantile("p99", q));
+    ASSERT_DOUBLE_EQ(q, 0.99);
+    ASSERT_TRUE(TDigest::parseQuantile("p99.9", q));
+    ASSERT_DOUBLE_EQ(q, 0.999);
+    ASSERT_FALSE(TDigest::parseQuantile("p101", q));
+    ASSERT_FALSE(TDigest::parseQuantile("p", q));
+    ASSERT_FALSE(TDigest::parseQuantile("p5x", q));
+    ASSERT_FALSE(TDigest::parseQuantile("product", q));
+}
@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+#include "Tracer.h"
+
+#include <sstream>
+#include <string>
+
+class TracerTest : public ::testing::Test {
+protected:
+    Tracer& tracer = Tracer::instance();
+
+    void SetUp() override {
+        std::ostringstream discard;
+        tracer.exportChrome(discard);
+        tracer.setNode(3);
+    }
+
+    void TearDown() override {
+        tracer.setSampling(0);
+    }
+};
+
+// Test that one request in `every` gets a unique id carrying the node
+TEST_F(TracerTest, Sampling) {
+    ASSERT_EQ(tracer.sample(), 0u);
+    ASSERT_FALSE(tracer.enabled());
+
+    tracer.setSampling(10);
+    ASSERT_TRUE(tracer.enabled());
+    std::vector<uint64_t> ids;
+    for (int i = 0; i < 1000; ++i) {
+        uint64_t id = tracer.sample();
+        if (id) ids.push_back(id);
+    }
+    ASSERT_EQ(ids.size(), 100u);
+    for (size_t i = 0; i < ids.size(); ++i) {
+        ASSERT_EQ(ids[i] >> 48, 3u);
+        if (i > 0) {
+            ASSERT_NE(ids[i], ids[i - 1]);
+        }
+    }
+}
+
+// Test that spans, including ones ended in another call, export as Chrome trace events
+TEST_F(TracerTest, ExportChrome) {
+    const uint64_t id = (uint64_t(3) << 48) | 42;
+    tracer.span(id, "encode", 1000, 1250);
+    tracer.mark(id, 2000);
+    uint64_t appended = 0;
+    ASSERT_TRUE(tracer.take(id, appended));
+    ASSERT_FALSE(tracer.take(id, appended));
+    tracer.span(id, "replicate", appended, 2600);
+    {
+        TraceSpan untraced(0, "apply");
+    }
+    ASSERT_EQ(tracer.getRecorded(), 2u);
+
+    std::ostringstream out;
+    ASSERT_EQ(tracer.exportChrome(out), 2u);
+    const std::string json = out.str();
+    ASSERT_EQ(json.find("{\"displayTimeUnit\":\"ms\",\"traceEvents\":["), 0u);
+    ASSERT_NE(json.find("{\"name\":\"encode\",\"cat\":\"raft\",\"ph\":\"X\",\"ts\":1000,\"dur\":250,"
+                        "\"pid\":3,\"tid\":42,\"args\":{\"trace_id\":\"3-42\"}}"), std::string::npos);
+    ASSERT_NE(json.find("\"name\":\"replicate\",\"cat\":\"raft\",\"ph\":\"X\",\"ts\":2000,\"dur\":600"),
+              std::string::npos);
+    ASSERT_EQ(tracer.getRecorded(), 0u);
+}
+
+// Test that the id reader finds trace ids in raw entries
+TEST_F(TracerTest, IdReader) {
+    const unsigned char entry[] = {0, 7, 0, 0, 0, 0, 0, 3, 0};
+    ASSERT_EQ(tracer.idOf(entry, sizeof(entry)), 0u);
+    tracer.setIdReader([](const unsigned char* data, size_t len) {
+        return len > 1 ? static_cast<uint64_t>(data[1]) : 0;
+    });
+    ASSERT_EQ(tracer.idOf(entry, sizeof(entry)), 7u);
+    tracer.setIdReader(nullptr);
+}
+
+// Test that beyond MAX_MARKS the oldest mark is forgotten and counted as dropped
+TEST_F(TracerTest, MarksEvictOldest) {
+    const uint64_t dropped = tracer.getDropped();
+    const uint64_t base = uint64_t(3) << 48;
+    for (uint64_t seq = 1; seq <= Tracer::MAX_MARKS + 1; ++seq) {
+        tracer.mark(base | seq, seq);
+    }
+    ASSERT_EQ(tracer.getDropped(), dropped + 1);
+    uint64_t time = 0;
+    ASSERT_FALSE(tracer.take(base | 1, time));
+    for (uint64_t seq = 2; seq <= Tracer::MAX_MARKS + 1; ++seq) {
+        ASSERT_TRUE(tracer.take(base | seq, time));
+        ASSERT_EQ(time, seq);
+    }
+}
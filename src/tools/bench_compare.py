@@ -0,0 +1,209 @@
+#!/usr/bin/env python3
+"""Compares mapreduce_microbench results with a checked-in baseline.
+
+Runs the benchmarks listed in the baseline (or reads the JSON of an earlier
+run) and fails when one got slower than its tolerance allows: its time rose,
+or its items/bytes per second fell, by more than the tolerance. A baseline
+benchmark missing from the results fails too, unless --allow-missing is set.
+
+    bench_compare.py --baseline baseline.json --binary ./mapreduce_microbench
+    bench_compare.py --baseline baseline.json --current microbench.json
+    bench_compare.py --baseline baseline.json --binary ... --update [--filter REGEX]
+
+--update records the current results as the new baseline; with --filter,
+it replaces only the benchmarks that ran and keeps the others. A benchmark's
+tolerance is the default one, or three times the noise seen across the
+repetitions of its run if that is larger, unless the baseline already set
+one for it. Times depend on the machine: record the baseline on the machine
+that runs the check.
+"""
+
+import argparse
+import datetime
+import json
+import os
+import platform
+import subprocess
+import sys
+import tempfile
+
+DEFAULT_TOLERANCE = 0.15
+THROUGHPUTS = ("items_per_second", "bytes_per_second")
+
+
+def run_benchmarks(binary, names, regex, repetitions):
+    """Runs `binary` and returns its Google Benchmark JSON output."""
+    if regex is None:
+        # Names are made of [A-Za-z0-9_/:], none of them special in a regex.
+        regex = "^(" + "|".join(sorted(names)) + ")$" if names else "."
+    fd, path = tempfile.mkstemp(suffix=".json")
+    os.close(fd)
+    try:
+        subprocess.run([binary,
+                        "--benchmark_filter=" + regex,
+                        "--benchmark_repetitions=%d" % repetitions,
+                        "--benchmark_report_aggregates_only=true",
+                        "--benchmark_out=" + path,
+                        "--benchmark_out_format=json"],
+                       check=True, stdout=subprocess.DEVNULL)
+        with open(path) as f:
+            return json.load(f)
+    finally:
+        os.remove(path)
+
+
+def to_ns(value, unit):
+    return value * {"ns": 1, "us": 1e3, "ms": 1e6, "s": 1e9}[unit]
+
+
+def summarize(results):
+    """Median time and throughput, and noise (stddev / mean), per benchmark."""
+    runs = {}
+    for bench in results.get("benchmarks", []):
+        name = bench.get("run_name", bench["name"])
+        aggregate = bench.get("aggregate_name", "")
+        if bench.get("run_type") == "aggregate" and aggregate not in ("median", "mean", "stddev"):
+            continue
+        entry = runs.setdefault(name, {})
+        values = {"real_time_ns": to_ns(bench["real_time"], bench.get("time_unit", "ns"))}
+        for key in THROUGHPUTS:
+            if key in bench:
+                values[key] = bench[key]
+        # A run without repetitions has no aggregates; take it as the median.
+        entry[aggregate or "median"] = values
+    summary = {}
+    for name, entry in runs.items():
+        median = entry.get("median") or entry.get("mean")
+        if not median:
+            continue
+        noise = 0.0
+        if "stddev" in entry and "mean" in entry and entry["mean"]["real_time_ns"] > 0:
+            noise = entry["stddev"]["real_time_ns"] / entry["mean"]["real_time_ns"]
+        summary[name] = dict(median, noise=noise)
+    return summary
+
+
+def format_value(key, value):
+    if key == "real_time_ns":
+        for unit, scale in (("s", 1e9), ("ms", 1e6), ("us", 1e3)):
+            if value >= scale:
+                return "%.2f %s" % (value / scale, unit)
+        return "%.1f ns" % value
+    for unit, scale in (("G/s", 1e9), ("M/s", 1e6), ("k/s", 1e3)):
+        if value >= scale:
+            return "%.2f %s" % (value / scale, unit)
+    return "%.1f /s" % value
+
+
+def compare(baseline, current, allow_missing=False):
+    """Prints a table of the changes and returns the number of failed benchmarks:
+    regressed ones, and missing ones unless `allow_missing`."""
+    default = baseline.get("default_tolerance", DEFAULT_TOLERANCE)
+    rows = []
+    regressed = set()
+    for name, base in sorted(baseline["benchmarks"].items()):
+        now = current.get(name)
+        if now is None:
+            rows.append((name, "", "", "", "", "", "missing" if allow_missing else "MISSING"))
+            if not allow_missing:
+                regressed.add(name)
+            continue
+        tolerance = base.get("tolerance", default)
+        for key in ("real_time_ns",) + THROUGHPUTS:
+            if key not in base or key not in now or base[key] <= 0:
+                continue
+            change = now[key] / base[key] - 1
+            # Time is better lower, throughput higher.
+            worse = change if key == "real_time_ns" else -change
+            status = "ok"
+            if worse > tolerance:
+                status = "REGRESSED"
+                regressed.add(name)
+            elif worse < -tolerance:
+                status = "improved"
+            metric = "time" if key == "real_time_ns" else key.replace("_per_second", "/s")
+            rows.append((name, metric, format_value(key, base[key]), format_value(key, now[key]),
+                         "%+.1f%%" % (100 * change), "%.0f%%" % (100 * tolerance), status))
+    for name in sorted(set(current) - set(baseline["benchmarks"])):
+        rows.append((name, "", "", "", "", "", "new"))
+
+    header = ("benchmark", "metric", "baseline", "current", "change", "limit", "status")
+    widths = [max(len(row[i]) for row in rows + [header]) for i in range(len(header))]
+    for row in [header] + rows:
+        print("  ".join(cell.ljust(width) if i < 2 else cell.rjust(width)
+                        for i, (cell, width) in enumerate(zip(row, widths))).rstrip())
+    return len(regressed)
+
+
+def update(baseline, current, path, keep_others):
+    default = baseline.get("default_tolerance", DEFAULT_TOLERANCE)
+    previous = baseline.get("benchmarks", {})
+    benchmarks = dict(previous) if keep_others else {}
+    for name, now in sorted(current.items()):
+        entry = {key: float("%.4g" % now[key])
+                 for key in ("real_time_ns",) + THROUGHPUTS if key in now}
+        if "tolerance" in previous.get(name, {}):
+            entry["tolerance"] = previous[name]["tolerance"]
+        elif 3 * now["noise"] > default:
+            entry["tolerance"] = round(3 * now["noise"], 2)
+        benchmarks[name] = entry
+    benchmarks = dict(sorted(benchmarks.items()))
+    recorded = {
+        "recorded": datetime.datetime.now().isoformat(timespec="seconds"),
+        "host": platform.node(),
+        "machine": platform.machine(),
+        "cpus": os.cpu_count(),
+        "default_tolerance": default,
+        "benchmarks": benchmarks,
+    }
+    with open(path, "w") as f:
+        json.dump(recorded, f, indent=2, sort_keys=False)
+        f.write("\n")
+    print("%d benchmarks recorded in %s" % (len(benchmarks), path))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--baseline", required=True, help="baseline JSON")
+    source = parser.add_mutually_exclusive_group(required=True)
+    source.add_argument("--binary", help="mapreduce_microbench to run")
+    source.add_argument("--current", help="Google Benchmark JSON of an earlier run")
+    parser.add_argument("--repetitions", type=int, default=5,
+                        help="runs of each benchmark; the median is compared (default 5)")
+    parser.add_argument("--filter", help="benchmarks to run instead of the baseline's (regex)")
+    parser.add_argument("--tolerance", type=float,
+                        help="default tolerance, e.g. 0.15 for 15%%")
+    parser.add_argument("--allow-missing", action="store_true",
+                        help="do not fail for baseline benchmarks missing from the results")
+    parser.add_argument("--update", action="store_true",
+                        help="write the current results to the baseline instead")
+    args = parser.parse_args()
+
+    baseline = {"benchmarks": {}}
+    if os.path.exists(args.baseline):
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+    elif not args.update:
+        sys.exit("No baseline at %s; record one with --update" % args.baseline)
+    if args.tolerance is not None:
+        baseline["default_tolerance"] = args.tolerance
+
+    if args.binary:
+        results = run_benchmarks(args.binary, baseline["benchmarks"], args.filter, args.repetitions)
+    else:
+        with open(args.current) as f:
+            results = json.load(f)
+    current = summarize(results)
+
+    if args.update:
+        update(baseline, current, args.baseline, args.filter is not None)
+        return 0
+    failures = compare(baseline, current, args.allow_missing)
+    if failures:
+        print("\n%d benchmark(s) regressed beyond their tolerance or missing" % failures)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,33 @@
+#include "logger.h"
+
+#include <fstream>
+#include <iostream>
+
+// Formats a log file written in SimpleLogger::BINARY_MODE as text.
+int main(int argc, char** argv) {
+    if (argc < 2 || argc > 3) {
+        std::cerr << "Usage: " << argv[0] << " <binary log file> [<output file>]" << std::endl;
+        return 1;
+    }
+    std::ifstream in(argv[1], std::ifstream::binary);
+    if (!in) {
+        std::cerr << "Cannot open " << argv[1] << std::endl;
+        return 1;
+    }
+    std::ofstream file;
+    if (argc == 3) {
+        file.open(argv[2]);
+        if (!file) {
+            std::cerr << "Cannot open " << argv[2] << std::endl;
+            return 1;
+        }
+    }
+
+    int64_t count = SimpleLogger::decodeBinaryLog(in, argc == 3 ? file : std::cout);
+    if (count < 0) {
+        std::cerr << argv[1] << " is not a binary log" << std::endl;
+        return 1;
+    }
+    std::cerr << count << " messages" << std::endl;
+    return 0;
+}